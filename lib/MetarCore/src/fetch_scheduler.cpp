@@ -0,0 +1,176 @@
+#include "fetch_scheduler.h"
+
+const char* fetchTriggerName(FetchTrigger trigger) {
+  static const char* const names[] = {"schedule", "manual", "boot", "retry", "fallback"};
+  return trigger < FETCH_TRIGGER_COUNT ? names[trigger] : "unknown";
+}
+
+const char* fetchSchedulerStateName(FetchSchedulerState state) {
+  static const char* const names[] = {"idle", "pending", "running", "backoff"};
+  return state <= FETCH_STATE_BACKOFF ? names[state] : "unknown";
+}
+
+FetchScheduler::FetchScheduler(const FetchSchedulerConfig& config, uint32_t seed)
+  : config_(config), rng_(seed ? seed : 0x9E3779B9u) {}
+
+void FetchScheduler::lock() {
+#ifdef ARDUINO
+  portENTER_CRITICAL(&mux_);
+#else
+  mutex_.lock();
+#endif
+}
+
+void FetchScheduler::unlock() {
+#ifdef ARDUINO
+  portEXIT_CRITICAL(&mux_);
+#else
+  mutex_.unlock();
+#endif
+}
+
+// xorshift32, only used to spread retries
+uint32_t FetchScheduler::random() {
+  rng_ ^= rng_ << 13;
+  rng_ ^= rng_ >> 17;
+  rng_ ^= rng_ << 5;
+  return rng_;
+}
+
+bool FetchScheduler::trigger(FetchTrigger trigger) {
+  lock();
+  triggers_[trigger]++;
+  // A running fetch serves the trigger, a waiting one or a pending retry absorbs it
+  bool merged = state_ == FETCH_STATE_RUNNING || state_ == FETCH_STATE_BACKOFF || pending_ != 0;
+  if (merged) {
+    coalesced_++;
+  }
+  if (state_ != FETCH_STATE_RUNNING) {
+    pending_ |= 1 << trigger;
+  }
+  if (state_ == FETCH_STATE_IDLE) {
+    state_ = FETCH_STATE_PENDING;
+  }
+  unlock();
+  return !merged;
+}
+
+// The grid starts again at alignSeconds past every hour, so it stays on :56 whatever the period. When the period
+// does not divide the hour, the last slot of each hour is followed sooner by the first of the next. Periods of an
+// hour or more start again every day instead, counted from alignSeconds past midnight UTC.
+uint32_t FetchScheduler::nextGridSlot(uint32_t unixTime) const {
+  uint32_t period = config_.refreshIntervalMs / 1000;
+  if (period == 0) {
+    return unixTime;
+  }
+  uint32_t cycle = period < 3600 ? 3600 : 86400;
+  uint32_t align = config_.alignSeconds % cycle;
+  // Last anchor at or before unixTime, then the first slot after it that is not earlier than unixTime
+  uint32_t anchor = unixTime - (unixTime + cycle - align) % cycle;
+  uint32_t slot = anchor + (unixTime - anchor + period - 1) / period * period;
+  return slot < anchor + cycle ? slot : anchor + cycle;
+}
+
+uint32_t FetchScheduler::waitFor(uint32_t nowMs, uint32_t unixTime) const {
+  uint32_t wait = 0;
+  if (everStarted_ && nowMs - lastStartMs_ < config_.minIntervalMs) {
+    wait = config_.minIntervalMs - (nowMs - lastStartMs_);
+  }
+  if (state_ == FETCH_STATE_BACKOFF) {
+    int32_t untilRetry = (int32_t)(retryAtMs_ - nowMs);
+    if (untilRetry > 0 && (uint32_t)untilRetry > wait) {
+      wait = untilRetry;
+    }
+    return wait;
+  }
+  if (pending_ != 0) {
+    return wait;
+  }
+
+  // Nothing asked for, so only the refresh grid. Before the first fetch there is no grid yet.
+  uint32_t untilSlot;
+  if (!everSucceeded_) {
+    untilSlot = config_.refreshIntervalMs;
+  } else if (unixTime != 0 && lastSuccessUnix_ != 0) {
+    // First grid point at least the minimum interval after the last refresh
+    uint32_t slot = nextGridSlot(lastSuccessUnix_ + config_.minIntervalMs / 1000);
+    untilSlot = slot > unixTime ? (slot - unixTime) * 1000 : 0;
+  } else {
+    // No wall clock, fall back to the interval since the last refresh
+    uint32_t elapsed = nowMs - lastSuccessMs_;
+    untilSlot = elapsed >= config_.refreshIntervalMs ? 0 : config_.refreshIntervalMs - elapsed;
+  }
+  return untilSlot > wait ? untilSlot : wait;
+}
+
+bool FetchScheduler::due(uint32_t nowMs, uint32_t unixTime, uint32_t& waitMs) {
+  lock();
+  if (state_ == FETCH_STATE_RUNNING) {
+    unlock();
+    waitMs = config_.minIntervalMs;
+    return false;
+  }
+  // The clock may have been set after the last refresh; place that refresh on it
+  if (everSucceeded_ && lastSuccessUnix_ == 0 && unixTime != 0) {
+    lastSuccessUnix_ = unixTime - (nowMs - lastSuccessMs_) / 1000;
+  }
+  waitMs = waitFor(nowMs, unixTime);
+  if (waitMs == 0) {
+    if (state_ == FETCH_STATE_BACKOFF) {
+      triggers_[FETCH_TRIGGER_RETRY]++;
+    } else if (pending_ == 0) {
+      triggers_[FETCH_TRIGGER_SCHEDULE]++;
+    }
+  }
+  unlock();
+  return waitMs == 0;
+}
+
+void FetchScheduler::started(uint32_t nowMs) {
+  lock();
+  state_ = FETCH_STATE_RUNNING;
+  pending_ = 0;
+  everStarted_ = true;
+  lastStartMs_ = nowMs;
+  fetches_++;
+  unlock();
+}
+
+void FetchScheduler::finished(bool ok, uint32_t nowMs, uint32_t unixTime) {
+  lock();
+  if (ok) {
+    failures_ = 0;
+    backoffMs_ = 0;
+    everSucceeded_ = true;
+    lastSuccessMs_ = nowMs;
+    lastSuccessUnix_ = unixTime;
+    state_ = FETCH_STATE_IDLE;
+  } else {
+    // Equal jitter: half the doubled wait is fixed, the other half random, so maps that failed together spread out
+    failures_++;
+    uint32_t shift = failures_ - 1 < 16 ? failures_ - 1 : 16;
+    uint64_t ceiling = (uint64_t)config_.backoffBaseMs << shift;
+    uint32_t capped = ceiling < config_.backoffMaxMs ? (uint32_t)ceiling : config_.backoffMaxMs;
+    backoffMs_ = capped / 2 + random() % (capped / 2 + 1);
+    retryAtMs_ = nowMs + backoffMs_;
+    state_ = FETCH_STATE_BACKOFF;
+  }
+  unlock();
+}
+
+FetchScheduler::Status FetchScheduler::status(uint32_t nowMs, uint32_t unixTime) {
+  Status status;
+  lock();
+  status.state = state_;
+  status.pending = pending_;
+  status.nextInMs = state_ == FETCH_STATE_RUNNING ? 0 : waitFor(nowMs, unixTime);
+  status.failures = failures_;
+  status.backoffMs = backoffMs_;
+  status.coalesced = coalesced_;
+  for (int i = 0; i < FETCH_TRIGGER_COUNT; i++) {
+    status.triggers[i] = triggers_[i];
+  }
+  status.fetches = fetches_;
+  unlock();
+  return status;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#else
+#include <mutex>
+#endif
+
+//===================================================== Fetch Scheduler ===================================================================//
+// Decides when the fetcher runs. Every trigger (timer, button, boot) only marks a fetch as wanted, so any number
+// of them while one is waiting or running collapse into a single request. Fetches start at least minIntervalMs
+// apart, failures back off exponentially with jitter, and regular refreshes land on a grid anchored shortly
+// after :55 of every hour, when the hourly METARs are out, instead of on whatever minute the map booted.
+//
+// Time comes in from the caller (a millisecond counter and Unix time, 0 while the clock is not set) so the whole
+// thing runs on a simulated clock off-device.
+
+enum FetchTrigger : uint8_t {
+  FETCH_TRIGGER_SCHEDULE,   // The refresh grid came around
+  FETCH_TRIGGER_MANUAL,     // Button, web request or live feed
+  FETCH_TRIGGER_BOOT,
+  FETCH_TRIGGER_RETRY,      // Backoff after a failed fetch ran out
+  FETCH_TRIGGER_FALLBACK,   // The LAN leader went silent
+  FETCH_TRIGGER_COUNT
+};
+
+enum FetchSchedulerState : uint8_t {
+  FETCH_STATE_IDLE,       // Waiting for the next grid slot
+  FETCH_STATE_PENDING,    // Wanted, waiting out the minimum interval
+  FETCH_STATE_RUNNING,
+  FETCH_STATE_BACKOFF     // Last fetch failed, waiting to retry
+};
+
+struct FetchSchedulerConfig {
+  uint32_t minIntervalMs;       // Between the starts of two fetches, whatever triggered them
+  uint32_t refreshIntervalMs;   // Spacing of the refresh grid
+  uint32_t alignSeconds;        // Grid anchor in seconds past the hour
+  uint32_t backoffBaseMs;       // Wait after the first failure, doubled for each one after it
+  uint32_t backoffMaxMs;
+};
+
+const char* fetchTriggerName(FetchTrigger trigger);
+const char* fetchSchedulerStateName(FetchSchedulerState state);
+
+class FetchScheduler {
+public:
+  FetchScheduler(const FetchSchedulerConfig& config, uint32_t seed);
+
+  // Ask for a fetch. Returns false if it was merged into one already waiting or running.
+  bool trigger(FetchTrigger trigger);
+
+  // Whether a fetch should start now. If not, waitMs is how long until it might.
+  bool due(uint32_t nowMs, uint32_t unixTime, uint32_t& waitMs);
+
+  // Bracket the fetch that due() allowed
+  void started(uint32_t nowMs);
+  void finished(bool ok, uint32_t nowMs, uint32_t unixTime);
+
+  // Snapshot of the scheduler for reporting
+  struct Status {
+    FetchSchedulerState state;
+    uint8_t pending;              // FetchTrigger bits waiting to be served
+    uint32_t nextInMs;            // Until the next fetch may start, 0 if it may now
+    uint32_t failures;            // Consecutive failed fetches
+    uint32_t backoffMs;           // Wait chosen after the last failure
+    uint32_t coalesced;           // Triggers merged into another
+    uint32_t triggers[FETCH_TRIGGER_COUNT];
+    uint32_t fetches;
+  };
+  Status status(uint32_t nowMs, uint32_t unixTime);
+
+private:
+  // Next start allowed by the interval, backoff and grid, relative to nowMs
+  uint32_t waitFor(uint32_t nowMs, uint32_t unixTime) const;
+  // First refresh grid point at or after unixTime
+  uint32_t nextGridSlot(uint32_t unixTime) const;
+  uint32_t random();
+  void lock();
+  void unlock();
+
+  FetchSchedulerConfig config_;
+  uint32_t rng_;
+  FetchSchedulerState state_ = FETCH_STATE_IDLE;
+  uint8_t pending_ = 0;
+  bool everStarted_ = false;
+  uint32_t lastStartMs_ = 0;
+  uint32_t lastSuccessMs_ = 0;
+  uint32_t lastSuccessUnix_ = 0;   // 0 if the clock was not set then
+  bool everSucceeded_ = false;
+  uint32_t retryAtMs_ = 0;
+  uint32_t failures_ = 0;
+  uint32_t backoffMs_ = 0;
+  uint32_t coalesced_ = 0;
+  uint32_t triggers_[FETCH_TRIGGER_COUNT] = {};
+  uint32_t fetches_ = 0;
+#ifdef ARDUINO
+  portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;
+#else
+  std::mutex mutex_;
+#endif
+};
@@ -0,0 +1,45 @@
+#include "flight_category.h"
+
+#include <string.h>
+
+CategoryThresholds categoryThresholds = FAA_CATEGORY_THRESHOLDS;
+
+CloudCover parseCloudCover(const char* cover) {
+  static const struct {
+    char code[6];
+    CloudCover cover;
+  } covers[] = {
+    {"CLR", COVER_CLR}, {"SKC", COVER_CLR}, {"CAVOK", COVER_CLR}, {"NCD", COVER_CLR}, {"NSC", COVER_CLR},
+    {"FEW", COVER_FEW}, {"SCT", COVER_SCT}, {"BKN", COVER_BKN}, {"OVC", COVER_OVC}, {"OVX", COVER_VV}, {"VV", COVER_VV}
+  };
+  if (cover == nullptr) {
+    return COVER_NONE;
+  }
+  for (const auto& entry : covers) {
+    if (strcmp(cover, entry.code) == 0) {
+      return entry.cover;
+    }
+  }
+  return COVER_NONE;
+}
+
+bool validCategoryThresholds(const CategoryThresholds& thresholds) {
+  return thresholds.visibility[0] >= thresholds.visibility[1] && thresholds.visibility[1] >= thresholds.visibility[2] &&
+         thresholds.ceiling[0] >= thresholds.ceiling[1] && thresholds.ceiling[1] >= thresholds.ceiling[2];
+}
+
+void classifyStations(const uint8_t* visibility, const uint16_t* ceiling, uint8_t* category, int count,
+                      const CategoryThresholds& thresholds) {
+  // Thresholds copied to locals so the compiler can keep them in registers across the loop
+  const uint8_t v0 = thresholds.visibility[0], v1 = thresholds.visibility[1], v2 = thresholds.visibility[2];
+  const uint16_t c0 = thresholds.ceiling[0], c1 = thresholds.ceiling[1], c2 = thresholds.ceiling[2];
+  for (int i = 0; i < count; i++) {
+    uint8_t vis = visibility[i];
+    uint16_t ceil = ceiling[i];
+    uint8_t visSeverity = (vis < v0) + (vis < v1) + (vis < v2);
+    uint8_t ceilSeverity = (ceil < c0) + (ceil < c1) + (ceil < c2);
+    uint8_t severity = visSeverity > ceilSeverity ? visSeverity : ceilSeverity;
+    uint8_t known = (vis != VISIBILITY_UNKNOWN) | (ceil != CEILING_NONE);
+    category[i] = known * (CATEGORY_VFR + severity);
+  }
+}
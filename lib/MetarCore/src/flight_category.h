@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+//===================================================== Flight Category ===================================================================//
+// Visibility and ceiling each map to a severity from 0 (VFR) to 3 (LIFR) by counting how many thresholds the
+// value is below, and the station's category is the worse of the two. Both sides work on the quantized values
+// kept in the station store, so a whole store is classified in one pass of compares and selects.
+
+enum FlightCategory : uint8_t {
+  CATEGORY_UNKNOWN = 0,
+  CATEGORY_VFR,
+  CATEGORY_MVFR,
+  CATEGORY_IFR,
+  CATEGORY_LIFR
+};
+
+inline const char* flightCategoryName(FlightCategory category) {
+  static const char* const names[] = {"N/A", "VFR", "MVFR", "IFR", "LIFR"};
+  return category <= CATEGORY_LIFR ? names[category] : names[CATEGORY_UNKNOWN];
+}
+
+// Sky cover of a cloud layer, in increasing order of coverage
+enum CloudCover : uint8_t {
+  COVER_NONE = 0,   // Missing or not recognised
+  COVER_CLR,        // CLR, SKC, CAVOK, NCD, NSC
+  COVER_FEW,
+  COVER_SCT,
+  COVER_BKN,
+  COVER_OVC,
+  COVER_VV          // Obscured sky, the base is the vertical visibility (OVX in the JSON API)
+};
+
+CloudCover parseCloudCover(const char* cover);
+
+// Only broken, overcast and obscured layers form a ceiling
+inline bool isCeilingCover(CloudCover cover) {
+  return cover >= COVER_BKN;
+}
+
+// Quantized values the station store uses for a missing visibility or ceiling
+#define VISIBILITY_UNKNOWN 0xFF
+#define CEILING_NONE 0xFFFF
+
+// A value below thresholds[0] is at least MVFR, below thresholds[1] at least IFR, below thresholds[2] LIFR
+struct CategoryThresholds {
+  uint8_t visibility[3];   // Quarter statute miles
+  uint16_t ceiling[3];     // Hundreds of feet AGL
+};
+
+// FAA definitions: MVFR at 5 miles or 3000ft and below, IFR below 3 miles or 1000ft, LIFR below 1 mile or 500ft
+const CategoryThresholds FAA_CATEGORY_THRESHOLDS = {{21, 12, 4}, {31, 10, 5}};
+
+// Active thresholds, can be replaced at runtime to use regional or custom minima
+extern CategoryThresholds categoryThresholds;
+
+// Thresholds must get stricter from MVFR to LIFR
+bool validCategoryThresholds(const CategoryThresholds& thresholds);
+
+// Category from quantized visibility and ceiling. VISIBILITY_UNKNOWN and CEILING_NONE count as unrestricted,
+// and a station with neither is CATEGORY_UNKNOWN.
+inline FlightCategory classifyFlightCategory(uint8_t visibility, uint16_t ceiling, const CategoryThresholds& thresholds) {
+  uint8_t visSeverity = (visibility < thresholds.visibility[0]) + (visibility < thresholds.visibility[1]) +
+                        (visibility < thresholds.visibility[2]);
+  uint8_t ceilSeverity = (ceiling < thresholds.ceiling[0]) + (ceiling < thresholds.ceiling[1]) +
+                         (ceiling < thresholds.ceiling[2]);
+  uint8_t severity = visSeverity > ceilSeverity ? visSeverity : ceilSeverity;
+  uint8_t known = (visibility != VISIBILITY_UNKNOWN) | (ceiling != CEILING_NONE);
+  return (FlightCategory)(known * (CATEGORY_VFR + severity));
+}
+
+// Classify count stations from the station store's parallel arrays
+void classifyStations(const uint8_t* visibility, const uint16_t* ceiling, uint8_t* category, int count,
+                      const CategoryThresholds& thresholds);
@@ -0,0 +1,119 @@
+#include "lan_sync.h"
+
+#include "crc32.h"
+
+#define OBS_AGE_NONE 0xFFFF   // Station without an observation time
+
+static uint8_t* put16(uint8_t* p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t* put32(uint8_t* p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+  return p + 4;
+}
+
+static uint16_t get16(const uint8_t*& p) {
+  uint16_t v = p[0] | (p[1] << 8);
+  p += 2;
+  return v;
+}
+
+static uint32_t get32(const uint8_t*& p) {
+  uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+  p += 4;
+  return v;
+}
+
+size_t encodeLanFrame(const LanFrameHeader& header, const LanStation* stations, uint8_t* out, size_t size) {
+  size_t len = LAN_HEADER_BYTES + (size_t)header.count * LAN_STATION_BYTES + 4;
+  if (len > size) {
+    return 0;
+  }
+  // Observation times go out as minutes before the newest one in the frame
+  uint32_t obsBase = 0;
+  for (int i = 0; i < header.count; i++) {
+    if (stations[i].obsTime > obsBase) obsBase = stations[i].obsTime;
+  }
+
+  uint8_t* p = put32(out, LAN_FRAME_MAGIC);
+  *p++ = LAN_PROTOCOL_VERSION;
+  *p++ = header.type;
+  p = put16(p, header.count);
+  p = put32(p, header.leaderId);
+  p = put32(p, header.version);
+  p = put32(p, header.baseVersion);
+  p = put32(p, obsBase);
+  for (int i = 0; i < header.count; i++) {
+    const LanStation& s = stations[i];
+    uint32_t versionAge = header.version - s.version;
+    uint32_t obsAge = (obsBase - s.obsTime) / 60;
+    if (s.obsTime == 0) {
+      obsAge = OBS_AGE_NONE;
+    } else if (obsAge >= OBS_AGE_NONE) {
+      obsAge = OBS_AGE_NONE - 1;
+    }
+    p = put32(p, s.icao);
+    p = put16(p, versionAge < 0xFFFF ? versionAge : 0xFFFF);  // Capped it only looks older, which is safe
+    p = put16(p, obsAge);
+    p = put16(p, s.ceiling);
+    p = put16(p, s.windDir);
+    p = put16(p, s.altimeter);
+    *p++ = s.visibility;
+    *p++ = s.category;
+    *p++ = s.flags;
+    *p++ = s.windSpeed;
+    *p++ = s.windGust;
+    *p++ = (uint8_t)s.temperature;
+  }
+  put32(p, crc32(out, p - out));
+  return len;
+}
+
+int decodeLanFrame(const uint8_t* data, size_t len, LanFrameHeader& header, LanStation* stations, int maxStations) {
+  if (len < LAN_HEADER_BYTES + 4) {
+    return -1;
+  }
+  const uint8_t* p = data;
+  if (get32(p) != LAN_FRAME_MAGIC || *p++ != LAN_PROTOCOL_VERSION) {
+    return -1;
+  }
+  uint8_t type = *p++;
+  uint16_t count = get16(p);
+  if (type > LAN_FRAME_RESYNC || count > maxStations ||
+      len != LAN_HEADER_BYTES + (size_t)count * LAN_STATION_BYTES + 4) {
+    return -1;
+  }
+  const uint8_t* trailer = data + len - 4;
+  if (get32(trailer) != crc32(data, len - 4)) {
+    return -1;
+  }
+  header.type = (LanFrameType)type;
+  header.count = count;
+  header.leaderId = get32(p);
+  header.version = get32(p);
+  header.baseVersion = get32(p);
+  uint32_t obsBase = get32(p);
+  for (int i = 0; i < count; i++) {
+    LanStation& s = stations[i];
+    s.icao = get32(p);
+    s.version = header.version - get16(p);
+    uint16_t obsAge = get16(p);
+    s.obsTime = obsAge == OBS_AGE_NONE ? 0 : obsBase - obsAge * 60u;
+    s.ceiling = get16(p);
+    s.windDir = get16(p);
+    s.altimeter = get16(p);
+    s.visibility = *p++;
+    s.category = *p++;
+    s.flags = *p++;
+    s.windSpeed = *p++;
+    s.windGust = *p++;
+    s.temperature = (int8_t)*p++;
+  }
+  return count;
+}
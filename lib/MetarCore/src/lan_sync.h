@@ -0,0 +1,170 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+//===================================================== LAN Sync ==========================================================================//
+// Lets one map (the leader) fetch for a room of maps (followers) over UDP multicast. The leader numbers every
+// published change of its station store with a state version and remembers, per station, the version it last
+// changed in. It sends deltas of the stations changed since its last delta, and a keyframe round of every
+// station in the background. Every entry carries its station's version, so a follower keeps an entry only if
+// it is newer than what it has: frames can be lost, duplicated or reordered and the follower still ends up with
+// the leader's state once a keyframe round gets through. A follower that sees a delta skip ahead asks for the
+// next round early.
+//
+// Frames are little-endian with a CRC32 trailer and fit one unfragmented datagram.
+
+#define LAN_FRAME_MAGIC 0x464C544Du   // "MTLF"
+#define LAN_PROTOCOL_VERSION 1
+#define LAN_FRAME_MAX_BYTES 1400
+#define LAN_HEADER_BYTES 24
+#define LAN_STATION_BYTES 20
+#define LAN_FRAME_STATIONS ((LAN_FRAME_MAX_BYTES - LAN_HEADER_BYTES - 4) / LAN_STATION_BYTES)
+
+enum LanFrameType : uint8_t {
+  LAN_FRAME_DELTA,      // Stations changed since baseVersion
+  LAN_FRAME_KEY,        // Part of a keyframe round, every station in turn
+  LAN_FRAME_RESYNC      // Follower to leader: a delta went missing, start a keyframe round
+};
+
+struct LanFrameHeader {
+  LanFrameType type;
+  uint16_t count;         // Stations in the frame
+  uint32_t leaderId;      // Random per leader boot, versions only compare within one
+  uint32_t version;       // Leader state version the frame was built from
+  uint32_t baseVersion;   // Deltas: the version the previous delta brought followers to
+};
+
+// Drawable state of one station, as the station store keeps it
+struct LanStation {
+  uint32_t icao;          // Packed ICAO code
+  uint32_t version;       // Leader state version the station last changed in
+  uint32_t obsTime;
+  uint16_t ceiling;
+  uint16_t windDir;
+  uint16_t altimeter;
+  uint8_t visibility;
+  uint8_t category;
+  uint8_t flags;          // StationFlags
+  uint8_t windSpeed;
+  uint8_t windGust;
+  int8_t temperature;
+};
+
+// Write a frame into out. Versions and observation times are sent as differences from the header's, which
+// fit 16 bits. Returns the frame length, 0 if it does not fit.
+size_t encodeLanFrame(const LanFrameHeader& header, const LanStation* stations, uint8_t* out, size_t size);
+
+// Check and read a frame. Returns the number of stations, -1 if it is not a valid frame of this protocol.
+int decodeLanFrame(const uint8_t* data, size_t len, LanFrameHeader& header, LanStation* stations, int maxStations);
+
+template <int MAX_STATIONS>
+class LanLeader {
+public:
+  uint32_t leaderId = 0;
+  uint32_t version = 1;               // Version 1 is whatever the map held at boot
+  uint32_t sentVersion = 1;           // Newest version already sent in a delta
+  uint32_t changedIn[MAX_STATIONS];   // Version each station last changed in
+
+  LanLeader() {
+    for (uint32_t& v : changedIn) v = 1;
+  }
+
+  // Record one published update of the station store
+  void stationsChanged(const bool* changed, int count) {
+    bool any = false;
+    for (int i = 0; i < count; i++) {
+      any |= changed[i];
+    }
+    if (!any) {
+      return;
+    }
+    version++;
+    for (int i = 0; i < count; i++) {
+      if (changed[i]) changedIn[i] = version;
+    }
+  }
+
+  bool deltaPending() const { return version != sentVersion; }
+
+  // Stations changed since the last delta, from cursor on. Call until it returns 0, then deltaSent().
+  int collectDelta(int& cursor, int count, uint16_t* out, int max) const {
+    int n = 0;
+    for (; cursor < count && n < max; cursor++) {
+      if (changedIn[cursor] > sentVersion) out[n++] = cursor;
+    }
+    return n;
+  }
+
+  void deltaSent(uint32_t sent) { sentVersion = sent; }
+
+  // Next stations of the keyframe round. Returns 0 once the round is through and starts the next one.
+  int collectKey(int count, uint16_t* out, int max) {
+    if (keyCursor_ >= count) {
+      keyCursor_ = 0;
+      return 0;
+    }
+    int n = 0;
+    while (n < max && keyCursor_ < count) {
+      out[n++] = keyCursor_++;
+    }
+    return n;
+  }
+
+  void restartKeyRound() { keyCursor_ = 0; }
+
+private:
+  int keyCursor_ = 0;
+};
+
+template <int MAX_STATIONS>
+class LanFollower {
+public:
+  uint32_t leaderId = 0;
+  uint32_t version = 0;                 // Newest leader version seen
+  uint32_t stationVersion[MAX_STATIONS] = {};
+  bool resyncWanted = false;            // A delta went missing, ask the leader for a keyframe round
+
+  uint32_t frames = 0;
+  uint32_t gaps = 0;                    // Deltas whose base was never seen
+  uint32_t staleEntries = 0;            // Entries older than what the station already had
+  uint32_t leaderChanges = 0;
+
+  // Keep the entries of a frame that are on this map (find returns the station index, -1 if not) and newer
+  // than what they have. Kept entries move to the front of entries and their station indexes go to stations.
+  // Returns how many were kept.
+  template <typename Find>
+  int accept(const LanFrameHeader& header, LanStation* entries, int count, Find find, uint16_t* stations) {
+    if (header.leaderId != leaderId) {
+      // A new leader, or the old one restarted: its versions start over
+      leaderId = header.leaderId;
+      version = 0;
+      memset(stationVersion, 0, sizeof(stationVersion));
+      leaderChanges++;
+    }
+    frames++;
+    if (header.type == LAN_FRAME_DELTA && header.baseVersion > version) {
+      gaps++;
+      resyncWanted = true;
+    }
+    if (header.version > version) {
+      version = header.version;
+    }
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+      int station = find(entries[i].icao);
+      if (station < 0 || station >= MAX_STATIONS) {
+        continue;
+      }
+      if (entries[i].version <= stationVersion[station]) {
+        staleEntries += entries[i].version < stationVersion[station];
+        continue;
+      }
+      stationVersion[station] = entries[i].version;
+      entries[kept] = entries[i];
+      stations[kept++] = station;
+    }
+    return kept;
+  }
+};
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "led_output.h"
+
+//===================================================== LED Animator ======================================================================//
+// Runs every LED through a small state machine at a fixed tick rate: a crossfade when its station changes
+// category, with wind blink, thunderstorm flash, a stale pulse and a deteriorating dip layered on top. Pixels refer to colors by
+// palette entry so each costs 4 bytes, and all per-pixel math is 8-bit fixed point on precomputed tables.
+// Fades and dimming happen on perceived levels and go through a gamma table on the way out, so they look even
+// instead of jumping near black, while a settled pixel shows its palette color exactly as configured.
+
+#define ANIMATION_HZ 50
+#define ANIMATION_PALETTE_SIZE 8   // Entry 0 is off
+
+// Effect timing in ticks at ANIMATION_HZ
+#define WIND_BLINK_PERIOD 50       // Dark for the last WIND_BLINK_OFF ticks of every second
+#define WIND_BLINK_OFF 15
+#define THUNDER_PERIOD 200         // Each LED double-flashes white once every 4 s, at its own phase
+#define STALE_PULSE_PERIOD 128
+#define STALE_LEVEL_MIN 96         // Perceived level range of the stale pulse
+#define STALE_LEVEL_MAX 160
+#define TREND_PERIOD 150           // Deteriorating stations dip once every 3 s, all in step
+#define TREND_DIP 40               // Ticks of the dip, down and back up
+#define TREND_LEVEL_MIN 64         // Perceived level at the bottom of the dip
+
+enum PixelEffect : uint8_t {
+  EFFECT_WIND = 1 << 0,      // Wind or gusts at or above the wind_blink setting
+  EFFECT_THUNDER = 1 << 1,   // Thunderstorm at or near the station
+  EFFECT_STALE = 1 << 2,     // Restored from the boot snapshot, not confirmed by a fetch yet
+  EFFECT_TREND = 1 << 3      // Category got worse over the trend window
+};
+
+struct PixelState {
+  uint8_t from;      // Palette entry being faded from
+  uint8_t to;        // Palette entry shown once the fade is done
+  uint8_t fade;      // Fade progress, 255 once settled
+  uint8_t effects;   // PixelEffect bits
+};
+
+// round(255 * (i / 255)^2.2), perceived level to PWM duty
+extern const uint8_t GAMMA8[256];
+
+// Inverse of GAMMA8, for turning configured colors into perceived levels
+uint8_t ungamma(uint8_t duty);
+
+// a + (b - a) * t / 256 on each channel
+inline uint32_t mixColor(uint32_t a, uint32_t b, uint8_t t) {
+  uint32_t out = 0;
+  for (int shift = 0; shift <= 16; shift += 8) {
+    int ca = (a >> shift) & 0xFF;
+    int cb = (b >> shift) & 0xFF;
+    out |= (uint32_t)((ca + (((cb - ca) * t) >> 8)) & 0xFF) << shift;
+  }
+  return out;
+}
+
+// Scale perceived levels by level / 256 and convert them to PWM duty
+inline uint32_t levelToDuty(uint32_t color, uint8_t level) {
+  return packColor(GAMMA8[scaleChannel(color >> 16, level)], GAMMA8[scaleChannel(color >> 8, level)],
+                   GAMMA8[scaleChannel(color, level)]);
+}
+
+template <int MAX_LEDS>
+class LedAnimator {
+public:
+  PixelState pixels[MAX_LEDS];
+  int count = 0;
+
+  uint32_t frames = 0;        // Frames that had anything to draw
+  uint32_t idleFrames = 0;    // Ticks skipped because nothing was animating
+
+  // Start with every LED off and settled
+  void begin(int leds, uint16_t fadeMs) {
+    count = leds < MAX_LEDS ? leds : MAX_LEDS;
+    memset(pixels, 0, sizeof(pixels));
+    for (int i = 0; i < count; i++) {
+      pixels[i].fade = 255;
+    }
+    int ticks = fadeMs * ANIMATION_HZ / 1000;
+    fadeStep_ = ticks > 1 ? (255 + ticks - 1) / ticks : 255;
+    active_ = true;
+  }
+
+  // Set a palette entry to a 0xRRGGBB color, as it should look on a settled pixel
+  void setPalette(uint8_t entry, uint32_t color) {
+    if (entry == 0 || entry >= ANIMATION_PALETTE_SIZE || palette_[entry] == color) {
+      return;
+    }
+    palette_[entry] = color;
+    levels_[entry] = packColor(ungamma(color >> 16), ungamma(color >> 8), ungamma(color));
+    active_ = true;
+  }
+
+  // Show a palette entry on an LED, crossfading from what it shows now
+  void setTarget(int led, uint8_t entry, uint8_t effects) {
+    if (led < 0 || led >= count || entry >= ANIMATION_PALETTE_SIZE) {
+      return;
+    }
+    PixelState& pixel = pixels[led];
+    if (pixel.to != entry) {
+      // A fade still running restarts from its target, close enough at this speed
+      pixel.from = pixel.fade < 128 ? pixel.from : pixel.to;
+      pixel.to = entry;
+      pixel.fade = 0;
+      active_ = true;
+    }
+    if (pixel.effects != effects) {
+      pixel.effects = effects;
+      active_ = true;
+    }
+  }
+
+  // Play the startup sweep for the given number of ticks, then fade every LED in to its target
+  void startIntro(uint32_t tick, uint16_t ticks) {
+    introStart_ = tick;
+    introTicks_ = ticks;
+    active_ = true;
+  }
+
+  // Whether the next render() has anything to draw: a fade, an effect or the intro
+  bool animating() const { return active_; }
+
+  // Draw the frame for a tick into out, PWM duty packed 0x00RRGGBB. Returns whether any pixel of out changed,
+  // and skips the pass entirely while nothing is animating.
+  bool render(uint32_t tick, uint32_t* out) {
+    if (!active_) {
+      idleFrames++;
+      return false;
+    }
+    frames++;
+    uint32_t elapsed = tick - introStart_;
+    if (introTicks_ != 0) {
+      if (elapsed < introTicks_) {
+        return renderIntro(elapsed, out);
+      }
+      introTicks_ = 0;
+      for (int i = 0; i < count; i++) {
+        pixels[i].from = 0;
+        pixels[i].fade = 0;
+      }
+    }
+
+    bool active = false;
+    bool changed = false;
+    bool windOff = tick % WIND_BLINK_PERIOD >= WIND_BLINK_PERIOD - WIND_BLINK_OFF;
+    uint32_t pulse = tick % STALE_PULSE_PERIOD;
+    pulse = pulse < STALE_PULSE_PERIOD / 2 ? pulse : STALE_PULSE_PERIOD - 1 - pulse;
+    uint8_t staleLevel = STALE_LEVEL_MIN + pulse * (STALE_LEVEL_MAX - STALE_LEVEL_MIN) / (STALE_PULSE_PERIOD / 2);
+    uint32_t dip = tick % TREND_PERIOD;
+    dip = dip < TREND_DIP / 2 ? dip : dip < TREND_DIP ? TREND_DIP - 1 - dip : 0;
+    uint8_t trendLevel = 255 - dip * (255 - TREND_LEVEL_MIN) / (TREND_DIP / 2 - 1);
+
+    for (int i = 0; i < count; i++) {
+      PixelState& pixel = pixels[i];
+      if (pixel.fade == 255 && pixel.effects == 0) {
+        changed |= put(out, i, palette_[pixel.to]);
+        continue;
+      }
+      active = true;
+      uint32_t level = levels_[pixel.to];
+      if (pixel.fade != 255) {
+        level = mixColor(levels_[pixel.from], level, pixel.fade);
+        pixel.fade = pixel.fade > 255 - fadeStep_ ? 255 : pixel.fade + fadeStep_;
+      }
+      uint8_t scale = 255;
+      if (pixel.effects & EFFECT_STALE) {
+        scale = staleLevel;
+      }
+      if ((pixel.effects & EFFECT_TREND) && trendLevel < scale) {
+        scale = trendLevel;
+      }
+      if ((pixel.effects & EFFECT_WIND) && windOff) {
+        scale = 0;
+      }
+      if (pixel.effects & EFFECT_THUNDER) {
+        // Spread the LEDs over the period so a line of storms does not flash in step
+        uint32_t phase = (tick + (uint32_t)i * 97) % THUNDER_PERIOD;
+        if (phase < 2 || phase == 5 || phase == 6) {
+          changed |= put(out, i, 0xFFFFFF);
+          continue;
+        }
+      }
+      changed |= put(out, i, pixel.fade == 255 && scale == 255 ? palette_[pixel.to] : levelToDuty(level, scale));
+    }
+    active_ = active;
+    return changed;
+  }
+
+private:
+  static bool put(uint32_t* out, int i, uint32_t color) {
+    if (out[i] == color) {
+      return false;
+    }
+    out[i] = color;
+    return true;
+  }
+
+  // The original startup sequence: LEDs light one after another in a hue that shifts from green to red
+  bool renderIntro(uint32_t elapsed, uint32_t* out) {
+    int lit = (int)((elapsed + 1) * count / introTicks_);
+    uint8_t hue = count > 0 ? lit * 255 / count : 0;
+    bool changed = false;
+    for (int i = 0; i < count; i++) {
+      changed |= put(out, i, i < lit ? packColor(hue, 255 - hue, 0) : 0);
+    }
+    return changed;
+  }
+
+  uint32_t palette_[ANIMATION_PALETTE_SIZE] = {};   // As configured, PWM duty
+  uint32_t levels_[ANIMATION_PALETTE_SIZE] = {};    // The same as perceived levels
+  uint8_t fadeStep_ = 255;
+  bool active_ = false;
+  uint32_t introStart_ = 0;
+  uint16_t introTicks_ = 0;
+};
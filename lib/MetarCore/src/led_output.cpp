@@ -0,0 +1,203 @@
+#include "led_output.h"
+
+#include <string.h>
+
+//===================================================== Recording Backend =================================================================//
+
+RecordingLedOutput::RecordingLedOutput(size_t maxFrames, uint32_t (*clock)())
+  : maxFrames_(maxFrames), clock_(clock) {}
+
+bool RecordingLedOutput::begin(const LedConfig& config) {
+  config_ = config;
+  clear();
+  return true;
+}
+
+bool RecordingLedOutput::show(const uint32_t* pixels, uint16_t count, uint8_t brightness) {
+  last_.timestampMicros = clock_ ? clock_() : 0;
+  last_.brightness = brightness;
+  last_.pixels.assign(pixels, pixels + count);
+  last_.wire.resize((size_t)count * 3);
+  encodeLedFrame(pixels, count, brightness, config_.order, last_.wire.data());
+  frameCount_++;
+  if (frames_.size() < maxFrames_) {
+    frames_.push_back(last_);
+  }
+  return true;
+}
+
+void RecordingLedOutput::clear() {
+  frameCount_ = 0;
+  last_ = {};
+  frames_.clear();
+}
+
+#if defined(ARDUINO) || defined(NATIVE_SHIMS)
+#include <Adafruit_NeoPixel.h>
+
+//===================================================== NeoPixel Backend ==================================================================//
+
+class NeoPixelLedOutput : public LedOutput {
+public:
+  ~NeoPixelLedOutput() override { delete strip_; }
+
+  bool begin(const LedConfig& config) override {
+    neoPixelType type = (config.order == LED_ORDER_GRB ? NEO_GRB : NEO_RGB) + (config.khz400 ? NEO_KHZ400 : NEO_KHZ800);
+    strip_ = new Adafruit_NeoPixel(config.count, config.pin, type);
+    strip_->begin();
+    return strip_->numPixels() == config.count;
+  }
+
+  bool show(const uint32_t* pixels, uint16_t count, uint8_t brightness) override {
+    // setBrightness rescales the pixels already in the strip, so set it before writing the new frame
+    strip_->setBrightness(brightness);
+    for (uint16_t i = 0; i < count; i++) {
+      strip_->setPixelColor(i, pixels[i]);
+    }
+    strip_->show();
+    return true;
+  }
+
+  const char* name() const override { return "neopixel"; }
+
+private:
+  Adafruit_NeoPixel* strip_ = nullptr;
+};
+#endif
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <driver/rmt.h>
+
+//===================================================== RMT Backend =======================================================================//
+// Frames are encoded to wire-order bytes in a back buffer and handed to the RMT driver without waiting for the
+// transmission to finish. The driver translates the front buffer into pulses from its ISR while it is on the wire,
+// so the two buffers swap only once the previous frame is done. A frame queued while one is still going out is
+// held in the back buffer and sent by the next show() or poll().
+
+#define RMT_LED_CLK_DIV 2  // 80MHz APB / 2 = 25ns per tick
+
+// WS2812 timings in 25ns ticks; WS2811 at 400kHz runs every phase twice as long
+#define RMT_BIT(high, low) {{{(high), 1, (low), 0}}}
+static const DRAM_ATTR rmt_item32_t rmtBits800[2] = {RMT_BIT(16, 34), RMT_BIT(32, 18)};  // 0.40/0.85us and 0.80/0.45us
+static const DRAM_ATTR rmt_item32_t rmtBits400[2] = {RMT_BIT(32, 68), RMT_BIT(64, 36)};
+
+static inline void IRAM_ATTR rmtTranslate(const rmt_item32_t* bits, const void* src, rmt_item32_t* dest,
+                                          size_t srcSize, size_t wantedNum, size_t* translatedSize, size_t* itemNum) {
+  if (src == nullptr || dest == nullptr) {
+    *translatedSize = 0;
+    *itemNum = 0;
+    return;
+  }
+  const uint8_t* in = (const uint8_t*)src;
+  size_t size = 0;
+  size_t num = 0;
+  while (size < srcSize && num + 8 <= wantedNum) {
+    for (int bit = 7; bit >= 0; bit--) {
+      dest[num++].val = bits[(in[size] >> bit) & 1].val;
+    }
+    size++;
+  }
+  *translatedSize = size;
+  *itemNum = num;
+}
+
+// The driver gives a translator no context, so strips at each clock rate get their own
+static void IRAM_ATTR rmtTranslate800(const void* src, rmt_item32_t* dest, size_t srcSize, size_t wantedNum,
+                                      size_t* translatedSize, size_t* itemNum) {
+  rmtTranslate(rmtBits800, src, dest, srcSize, wantedNum, translatedSize, itemNum);
+}
+
+static void IRAM_ATTR rmtTranslate400(const void* src, rmt_item32_t* dest, size_t srcSize, size_t wantedNum,
+                                      size_t* translatedSize, size_t* itemNum) {
+  rmtTranslate(rmtBits400, src, dest, srcSize, wantedNum, translatedSize, itemNum);
+}
+
+class RmtLedOutput : public LedOutput {
+public:
+  ~RmtLedOutput() override {
+    if (installed_) {
+      rmt_driver_uninstall(channel_);
+    }
+    free(buffers_[0]);
+    free(buffers_[1]);
+  }
+
+  bool begin(const LedConfig& config) override {
+    config_ = config;
+    bytes_ = (size_t)config.count * 3;
+    buffers_[0] = (uint8_t*)calloc(bytes_, 1);
+    buffers_[1] = (uint8_t*)calloc(bytes_, 1);
+    if (buffers_[0] == nullptr || buffers_[1] == nullptr) {
+      return false;
+    }
+
+    // Each strip takes two memory blocks, so strip n uses channels 2n and 2n+1
+    if (config.channel >= RMT_CHANNEL_MAX / 2) {
+      return false;
+    }
+    channel_ = (rmt_channel_t)(config.channel * 2);
+
+    rmt_config_t rmtConfig = RMT_DEFAULT_CONFIG_TX((gpio_num_t)config.pin, channel_);
+    rmtConfig.clk_div = RMT_LED_CLK_DIV;
+    // Two memory blocks give the refill ISR more slack when WiFi interrupts are busy
+    rmtConfig.mem_block_num = 2;
+    if (rmt_config(&rmtConfig) != ESP_OK || rmt_driver_install(channel_, 0, 0) != ESP_OK) {
+      return false;
+    }
+    installed_ = true;
+    return rmt_translator_init(channel_, config.khz400 ? rmtTranslate400 : rmtTranslate800) == ESP_OK;
+  }
+
+  bool show(const uint32_t* pixels, uint16_t count, uint8_t brightness) override {
+    if (!installed_) {
+      return false;
+    }
+    encodeLedFrame(pixels, count < config_.count ? count : config_.count, brightness, config_.order, buffers_[back_]);
+    pending_ = true;
+    poll();
+    return true;
+  }
+
+  bool busy() override {
+    return rmt_wait_tx_done(channel_, 0) != ESP_OK;
+  }
+
+  void poll() override {
+    if (!pending_ || busy()) {
+      return;
+    }
+    rmt_write_sample(channel_, buffers_[back_], bytes_, false);
+    back_ ^= 1;
+    pending_ = false;
+  }
+
+  const char* name() const override { return "rmt"; }
+
+private:
+  LedConfig config_ = {};
+  rmt_channel_t channel_ = RMT_CHANNEL_0;
+  uint8_t* buffers_[2] = {nullptr, nullptr};
+  size_t bytes_ = 0;
+  uint8_t back_ = 0;      // Buffer the next frame is encoded into
+  bool pending_ = false;  // Back buffer holds a frame that has not been sent yet
+  bool installed_ = false;
+};
+#endif
+
+LedOutput* createLedOutput(LedBackendType type) {
+  switch (type) {
+#if defined(ARDUINO) || defined(NATIVE_SHIMS)
+    case LED_BACKEND_NEOPIXEL:
+      return new NeoPixelLedOutput();
+#endif
+#ifdef ARDUINO
+    case LED_BACKEND_RMT:
+      return new RmtLedOutput();
+#endif
+    case LED_BACKEND_RECORDING:
+      return new RecordingLedOutput();
+    default:
+      return nullptr;
+  }
+}
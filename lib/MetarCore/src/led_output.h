@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+//===================================================== LED Output Backends ===============================================================//
+// The frame buffer hands finished frames to one of these. Pixels are packed 0x00RRGGBB at full brightness;
+// each backend applies brightness and the strip's wire color order itself.
+
+enum LedBackendType : uint8_t {
+  LED_BACKEND_NEOPIXEL = 0,   // Adafruit_NeoPixel, blocks with interrupts off for the whole frame
+  LED_BACKEND_RMT = 1,        // ESP32 RMT peripheral, double buffered, returns as soon as the frame is queued
+  LED_BACKEND_RECORDING = 2   // Keeps frames in memory, for running the render path off-device
+};
+
+enum LedColorOrder : uint8_t {
+  LED_ORDER_RGB = 0,
+  LED_ORDER_GRB = 1
+};
+
+struct LedConfig {
+  uint8_t pin;
+  uint16_t count;
+  LedColorOrder order;
+  bool khz400;      // WS2811 strips clocked at 400kHz instead of 800kHz
+  uint8_t channel;  // Strip number, so several strips can be driven at once
+};
+
+inline uint32_t packColor(uint8_t r, uint8_t g, uint8_t b) {
+  return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+}
+
+// Scale one channel by brightness 0-255 the same way Adafruit_NeoPixel does
+inline uint8_t scaleChannel(uint8_t value, uint8_t brightness) {
+  return (uint8_t)(((uint16_t)value * (brightness + 1)) >> 8);
+}
+
+// Encode a frame into the bytes that go out on the wire: brightness applied and each pixel in the strip's color
+// order, 3 bytes per pixel
+inline void encodeLedFrame(const uint32_t* pixels, uint16_t count, uint8_t brightness, LedColorOrder order,
+                           uint8_t* out) {
+  for (uint16_t i = 0; i < count; i++) {
+    uint8_t r = scaleChannel(pixels[i] >> 16, brightness);
+    uint8_t g = scaleChannel(pixels[i] >> 8, brightness);
+    uint8_t b = scaleChannel(pixels[i], brightness);
+    if (order == LED_ORDER_GRB) {
+      *out++ = g; *out++ = r; *out++ = b;
+    } else {
+      *out++ = r; *out++ = g; *out++ = b;
+    }
+  }
+}
+
+class LedOutput {
+public:
+  virtual ~LedOutput() {}
+  virtual bool begin(const LedConfig& config) = 0;
+  // Queue a frame for output. Returns false if the backend could not take it.
+  virtual bool show(const uint32_t* pixels, uint16_t count, uint8_t brightness) = 0;
+  // True while a previous frame is still going out on the wire
+  virtual bool busy() { return false; }
+  // Give a backend holding a deferred frame a chance to start sending it
+  virtual void poll() {}
+  virtual const char* name() const = 0;
+};
+
+// Records every frame with a timestamp so frame timing and content can be checked without a strip attached.
+// With maxFrames = 0 it only counts frames and keeps the latest one.
+class RecordingLedOutput : public LedOutput {
+public:
+  struct Frame {
+    uint32_t timestampMicros;
+    uint8_t brightness;
+    std::vector<uint32_t> pixels;   // As handed to show()
+    std::vector<uint8_t> wire;      // What a strip in the configured color order would receive
+  };
+
+  explicit RecordingLedOutput(size_t maxFrames = 0, uint32_t (*clock)() = nullptr);
+
+  bool begin(const LedConfig& config) override;
+  bool show(const uint32_t* pixels, uint16_t count, uint8_t brightness) override;
+  const char* name() const override { return "recording"; }
+
+  const LedConfig& config() const { return config_; }
+  uint32_t frameCount() const { return frameCount_; }
+  const Frame& lastFrame() const { return last_; }
+  const std::vector<Frame>& frames() const { return frames_; }
+  void clear();
+
+private:
+  LedConfig config_ = {};
+  size_t maxFrames_;
+  uint32_t (*clock_)();
+  uint32_t frameCount_ = 0;
+  Frame last_ = {};
+  std::vector<Frame> frames_;
+};
+
+// Create the backend for the given type, nullptr if it is not available on this platform
+LedOutput* createLedOutput(LedBackendType type);
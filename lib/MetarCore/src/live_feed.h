@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#else
+#include <mutex>
+#endif
+
+//===================================================== Live Feed =========================================================================//
+// What each connected web client has not been sent yet. A change only sets a bit per client, and the sender
+// builds each message from the current state once the client has room in its send queue. A slow client
+// therefore gets fewer, larger updates instead of a growing backlog, and costs MAX_STATIONS bits whatever
+// happens on the map.
+
+enum LiveFeedTopic : uint8_t {
+  FEED_SETTINGS = 1 << 0,
+  FEED_STATUS = 1 << 1      // Fetch progress and result
+};
+
+template <int MAX_STATIONS, int MAX_CLIENTS>
+class LiveFeed {
+public:
+  static constexpr int words = (MAX_STATIONS + 31) / 32;
+
+  uint32_t coalesced = 0;   // Changes merged into one not sent yet
+
+  // Start tracking a client with everything to send. Returns false when every slot is taken.
+  bool add(uint32_t client) {
+    lock();
+    for (Slot& slot : slots_) {
+      if (!slot.used) {
+        slot.used = true;
+        slot.client = client;
+        slot.topics = FEED_SETTINGS | FEED_STATUS;
+        memset(slot.dirty, 0xFF, sizeof(slot.dirty));
+        unlock();
+        return true;
+      }
+    }
+    unlock();
+    return false;
+  }
+
+  void remove(uint32_t client) {
+    lock();
+    for (Slot& slot : slots_) {
+      if (slot.used && slot.client == client) {
+        slot.used = false;
+      }
+    }
+    unlock();
+  }
+
+  // Client tracked in a slot, false if the slot is free
+  bool clientAt(int index, uint32_t& client) const {
+    client = slots_[index].client;
+    return slots_[index].used;
+  }
+
+  void markStation(int station) {
+    if (station < 0 || station >= MAX_STATIONS) {
+      return;
+    }
+    uint32_t bit = 1u << (station & 31);
+    lock();
+    for (Slot& slot : slots_) {
+      if (slot.used) {
+        coalesced += (slot.dirty[station >> 5] & bit) != 0;
+        slot.dirty[station >> 5] |= bit;
+      }
+    }
+    unlock();
+  }
+
+  void markAllStations() {
+    lock();
+    for (Slot& slot : slots_) {
+      if (slot.used) {
+        memset(slot.dirty, 0xFF, sizeof(slot.dirty));
+      }
+    }
+    unlock();
+  }
+
+  void markTopic(uint8_t topic) {
+    lock();
+    for (Slot& slot : slots_) {
+      if (slot.used) {
+        coalesced += (slot.topics & topic) != 0;
+        slot.topics |= topic;
+      }
+    }
+    unlock();
+  }
+
+  // Clear and return one pending topic of a slot, 0 if there is none
+  uint8_t takeTopic(int index) {
+    lock();
+    Slot& slot = slots_[index];
+    uint8_t topic = slot.topics & -slot.topics;
+    slot.topics &= ~topic;
+    unlock();
+    return topic;
+  }
+
+  // Clear and return up to max pending stations of a slot, lowest first. Returns how many.
+  int takeStations(int index, uint16_t* out, int max) {
+    int count = 0;
+    lock();
+    uint32_t* dirty = slots_[index].dirty;
+    for (int w = 0; w < words && count < max; w++) {
+      while (dirty[w] != 0 && count < max) {
+        int bit = __builtin_ctz(dirty[w]);
+        dirty[w] &= dirty[w] - 1;
+        int station = w * 32 + bit;
+        if (station < MAX_STATIONS) {
+          out[count++] = station;
+        }
+      }
+    }
+    unlock();
+    return count;
+  }
+
+private:
+  struct Slot {
+    bool used;
+    uint8_t topics;           // LiveFeedTopic bits
+    uint32_t client;
+    uint32_t dirty[words];    // Stations changed since they were last sent
+  };
+
+  void lock() {
+#ifdef ARDUINO
+    portENTER_CRITICAL(&mux_);
+#else
+    mutex_.lock();
+#endif
+  }
+
+  void unlock() {
+#ifdef ARDUINO
+    portEXIT_CRITICAL(&mux_);
+#else
+    mutex_.unlock();
+#endif
+  }
+
+  Slot slots_[MAX_CLIENTS] = {};
+#ifdef ARDUINO
+  portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;
+#else
+  std::mutex mutex_;
+#endif
+};
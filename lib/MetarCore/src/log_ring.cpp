@@ -0,0 +1,159 @@
+#include "log_ring.h"
+
+#include <stdio.h>
+
+LogRing logRing;
+
+void LogRing::lock() {
+#ifdef ARDUINO
+  portENTER_CRITICAL(&mux_);
+#else
+  mutex_.lock();
+#endif
+}
+
+void LogRing::unlock() {
+#ifdef ARDUINO
+  portEXIT_CRITICAL(&mux_);
+#else
+  mutex_.unlock();
+#endif
+}
+
+void LogRing::copyIn(const void* src, size_t n) {
+  size_t first = n < LOG_RING_BYTES - head_ ? n : LOG_RING_BYTES - head_;
+  memcpy(ring_ + head_, src, first);
+  memcpy(ring_, (const uint8_t*)src + first, n - first);
+  head_ = (head_ + n) % LOG_RING_BYTES;
+  used_ += n;
+}
+
+void LogRing::copyOut(void* dest, size_t n) {
+  size_t first = n < LOG_RING_BYTES - tail_ ? n : LOG_RING_BYTES - tail_;
+  memcpy(dest, ring_ + tail_, first);
+  memcpy((uint8_t*)dest + first, ring_, n - first);
+  tail_ = (tail_ + n) % LOG_RING_BYTES;
+  used_ -= n;
+}
+
+void LogRing::push(uint8_t recordLevel, const char* format, const uint8_t* args, uint16_t argLen) {
+  Header header = {format, clock_ ? clock_() : 0, recordLevel, argLen};
+  lock();
+  if (used_ + sizeof(header) + argLen > LOG_RING_BYTES) {
+    dropped++;
+  } else {
+    copyIn(&header, sizeof(header));
+    copyIn(args, argLen);
+    written++;
+  }
+  unlock();
+}
+
+bool LogRing::pop(LogRecord& record) {
+  lock();
+  if (used_ == 0) {
+    unlock();
+    return false;
+  }
+  Header header;
+  copyOut(&header, sizeof(header));
+  copyOut(record.args, header.argLen);
+  unlock();
+  record.format = header.format;
+  record.timestampMs = header.timestampMs;
+  record.level = header.level;
+  record.argLen = header.argLen;
+  return true;
+}
+
+// Walks the format string and prints each conversion with the next stored argument. The conversion's
+// length modifiers are replaced by the ones matching the stored type, so %lu, %u and %d all work on any
+// integer and a float passed to %d is printed as an integer instead of reading garbage.
+size_t LogRing::format(const LogRecord& record, char* out, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  size_t len = 0;
+  size_t arg = 0;
+  const char* p = record.format;
+  while (*p && len + 1 < size) {
+    if (*p != '%') {
+      out[len++] = *p++;
+      continue;
+    }
+    if (p[1] == '%') {
+      out[len++] = '%';
+      p += 2;
+      continue;
+    }
+
+    // Copy flags, width and precision, drop length modifiers
+    char spec[24];
+    size_t specLen = 0;
+    const char* start = p++;
+    while (*p && strchr("-+ #0123456789.", *p) && specLen < sizeof(spec) - 6) {
+      spec[specLen++] = *p++;
+    }
+    while (*p && strchr("hlLzjt", *p)) {
+      p++;
+    }
+    char conversion = *p;
+    if (conversion == '\0' || arg >= record.argLen) {
+      // Malformed or out of arguments, print the rest of the format as is
+      p = start;
+      while (*p && len + 1 < size) out[len++] = *p++;
+      break;
+    }
+    p++;
+
+    char type = record.args[arg++];
+    const uint8_t* value = record.args + arg;
+    int64_t integer = 0;
+    double real = 0;
+    switch (type) {
+      case 'i': { int32_t v; memcpy(&v, value, 4); integer = v; real = v; arg += 4; break; }
+      case 'u': { uint32_t v; memcpy(&v, value, 4); integer = v; real = v; arg += 4; break; }
+      case 'I': { int64_t v; memcpy(&v, value, 8); integer = v; real = (double)v; arg += 8; break; }
+      case 'U': { uint64_t v; memcpy(&v, value, 8); integer = (int64_t)v; real = (double)v; arg += 8; break; }
+      case 'f': { memcpy(&real, value, sizeof(real)); integer = (int64_t)real; arg += sizeof(real); break; }
+      case 's': arg += 1 + value[0]; break;
+      default: arg = record.argLen; break;
+    }
+
+    char piece[LOG_MAX_STRING + 1];
+    int written;
+    if (type == 's') {
+      char text[LOG_MAX_STRING + 1];
+      memcpy(text, value + 1, value[0]);
+      text[value[0]] = '\0';
+      spec[specLen++] = 's';
+      spec[specLen] = '\0';
+      char fullSpec[sizeof(spec) + 1] = "%";
+      strcat(fullSpec, spec);
+      written = snprintf(piece, sizeof(piece), fullSpec, text);
+    } else if (strchr("feEgGaA", conversion)) {
+      spec[specLen++] = conversion;
+      spec[specLen] = '\0';
+      char fullSpec[sizeof(spec) + 1] = "%";
+      strcat(fullSpec, spec);
+      written = snprintf(piece, sizeof(piece), fullSpec, real);
+    } else if (conversion == 's') {
+      written = snprintf(piece, sizeof(piece), "%lld", (long long)integer);
+    } else {
+      if (!strchr("diouxXc", conversion)) conversion = 'd';
+      spec[specLen++] = 'l';
+      spec[specLen++] = 'l';
+      spec[specLen++] = conversion;
+      spec[specLen] = '\0';
+      char fullSpec[sizeof(spec) + 1] = "%";
+      strcat(fullSpec, spec);
+      written = conversion == 'c' ? snprintf(piece, sizeof(piece), "%c", (int)integer)
+                                  : snprintf(piece, sizeof(piece), fullSpec, (long long)integer);
+    }
+    for (int i = 0; i < written && piece[i] && len + 1 < size; i++) {
+      out[len++] = piece[i];
+    }
+  }
+  out[len] = '\0';
+  return len;
+}
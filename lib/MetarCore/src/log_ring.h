@@ -0,0 +1,176 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#else
+#include <mutex>
+#endif
+
+//===================================================== Log Ring ==========================================================================//
+// Callers never format. A log call copies the format string pointer, a timestamp and its arguments as tagged
+// binary values into a ring buffer, and a low priority task later pops the records and does the printf work.
+// Format strings must be literals, only their address is stored. String arguments are copied, so temporaries
+// such as String::c_str() are safe to log. When the ring is full new records are dropped and counted.
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Most verbose level compiled in, calls above it cost nothing
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#ifndef LOG_RING_BYTES
+#define LOG_RING_BYTES 8192
+#endif
+
+#define LOG_MAX_ARG_BYTES 256   // Encoded arguments of one record
+#define LOG_MAX_STRING 160      // Longer string arguments are cut
+
+inline const char* logLevelName(uint8_t level) {
+  static const char* const names[] = {"NONE", "ERROR", "WARN", "INFO", "DEBUG"};
+  return level <= LOG_LEVEL_DEBUG ? names[level] : "?";
+}
+
+// Encoded arguments of one log call: a type tag byte followed by the raw value
+struct LogArgs {
+  uint8_t data[LOG_MAX_ARG_BYTES];
+  uint16_t len = 0;
+
+  void put(char type, const void* value, size_t size) {
+    if (len + 1 + size > sizeof(data)) {
+      return;
+    }
+    data[len++] = type;
+    memcpy(data + len, value, size);
+    len += size;
+  }
+
+  template <typename T>
+  void putInteger(T value) {
+    if (sizeof(T) <= 4) {
+      if (T(-1) < T(0)) { int32_t v = (int32_t)value; put('i', &v, 4); }
+      else { uint32_t v = (uint32_t)value; put('u', &v, 4); }
+    } else {
+      if (T(-1) < T(0)) { int64_t v = (int64_t)value; put('I', &v, 8); }
+      else { uint64_t v = (uint64_t)value; put('U', &v, 8); }
+    }
+  }
+
+  void add(int value) { putInteger(value); }
+  void add(unsigned value) { putInteger(value); }
+  void add(long value) { putInteger(value); }
+  void add(unsigned long value) { putInteger(value); }
+  void add(long long value) { putInteger(value); }
+  void add(unsigned long long value) { putInteger(value); }
+  void add(double value) { put('f', &value, sizeof(value)); }
+  void add(const char* value) {
+    if (value == nullptr) value = "(null)";
+    if (len + 2u > sizeof(data)) {
+      return;
+    }
+    size_t n = strnlen(value, LOG_MAX_STRING);
+    if (n > sizeof(data) - len - 2) n = sizeof(data) - len - 2;
+    data[len++] = 's';
+    data[len++] = (uint8_t)n;
+    memcpy(data + len, value, n);
+    len += n;
+  }
+
+  void addAll() {}
+  template <typename T, typename... Rest>
+  void addAll(T first, Rest... rest) {
+    add(first);
+    addAll(rest...);
+  }
+};
+
+struct LogRecord {
+  const char* format;
+  uint32_t timestampMs;
+  uint8_t level;
+  uint16_t argLen;
+  uint8_t args[LOG_MAX_ARG_BYTES];
+};
+
+class LogRing {
+public:
+  uint8_t level = LOG_LEVEL;     // Runtime threshold, can only lower what LOG_LEVEL compiled in
+  uint32_t dropped = 0;          // Records lost because the ring was full
+  uint32_t written = 0;
+
+  void begin(uint32_t (*clock)()) { clock_ = clock; }
+
+  bool enabled(uint8_t recordLevel) const { return recordLevel <= level; }
+
+  template <typename... Args>
+  void write(uint8_t recordLevel, const char* format, Args... args) {
+    if (!enabled(recordLevel)) {
+      return;
+    }
+    LogArgs encoded;
+    encoded.addAll(args...);
+    push(recordLevel, format, encoded.data, encoded.len);
+  }
+
+  // Take the oldest record, returns false when the ring is empty
+  bool pop(LogRecord& record);
+
+  // printf the record into out, returns the length written
+  static size_t format(const LogRecord& record, char* out, size_t size);
+
+private:
+  struct Header {
+    const char* format;
+    uint32_t timestampMs;
+    uint8_t level;
+    uint16_t argLen;
+  };
+
+  void push(uint8_t recordLevel, const char* format, const uint8_t* args, uint16_t argLen);
+  void copyIn(const void* src, size_t n);
+  void copyOut(void* dest, size_t n);
+  void lock();
+  void unlock();
+
+  uint8_t ring_[LOG_RING_BYTES];
+  size_t head_ = 0;   // Next byte to write
+  size_t tail_ = 0;   // Next byte to read
+  size_t used_ = 0;
+  uint32_t (*clock_)() = nullptr;
+#ifdef ARDUINO
+  portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;
+#else
+  std::mutex mutex_;
+#endif
+};
+
+extern LogRing logRing;
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logRing.write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logRing.write(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logRing.write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logRing.write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
@@ -0,0 +1,328 @@
+#include "metar_decoder.h"
+
+#include <string.h>
+
+#include "string_compat.h"
+
+// One space-separated group of the report, pointing into the text
+struct MetarGroup {
+  const char* p;
+  int len;
+
+  bool is(const char* text) const { return (int)strlen(text) == len && memcmp(p, text, len) == 0; }
+  bool startsWith(const char* text) const {
+    int n = strlen(text);
+    return len >= n && memcmp(p, text, n) == 0;
+  }
+  bool endsWith(const char* text) const {
+    int n = strlen(text);
+    return len >= n && memcmp(p + len - n, text, n) == 0;
+  }
+};
+
+static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+static bool isUpper(char c) { return c >= 'A' && c <= 'Z'; }
+
+static bool allDigits(const char* p, int n) {
+  for (int i = 0; i < n; i++) {
+    if (!isDigit(p[i])) return false;
+  }
+  return true;
+}
+
+static int toNumber(const char* p, int n) {
+  int value = 0;
+  for (int i = 0; i < n; i++) {
+    value = value * 10 + (p[i] - '0');
+  }
+  return value;
+}
+
+static int digitRun(const char* p, int n) {
+  int i = 0;
+  while (i < n && isDigit(p[i])) i++;
+  return i;
+}
+
+// dddff(Gff)KT, VRB for a variable direction, MPS and KMH converted to knots
+static bool parseWind(const MetarGroup& g, MetarRecord& record) {
+  int dir;
+  if (g.startsWith("VRB")) {
+    dir = -1;
+  } else if (g.len >= 3 && allDigits(g.p, 3) && toNumber(g.p, 3) <= 360) {
+    dir = toNumber(g.p, 3);
+  } else {
+    return false;
+  }
+  int i = 3;
+  int n = digitRun(g.p + i, g.len - i);
+  if (n < 2 || n > 3) return false;
+  int speed = toNumber(g.p + i, n);
+  i += n;
+  int gust = -1;
+  if (i < g.len && g.p[i] == 'G') {
+    n = digitRun(g.p + i + 1, g.len - i - 1);
+    if (n < 2 || n > 3) return false;
+    gust = toNumber(g.p + i + 1, n);
+    i += 1 + n;
+  }
+  float toKnots;
+  MetarGroup unit = {g.p + i, g.len - i};
+  if (unit.is("KT")) toKnots = 1.0f;
+  else if (unit.is("MPS")) toKnots = 1.944f;
+  else if (unit.is("KMH")) toKnots = 0.54f;
+  else return false;
+  record.wdir = dir;
+  record.wspd = (int)(speed * toKnots + 0.5f);
+  record.wgst = gust >= 0 ? (int)(gust * toKnots + 0.5f) : -1;
+  return true;
+}
+
+// Statute miles (10SM, 1/2SM, M1/4SM, P6SM, whole miles of "1 1/2SM" in the group before) or metres (9999, 4000NE).
+// More than 10 miles is read as 10, the JSON API's "10+", so both formats leave the same visibility in the store.
+static bool parseVisibility(const MetarGroup& g, int wholeMiles, MetarRecord& record) {
+  if (g.len >= 3 && g.endsWith("SM")) {
+    const char* p = g.p;
+    int n = g.len - 2;
+    if (*p == 'M' || *p == 'P') {
+      p++;
+      n--;
+    }
+    const char* slash = (const char*)memchr(p, '/', n);
+    if (slash != nullptr) {
+      int numLen = slash - p;
+      int denLen = n - numLen - 1;
+      if (numLen < 1 || numLen > 2 || denLen < 1 || denLen > 2 || !allDigits(p, numLen) || !allDigits(slash + 1, denLen)) {
+        return false;
+      }
+      int den = toNumber(slash + 1, denLen);
+      if (den == 0) return false;
+      record.visib = (wholeMiles > 0 ? wholeMiles : 0) + (float)toNumber(p, numLen) / den;
+      return true;
+    }
+    if (n < 1 || n > 2 || !allDigits(p, n)) return false;
+    int miles = toNumber(p, n);
+    record.visib = miles > 10 ? 10 : miles;
+    return true;
+  }
+  if (g.len >= 4 && allDigits(g.p, 4)) {
+    for (int i = 4; i < g.len; i++) {
+      if (!isUpper(g.p[i])) return false;
+    }
+    int metres = toNumber(g.p, 4);
+    record.visib = (metres >= 9999 ? 10000 : metres) / 1609.344f;
+    return true;
+  }
+  return false;
+}
+
+// FEW/SCT/BKN/OVC/VV with a base in hundreds of feet, or a clear sky
+static bool parseSky(const MetarGroup& g, MetarRecord& record) {
+  static const struct {
+    char code[4];
+    CloudCover cover;
+  } layers[] = {{"FEW", COVER_FEW}, {"SCT", COVER_SCT}, {"BKN", COVER_BKN}, {"OVC", COVER_OVC}, {"VV", COVER_VV}};
+  if (g.is("CLR") || g.is("SKC") || g.is("NSC") || g.is("NCD")) {
+    return true;
+  }
+  for (const auto& layer : layers) {
+    if (!g.startsWith(layer.code)) {
+      continue;
+    }
+    int n = strlen(layer.code);
+    if (g.len < n + 3) return false;
+    // "///" is a layer whose base was not measured
+    int base = allDigits(g.p + n, 3) ? toNumber(g.p + n, 3) * 100 : -1;
+    if (isCeilingCover(layer.cover) && base >= 0 && (record.ceiling == -1 || base < record.ceiling)) {
+      record.ceiling = base;
+      record.ceilingCover = layer.cover;
+    }
+    return true;
+  }
+  return false;
+}
+
+// Signed two-digit value with M for minus, as in the temperature group
+static bool parseSigned(const char* p, int n, int& value) {
+  bool negative = n > 0 && *p == 'M';
+  if (negative) {
+    p++;
+    n--;
+  }
+  if (n != 2 || !allDigits(p, 2)) return false;
+  value = negative ? -toNumber(p, 2) : toNumber(p, 2);
+  return true;
+}
+
+// tt/dd, either side may be missing
+static bool parseTemperature(const MetarGroup& g, MetarRecord& record) {
+  const char* slash = (const char*)memchr(g.p, '/', g.len);
+  if (slash == nullptr) return false;
+  int tempLen = slash - g.p;
+  int dewLen = g.len - tempLen - 1;
+  int temp, dew;
+  bool tempMissing = tempLen == 2 && memcmp(g.p, "//", 2) == 0;
+  bool dewMissing = dewLen == 0 || (dewLen == 2 && memcmp(slash + 1, "//", 2) == 0);
+  if (!(tempMissing || parseSigned(g.p, tempLen, temp)) || !(dewMissing || parseSigned(slash + 1, dewLen, dew))) {
+    return false;
+  }
+  if (!tempMissing) {
+    record.temp = temp;
+  }
+  return true;
+}
+
+// A in hundredths of inHg, Q in hPa
+static bool parseAltimeter(const MetarGroup& g, MetarRecord& record) {
+  if (g.len != 5 || (g.p[0] != 'A' && g.p[0] != 'Q') || !allDigits(g.p + 1, 4)) {
+    return false;
+  }
+  int value = toNumber(g.p + 1, 4);
+  record.altim = g.p[0] == 'A' ? value * 0.338639f : value;
+  return true;
+}
+
+// Present weather with a thunderstorm at or near the station: TS, +TSRA, VCTS...
+static bool isThunderstorm(MetarGroup g) {
+  if (g.len > 0 && (*g.p == '+' || *g.p == '-')) {
+    g.p++;
+    g.len--;
+  }
+  if (g.startsWith("VC")) {
+    g.p += 2;
+    g.len -= 2;
+  }
+  if (!g.startsWith("TS")) return false;
+  for (int i = 2; i < g.len; i++) {
+    if (!isUpper(g.p[i])) return false;
+  }
+  return true;
+}
+
+static int64_t daysFromCivil(int y, int m, int d) {
+  y -= m <= 2;
+  int era = (y >= 0 ? y : y - 399) / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return (int64_t)era * 146097 + doe - 719468;
+}
+
+static void civilFromDays(int64_t z, int& y, int& m, int& d) {
+  z += 719468;
+  int era = (z >= 0 ? z : z - 146096) / 146097;
+  int doe = z - (int64_t)era * 146097;
+  int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  int mp = (5 * doy + 2) / 153;
+  d = doy - (153 * mp + 2) / 5 + 1;
+  m = mp < 10 ? mp + 3 : mp - 9;
+  y = yoe + era * 400 + (m <= 2);
+}
+
+uint32_t metarObsTime(int day, int hour, int minute, uint32_t nowUnix) {
+  if (nowUnix == 0 || day < 1 || day > 31 || hour > 23 || minute > 59) {
+    return 0;
+  }
+  int y, m, d;
+  civilFromDays(nowUnix / 86400, y, m, d);
+  // This month unless that is more than a day ahead (the report is from last month) or has no such day
+  for (int back = 0; back < 3; back++) {
+    int64_t monthStart = daysFromCivil(y, m, 1);
+    int nextY = m == 12 ? y + 1 : y;
+    int nextM = m == 12 ? 1 : m + 1;
+    int monthDays = daysFromCivil(nextY, nextM, 1) - monthStart;
+    int64_t t = (monthStart + day - 1) * 86400 + hour * 3600 + minute * 60;
+    if (day <= monthDays && t <= (int64_t)nowUnix + 86400) {
+      return t;
+    }
+    y = m == 1 ? y - 1 : y;
+    m = m == 1 ? 12 : m - 1;
+  }
+  return 0;
+}
+
+bool decodeMetar(const char* raw, uint32_t nowUnix, MetarRecord& record) {
+  record.icaoId[0] = '\0';
+  record.visib = -1;
+  record.ceiling = -1;
+  record.ceilingCover = COVER_NONE;
+  record.temp = -999;
+  record.wdir = -1;
+  record.wspd = -1;
+  record.wgst = -1;
+  record.altim = -999;
+  record.obsTime = 0;
+  record.thunderstorm = false;
+  strlcpy(record.rawOb, raw, sizeof(record.rawOb));
+
+  enum { STATION, TIME, BODY, TREND, REMARKS } part = STATION;
+  int wholeMiles = -1;  // A single digit group waiting for the fraction of "1 1/2SM"
+  const char* p = raw;
+  for (;;) {
+    while (*p == ' ') p++;
+    if (*p == '\0') break;
+    MetarGroup g = {p, 0};
+    while (p[g.len] != '\0' && p[g.len] != ' ') g.len++;
+    p += g.len;
+    if (g.p[g.len - 1] == '=') g.len--;  // End of report marker
+    if (g.len == 0) continue;
+
+    switch (part) {
+      case STATION:
+        if (g.is("METAR") || g.is("SPECI")) continue;
+        if (g.len != 4) return false;
+        for (int i = 0; i < 4; i++) {
+          if (!isUpper(g.p[i]) && !isDigit(g.p[i])) return false;
+        }
+        memcpy(record.icaoId, g.p, 4);
+        record.icaoId[4] = '\0';
+        part = TIME;
+        break;
+
+      case TIME:
+        if (g.len != 7 || g.p[6] != 'Z' || !allDigits(g.p, 6)) return false;
+        record.obsTime = metarObsTime(toNumber(g.p, 2), toNumber(g.p + 2, 2), toNumber(g.p + 4, 2), nowUnix);
+        part = BODY;
+        break;
+
+      case BODY: {
+        int whole = wholeMiles;
+        wholeMiles = -1;
+        if (g.is("RMK")) {
+          part = REMARKS;
+        } else if (g.is("NOSIG") || g.is("BECMG") || g.is("TEMPO")) {
+          part = TREND;
+        } else if (g.is("NIL")) {
+          return false;
+        } else if (g.is("CAVOK")) {
+          record.visib = 10000 / 1609.344f;
+        } else if (record.wspd < 0 && parseWind(g, record)) {
+          continue;
+        } else if (record.visib < 0 && parseVisibility(g, whole, record)) {
+          continue;
+        } else if (g.len == 1 && isDigit(*g.p)) {
+          wholeMiles = *g.p - '0';
+        } else if (parseSky(g, record) || parseTemperature(g, record) || parseAltimeter(g, record)) {
+          continue;
+        } else if (isThunderstorm(g)) {
+          record.thunderstorm = true;
+        }
+        break;
+      }
+
+      case TREND:
+        if (g.is("RMK")) part = REMARKS;
+        break;
+
+      case REMARKS:
+        // Temperature to a tenth of a degree: T02110117 is 21.1, dew point 11.7
+        if (g.len == 9 && g.p[0] == 'T' && allDigits(g.p + 1, 8) && (g.p[1] == '0' || g.p[1] == '1')) {
+          int tenths = toNumber(g.p + 2, 3);
+          record.temp = (g.p[1] == '1' ? -tenths : tenths) / 10.0f;
+        }
+        break;
+    }
+  }
+  return part >= BODY;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "metar_record.h"
+
+//===================================================== METAR Decoder =====================================================================//
+// Reads a MetarRecord straight out of the report text, for the plain text (format=raw) API responses that are a
+// fraction of the size of the JSON ones. One pass over the groups in place: nothing is copied or allocated apart
+// from the rawOb field of the record.
+//
+// Groups are recognised by their shape rather than their position, so missing or reordered groups do not throw
+// off the rest. Trend groups (BECMG, TEMPO, NOSIG) end the body, and of the remarks only the T group is read for
+// the temperature in tenths.
+
+enum MetarFormat : uint8_t {
+  METAR_FORMAT_JSON,
+  METAR_FORMAT_RAW,
+  METAR_FORMAT_COUNT
+};
+
+inline const char* metarFormatName(MetarFormat format) {
+  return format == METAR_FORMAT_RAW ? "raw" : "json";
+}
+
+// Decode one report. nowUnix places the day and time group in a month, 0 leaves obsTime at 0.
+// Returns false for text without a station and time group, and for NIL reports.
+bool decodeMetar(const char* raw, uint32_t nowUnix, MetarRecord& record);
+
+// Unix time of a ddhhmmZ group: the latest such time no more than a day after nowUnix
+uint32_t metarObsTime(int day, int hour, int minute, uint32_t nowUnix);
@@ -0,0 +1,34 @@
+#include "metar_record.h"
+
+#include <string.h>
+
+bool hasThunderstorm(const char* raw) {
+  bool afterTime = false;  // Weather groups come after the ddhhmmZ time group
+  const char* p = raw;
+  while (*p) {
+    while (*p == ' ') p++;
+    const char* token = p;
+    while (*p && *p != ' ') p++;
+    size_t len = p - token;
+    if ((len == 3 && strncmp(token, "RMK", 3) == 0) || (len == 5 && (strncmp(token, "TEMPO", 5) == 0 ||
+        strncmp(token, "BECMG", 5) == 0 || strncmp(token, "NOSIG", 5) == 0))) {
+      break;
+    }
+    if (!afterTime) {
+      afterTime = len == 7 && token[6] == 'Z';
+      continue;
+    }
+    if (len > 0 && (*token == '+' || *token == '-')) {
+      token++;
+      len--;
+    }
+    if (len >= 2 && strncmp(token, "VC", 2) == 0) {
+      token += 2;
+      len -= 2;
+    }
+    if (len >= 2 && strncmp(token, "TS", 2) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
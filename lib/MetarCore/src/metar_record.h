@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "flight_category.h"
+
+//===================================================== METAR Record ======================================================================//
+
+//Fields of a METAR element the map actually uses, everything else is dropped while streaming
+struct MetarRecord {
+  char icaoId[8];
+  float visib;          // Statute miles, -1 when missing
+  int ceiling;          // Feet AGL of the lowest broken, overcast or obscured layer, -1 when there is none
+  CloudCover ceilingCover;  // Cover of that layer, COVER_NONE without a ceiling
+  float temp;           // Celsius, -999 when missing
+  int wdir;             // Degrees, -1 when variable or missing
+  int wspd;             // Knots, -1 when missing
+  int wgst;             // Knots, -1 without gusts
+  float altim;          // hPa, -999 when missing
+  uint32_t obsTime;     // Unix time, 0 when missing
+  bool thunderstorm;    // rawOb reports a thunderstorm at or near the station
+  char rawOb[160];
+};
+
+// Whether the weather groups of a raw METAR report a thunderstorm (TS, +TSRA, VCTS...). Remarks and trends are
+// not checked, so neither a TSNO remark nor a TEMPO TSRA forecast counts, the same as decodeMetar().
+bool hasThunderstorm(const char* raw);
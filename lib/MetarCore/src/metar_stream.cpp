@@ -0,0 +1,144 @@
+#include "metar_stream.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log_ring.h"
+#include "metrics.h"
+#include "string_compat.h"
+
+void setupMetarFilter(JsonDocument& filter) {
+  filter["icaoId"] = true;
+  filter["visib"] = true;
+  filter["clouds"][0]["cover"] = true;
+  filter["clouds"][0]["base"] = true;
+  filter["temp"] = true;
+  filter["wdir"] = true;
+  filter["wspd"] = true;
+  filter["wgst"] = true;
+  filter["altim"] = true;
+  filter["obsTime"] = true;
+  filter["rawOb"] = true;
+}
+
+void readMetarRecord(JsonObject metar, MetarRecord& record) {
+  strlcpy(record.icaoId, metar["icaoId"] | "", sizeof(record.icaoId));
+  strlcpy(record.rawOb, metar["rawOb"] | "", sizeof(record.rawOb));
+  record.temp = metar["temp"] | -999.0f;
+  record.wdir = metar["wdir"] | -1;
+  record.wspd = metar["wspd"] | -1;
+  record.wgst = metar["wgst"] | -1;
+  record.altim = metar["altim"] | -999.0f;
+  record.obsTime = metar["obsTime"] | 0;
+  record.thunderstorm = hasThunderstorm(record.rawOb);
+
+  if (metar["visib"].is<const char*>()) {
+    const char* visibStr = metar["visib"];
+    if (strcmp(visibStr, "10+") == 0) {
+      record.visib = 10.0; // "10+" is reported as a string
+    } else {
+      record.visib = atof(visibStr);
+    }
+  } else if (metar["visib"].is<float>()) {
+    record.visib = metar["visib"].as<float>();
+  } else {
+    record.visib = -1.0; // Default value for missing or invalid data
+  }
+
+  // The ceiling is the lowest broken, overcast or obscured layer, whatever order the layers come in
+  record.ceiling = -1;
+  record.ceilingCover = COVER_NONE;
+  for (JsonObject cloud : metar["clouds"].as<JsonArray>()) {
+    CloudCover cover = parseCloudCover(cloud["cover"] | "");
+    int base = cloud["base"] | -1; // Default to -1 if base is missing
+    if (isCeilingCover(cover) && base >= 0 && (record.ceiling == -1 || base < record.ceiling)) {
+      record.ceiling = base;
+      record.ceilingCover = cover;
+    }
+  }
+}
+
+// Peek the next non-whitespace character, waiting up to the stream timeout for it to arrive
+static int peekNonSpace(Stream& stream) {
+  unsigned long start = millis();
+  for (;;) {
+    int c = stream.peek();
+    if (c >= 0 && !isspace(c)) {
+      return c;
+    }
+    if (c >= 0) {
+      stream.read();
+    } else if (millis() - start >= stream.getTimeout()) {
+      return -1;
+    } else {
+      delay(1);
+    }
+  }
+}
+
+int streamMetars(Stream& stream, const JsonDocument& filter, ArenaJsonAllocator& allocator, MetarSink onMetar,
+                 IngestStats& stats) {
+  if (!stream.find("[")) {
+    LOG_WARN("METAR stream: response is not a JSON array\n");
+    return -1;
+  }
+  if (peekNonSpace(stream) == ']') {
+    return 0;
+  }
+
+  JsonDocument element(&allocator);
+  RefreshArena& arena = allocator.arena();
+  size_t arenaMark = arena.mark();
+  MetarRecord record;
+  int count = 0;
+  do {
+    uint32_t started = micros();
+    METRIC_TIMER_START(parseTimer);
+    DeserializationError error = deserializeJson(element, stream, DeserializationOption::Filter(filter));
+    if (error) {
+      LOG_WARN("METAR stream: element %d failed to parse: %s\n", count, error.c_str());
+      return -1;
+    }
+    readMetarRecord(element.as<JsonObject>(), record);
+    element.clear();
+    arena.rewind(arenaMark);
+    METRIC_TIMER_STOP(parseTimer, STAGE_PARSE);
+    stats.metars++;
+    stats.parseMicros += micros() - started;
+    onMetar(record);
+    count++;
+  } while (stream.findUntil(",", "]"));
+
+  return count;
+}
+
+int streamRawMetars(PayloadStream& stream, uint32_t nowUnix, MetarSink onMetar, IngestStats& stats) {
+  char line[256];   // Longer reports keep their start, the groups the map reads come before the remarks
+  MetarRecord record;
+  int count = 0;
+  for (;;) {
+    uint32_t started = micros();
+    int len = 0;
+    int c;
+    while ((c = stream.read()) >= 0 && c != '\n') {
+      if (len + 1 < (int)sizeof(line)) line[len++] = c;
+    }
+    if (c < 0 && (len == 0 || !stream.complete())) {
+      break;
+    }
+    while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == ' ')) len--;
+    line[len] = '\0';
+    METRIC_TIMER_START(parseTimer);
+    bool decoded = decodeMetar(line, nowUnix, record);
+    METRIC_TIMER_STOP(parseTimer, STAGE_PARSE);
+    if (!decoded) {
+      continue;  // Blank line or NIL report
+    }
+    stats.metars++;
+    stats.parseMicros += micros() - started;
+    onMetar(record);
+    count++;
+  }
+  return count;
+}
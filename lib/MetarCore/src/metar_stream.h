@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include "metar_decoder.h"
+#include "refresh_arena.h"
+
+//===================================================== METAR Stream ======================================================================//
+// Reads the reports of an API response straight off the body while it is still downloading, in either format,
+// and hands each to a callback as soon as it is complete. Only one report is ever held, so peak memory does not
+// grow with the number of stations.
+
+typedef void (*MetarSink)(const MetarRecord& record);
+
+// A response body being read, that can tell once it has ended whether it arrived in full
+class PayloadStream : public Stream {
+public:
+  virtual bool complete() const = 0;
+};
+
+// What a response format has cost, so the two can be compared on the same map
+struct IngestStats {
+  uint32_t bytes;          // Response bytes downloaded
+  uint32_t metars;         // Reports parsed
+  uint64_t parseMicros;    // Parser time for them, including waiting on the stream
+};
+
+// Fill the ArduinoJson filter that keeps only the fields of a MetarRecord
+void setupMetarFilter(JsonDocument& filter);
+
+// Copy one filtered METAR element into a fixed-size record
+void readMetarRecord(JsonObject metar, MetarRecord& record);
+
+// Parse a format=json response one array element at a time through filter. Each element is kept in the arena of
+// allocator, which is rewound after every one. Returns the number of METARs handed to onMetar, or -1 if the
+// stream was malformed or cut short.
+int streamMetars(Stream& stream, const JsonDocument& filter, ArenaJsonAllocator& allocator, MetarSink onMetar,
+                 IngestStats& stats);
+
+// Parse a format=raw response, one report per line. A last line without a newline is only decoded if the payload
+// arrived in full, so a cut-off report never shows up as a partial one. nowUnix places the reports' day and time
+// groups. Returns the number of METARs handed to onMetar.
+int streamRawMetars(PayloadStream& stream, uint32_t nowUnix, MetarSink onMetar, IngestStats& stats);
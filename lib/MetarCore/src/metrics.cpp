@@ -0,0 +1,5 @@
+#include "metrics.h"
+
+#if METRICS_ENABLED
+LatencyHistogram stageLatency[STAGE_COUNT];
+#endif
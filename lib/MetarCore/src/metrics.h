@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+
+//===================================================== Metrics ===========================================================================//
+// Stage timers read the CPU cycle counter and land in fixed-bucket latency histograms, one per pipeline stage.
+// Each stage is recorded from a single task, so a histogram is only ever written from one place and needs no lock.
+// Build with -DMETRICS_ENABLED=0 to compile the timers, histograms and /metrics out entirely.
+
+#ifndef METRICS_ENABLED
+#define METRICS_ENABLED 1
+#endif
+
+#if METRICS_ENABLED
+
+#ifdef ARDUINO
+#include <Arduino.h>
+// Cycle counter of the core the task runs on. Tasks are pinned, so start and stop read the same counter.
+inline uint32_t metricCycles() { return ESP.getCycleCount(); }
+inline uint32_t metricCyclesPerMicro() { return getCpuFrequencyMhz(); }
+#else
+#include <chrono>
+inline uint32_t metricCycles() {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+inline uint32_t metricCyclesPerMicro() { return 1; }
+#endif
+
+enum MetricStage : uint8_t {
+  STAGE_FETCH,      // One METAR request, from sending it to the last byte of the body
+  STAGE_TLS,        // Opening a new connection, handshake included
+  STAGE_PARSE,      // Deserializing one METAR element, including any wait for its bytes
+  STAGE_CLASSIFY,   // Classifying every station of an update in one pass
+  STAGE_RENDER,     // Drawing the station store into the frame and pushing it out
+  STAGE_WEB,        // Web handlers
+  STAGE_COUNT
+};
+
+inline const char* metricStageName(MetricStage stage) {
+  static const char* const names[] = {"fetch", "tls", "parse", "classify", "render", "web"};
+  return stage < STAGE_COUNT ? names[stage] : "unknown";
+}
+
+// Bucket upper bounds in microseconds, 10us to 10s
+#define LATENCY_BUCKET_COUNT 13
+static const uint32_t LATENCY_BUCKETS_US[LATENCY_BUCKET_COUNT] = {
+  10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000, 10000000
+};
+
+struct LatencyHistogram {
+  uint32_t buckets[LATENCY_BUCKET_COUNT];  // Not cumulative, the exporter sums them into Prometheus "le" buckets
+  uint32_t count;
+  uint64_t sumMicros;
+  uint32_t maxMicros;
+
+  void record(uint32_t micros) {
+    for (int i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+      if (micros <= LATENCY_BUCKETS_US[i]) {
+        buckets[i]++;
+        break;
+      }
+    }
+    count++;
+    sumMicros += micros;
+    if (micros > maxMicros) maxMicros = micros;
+  }
+};
+
+extern LatencyHistogram stageLatency[STAGE_COUNT];
+
+// The cycle counter wraps after 2^32 cycles (about 17s at 240MHz), longer stages are recorded short
+inline void recordStageCycles(MetricStage stage, uint32_t cycles) {
+  stageLatency[stage].record(cycles / metricCyclesPerMicro());
+}
+
+#define METRIC_TIMER_START(timer) uint32_t timer = metricCycles()
+#define METRIC_TIMER_STOP(timer, stage) recordStageCycles(stage, metricCycles() - timer)
+
+#else
+
+#define METRIC_TIMER_START(timer)
+#define METRIC_TIMER_STOP(timer, stage)
+
+#endif
@@ -0,0 +1,147 @@
+#include "power_scheduler.h"
+
+#include <algorithm>
+#include <initializer_list>
+
+const char* powerModeName(PowerMode mode) {
+  static const char* const names[] = {"active", "idle", "lightSleep"};
+  return mode < POWER_MODE_COUNT ? names[mode] : "unknown";
+}
+
+const char* powerWakeName(PowerWake wake) {
+  static const char* const names[] = {"poll", "fetch", "schedule", "housekeeping", "check"};
+  return wake < WAKE_COUNT ? names[wake] : "unknown";
+}
+
+static bool scheduledOn(const DisplaySchedule& schedule, int weekday) {
+  return (schedule.days >> weekday) & 1;
+}
+
+bool displayScheduled(const DisplaySchedule& schedule, const struct tm& local) {
+  int minute = local.tm_hour * 60 + local.tm_min;
+  if (schedule.startMinute < schedule.endMinute) {
+    return scheduledOn(schedule, local.tm_wday) && minute >= schedule.startMinute && minute < schedule.endMinute;
+  }
+  if (schedule.startMinute > schedule.endMinute) {
+    // The part after midnight belongs to the window that started the day before
+    return (minute >= schedule.startMinute && scheduledOn(schedule, local.tm_wday)) ||
+           (minute < schedule.endMinute && scheduledOn(schedule, (local.tm_wday + 6) % 7));
+  }
+  return false;
+}
+
+time_t nextScheduleChange(const DisplaySchedule& schedule, time_t now) {
+  struct tm local;
+  localtime_r(&now, &local);
+  bool current = displayScheduled(schedule, local);
+
+  // Every start and end over the next week and a bit, through mktime so they land right across DST changes. A
+  // time in the hour that repeats when DST ends is there twice; mktime picks one, the other DST flag finds the
+  // other, so the first of them is the one that counts.
+  time_t candidates[9 * 2 * 2];
+  int count = 0;
+  for (int day = 0; day <= 8; day++) {
+    for (uint16_t minute : {schedule.startMinute, schedule.endMinute}) {
+      struct tm at = local;
+      at.tm_mday += day;
+      at.tm_hour = 0;
+      at.tm_min = minute;
+      at.tm_sec = 0;
+      at.tm_isdst = -1;
+      struct tm other = at;
+      time_t t = mktime(&at);
+      if (t > now) {
+        candidates[count++] = t;
+      }
+      other.tm_isdst = !at.tm_isdst;
+      time_t repeated = mktime(&other);
+      if (repeated != t && repeated > now && other.tm_hour == at.tm_hour && other.tm_min == at.tm_min) {
+        candidates[count++] = repeated;
+      }
+    }
+  }
+  std::sort(candidates, candidates + count);
+  for (int i = 0; i < count; i++) {
+    localtime_r(&candidates[i], &local);
+    if (displayScheduled(schedule, local) != current) {
+      return candidates[i];
+    }
+  }
+  return 0;
+}
+
+PowerPlan PowerScheduler::plan(const PowerInputs& in) const {
+  PowerPlan active = {POWER_ACTIVE, WAKE_POLL, config_.pollMs};
+  if (in.level == POWER_LEVEL_OFF) {
+    return active;
+  }
+  bool requestRecent = in.lastRequestMs != 0 && in.nowMs - in.lastRequestMs < config_.requestHoldMs;
+  if (in.animating || in.fetchRunning || in.clientsConnected || in.lanActive || requestRecent) {
+    return active;
+  }
+
+  // The nearest event, with the fetch moved up so the clock is back up before it starts
+  PowerWake wake = WAKE_POLL;
+  uint32_t waitMs = POWER_WAIT_NONE;
+  if (in.fetchWaitMs != POWER_WAIT_NONE) {
+    wake = WAKE_FETCH;
+    waitMs = in.fetchWaitMs > config_.fetchLeadMs ? in.fetchWaitMs - config_.fetchLeadMs : 0;
+  }
+  if (in.scheduleWaitMs < waitMs) {
+    wake = WAKE_SCHEDULE;
+    waitMs = in.scheduleWaitMs;
+  }
+  if (in.housekeepingWaitMs < waitMs) {
+    wake = WAKE_HOUSEKEEPING;
+    waitMs = in.housekeepingWaitMs;
+  }
+  if (waitMs < config_.pollMs) {
+    // Too close to be worth clocking down for, poll until it comes around
+    return {POWER_ACTIVE, wake, config_.pollMs};
+  }
+
+  bool justWoke = lastWakeMs_ != 0 && in.nowMs - lastWakeMs_ < config_.awakeHoldMs;
+  if (in.level >= POWER_LEVEL_SLEEP && !in.displayOn && !justWoke && waitMs >= config_.minSleepMs + config_.sleepLeadMs) {
+    // Wake early enough for WiFi to be back by the time the event comes around
+    waitMs -= config_.sleepLeadMs;
+    return waitMs > config_.maxSleepMs ? PowerPlan{POWER_LIGHT_SLEEP, WAKE_CHECK, config_.maxSleepMs}
+                                       : PowerPlan{POWER_LIGHT_SLEEP, wake, waitMs};
+  }
+  return waitMs > config_.idleMaxMs ? PowerPlan{POWER_IDLE, WAKE_POLL, config_.idleMaxMs}
+                                    : PowerPlan{POWER_IDLE, wake, waitMs};
+}
+
+void PowerScheduler::enter(PowerMode mode, uint32_t nowMs) {
+  residency_[mode_] += nowMs - modeSinceMs_;
+  mode_ = mode;
+  modeSinceMs_ = nowMs;
+}
+
+void PowerScheduler::woke(uint32_t plannedMs, uint32_t sleptMs, uint32_t nowMs) {
+  sleeps++;
+  uint32_t late = sleptMs > plannedMs ? sleptMs - plannedMs : 0;
+  wakeLateMsTotal += late;
+  wakeLateMsMax = std::max(wakeLateMsMax, late);
+  lastWakeMs_ = nowMs ? nowMs : 1;
+}
+
+void PowerScheduler::reconnected(uint32_t ms) {
+  reconnects++;
+  reconnectMsTotal += ms;
+  reconnectMsMax = std::max(reconnectMsMax, ms);
+}
+
+uint64_t PowerScheduler::residencyMs(PowerMode mode, uint32_t nowMs) const {
+  return residency_[mode] + (mode == mode_ ? nowMs - modeSinceMs_ : 0);
+}
+
+float PowerScheduler::estimatedMilliamps(uint32_t nowMs) const {
+  double charge = 0;
+  uint64_t total = 0;
+  for (int i = 0; i < POWER_MODE_COUNT; i++) {
+    uint64_t ms = residencyMs((PowerMode)i, nowMs);
+    charge += (double)ms * config_.modeMilliamps[i];
+    total += ms;
+  }
+  return total ? (float)(charge / total) : config_.modeMilliamps[mode_];
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+//===================================================== Power Scheduler ===================================================================//
+// Decides how much of the board stays awake until the next thing it has to do: the next fetch, the next change of
+// the display window, the next animation frame or a web client waiting on it. While anything is moving it stays
+// fully awake. When nothing needs it until a known time, it idles with the CPU clocked down and the radio in
+// modem sleep, which keeps the web UI reachable. Outside the display window it can also go into light sleep in
+// long slices, with WiFi off until it wakes.
+//
+// Like the fetch scheduler it gets the time and the state of the rest of the map from the caller, so the whole
+// thing runs on a simulated clock off-device.
+
+//===================================================== Display Schedule ==================================================================//
+// Local wall clock window the map is lit in. Times are minutes of the day in the TZ set through setenv("TZ"),
+// so DST shifts move the window with the clock. Check displayScheduled() once and then switch at the times
+// nextScheduleChange() gives: a boundary in the hour that repeats when DST ends then happens once, not twice.
+
+struct DisplaySchedule {
+  uint16_t startMinute;   // Turns on at this minute of the day
+  uint16_t endMinute;     // and off at this one. Before startMinute the window runs past midnight, equal is never on.
+  uint8_t days;           // Days a window starts on, bit 0 Sunday to bit 6 Saturday
+};
+
+// Whether the window is open at a local time
+bool displayScheduled(const DisplaySchedule& schedule, const struct tm& local);
+
+// Unix time of the next minute displayScheduled() changes after now, 0 if it never does
+time_t nextScheduleChange(const DisplaySchedule& schedule, time_t now);
+
+//===================================================== Power Plan ========================================================================//
+
+enum PowerMode : uint8_t {
+  POWER_ACTIVE,         // Full clock, radio in its default power save
+  POWER_IDLE,           // Clocked down, radio in maximum modem sleep
+  POWER_LIGHT_SLEEP,    // CPU halted, WiFi off
+  POWER_MODE_COUNT
+};
+
+// What the plan is waiting for
+enum PowerWake : uint8_t {
+  WAKE_POLL,            // Nothing in particular, the next loop pass
+  WAKE_FETCH,
+  WAKE_SCHEDULE,        // Display window opens or closes
+  WAKE_HOUSEKEEPING,    // Settings flush and the like
+  WAKE_CHECK,           // Longest light sleep slice ran out
+  WAKE_COUNT
+};
+
+enum PowerLevel : uint8_t {
+  POWER_LEVEL_OFF,      // Always active, as before there was a scheduler
+  POWER_LEVEL_IDLE,     // Idle between events
+  POWER_LEVEL_SLEEP     // Also light sleep outside the display window
+};
+
+#define POWER_WAIT_NONE UINT32_MAX
+
+struct PowerConfig {
+  uint32_t pollMs;            // Loop period while active
+  uint32_t idleMaxMs;         // Longest wait while idle, so new work is noticed
+  uint32_t fetchLeadMs;       // Go active this long before a fetch
+  uint32_t requestHoldMs;     // Stay active after a web request
+  uint32_t minSleepMs;        // Shorter waits are not worth stopping WiFi for
+  uint32_t maxSleepMs;        // Longest light sleep slice
+  uint32_t sleepLeadMs;       // Wake from light sleep this long before an event, to reconnect WiFi
+  uint32_t awakeHoldMs;       // Stay reachable after waking from light sleep
+  float modeMilliamps[POWER_MODE_COUNT];   // Board current in each mode, for the estimate
+};
+
+// State of the map the plan is made from
+struct PowerInputs {
+  uint32_t nowMs;
+  PowerLevel level;
+  bool displayOn;             // Inside the display window
+  bool animating;             // The animator has something moving
+  bool fetchRunning;
+  bool clientsConnected;      // Live feed sockets open
+  bool lanActive;             // LAN fan-out needs the radio up
+  uint32_t lastRequestMs;     // Last web request, 0 if none yet
+  uint32_t fetchWaitMs;       // Until the next fetch may start, POWER_WAIT_NONE if none
+  uint32_t scheduleWaitMs;    // Until the display window changes, POWER_WAIT_NONE if it does not
+  uint32_t housekeepingWaitMs;
+};
+
+struct PowerPlan {
+  PowerMode mode;
+  PowerWake wake;
+  uint32_t waitMs;            // Stay in mode this long, then plan again
+};
+
+const char* powerModeName(PowerMode mode);
+const char* powerWakeName(PowerWake wake);
+
+class PowerScheduler {
+public:
+  explicit PowerScheduler(const PowerConfig& config) : config_(config) {}
+
+  PowerPlan plan(const PowerInputs& in) const;
+
+  // Switch the mode time is counted against
+  void enter(PowerMode mode, uint32_t nowMs);
+
+  // A light sleep ended: planned and actual length, then how long WiFi took to come back
+  void woke(uint32_t plannedMs, uint32_t sleptMs, uint32_t nowMs);
+  void reconnected(uint32_t ms);
+
+  PowerMode mode() const { return mode_; }
+  uint64_t residencyMs(PowerMode mode, uint32_t nowMs) const;
+
+  // Average board current since boot from the time spent in each mode
+  float estimatedMilliamps(uint32_t nowMs) const;
+
+  uint32_t sleeps = 0;
+  uint32_t wakeLateMsMax = 0;         // Light sleep that ran past its timer
+  uint64_t wakeLateMsTotal = 0;
+  uint32_t reconnectMsMax = 0;
+  uint64_t reconnectMsTotal = 0;
+  uint32_t reconnects = 0;
+
+private:
+  PowerConfig config_;
+  PowerMode mode_ = POWER_ACTIVE;
+  uint32_t modeSinceMs_ = 0;
+  uint32_t lastWakeMs_ = 0;           // End of the last light sleep, 0 before the first
+  uint64_t residency_[POWER_MODE_COUNT] = {};
+};
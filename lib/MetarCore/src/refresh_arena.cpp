@@ -0,0 +1,83 @@
+#include "refresh_arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 8
+// Each JSON block is preceded by its size so reallocate() knows how much to copy, padded to keep alignment
+#define BLOCK_HEADER ARENA_ALIGN
+
+static size_t alignUp(size_t n) {
+  return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void* RefreshArena::allocate(size_t size) {
+  size_t start = alignUp(used_);
+  if (start + size > size_ || start + size < start) {
+    overflows++;
+    return nullptr;
+  }
+  used_ = start + size;
+  if (used_ > highWater) highWater = used_;
+  last_ = buffer_ + start;
+  return last_;
+}
+
+bool RefreshArena::resizeLast(void* ptr, size_t size) {
+  size_t start = (uint8_t*)ptr - buffer_;
+  if (ptr != last_ || start + size > size_) {
+    return false;
+  }
+  used_ = start + size;
+  if (used_ > highWater) highWater = used_;
+  return true;
+}
+
+static size_t& blockSize(void* ptr) {
+  return *(size_t*)((uint8_t*)ptr - BLOCK_HEADER);
+}
+
+void* ArenaJsonAllocator::allocate(size_t size) {
+  uint8_t* block = (uint8_t*)arena_.allocate(BLOCK_HEADER + size);
+  if (block == nullptr) {
+    heapFallbacks++;
+    block = (uint8_t*)malloc(BLOCK_HEADER + size);
+    if (block == nullptr) {
+      return nullptr;
+    }
+  }
+  *(size_t*)block = size;
+  return block + BLOCK_HEADER;
+}
+
+void ArenaJsonAllocator::deallocate(void* ptr) {
+  if (ptr != nullptr && !arena_.owns(ptr)) {
+    free((uint8_t*)ptr - BLOCK_HEADER);
+  }
+}
+
+void* ArenaJsonAllocator::reallocate(void* ptr, size_t newSize) {
+  if (ptr == nullptr) {
+    return allocate(newSize);
+  }
+  uint8_t* block = (uint8_t*)ptr - BLOCK_HEADER;
+  if (!arena_.owns(ptr)) {
+    block = (uint8_t*)realloc(block, BLOCK_HEADER + newSize);
+    if (block == nullptr) {
+      return nullptr;
+    }
+    *(size_t*)block = newSize;
+    return block + BLOCK_HEADER;
+  }
+  size_t oldSize = blockSize(ptr);
+  // ArduinoJson grows strings while reading them and shrinks pools when done, both usually on the newest block
+  if (arena_.resizeLast(block, BLOCK_HEADER + newSize) || newSize <= oldSize) {
+    blockSize(ptr) = newSize;
+    return ptr;
+  }
+  void* moved = allocate(newSize);
+  if (moved != nullptr) {
+    memcpy(moved, ptr, oldSize);
+  }
+  return moved;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ArduinoJson.h>
+
+//===================================================== Refresh Arena =====================================================================//
+// Bump allocator over a fixed buffer for memory that only lives as long as one step of a refresh: the request
+// URL, the JSON document of the element being parsed. Allocating is a pointer bump and releasing is resetting
+// the pointer, so none of it ever reaches the heap, where interleaving with the long-lived TLS buffers is what
+// breaks the largest free block into pieces on boards that run for weeks.
+//
+// An arena has one owner task and is not locked.
+
+class RefreshArena {
+public:
+  RefreshArena(void* buffer, size_t size) : buffer_((uint8_t*)buffer), size_(size) {}
+
+  // Aligned block, nullptr if it does not fit
+  void* allocate(size_t size);
+
+  // Grow or shrink the newest block in place. Returns false if ptr is not the newest block or it does not fit.
+  bool resizeLast(void* ptr, size_t size);
+
+  bool owns(const void* ptr) const { return ptr >= buffer_ && ptr < buffer_ + size_; }
+
+  // Release everything allocated after mark() in one step
+  size_t mark() const { return used_; }
+  void rewind(size_t mark) { used_ = mark < used_ ? mark : used_; last_ = nullptr; }
+  void reset() { rewind(0); }
+
+  size_t size() const { return size_; }
+  size_t used() const { return used_; }
+
+  size_t highWater = 0;       // Most ever in use at once
+  uint32_t overflows = 0;     // Requests that did not fit
+
+private:
+  uint8_t* buffer_;
+  size_t size_;
+  size_t used_ = 0;
+  uint8_t* last_ = nullptr;   // Newest block, the only one that can be resized
+};
+
+// ArduinoJson allocator on an arena. Blocks that do not fit come from the heap instead, so a document larger
+// than planned still parses; heapFallbacks counts them. Freeing an arena block does nothing, the owner of the
+// arena releases them all with rewind() or reset() once the document is cleared.
+class ArenaJsonAllocator : public ArduinoJson::Allocator {
+public:
+  explicit ArenaJsonAllocator(RefreshArena& arena) : arena_(arena) {}
+
+  void* allocate(size_t size) override;
+  void deallocate(void* ptr) override;
+  void* reallocate(void* ptr, size_t newSize) override;
+
+  RefreshArena& arena() const { return arena_; }
+
+  uint32_t heapFallbacks = 0;
+
+private:
+  RefreshArena& arena_;
+};
@@ -0,0 +1,151 @@
+#include "settings_registry.h"
+
+#include <string.h>
+
+void SettingsRegistry::lock() {
+#ifdef ARDUINO
+  xSemaphoreTake(mutex_, portMAX_DELAY);
+#else
+  mutex_.lock();
+#endif
+}
+
+void SettingsRegistry::unlock() {
+#ifdef ARDUINO
+  xSemaphoreGive(mutex_);
+#else
+  mutex_.unlock();
+#endif
+}
+
+void SettingsRegistry::load() {
+#ifdef ARDUINO
+  if (mutex_ == nullptr) {
+    mutex_ = xSemaphoreCreateMutex();
+  }
+#endif
+  bool open = storage_.begin(true);
+  for (size_t i = 0; i < count_; i++) {
+    Setting& setting = settings_[i];
+    setting.dirty = false;
+    if (setting.type == SETTING_STRING) {
+      if (!open || !storage_.getString(setting.key, setting.text, sizeof(setting.text))) {
+        strncpy(setting.text, setting.defaultText ? setting.defaultText : "", sizeof(setting.text) - 1);
+        setting.text[sizeof(setting.text) - 1] = '\0';
+      }
+    } else {
+      int32_t value;
+      setting.value = open && storage_.getInt(setting.key, value) ? value : setting.defaultValue;
+      if (setting.type == SETTING_INT && setting.min < setting.max) {
+        if (setting.value < setting.min) setting.value = setting.min;
+        if (setting.value > setting.max) setting.value = setting.max;
+      }
+    }
+  }
+  if (open) {
+    storage_.end();
+  }
+}
+
+int SettingsRegistry::find(const char* key) const {
+  for (size_t i = 0; i < count_; i++) {
+    if (strcmp(settings_[i].key, key) == 0) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+void SettingsRegistry::getString(size_t id, char* text, size_t size) {
+  if (size == 0) {
+    return;
+  }
+  lock();
+  strncpy(text, id < count_ ? settings_[id].text : "", size - 1);
+  text[size - 1] = '\0';
+  unlock();
+}
+
+bool SettingsRegistry::setInt(size_t id, int32_t value, uint32_t now) {
+  if (id >= count_ || settings_[id].type == SETTING_STRING) {
+    return false;
+  }
+  Setting& setting = settings_[id];
+  if (setting.type == SETTING_INT && setting.min < setting.max) {
+    if (value < setting.min) value = setting.min;
+    if (value > setting.max) value = setting.max;
+  }
+  lock();
+  requests++;
+  if (setting.value != value) {
+    setting.value = value;
+    setting.dirty = true;
+    lastChange_ = now;
+    changes++;
+  }
+  unlock();
+  return true;
+}
+
+bool SettingsRegistry::setString(size_t id, const char* text, uint32_t now) {
+  if (id >= count_ || settings_[id].type != SETTING_STRING) {
+    return false;
+  }
+  Setting& setting = settings_[id];
+  lock();
+  requests++;
+  if (strncmp(setting.text, text, sizeof(setting.text) - 1) != 0) {
+    strncpy(setting.text, text, sizeof(setting.text) - 1);
+    setting.text[sizeof(setting.text) - 1] = '\0';
+    setting.dirty = true;
+    lastChange_ = now;
+    changes++;
+  }
+  unlock();
+  return true;
+}
+
+size_t SettingsRegistry::pending() const {
+  size_t dirty = 0;
+  for (size_t i = 0; i < count_; i++) {
+    dirty += settings_[i].dirty;
+  }
+  return dirty;
+}
+
+size_t SettingsRegistry::flush(uint32_t now, bool force) {
+  if (pending() == 0 || (!force && now - lastChange_ < debounceMs_)) {
+    return 0;
+  }
+  // Values are copied under the lock and written outside it, so web handlers never wait on flash
+  size_t written = 0;
+  if (!storage_.begin(false)) {
+    return 0;
+  }
+  for (size_t i = 0; i < count_; i++) {
+    Setting& setting = settings_[i];
+    lock();
+    bool dirty = setting.dirty;
+    int32_t value = setting.value;
+    char text[SETTING_STRING_MAX];
+    memcpy(text, setting.text, sizeof(text));
+    setting.dirty = false;
+    unlock();
+    if (!dirty) {
+      continue;
+    }
+    bool ok = setting.type == SETTING_STRING ? storage_.putString(setting.key, text)
+                                             : storage_.putInt(setting.key, value);
+    if (ok) {
+      written++;
+    } else {
+      lock();
+      setting.dirty = true;  // Retried on the next flush
+      unlock();
+    }
+  }
+  storage_.end();
+  writes += written;
+  flushes++;
+  return written;
+}
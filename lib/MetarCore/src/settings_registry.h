@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#else
+#include <mutex>
+#endif
+
+//===================================================== Settings Registry =================================================================//
+// Every setting is loaded from storage once at boot and then read from RAM. A change only marks the setting
+// dirty; flush() writes all dirty settings in one storage session once no change has come in for the debounce
+// window, so dragging a slider costs one flash write instead of one per step.
+
+#define SETTING_STRING_MAX 32   // Including the terminator
+
+enum SettingType : uint8_t {
+  SETTING_INT,
+  SETTING_COLOR,    // 0xRRGGBB, same packing as packColor()
+  SETTING_STRING
+};
+
+struct Setting {
+  const char* key;          // Storage key, at most 15 characters for NVS
+  SettingType type;
+  int32_t defaultValue;     // For SETTING_INT and SETTING_COLOR
+  int32_t min;              // Values outside min..max are clamped, SETTING_INT only
+  int32_t max;
+  const char* defaultText;  // For SETTING_STRING
+  // Current state, filled in by load()
+  int32_t value;
+  char text[SETTING_STRING_MAX];
+  bool dirty;
+};
+
+// Where settings live between boots
+class SettingsStorage {
+public:
+  virtual ~SettingsStorage() {}
+  virtual bool begin(bool readOnly) = 0;
+  virtual void end() = 0;
+  virtual bool getInt(const char* key, int32_t& value) = 0;
+  virtual bool putInt(const char* key, int32_t value) = 0;
+  virtual bool getString(const char* key, char* text, size_t size) = 0;
+  virtual bool putString(const char* key, const char* text) = 0;
+};
+
+#if defined(ARDUINO) || defined(NATIVE_SHIMS)
+#include <Preferences.h>
+
+// Settings in one NVS namespace through Preferences
+class PreferencesSettingsStorage : public SettingsStorage {
+public:
+  explicit PreferencesSettingsStorage(const char* name) : name_(name) {}
+
+  bool begin(bool readOnly) override { return preferences_.begin(name_, readOnly); }
+  void end() override { preferences_.end(); }
+  bool getInt(const char* key, int32_t& value) override {
+    if (!preferences_.isKey(key)) return false;
+    value = preferences_.getInt(key);
+    return true;
+  }
+  bool putInt(const char* key, int32_t value) override { return preferences_.putInt(key, value) == sizeof(value); }
+  bool getString(const char* key, char* text, size_t size) override {
+    return preferences_.isKey(key) && preferences_.getString(key, text, size) > 0;
+  }
+  bool putString(const char* key, const char* text) override { return preferences_.putString(key, text) > 0; }
+
+private:
+  const char* name_;
+  Preferences preferences_;
+};
+#endif
+
+class SettingsRegistry {
+public:
+  SettingsRegistry(Setting* settings, size_t count, SettingsStorage& storage, uint32_t debounceMs)
+    : settings_(settings), count_(count), storage_(storage), debounceMs_(debounceMs) {}
+
+  uint32_t changes = 0;        // set() calls that changed a value
+  uint32_t requests = 0;       // All set() calls, each used to be a flash write
+  uint32_t writes = 0;         // Settings actually written to storage
+  uint32_t flushes = 0;
+
+  // Read every setting, falling back to its default. Call once before any task uses the registry.
+  void load();
+
+  // Index of a setting by key, -1 if there is none
+  int find(const char* key) const;
+
+  size_t count() const { return count_; }
+  const Setting& at(size_t id) const { return settings_[id]; }
+
+  int32_t getInt(size_t id) const { return settings_[id].value; }
+  // Copies the text so a concurrent set cannot tear it
+  void getString(size_t id, char* text, size_t size);
+
+  // Returns false if the id is out of range or of another type
+  bool setInt(size_t id, int32_t value, uint32_t now);
+  bool setString(size_t id, const char* text, uint32_t now);
+
+  // Settings whose change is waiting for the debounce window
+  size_t pending() const;
+
+  // Write dirty settings once nothing changed for the debounce window, or right away with force.
+  // Returns how many were written.
+  size_t flush(uint32_t now, bool force = false);
+
+  uint32_t writesAvoided() const { return requests - writes; }
+
+private:
+  void lock();
+  void unlock();
+
+  Setting* settings_;
+  size_t count_;
+  SettingsStorage& storage_;
+  uint32_t debounceMs_;
+  uint32_t lastChange_ = 0;
+#ifdef ARDUINO
+  SemaphoreHandle_t mutex_ = nullptr;
+#else
+  std::mutex mutex_;
+#endif
+};
@@ -0,0 +1,192 @@
+#include "station_history.h"
+
+#include <string.h>
+
+// Which fields follow the time delta in a record
+enum HistoryField : uint8_t {
+  FIELD_CATEGORY = 1 << 0,
+  FIELD_CEILING = 1 << 1,      // Zigzag varint delta
+  FIELD_VISIBILITY = 1 << 2,
+  FIELD_WIND_DIR = 1 << 3,     // Zigzag varint delta
+  FIELD_WIND_SPEED = 1 << 4,
+  FIELD_WIND_GUST = 1 << 5,
+  FIELD_ALTIMETER = 1 << 6     // Zigzag varint delta
+};
+
+// Mask, minutes as a varint and every field changed
+#define HISTORY_MAX_RECORD 19
+
+static uint8_t* putVarint(uint8_t* p, uint32_t v) {
+  while (v >= 0x80) {
+    *p++ = (uint8_t)v | 0x80;
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+// Small changes either way fit one byte
+static uint8_t* putDelta(uint8_t* p, uint16_t from, uint16_t to) {
+  uint16_t delta = to - from;
+  return putVarint(p, (uint16_t)(delta & 0x8000 ? ~(delta << 1) : delta << 1));
+}
+
+static size_t encodeRecord(const HistorySample& prev, const HistorySample& next, uint8_t* out) {
+  uint8_t mask = (next.category != prev.category ? FIELD_CATEGORY : 0) |
+                 (next.ceiling != prev.ceiling ? FIELD_CEILING : 0) |
+                 (next.visibility != prev.visibility ? FIELD_VISIBILITY : 0) |
+                 (next.windDir != prev.windDir ? FIELD_WIND_DIR : 0) |
+                 (next.windSpeed != prev.windSpeed ? FIELD_WIND_SPEED : 0) |
+                 (next.windGust != prev.windGust ? FIELD_WIND_GUST : 0) |
+                 (next.altimeter != prev.altimeter ? FIELD_ALTIMETER : 0);
+  uint8_t* p = out;
+  *p++ = mask;
+  p = putVarint(p, (next.obsTime - prev.obsTime) / 60);
+  if (mask & FIELD_CATEGORY) *p++ = next.category;
+  if (mask & FIELD_CEILING) p = putDelta(p, prev.ceiling, next.ceiling);
+  if (mask & FIELD_VISIBILITY) *p++ = next.visibility;
+  if (mask & FIELD_WIND_DIR) p = putDelta(p, prev.windDir, next.windDir);
+  if (mask & FIELD_WIND_SPEED) *p++ = next.windSpeed;
+  if (mask & FIELD_WIND_GUST) *p++ = next.windGust;
+  if (mask & FIELD_ALTIMETER) p = putDelta(p, prev.altimeter, next.altimeter);
+  return p - out;
+}
+
+// Reads a record out of a ring, wrapping at its end
+struct RingReader {
+  const uint8_t* ring;
+  uint16_t size;
+  uint16_t offset;
+
+  uint8_t byte() {
+    uint8_t b = ring[offset];
+    offset = offset + 1 == size ? 0 : offset + 1;
+    return b;
+  }
+
+  uint32_t varint() {
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      uint8_t b = byte();
+      v |= (uint32_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) break;
+    }
+    return v;
+  }
+
+  uint16_t delta(uint16_t from) {
+    uint16_t zz = varint();
+    return from + (uint16_t)((zz >> 1) ^ -(zz & 1));
+  }
+};
+
+size_t StationHistory::bytesFor(int stations, uint16_t ringBytes) {
+  return (size_t)stations * (sizeof(Ring) + ringBytes);
+}
+
+void StationHistory::begin(void* memory, int stations, uint16_t ringBytes, uint32_t retentionSeconds) {
+  rings_ = (Ring*)memory;
+  records_ = (uint8_t*)memory + (size_t)stations * sizeof(Ring);
+  stations_ = stations;
+  ringBytes_ = ringBytes;
+  retentionSeconds_ = retentionSeconds;
+  memset(rings_, 0, (size_t)stations * sizeof(Ring));
+}
+
+uint16_t StationHistory::decode(int station, uint16_t offset, HistorySample& sample) const {
+  RingReader in = {ring(station), ringBytes_, offset};
+  uint8_t mask = in.byte();
+  sample.obsTime += in.varint() * 60;
+  if (mask & FIELD_CATEGORY) sample.category = in.byte();
+  if (mask & FIELD_CEILING) sample.ceiling = in.delta(sample.ceiling);
+  if (mask & FIELD_VISIBILITY) sample.visibility = in.byte();
+  if (mask & FIELD_WIND_DIR) sample.windDir = in.delta(sample.windDir);
+  if (mask & FIELD_WIND_SPEED) sample.windSpeed = in.byte();
+  if (mask & FIELD_WIND_GUST) sample.windGust = in.byte();
+  if (mask & FIELD_ALTIMETER) sample.altimeter = in.delta(sample.altimeter);
+  return in.offset;
+}
+
+// Fold the first record into the oldest sample and give its bytes back
+void StationHistory::evictOldest(int station) {
+  Ring& r = rings_[station];
+  uint16_t next = decode(station, r.start, r.oldest);
+  uint16_t length = next >= r.start ? next - r.start : next + ringBytes_ - r.start;
+  r.start = next;
+  r.used -= length;
+  r.count--;
+}
+
+bool StationHistory::append(int station, const HistorySample& sample) {
+  if (!valid(station)) {
+    return false;
+  }
+  Ring& r = rings_[station];
+  HistorySample rounded = sample;
+  rounded.obsTime -= rounded.obsTime % 60;
+  if (r.count == 0) {
+    r.oldest = rounded;
+    r.newest = rounded;
+    r.start = 0;
+    r.used = 0;
+    r.count = 1;
+    appended++;
+    return true;
+  }
+  if (rounded.obsTime <= r.newest.obsTime) {
+    return false;
+  }
+
+  uint8_t record[HISTORY_MAX_RECORD];
+  size_t length = encodeRecord(r.newest, rounded, record);
+  while (r.count > 1 && r.used + length > ringBytes_) {
+    evictOldest(station);
+    evictedFull++;
+  }
+  if (r.used + length > ringBytes_) {
+    // Only the oldest sample is left, start over from this one
+    r.oldest = rounded;
+    r.newest = rounded;
+    r.start = 0;
+    r.used = 0;
+    r.count = 1;
+    appended++;
+    return true;
+  }
+  uint8_t* bytes = ring(station);
+  uint16_t offset = (r.start + r.used) % ringBytes_;
+  for (size_t i = 0; i < length; i++) {
+    bytes[offset] = record[i];
+    offset = offset + 1 == ringBytes_ ? 0 : offset + 1;
+  }
+  r.used += length;
+  r.count++;
+  r.newest = rounded;
+  appended++;
+
+  while (r.count > 1 && rounded.obsTime - r.oldest.obsTime > retentionSeconds_) {
+    evictOldest(station);
+    evictedAged++;
+  }
+  return true;
+}
+
+HistoryTrend StationHistory::trend(int station, uint32_t windowSeconds) const {
+  if (!valid(station) || rings_[station].count < 2 || windowSeconds == 0) {
+    return TREND_STEADY;
+  }
+  const HistorySample& newest = rings_[station].newest;
+  uint32_t cutoff = newest.obsTime > windowSeconds ? newest.obsTime - windowSeconds : 0;
+  // The category in effect at the start of the window, or the oldest known one if history is shorter
+  uint8_t baseline = 0;
+  forEach(station, 0, [&](const HistorySample& sample) {
+    if (sample.category != 0 && (baseline == 0 || sample.obsTime <= cutoff)) {
+      baseline = sample.category;
+    }
+  });
+  if (baseline == 0 || newest.category == 0 || newest.category == baseline) {
+    return TREND_STEADY;
+  }
+  // FlightCategory goes up from VFR to LIFR
+  return newest.category > baseline ? TREND_WORSE : TREND_BETTER;
+}
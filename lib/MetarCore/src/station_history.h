@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+//===================================================== Station History ===================================================================//
+// The last day or two of observations of every station, in one fixed block of memory handed in at boot. Each
+// station has a ring of delta records behind a full copy of its oldest sample: a record holds the minutes since
+// the previous observation, a bitmask of the fields that changed and only those fields, so an hourly report with
+// nothing new but the altimeter is 3 bytes. Appending evicts the oldest records once the ring is full or they are
+// older than the retention, folding each into the oldest sample, so it never has to walk the ring. Reading walks
+// it forward from the oldest sample.
+//
+// Values are the station store's quantized ones. Not locked, the caller serializes access.
+
+#define HISTORY_MIN_RING_BYTES 64   // Room for a few of the largest records
+
+struct HistorySample {
+  uint32_t obsTime;       // Unix time, whole minutes
+  uint16_t ceiling;       // Hundreds of feet, CEILING_NONE without a ceiling
+  uint16_t windDir;       // Degrees, WIND_DIR_UNKNOWN when variable or missing
+  uint16_t altimeter;     // Tenths of hPa, ALTIMETER_UNKNOWN when missing
+  uint8_t category;       // FlightCategory, as classified when the sample was taken
+  uint8_t visibility;     // Quarter statute miles
+  uint8_t windSpeed;      // Knots
+  uint8_t windGust;       // Knots, WIND_SPEED_UNKNOWN without gusts
+};
+
+enum HistoryTrend : uint8_t {
+  TREND_STEADY,
+  TREND_WORSE,            // Category is worse than it was at the start of the window
+  TREND_BETTER
+};
+
+class StationHistory {
+public:
+  // Per station: its ring header plus ringBytes of records
+  static size_t bytesFor(int stations, uint16_t ringBytes);
+
+  // Take over memory of bytesFor() bytes. ringBytes must be at least HISTORY_MIN_RING_BYTES.
+  void begin(void* memory, int stations, uint16_t ringBytes, uint32_t retentionSeconds);
+
+  bool ready() const { return rings_ != nullptr; }
+  int stations() const { return stations_; }
+  uint16_t ringBytes() const { return ringBytes_; }
+
+  // Add a station's newest observation. Returns false if it is not newer than the last one kept.
+  bool append(int station, const HistorySample& sample);
+
+  // Call visit(const HistorySample&) for each sample of a station at or after from, oldest first.
+  // Returns how many were visited.
+  template <typename Visit>
+  int forEach(int station, uint32_t from, Visit visit) const {
+    if (!valid(station) || rings_[station].count == 0) {
+      return 0;
+    }
+    const Ring& ring = rings_[station];
+    HistorySample sample = ring.oldest;
+    uint16_t offset = ring.start;
+    int visited = 0;
+    for (uint16_t i = 0; i < ring.count; i++) {
+      if (i > 0) {
+        offset = decode(station, offset, sample);
+      }
+      if (sample.obsTime >= from) {
+        visit(sample);
+        visited++;
+      }
+    }
+    return visited;
+  }
+
+  // Compare a station's newest category with the one in effect windowSeconds before it
+  HistoryTrend trend(int station, uint32_t windowSeconds) const;
+
+  uint16_t count(int station) const { return valid(station) ? rings_[station].count : 0; }
+  uint16_t used(int station) const { return valid(station) ? rings_[station].used : 0; }
+  uint32_t oldestTime(int station) const { return count(station) ? rings_[station].oldest.obsTime : 0; }
+  uint32_t newestTime(int station) const { return count(station) ? rings_[station].newest.obsTime : 0; }
+
+  uint32_t appended = 0;
+  uint32_t evictedFull = 0;   // Records dropped to make room before they reached the retention
+  uint32_t evictedAged = 0;
+
+private:
+  struct Ring {
+    HistorySample oldest;     // Full copy of the oldest sample kept
+    HistorySample newest;     // What the next record is a delta from
+    uint16_t start;           // Offset of the oldest record in the ring
+    uint16_t used;            // Record bytes
+    uint16_t count;           // Samples including oldest, 0 when empty
+  };
+
+  bool valid(int station) const { return rings_ != nullptr && station >= 0 && station < stations_; }
+  uint8_t* ring(int station) const { return records_ + (size_t)station * ringBytes_; }
+  uint16_t decode(int station, uint16_t offset, HistorySample& sample) const;
+  void evictOldest(int station);
+
+  Ring* rings_ = nullptr;
+  uint8_t* records_ = nullptr;
+  int stations_ = 0;
+  uint16_t ringBytes_ = 0;
+  uint32_t retentionSeconds_ = 0;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+#include <ctype.h>
+
+//===================================================== Station Index =====================================================================//
+// ICAO codes are packed into 4 bytes so a lookup is an integer hash probe instead of a String compare per station.
+// The table is built once at boot from the station table and numbers each distinct station in order of first
+// appearance. An LED without a station stays dark, and a station listed more than once drives all of its LEDs.
+
+// Pack a 3-4 character ICAO code into an integer, returns 0 for anything that is not a valid code
+inline uint32_t packIcao(const char* icao) {
+  if (icao == nullptr) {
+    return 0;
+  }
+  uint32_t key = 0;
+  int len = 0;
+  for (; icao[len] != '\0'; len++) {
+    if (len == 4 || !isalnum((uint8_t)icao[len])) {
+      return 0;
+    }
+    key = (key << 8) | (uint8_t)toupper(icao[len]);
+  }
+  return len >= 3 ? key : 0;
+}
+
+inline void unpackIcao(uint32_t key, char out[5]) {
+  int len = 0;
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    char c = (key >> shift) & 0xFF;
+    if (c != '\0') out[len++] = c;
+  }
+  out[len] = '\0';
+}
+
+constexpr int nextPowerOfTwo(int n, int p = 1) {
+  return p >= n ? p : nextPowerOfTwo(n, p * 2);
+}
+
+template <int MAX_LEDS, int MAX_STATIONS>
+class StationIndex {
+public:
+  // Open-addressed table kept at most half full so probes stay short
+  static constexpr int tableSize = nextPowerOfTwo(MAX_STATIONS * 2);
+
+  struct Slot {
+    uint32_t key;      // Packed ICAO code, 0 when the slot is empty
+    int16_t station;   // Index into the station store
+  };
+
+  Slot slots[tableSize];
+  int16_t ledStation[MAX_LEDS];         // Station shown on each LED, -1 for an LED with no station
+  uint32_t stationIcao[MAX_STATIONS];   // Packed ICAO code of each station
+  int stationCount = 0;
+  int ledCount = 0;
+
+  // Start an empty map of leds LEDs, all dark
+  void clear(int leds) {
+    for (int s = 0; s < tableSize; s++) {
+      slots[s] = {0, -1};
+    }
+    for (int i = 0; i < MAX_LEDS; i++) {
+      ledStation[i] = -1;
+    }
+    stationCount = 0;
+    ledCount = leds < MAX_LEDS ? leds : MAX_LEDS;
+  }
+
+  // Show a station on an LED, numbering the station on first use. Returns the station, or -1 if the LED is
+  // out of range or there is no room for another station.
+  int add(uint32_t key, int led) {
+    if (key == 0 || led < 0 || led >= ledCount) {
+      return -1;
+    }
+    uint32_t s = slotFor(key);
+    while (slots[s].key != 0 && slots[s].key != key) {
+      s = (s + 1) & (tableSize - 1);
+    }
+    if (slots[s].key == 0) {
+      if (stationCount == MAX_STATIONS) {
+        return -1;
+      }
+      slots[s] = {key, (int16_t)stationCount};
+      stationIcao[stationCount++] = key;
+    }
+    ledStation[led] = slots[s].station;
+    return slots[s].station;
+  }
+
+  // airports holds one ICAO code per LED, in wiring order, "" for an LED with no station
+  void build(const char* const* airports, int count) {
+    clear(count);
+    for (int i = 0; i < ledCount; i++) {
+      add(packIcao(airports[i]), i);
+    }
+  }
+
+  // Station store index for an ICAO code, or -1 if it is not on the map
+  int find(const char* icao) const {
+    return findKey(packIcao(icao));
+  }
+
+  // Same for an already packed code
+  int findKey(uint32_t key) const {
+    if (key == 0) {
+      return -1;
+    }
+    for (uint32_t s = slotFor(key); slots[s].key != 0; s = (s + 1) & (tableSize - 1)) {
+      if (slots[s].key == key) {
+        return slots[s].station;
+      }
+    }
+    return -1;
+  }
+
+private:
+  static uint32_t slotFor(uint32_t key) {
+    return (key * 2654435761u) & (tableSize - 1);
+  }
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "station_store.h"
+#include "crc32.h"
+
+//===================================================== Station Snapshot ==================================================================//
+// The part of the station store needed to draw the map, saved to flash so a reboot can show the last known
+// categories before WiFi is up. The raw text and wind/temperature fields are left out to keep writes small.
+
+#define SNAPSHOT_MAGIC 0x4D54524Du   // "MTRM"
+#define SNAPSHOT_VERSION 1
+
+template <uint16_t CAPACITY>
+struct StationSnapshot {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+  uint32_t newestObsTime;     // Unix time of the newest observation in the snapshot
+  uint32_t icao[CAPACITY];
+  uint16_t ceiling[CAPACITY];
+  uint8_t visibility[CAPACITY];
+  uint8_t category[CAPACITY];
+  uint32_t crc;               // Over everything above
+
+  uint32_t computeCrc() const {
+    return crc32(this, offsetof(StationSnapshot, crc));
+  }
+
+  // Take the stations that have an observation from a store
+  template <uint16_t STORE_CAPACITY, uint16_t RAW_ARENA_BYTES>
+  void capture(const StationStore<STORE_CAPACITY, RAW_ARENA_BYTES>& store, int stationCount) {
+    memset(this, 0, sizeof(*this));
+    magic = SNAPSHOT_MAGIC;
+    version = SNAPSHOT_VERSION;
+    for (int i = 0; i < stationCount && count < CAPACITY; i++) {
+      if (!store.valid(i)) {
+        continue;
+      }
+      icao[count] = store.icao[i];
+      ceiling[count] = store.ceiling[i];
+      visibility[count] = store.visibility[i];
+      category[count] = store.category[i];
+      if (store.obsTime[i] > newestObsTime) newestObsTime = store.obsTime[i];
+      count++;
+    }
+    crc = computeCrc();
+  }
+
+  bool valid() const {
+    return magic == SNAPSHOT_MAGIC && version == SNAPSHOT_VERSION && count <= CAPACITY && crc == computeCrc();
+  }
+
+  // Whether saving this instead of other would change what a restored map shows
+  bool sameCategories(const StationSnapshot& other) const {
+    if (count != other.count) {
+      return false;
+    }
+    return memcmp(icao, other.icao, count * sizeof(icao[0])) == 0 &&
+           memcmp(category, other.category, count * sizeof(category[0])) == 0;
+  }
+};
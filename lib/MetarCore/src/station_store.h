@@ -0,0 +1,167 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "flight_category.h"
+#include "metar_record.h"
+#include "station_index.h"
+
+//===================================================== Station Store =====================================================================//
+// Latest weather for every station on the map, kept as parallel fixed-size arrays (one entry per station) with
+// values quantized to small integers. Raw METAR text lives in one shared arena. Nothing here allocates, so the
+// LEDs, web UI and logging can all read it without touching JSON or String.
+
+enum StationFlags : uint8_t {
+  STATION_VALID = 1 << 0,   // Has an observation from the latest response
+  STATION_STALE = 1 << 1,   // Restored from the boot snapshot, not confirmed by a fetch yet
+  STATION_THUNDER = 1 << 2  // Latest report has a thunderstorm at or near the station
+};
+
+// Sentinels for fields the observation did not report, VISIBILITY_UNKNOWN and CEILING_NONE are in flight_category.h
+#define WIND_DIR_UNKNOWN 0xFFFF
+#define WIND_SPEED_UNKNOWN 0xFF
+#define TEMPERATURE_UNKNOWN INT8_MIN
+#define ALTIMETER_UNKNOWN 0
+#define RAW_NONE 0xFFFF
+
+// Visibility in quarter statute miles, 10+ is stored as 40
+inline uint8_t quantizeVisibility(float miles) {
+  if (miles < 0) return VISIBILITY_UNKNOWN;
+  float quarters = miles * 4 + 0.5f;
+  return quarters >= 254 ? 254 : (uint8_t)quarters;
+}
+
+inline float visibilityMiles(uint8_t quarters) {
+  return quarters == VISIBILITY_UNKNOWN ? -1.0f : quarters / 4.0f;
+}
+
+// Ceiling in hundreds of feet AGL, the resolution METARs report cloud bases in
+inline uint16_t quantizeCeiling(int feet) {
+  if (feet < 0) return CEILING_NONE;
+  int hundreds = (feet + 50) / 100;
+  return hundreds >= CEILING_NONE ? CEILING_NONE - 1 : (uint16_t)hundreds;
+}
+
+inline int ceilingFeet(uint16_t hundreds) {
+  return hundreds == CEILING_NONE ? -1 : hundreds * 100;
+}
+
+inline int8_t quantizeTemperature(float celsius) {
+  if (celsius <= -128 || celsius > 127) return TEMPERATURE_UNKNOWN;
+  return (int8_t)(celsius < 0 ? celsius - 0.5f : celsius + 0.5f);
+}
+
+// Altimeter in tenths of hPa
+inline uint16_t quantizeAltimeter(float hpa) {
+  if (hpa <= 0 || hpa >= 6553) return ALTIMETER_UNKNOWN;
+  return (uint16_t)(hpa * 10 + 0.5f);
+}
+
+inline uint8_t quantizeWindSpeed(int knots) {
+  if (knots < 0) return WIND_SPEED_UNKNOWN;
+  return knots >= WIND_SPEED_UNKNOWN ? WIND_SPEED_UNKNOWN - 1 : (uint8_t)knots;
+}
+
+// FNV-1a over the raw METAR text
+inline uint32_t rawMetarHash(const char* text) {
+  uint32_t hash = 2166136261u;
+  while (*text) {
+    hash = (hash ^ (uint8_t)*text++) * 16777619u;
+  }
+  return hash;
+}
+
+template <uint16_t CAPACITY, uint16_t RAW_ARENA_BYTES>
+class StationStore {
+public:
+  static constexpr uint16_t capacity = CAPACITY;
+  static constexpr uint16_t rawArenaBytes = RAW_ARENA_BYTES;
+  // Fixed fields per station, not counting its share of the raw arena
+  static constexpr size_t bytesPerStation =
+      sizeof(uint32_t) * 3 + sizeof(uint16_t) * 4 + sizeof(uint8_t) * 5 + sizeof(int8_t);
+
+  uint32_t icao[CAPACITY];         // Packed ICAO code
+  uint32_t obsTime[CAPACITY];      // Unix time of the observation
+  uint32_t rawHash[CAPACITY];      // rawMetarHash() of the raw METAR, to spot unchanged reports
+  uint16_t ceiling[CAPACITY];      // Hundreds of feet AGL, CEILING_NONE when there is no ceiling
+  uint16_t windDir[CAPACITY];      // Degrees, WIND_DIR_UNKNOWN when variable or missing
+  uint16_t altimeter[CAPACITY];    // Tenths of hPa
+  uint16_t rawOffset[CAPACITY];    // Start of the raw METAR in the arena, RAW_NONE if not stored
+  uint8_t category[CAPACITY];      // FlightCategory
+  uint8_t visibility[CAPACITY];    // Quarter statute miles
+  uint8_t windSpeed[CAPACITY];     // Knots
+  uint8_t windGust[CAPACITY];      // Knots, WIND_SPEED_UNKNOWN without gusts
+  uint8_t flags[CAPACITY];         // StationFlags
+  int8_t temperature[CAPACITY];    // Whole degrees Celsius
+
+  void clear() {
+    memset(this, 0, sizeof(*this));
+    memset(rawOffset, 0xFF, sizeof(rawOffset));
+  }
+
+  bool valid(uint16_t station) const {
+    return flags[station] & STATION_VALID;
+  }
+
+  // Raw METAR text, "" if none was stored
+  const char* raw(uint16_t station) const {
+    return rawOffset[station] == RAW_NONE ? "" : rawArena + rawOffset[station];
+  }
+
+  // Store the raw METAR for a station. Returns false and leaves it empty if the arena is full.
+  bool setRaw(uint16_t station, const char* text) {
+    size_t len = strlen(text) + 1;
+    if (rawUsed + len > RAW_ARENA_BYTES) {
+      rawOffset[station] = RAW_NONE;
+      rawDropped++;
+      return false;
+    }
+    memcpy(rawArena + rawUsed, text, len);
+    rawOffset[station] = rawUsed;
+    rawUsed += len;
+    return true;
+  }
+
+  // Quantize an observation into a station. Returns false and leaves the station alone if it is the report
+  // already stored, as most stations send the same one back until their next hourly report. A raw text that does
+  // not fit the arena is dropped and counted in rawDropped, the rest of the observation is still stored.
+  bool update(uint16_t station, const MetarRecord& metar) {
+    uint32_t hash = rawMetarHash(metar.rawOb);
+    if (valid(station) && obsTime[station] == metar.obsTime && rawHash[station] == hash) {
+      return false;
+    }
+    icao[station] = packIcao(metar.icaoId);
+    rawHash[station] = hash;
+    obsTime[station] = metar.obsTime;
+    visibility[station] = quantizeVisibility(metar.visib);
+    ceiling[station] = quantizeCeiling(metar.ceiling);
+    windDir[station] = metar.wdir >= 0 ? metar.wdir : WIND_DIR_UNKNOWN;
+    windSpeed[station] = quantizeWindSpeed(metar.wspd);
+    windGust[station] = quantizeWindSpeed(metar.wgst);
+    temperature[station] = metar.temp != -999 ? quantizeTemperature(metar.temp) : TEMPERATURE_UNKNOWN;
+    altimeter[station] = metar.altim != -999 ? quantizeAltimeter(metar.altim) : ALTIMETER_UNKNOWN;
+    flags[station] = STATION_VALID | (metar.thunderstorm ? STATION_THUNDER : 0);  // Also clears STATION_STALE
+    setRaw(station, metar.rawOb);
+    return true;
+  }
+
+  // Copy another store, compacting its raw text so this arena holds only live METARs
+  void copyFrom(const StationStore& other) {
+    memcpy(this, &other, offsetof(StationStore, rawArena));
+    memset(rawOffset, 0xFF, sizeof(rawOffset));
+    rawUsed = 0;
+    rawDropped = 0;
+    for (uint16_t i = 0; i < CAPACITY; i++) {
+      if (other.rawOffset[i] != RAW_NONE) {
+        setRaw(i, other.raw(i));
+      }
+    }
+  }
+
+  // Kept last and public so the fixed fields above can be copied with a single memcpy
+  char rawArena[RAW_ARENA_BYTES];
+  uint16_t rawUsed;
+  uint16_t rawDropped;   // METARs left out because the arena was full
+};
@@ -0,0 +1,190 @@
+#include "station_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "station_index.h"
+#include "crc32.h"
+
+void StationTable::clear() {
+  memset(strips, 0, sizeof(strips));
+  stripCount = 0;
+  entries.clear();
+  error[0] = '\0';
+}
+
+bool StationTable::fail(const char* message, int line) {
+  if (line > 0) {
+    snprintf(error, sizeof(error), "line %d: %s", line, message);
+  } else {
+    snprintf(error, sizeof(error), "%s", message);
+  }
+  return false;
+}
+
+// Split a CSV line in place, returns the number of fields
+static int splitFields(char* line, char* fields[], int maxFields) {
+  int count = 0;
+  char* p = line;
+  while (count < maxFields) {
+    while (*p == ' ' || *p == '\t') p++;
+    fields[count++] = p;
+    char* comma = strchr(p, ',');
+    char* end = comma ? comma : p + strlen(p);
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+    if (comma == nullptr) {
+      *end = '\0';
+      break;
+    }
+    *end = '\0';
+    p = comma + 1;
+  }
+  return count;
+}
+
+static bool parseNumber(const char* text, long maxValue, long& value) {
+  char* end;
+  value = strtol(text, &end, 10);
+  return *text != '\0' && *end == '\0' && value >= 0 && value <= maxValue;
+}
+
+bool StationTable::parseCsv(const char* text, size_t len) {
+  clear();
+  char line[96];
+  int lineNumber = 0;
+  size_t pos = 0;
+  while (pos < len) {
+    size_t lineLen = 0;
+    while (pos < len && text[pos] != '\n') {
+      if (lineLen + 1 < sizeof(line)) line[lineLen++] = text[pos];
+      pos++;
+    }
+    pos++;
+    lineNumber++;
+    line[lineLen] = '\0';
+    char* hash = strchr(line, '#');
+    if (hash) *hash = '\0';
+
+    char* fields[6];
+    int count = splitFields(line, fields, 6);
+    if (count == 1 && fields[0][0] == '\0') {
+      continue;  // Blank or comment
+    }
+
+    long value;
+    if (strcmp(fields[0], "strip") == 0) {
+      if (count < 4) return fail("strip needs index, pin and LED count", lineNumber);
+      long index, pin, leds;
+      if (!parseNumber(fields[1], MAX_STRIPS - 1, index)) return fail("bad strip index", lineNumber);
+      if (!parseNumber(fields[2], 63, pin)) return fail("bad pin", lineNumber);
+      if (!parseNumber(fields[3], 0xFFFF, leds) || leds == 0) return fail("bad LED count", lineNumber);
+      StripConfig& strip = strips[index];
+      strip = {};
+      strip.pin = pin;
+      strip.count = leds;
+      strip.order = STRIP_DEFAULT;
+      strip.khz400 = STRIP_DEFAULT;
+      for (int i = 4; i < count; i++) {
+        if (strcasecmp(fields[i], "rgb") == 0) strip.order = 0;
+        else if (strcasecmp(fields[i], "grb") == 0) strip.order = 1;
+        else if (strcmp(fields[i], "800") == 0) strip.khz400 = 0;
+        else if (strcmp(fields[i], "400") == 0) strip.khz400 = 1;
+        else return fail("unknown strip option", lineNumber);
+      }
+      if (index + 1 > stripCount) stripCount = index + 1;
+      continue;
+    }
+
+    if (count < 2) return fail("station needs an LED index", lineNumber);
+    StationTableEntry entry = {};
+    if (strcmp(fields[0], "-") != 0) {
+      entry.icao = packIcao(fields[0]);
+      if (entry.icao == 0) return fail("bad ICAO code", lineNumber);
+    }
+    if (!parseNumber(fields[1], 0xFFFF, value)) return fail("bad LED index", lineNumber);
+    entry.led = value;
+    if (count > 2) {
+      if (!parseNumber(fields[2], MAX_STRIPS - 1, value)) return fail("bad strip index", lineNumber);
+      entry.strip = value;
+    }
+    entries.push_back(entry);
+  }
+  return true;
+}
+
+bool StationTable::parseBinary(const uint8_t* data, size_t len) {
+  clear();
+  StationTableHeader header;
+  if (len < sizeof(header) + sizeof(uint32_t)) return fail("too short");
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != STATION_TABLE_MAGIC) return fail("not a station table");
+  if (header.version != STATION_TABLE_VERSION) return fail("unsupported version");
+  if (header.stripCount > MAX_STRIPS) return fail("too many strips");
+  size_t expected = sizeof(header) + header.stripCount * sizeof(StripConfig) +
+                    (size_t)header.entryCount * sizeof(StationTableEntry) + sizeof(uint32_t);
+  if (len != expected) return fail("length does not match header");
+  uint32_t crc;
+  memcpy(&crc, data + len - sizeof(crc), sizeof(crc));
+  if (crc != crc32(data, len - sizeof(crc))) return fail("CRC mismatch");
+
+  const uint8_t* p = data + sizeof(header);
+  stripCount = header.stripCount;
+  memcpy(strips, p, stripCount * sizeof(StripConfig));
+  p += stripCount * sizeof(StripConfig);
+  entries.resize(header.entryCount);
+  memcpy(entries.data(), p, header.entryCount * sizeof(StationTableEntry));
+  return true;
+}
+
+bool StationTable::validate(uint32_t maxLeds, uint32_t maxStations) {
+  if (stripCount == 0) return fail("no strips");
+  uint32_t offset = 0;
+  for (int i = 0; i < stripCount; i++) {
+    if (strips[i].count == 0) return fail("strip without LEDs");
+    strips[i].offset = offset;
+    offset += strips[i].count;
+  }
+  if (offset > maxLeds) return fail("more LEDs than the map supports");
+
+  std::vector<bool> used(offset, false);
+  std::vector<uint32_t> stations;
+  for (const StationTableEntry& entry : entries) {
+    if (entry.strip >= stripCount || entry.led >= strips[entry.strip].count) return fail("LED outside its strip");
+    uint32_t led = strips[entry.strip].offset + entry.led;
+    if (used[led]) return fail("LED listed twice");
+    used[led] = true;
+    // Distinct count only matters against the limit, so a linear check over the few hundred allowed is enough
+    if (entry.icao != 0) {
+      bool seen = false;
+      for (uint32_t key : stations) {
+        if (key == entry.icao) { seen = true; break; }
+      }
+      if (!seen) {
+        if (stations.size() == maxStations) return fail("more stations than the map supports");
+        stations.push_back(entry.icao);
+      }
+    }
+  }
+  return true;
+}
+
+void StationTable::serialize(std::vector<uint8_t>& out) const {
+  StationTableHeader header = {STATION_TABLE_MAGIC, STATION_TABLE_VERSION, stripCount, 0, (uint32_t)entries.size()};
+  out.clear();
+  out.insert(out.end(), (const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+  out.insert(out.end(), (const uint8_t*)strips, (const uint8_t*)strips + stripCount * sizeof(StripConfig));
+  out.insert(out.end(), (const uint8_t*)entries.data(),
+             (const uint8_t*)entries.data() + entries.size() * sizeof(StationTableEntry));
+  uint32_t crc = crc32(out.data(), out.size());
+  out.insert(out.end(), (const uint8_t*)&crc, (const uint8_t*)&crc + sizeof(crc));
+}
+
+uint32_t StationTable::ledCount() const {
+  uint32_t count = 0;
+  for (int i = 0; i < stripCount; i++) {
+    count += strips[i].count;
+  }
+  return count;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+//===================================================== Station Table =====================================================================//
+// Which station each LED shows, loaded at boot instead of compiled in. A table lists up to MAX_STRIPS strips
+// and one entry per lit or reserved LED; LEDs without an entry stay dark, so indexes can be sparse.
+//
+// CSV form, one record per line, '#' starts a comment:
+//   strip,<index>,<pin>,<led count>[,rgb|grb][,800|400]
+//   <ICAO>,<led>[,<strip>]      ICAO "-" reserves a spacer LED, strip defaults to 0
+//
+// Binary form, little endian: StationTableHeader, the StripConfig of each strip, the entries, then the
+// CRC-32 of everything before it. Binary is what gets stored in flash; CSV is converted on upload.
+
+#define MAX_STRIPS 4
+#define STATION_TABLE_MAGIC 0x4C42544Du   // "MTBL"
+#define STATION_TABLE_VERSION 1
+#define STRIP_DEFAULT 0xFF                // Order or speed taken from the led_* settings
+
+struct StripConfig {
+  uint8_t pin;
+  uint8_t order;       // LedColorOrder, or STRIP_DEFAULT
+  uint8_t khz400;      // 0, 1, or STRIP_DEFAULT
+  uint8_t reserved;
+  uint16_t count;
+  uint16_t offset;     // First LED of this strip in the map's LED numbering, filled in on load
+};
+
+struct StationTableEntry {
+  uint32_t icao;       // packIcao() code, 0 for a spacer
+  uint8_t strip;
+  uint8_t reserved;
+  uint16_t led;        // Index on its strip
+};
+
+struct StationTableHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t stripCount;
+  uint8_t reserved;
+  uint32_t entryCount;
+};
+
+class StationTable {
+public:
+  StripConfig strips[MAX_STRIPS] = {};
+  uint8_t stripCount = 0;
+  std::vector<StationTableEntry> entries;
+  char error[64] = "";
+
+  void clear();
+
+  // Parse a complete upload. Both return false with error set when the input is malformed.
+  bool parseCsv(const char* text, size_t len);
+  bool parseBinary(const uint8_t* data, size_t len);
+
+  // Check the table fits the map's limits, also fills in the strip offsets
+  bool validate(uint32_t maxLeds, uint32_t maxStations);
+
+  void serialize(std::vector<uint8_t>& out) const;
+
+  // LEDs over all strips
+  uint32_t ledCount() const;
+
+private:
+  bool fail(const char* message, int line = 0);
+};
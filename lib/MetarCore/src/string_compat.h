@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+//===================================================== String Compat =====================================================================//
+// strlcpy() is in the ESP32 toolchain's newlib, musl, the BSDs and glibc from 2.38, but not in older glibc, so
+// MetarCore brings its own there for the native build. It is only defined where the C library lacks one.
+
+#if !defined(ARDUINO) && defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+inline size_t strlcpy(char* dest, const char* src, size_t size) {
+  size_t len = strlen(src);
+  if (size > 0) {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dest, src, n);
+    dest[n] = '\0';
+  }
+  return len;
+}
+#endif
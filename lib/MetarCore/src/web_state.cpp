@@ -0,0 +1,41 @@
+#include "web_state.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "station_index.h"
+
+size_t fillStateChunk(StateCursor& cursor, StatePieceWriter writePiece, uint8_t* buffer, size_t maxLen) {
+  char piece[STATE_ENTRY_SIZE];
+  size_t written = 0;
+  while (!cursor.done) {
+    StateCursor saved = cursor;
+    size_t len = writePiece(cursor, piece, sizeof(piece));
+    if (written + len > maxLen) {
+      cursor = saved;  // Did not fit, send it in the next chunk
+      break;
+    }
+    memcpy(buffer + written, piece, len);
+    written += len;
+  }
+  return written;
+}
+
+size_t writeStateJson(const WebState& state, StateCursor& cursor, char* buf, size_t size) {
+  if (cursor.done) {
+    return 0;
+  }
+  if (cursor.next < 0) {
+    cursor.next = 0;
+    return snprintf(buf, size, "{\"brightness\":%d,\"startTime\":%d,\"endTime\":%d,\"stations\":[",
+                    state.brightness, state.startTime, state.endTime);
+  }
+  if (cursor.next >= state.stationCount) {
+    cursor.done = true;
+    return snprintf(buf, size, "]}");
+  }
+  int i = cursor.next++;
+  char icao[5];
+  unpackIcao(state.stationIcao[i], icao);
+  return snprintf(buf, size, "%s{\"icao\":\"%s\",\"cat\":\"%s\"}", i > 0 ? "," : "", icao, state.category(i));
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+//===================================================== Web State =========================================================================//
+// Chunked web responses written one small piece at a time from a fixed buffer, so their cost does not depend on
+// how many stations are on the map. The page itself is static and gzipped in flash, the live values it shows come
+// from /api/state.
+
+#define STATE_ENTRY_SIZE 64      // Longest piece is the /api/state header, 59 bytes with its terminator
+
+// Progress through one chunked response
+struct StateCursor {
+  int next;      // Next station or LED to write, -1 before the header
+  bool done;
+};
+
+// Writes the next piece at the cursor into buf. Returns its length, 0 once everything has been written.
+typedef size_t (*StatePieceWriter)(StateCursor& cursor, char* buf, size_t size);
+
+// Fill one chunk of at most maxLen bytes with as many whole pieces as fit. Returns the bytes written, 0 when done.
+size_t fillStateChunk(StateCursor& cursor, StatePieceWriter writePiece, uint8_t* buffer, size_t maxLen);
+
+// What /api/state reports
+struct WebState {
+  int brightness;
+  int startTime;
+  int endTime;
+  int stationCount;
+  const uint32_t* stationIcao;          // Packed ICAO code of each station
+  const char* (*category)(int station); // Flight category name, "" while there is no report
+};
+
+// Next piece of the /api/state JSON for state
+size_t writeStateJson(const WebState& state, StateCursor& cursor, char* buf, size_t size);
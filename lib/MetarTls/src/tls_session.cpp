@@ -0,0 +1,187 @@
+#include "tls_session.h"
+
+#include <string.h>
+
+// The handshake state became private in mbedTLS 3
+#if MBEDTLS_VERSION_MAJOR >= 3
+#define TLS_HANDSHAKE_STATE(ssl) ((ssl).MBEDTLS_PRIVATE(state))
+#else
+#define TLS_HANDSHAKE_STATE(ssl) ((ssl).state)
+#endif
+
+TlsSession::TlsSession(uint32_t (*clockMs)(), uint32_t timeoutMs) : clockMs_(clockMs), timeoutMs_(timeoutMs) {
+  mbedtls_ssl_init(&ssl_);
+  mbedtls_ssl_config_init(&conf_);
+  mbedtls_ssl_session_init(&session_);
+  mbedtls_x509_crt_init(&ca_);
+  mbedtls_entropy_init(&entropy_);
+  mbedtls_ctr_drbg_init(&drbg_);
+}
+
+TlsSession::~TlsSession() {
+  mbedtls_ssl_free(&ssl_);
+  mbedtls_ssl_config_free(&conf_);
+  mbedtls_ssl_session_free(&session_);
+  mbedtls_x509_crt_free(&ca_);
+  mbedtls_ctr_drbg_free(&drbg_);
+  mbedtls_entropy_free(&entropy_);
+}
+
+bool TlsSession::begin(const char* caPem) {
+  if (ready_) {
+    return true;
+  }
+  if (caPem != nullptr) {
+    // The PEM parser wants the terminator counted in the length. Of a bundle, certificates it cannot read are
+    // skipped as long as one of them is read.
+    int ret = mbedtls_x509_crt_parse(&ca_, (const unsigned char*)caPem, strlen(caPem) + 1);
+    if (ret < 0 || ca_.version == 0) {
+      mbedtls_x509_crt_free(&ca_);
+      mbedtls_x509_crt_init(&ca_);
+      lastError = ret < 0 ? ret : MBEDTLS_ERR_X509_INVALID_FORMAT;
+      return false;
+    }
+  }
+  static const char personalization[] = "metar-tls";
+  int ret = mbedtls_ctr_drbg_seed(&drbg_, mbedtls_entropy_func, &entropy_, (const unsigned char*)personalization,
+                                  sizeof(personalization) - 1);
+  if (ret == 0) {
+    ret = mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+  }
+  if (ret != 0) {
+    lastError = ret;
+    return false;
+  }
+  mbedtls_ssl_conf_rng(&conf_, mbedtls_ctr_drbg_random, &drbg_);
+  if (caPem != nullptr) {
+    mbedtls_ssl_conf_ca_chain(&conf_, &ca_, nullptr);
+    mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_REQUIRED);
+  } else {
+    mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_NONE);
+  }
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  mbedtls_ssl_conf_session_tickets(&conf_, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+  ret = mbedtls_ssl_setup(&ssl_, &conf_);
+  if (ret != 0) {
+    lastError = ret;
+    return false;
+  }
+  ready_ = true;
+  verified_ = caPem != nullptr;
+  return true;
+}
+
+int TlsSession::connect(const char* host, void* io, TlsSendFn send, TlsRecvFn recv) {
+  if (!ready_) {
+    return lastError = MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+  }
+  open_ = false;
+  resumed_ = false;
+  int ret = mbedtls_ssl_session_reset(&ssl_);
+  if (ret == 0) {
+    ret = mbedtls_ssl_set_hostname(&ssl_, host);
+  }
+  if (ret != 0) {
+    return lastError = ret;
+  }
+  mbedtls_ssl_set_bio(&ssl_, io, send, recv, nullptr);
+  bool offered = hasSession_ && mbedtls_ssl_set_session(&ssl_, &session_) == 0;
+
+  // A full handshake goes on from the ServerHello to the server's certificate, a resumed one skips straight to
+  // ChangeCipherSpec. Watching for that state tells them apart even when certificates are not verified.
+  bool sawCertificate = false;
+  uint32_t start = clockMs_();
+  while (TLS_HANDSHAKE_STATE(ssl_) != MBEDTLS_SSL_HANDSHAKE_OVER) {
+    ret = mbedtls_ssl_handshake_step(&ssl_);
+    sawCertificate |= TLS_HANDSHAKE_STATE(ssl_) == MBEDTLS_SSL_SERVER_CERTIFICATE;
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+      if (clockMs_() - start >= timeoutMs_) {
+        ret = MBEDTLS_ERR_SSL_TIMEOUT;
+        break;
+      }
+      ret = 0;
+    } else if (ret != 0) {
+      break;
+    }
+  }
+  if (ret != 0) {
+    // A session the server chokes on is not offered again
+    forgetSession();
+    return lastError = ret;
+  }
+
+  handshakes++;
+  resumed_ = offered && !sawCertificate;
+  if (resumed_) {
+    resumptions++;
+  }
+  // Keep this connection's session, with the ticket the server may just have renewed, for the next one
+  mbedtls_ssl_session_free(&session_);
+  mbedtls_ssl_session_init(&session_);
+  hasSession_ = mbedtls_ssl_get_session(&ssl_, &session_) == 0;
+  open_ = true;
+  return 0;
+}
+
+int TlsSession::write(const uint8_t* data, size_t len) {
+  size_t sent = 0;
+  uint32_t start = clockMs_();
+  while (open_ && sent < len) {
+    int ret = mbedtls_ssl_write(&ssl_, data + sent, len - sent);
+    if (ret > 0) {
+      sent += ret;
+    } else if ((ret != MBEDTLS_ERR_SSL_WANT_WRITE && ret != MBEDTLS_ERR_SSL_WANT_READ) ||
+               clockMs_() - start >= timeoutMs_) {
+      open_ = false;
+    }
+  }
+  return open_ ? (int)sent : -1;
+}
+
+int TlsSession::read(uint8_t* data, size_t len) {
+  if (!open_) {
+    return -1;
+  }
+  int ret = mbedtls_ssl_read(&ssl_, data, len);
+  if (ret > 0) {
+    return ret;
+  }
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    return 0;
+  }
+  // 0 is the end of the stream, close_notify or anything else ends the connection too
+  open_ = false;
+  return -1;
+}
+
+size_t TlsSession::available() {
+  if (!open_) {
+    return 0;
+  }
+  size_t waiting = mbedtls_ssl_get_bytes_avail(&ssl_);
+  if (waiting == 0) {
+    // A zero-length read decrypts the next record, if one has arrived, without taking any of it
+    int ret = mbedtls_ssl_read(&ssl_, nullptr, 0);
+    if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      open_ = false;
+      return 0;
+    }
+    waiting = mbedtls_ssl_get_bytes_avail(&ssl_);
+  }
+  return waiting;
+}
+
+void TlsSession::close() {
+  if (open_) {
+    mbedtls_ssl_close_notify(&ssl_);
+    open_ = false;
+  }
+}
+
+void TlsSession::forgetSession() {
+  mbedtls_ssl_session_free(&session_);
+  mbedtls_ssl_session_init(&session_);
+  hasSession_ = false;
+}
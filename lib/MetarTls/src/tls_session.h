@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <mbedtls/version.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/x509_crt.h>
+
+//===================================================== TLS Session =======================================================================//
+// TLS client on mbedTLS that keeps the session of its last connection and offers it on the next handshake. When
+// the server drops a kept-alive connection, the reconnect resumes with an abbreviated handshake, by session ticket
+// or session ID, whichever the server handed out. That skips the certificate chain, its verification and the key
+// exchange, which are most of a handshake's time and heap.
+//
+// The SSL context and its record buffers are set up once in begin() and reused by every connection, so reconnecting
+// does not allocate them again. The transport is a pair of callbacks: a WiFiClient on the map, a socket in the host
+// tests. Callbacks return MBEDTLS_ERR_SSL_WANT_READ while no data is waiting.
+
+typedef int (*TlsSendFn)(void* io, const unsigned char* data, size_t len);
+typedef int (*TlsRecvFn)(void* io, unsigned char* data, size_t len);
+
+class TlsSession {
+public:
+  // clockMs times the handshake and write timeouts
+  TlsSession(uint32_t (*clockMs)(), uint32_t timeoutMs);
+  ~TlsSession();
+
+  // Server certificates are checked against caPem, one or more PEM certificates, or not at all when it is nullptr.
+  // Returns false with lastError set if caPem holds no certificate that parses, or the context cannot be set up.
+  // The session is then left as it was, so begin() can be called again with other roots.
+  bool begin(const char* caPem);
+  bool ready() const { return ready_; }
+  bool verified() const { return verified_; }   // Set up with roots to check the server against
+
+  // Handshake over a transport that is already connected, offering the saved session.
+  // Returns 0, or the mbedTLS error that ended the handshake.
+  int connect(const char* host, void* io, TlsSendFn send, TlsRecvFn recv);
+
+  // Bytes written, or -1 once the connection is gone
+  int write(const uint8_t* data, size_t len);
+  // Bytes read, 0 while nothing is waiting, or -1 once the connection is gone
+  int read(uint8_t* data, size_t len);
+  // Decrypted bytes ready to read, reading the next record off the transport if there are none
+  size_t available();
+
+  // Send close_notify. The session stays saved for the next connect().
+  void close();
+  // Make the next connect() a full handshake
+  void forgetSession();
+
+  bool open() const { return open_; }
+  bool hasSession() const { return hasSession_; }
+  bool resumed() const { return resumed_; }   // The last handshake resumed a saved session
+
+  uint32_t handshakes = 0;    // Completed handshakes
+  uint32_t resumptions = 0;   // Of those, the abbreviated ones
+  int lastError = 0;          // mbedTLS error of the last failed begin() or handshake
+
+private:
+  uint32_t (*clockMs_)();
+  uint32_t timeoutMs_;
+  mbedtls_ssl_context ssl_;
+  mbedtls_ssl_config conf_;
+  mbedtls_ssl_session session_;
+  mbedtls_x509_crt ca_;
+  mbedtls_entropy_context entropy_;
+  mbedtls_ctr_drbg_context drbg_;
+  bool ready_ = false;
+  bool verified_ = false;
+  bool open_ = false;
+  bool hasSession_ = false;
+  bool resumed_ = false;
+};
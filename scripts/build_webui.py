@@ -0,0 +1,38 @@
+# Gzips data/index.html into include/webui_index_html.h before every build so the page can be served
+# straight from flash with Content-Encoding: gzip. The header is generated, do not edit or commit it.
+Import("env")
+
+import gzip
+import hashlib
+import os
+
+project_dir = env.subst("$PROJECT_DIR")
+source = os.path.join(project_dir, "data", "index.html")
+target = os.path.join(project_dir, "include", "webui_index_html.h")
+
+with open(source, "rb") as f:
+    html = f.read()
+
+# mtime=0 keeps the output byte-identical between builds of the same page
+compressed = gzip.compress(html, compresslevel=9, mtime=0)
+etag = hashlib.sha1(compressed).hexdigest()[:16]
+
+lines = [
+    "// Generated by scripts/build_webui.py from data/index.html, do not edit",
+    "#pragma once",
+    "#include <pgmspace.h>",
+    "",
+    '#define INDEX_HTML_GZ_ETAG "\\"%s\\""' % etag,
+    "const size_t INDEX_HTML_GZ_LEN = %d;" % len(compressed),
+    "const uint8_t INDEX_HTML_GZ[] PROGMEM = {",
+]
+for i in range(0, len(compressed), 16):
+    lines.append("  " + ", ".join("0x%02x" % b for b in compressed[i:i + 16]) + ",")
+lines.append("};")
+output = "\n".join(lines) + "\n"
+
+# Only touch the header when the page changed so it does not force a rebuild of main.cpp
+if not os.path.exists(target) or open(target).read() != output:
+    with open(target, "w") as f:
+        f.write(output)
+    print("Web UI: %d bytes gzipped to %d" % (len(html), len(compressed)))
@@ -1,8 +1,7 @@
-#include <NTPClient.h>
 #include <ArduinoJson.h>
 #include <WiFiManager.h>
 #include <HTTPClient.h>
-#include <Adafruit_NeoPixel.h>
+#include <WiFiClient.h>
 #include <Preferences.h>
 #include <ESPAsyncWebServer.h>
 #include <AsyncTCP.h>
@@ -11,36 +10,74 @@
 #include <FS.h>
 #include <SPIFFS.h>
 #include <ESPmDNS.h>
-
-
-//Airports List
+#include <AsyncUDP.h>
+#include <esp_heap_caps.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <time.h>
+#include <memory>
+#include "led_output.h"
+#include "station_store.h"
+#include "station_index.h"
+#include "metar_record.h"
+#include "metar_decoder.h"
+#include "metar_stream.h"
+#include "metrics.h"
+#include "log_ring.h"
+#include "station_snapshot.h"
+#include "settings_registry.h"
+#include "station_table.h"
+#include "led_animator.h"
+#include "live_feed.h"
+#include "fetch_scheduler.h"
+#include "lan_sync.h"
+#include "refresh_arena.h"
+#include "station_history.h"
+#include "power_scheduler.h"
+#include "tls_session.h"
+#include "web_state.h"
+#include "webui_index_html.h"
+#include "metar_root_ca.h"
+
+
+//Airports List, in the order the LEDs are wired. Use "" for an LED with no station,
+//and repeat an ICAO code to light more than one LED from the same station.
+//This built-in map drives DATA_PIN until a station table is uploaded to /api/stations
 const char* airports[] = {"KCHD", "KPHX", "KGYR", "KGEU", "KDVT", "KSDL", "KFFZ", "KIWA", "KSRQ", "KSPG", "KPIE", "KTPA", "KBKV", "KZPH", "KLAL"};
 
 //Pin for LEDs
 #define DATA_PIN 25
 
+//Largest map a station table can describe, every per-LED and per-station buffer is sized from these
+#define MAX_LEDS 2048
+#define MAX_STATIONS 256
+
 //DEFINE LED TYPE - WS2812B is default
 //#define WS2811_LED
 
+//LED output - LED_BACKEND_RMT sends frames in the background so WiFi and the web server keep running,
+//LED_BACKEND_NEOPIXEL blocks while the strip updates. Both can be changed at runtime with the led_* settings.
+#define LED_BACKEND LED_BACKEND_RMT
+
 //How many minutes map updates
 #define UPADTE_TIME 15
 
-// Debug mode
+// Debug mode, false only logs warnings and errors. Build with -DLOG_LEVEL=LOG_LEVEL_INFO to compile debug logging out.
 bool debug = true;
 
 //Get Time
-WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, "pool.ntp.org", -25200, 60000); //set for MST -7 
-//Use Chart Below to Set your Correct TimeZone
-// Time Zone	Offset (Hours)	Offset (Seconds)
-// UTC	0	0
-// Eastern (EST)	-5	-18000
-// Central (CST)	-6	-21600
-// Mountain (MST)	-7	-25200
-// Pacific (PST)	-8	-28800
-// UTC+1	+1	3600
-// UTC+2	+2	7200
-// UTC+3	+3	10800
+#define NTP_SERVER "pool.ntp.org"
+#define TIME_VALID_AFTER 1700000000UL   // Anything earlier means SNTP has not set the clock yet
+//Time zone is the tz setting, a POSIX TZ string so DST is handled. Some common ones:
+// Time Zone	TZ
+// UTC	UTC0
+// Eastern	EST5EDT,M3.2.0,M11.1.0
+// Central	CST6CDT,M3.2.0,M11.1.0
+// Mountain	MST7MDT,M3.2.0,M11.1.0
+// Arizona	MST7
+// Pacific	PST8PDT,M3.2.0,M11.1.0
+// Central Europe	CET-1CEST,M3.5.0,M10.5.0/3
+// UK	GMT0BST,M3.5.0/1,M10.5.0
 
 
 // Struct to hold RGB values DO NOT EDIT
@@ -49,7 +86,7 @@ struct RGBColor {
   uint8_t g;
   uint8_t b;
 };
-//CHANGE THESE RGB VALUES TO CHANGE CONDITION COLORS
+//CHANGE THESE RGB VALUES TO CHANGE THE DEFAULT CONDITION COLORS, the web UI can change them later
 const RGBColor VFR = {0,255,0};
 const RGBColor MVFR = {0,0,255};
 const RGBColor IFR = {255,0,0};
@@ -61,395 +98,2351 @@ const RGBColor BLACK = {0,0,0};
 int ledBrightness = 75; 
 // Timing interval (15 minutes)
 constexpr unsigned long INTERVAL = UPADTE_TIME * 60 * 1000; // Milliseconds
+// Refreshes line up on this many seconds past the hour, just after the hourly METARs go out around :55
+#define FETCH_ALIGN_SECONDS (56 * 60)
+// No two fetches start closer than this, however they were triggered
+#define FETCH_MIN_INTERVAL_MS (60 * 1000UL)
+// Wait after a failed fetch, doubled for each failure after it up to INTERVAL
+#define FETCH_BACKOFF_BASE_MS (30 * 1000UL)
     
-struct Preference {
-  const char* name;
-  int value;
+//WS2812B
+#ifndef WS2811_LED
+#define DEFAULT_LED_ORDER LED_ORDER_RGB
+#define DEFAULT_LED_KHZ400 0
+#else
+#define DEFAULT_LED_ORDER LED_ORDER_GRB
+#define DEFAULT_LED_KHZ400 1
+#endif
+
+// Default colors as stored in the color_* settings
+constexpr int32_t colorSetting(RGBColor color) {
+  return ((int32_t)color.r << 16) | ((int32_t)color.g << 8) | color.b;
+}
+
+// Order must match settings[] below
+enum SettingId {
+  SET_LED_BRIGHTNESS,
+  SET_START_TIME,
+  SET_END_TIME,
+  SET_LED_BACKEND,
+  SET_LED_ORDER,
+  SET_LED_KHZ400,
+  SET_VIS_MVFR,
+  SET_VIS_IFR,
+  SET_VIS_LIFR,
+  SET_CEIL_MVFR,
+  SET_CEIL_IFR,
+  SET_CEIL_LIFR,
+  SET_COLOR_VFR,
+  SET_COLOR_MVFR,
+  SET_COLOR_IFR,
+  SET_COLOR_LIFR,
+  SET_HOSTNAME,
+  SET_WIND_BLINK,
+  SET_METAR_FORMAT,
+  SET_LAN_ROLE,
+  SET_TREND_HOURS,
+  SET_START_MINUTE,
+  SET_END_MINUTE,
+  SET_DAYS,
+  SET_TZ,
+  SET_POWER_SAVE,
+  SET_TLS_VERIFY,
+  SETTING_COUNT
+};
+
+Setting settings[] = {
+{"led_brightness", SETTING_INT, 75, 0, 255},
+{"start_time", SETTING_INT, 7, 0, 24},
+{"end_time", SETTING_INT, 20, 0, 24},
+{"led_backend", SETTING_INT, LED_BACKEND, LED_BACKEND_NEOPIXEL, LED_BACKEND_RMT},
+{"led_order", SETTING_INT, DEFAULT_LED_ORDER, LED_ORDER_RGB, LED_ORDER_GRB},
+{"led_khz400", SETTING_INT, DEFAULT_LED_KHZ400, 0, 1},
+// Category minima, a visibility below vis_* quarter miles or a ceiling below ceil_* hundreds of feet
+// is at least that category. Defaults are the FAA definitions.
+{"vis_mvfr", SETTING_INT, 21, 0, 254},
+{"vis_ifr", SETTING_INT, 12, 0, 254},
+{"vis_lifr", SETTING_INT, 4, 0, 254},
+{"ceil_mvfr", SETTING_INT, 31, 0, 0xFFFE},
+{"ceil_ifr", SETTING_INT, 10, 0, 0xFFFE},
+{"ceil_lifr", SETTING_INT, 5, 0, 0xFFFE},
+{"color_vfr", SETTING_COLOR, colorSetting(VFR)},
+{"color_mvfr", SETTING_COLOR, colorSetting(MVFR)},
+{"color_ifr", SETTING_COLOR, colorSetting(IFR)},
+{"color_lifr", SETTING_COLOR, colorSetting(LIFR)},
+{"hostname", SETTING_STRING, 0, 0, 0, "esp_metar_map"},
+{"wind_blink", SETTING_INT, 25, 0, 99},  // Knots of wind or gust that make a station blink, 0 turns it off
+{"metar_format", SETTING_INT, METAR_FORMAT_JSON, METAR_FORMAT_JSON, METAR_FORMAT_RAW},  // 1 fetches plain text reports
+{"lan_role", SETTING_INT, 0, 0, 2},  // 1 shares fetched weather on the LAN, 2 takes it from a map that does. Read at boot.
+{"trend_hours", SETTING_INT, 3, 0, 12},  // Stations worse than this many hours ago dip in brightness, 0 turns it off
+// The display window runs from start_time:start_minute to end_time:end_minute local time, past midnight if the end
+// is earlier, on the days set in days (bit 0 Sunday to bit 6 Saturday)
+{"start_minute", SETTING_INT, 0, 0, 59},
+{"end_minute", SETTING_INT, 0, 0, 59},
+{"days", SETTING_INT, 0x7F, 0, 0x7F},
+{"tz", SETTING_STRING, 0, 0, 0, "MST7"},  // POSIX TZ, see the table at the top
+{"power_save", SETTING_INT, POWER_LEVEL_IDLE, POWER_LEVEL_OFF, POWER_LEVEL_SLEEP},  // 1 idles between events, 2 also light sleeps outside the display window
+{"tls_verify", SETTING_INT, 1, 0, 1}  // 0 fetches without checking the server's certificate. Read at boot.
+};
+static_assert(sizeof(settings) / sizeof(settings[0]) == SETTING_COUNT, "settings[] and SettingId are out of step");
+
+
+const int NUM_AIRPORTS = sizeof(airports) / sizeof(airports[0]);
+
+LedOutput* ledOutputs[MAX_STRIPS] = {};  // One per strip of the station table
+
+
+// Web server setup
+AsyncWebServer server(80);
+//map 1
+//String airports[] = {"KDUG", "KOLS", "KTUS", "KPHX", "KNYL", "KGXF", "KPAN", "KSOW", "KDVT", "KINW", "KPGA", "KFLG", "KIGM", "KGCN", "KPRC", "KCMR", "KSEZ"};
+
+// MAP 2
+//String airports[] = {"KDUG", "KOLS", "KSOW", "KDVT", "KTUS", "KGXF", "KNYL", "KA39", "KSEZ", "KPHX", "KINW", "KFLG", "KGCN", "KPGA"};
+
+//===================================================== Helper Functions ===================================================================//
+// Debug print helper, queued for logTask instead of written to the UART by the caller
+#define debugPrint(...) LOG_DEBUG(__VA_ARGS__)
+
+// Recent formatted log text for /logs, oldest bytes are overwritten
+#define LOG_TEXT_BYTES 4096
+#define LOG_TASK_CORE 0
+
+char logText[LOG_TEXT_BYTES];
+size_t logTextHead = 0;
+bool logTextWrapped = false;
+SemaphoreHandle_t logTextMutex;
+
+void appendLogText(const char* text, size_t len) {
+  xSemaphoreTake(logTextMutex, portMAX_DELAY);
+  for (size_t i = 0; i < len; i++) {
+    logText[logTextHead++] = text[i];
+    if (logTextHead == LOG_TEXT_BYTES) {
+      logTextHead = 0;
+      logTextWrapped = true;
+    }
+  }
+  xSemaphoreGive(logTextMutex);
+}
+
+// Formats queued log records and writes them out, at the lowest priority so logging never delays the pipeline
+void logTask(void* param) {
+  LogRecord record;
+  char line[320];
+  char prefix[24];
+  for (;;) {
+    if (!logRing.pop(record)) {
+      vTaskDelay(pdMS_TO_TICKS(20));
+      continue;
+    }
+    size_t len = LogRing::format(record, line, sizeof(line));
+    Serial.write((const uint8_t*)line, len);
+    int prefixLen = snprintf(prefix, sizeof(prefix), "[%u] %s ", record.timestampMs, logLevelName(record.level));
+    appendLogText(prefix, prefixLen);
+    appendLogText(line, len);
+  }
+}
+
+void startLogger() {
+  logRing.begin([]() -> uint32_t { return millis(); });
+  logRing.level = debug ? LOG_LEVEL_DEBUG : LOG_LEVEL_WARN;
+  logTextMutex = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(logTask, "log", 3072, nullptr, tskIDLE_PRIORITY, nullptr, LOG_TASK_CORE);
+}
+
+// Unix time from SNTP, 0 until the clock has been set
+uint32_t unixNow() {
+  time_t now = time(nullptr);
+  return now > (time_t)TIME_VALID_AFTER ? now : 0;
+}
+
+//===================================================== Get/Set Preferences ================================================================//
+
+// Settings are read from NVS once at boot and served from RAM. Changes are written in one batch once they
+// have settled for SETTINGS_DEBOUNCE_MS, so a dragged slider costs one flash write.
+#define SETTINGS_NAMESPACE "settings"
+#define SETTINGS_DEBOUNCE_MS 2000
+
+PreferencesSettingsStorage settingsStorage(SETTINGS_NAMESPACE);
+SettingsRegistry settingsRegistry(settings, SETTING_COUNT, settingsStorage, SETTINGS_DEBOUNCE_MS);
+
+// Changes waiting to be pushed to each browser on /ws, see the Live Feed section
+#define LIVE_FEED_CLIENTS 4
+LiveFeed<MAX_STATIONS, LIVE_FEED_CLIENTS> liveFeed;
+
+void setSettingValue(SettingId id, int newValue) {
+  settingsRegistry.setInt(id, newValue, millis());
+  liveFeed.markTopic(FEED_SETTINGS);
+  debugPrint("setSettingValue: '%s' set to %d\n", settings[id].key, settingsRegistry.getInt(id));
+}
+
+int getSettingValue(SettingId id) {
+  return settingsRegistry.getInt(id);
+}
+
+// Write settings that have settled, called from loop()
+void flushSettings() {
+  size_t written = settingsRegistry.flush(millis());
+  if (written > 0) {
+    debugPrint("Settings: %u written, %u flash writes avoided so far\n", written, settingsRegistry.writesAvoided());
+  }
+}
+
+//===================================================== Station Index =====================================================================//
+
+// Filled once at boot from the station table in SPIFFS, or the built-in airports[] without one, and read-only after
+StationIndex<MAX_LEDS, MAX_STATIONS> stationMap;
+StationTable stationTable;          // Strips of the loaded table; its entries are dropped once they are in stationMap
+bool stationTableFromFlash = false;
+
+#define STATION_TABLE_FILE "/stations.bin"
+#define STATION_TABLE_MAX_UPLOAD 49152   // Enough for a CSV of MAX_LEDS lines
+
+// Build the map from the station table in SPIFFS. Falls back to airports[] on DATA_PIN if there is none or it is
+// invalid, so a bad upload can never leave the map without LEDs.
+void loadStationTable() {
+  File file = SPIFFS.open(STATION_TABLE_FILE, "r");
+  if (file) {
+    std::vector<uint8_t> data(file.size());
+    size_t len = file.read(data.data(), data.size());
+    file.close();
+    if (len == data.size() && stationTable.parseBinary(data.data(), len) &&
+        stationTable.validate(MAX_LEDS, MAX_STATIONS)) {
+      stationMap.clear(stationTable.ledCount());
+      for (const StationTableEntry& entry : stationTable.entries) {
+        stationMap.add(entry.icao, stationTable.strips[entry.strip].offset + entry.led);
+      }
+      LOG_INFO("Station table: %d strips, %d LEDs, %d stations\n",
+               stationTable.stripCount, stationMap.ledCount, stationMap.stationCount);
+      stationTable.entries.clear();
+      stationTable.entries.shrink_to_fit();
+      stationTableFromFlash = true;
+      return;
+    }
+    LOG_ERROR("Station table is invalid (%s), using the built-in airports\n", stationTable.error);
+  }
+  stationTable.clear();
+  stationTable.strips[0] = {DATA_PIN, STRIP_DEFAULT, STRIP_DEFAULT, 0, (uint16_t)NUM_AIRPORTS, 0};
+  stationTable.stripCount = 1;
+  stationMap.build(airports, NUM_AIRPORTS);
+}
+
+//===================================================== LED Frame Buffer ==================================================================//
+// The animator draws each frame here and it is handed to the LED outputs once per tick. A blocking show() runs
+// with interrupts off for ~30us per LED, so a tick that changed no pixel skips the push entirely.
+uint32_t frame[MAX_LEDS];
+bool frameDirty = false;
+
+// Frame statistics
+unsigned long frameShowCount = 0;
+unsigned long frameSkipCount = 0;
+unsigned long frameShowMicros = 0;      // Total time the CPU spent handing frames to the LED output
+unsigned long frameLastShowMicros = 0;
+
+// Force the next commitFrame() to push even if no pixel changed, e.g. after a brightness change
+void invalidateFrame() {
+  frameDirty = true;
+}
+
+// Push the staged frame with a single show() per strip, skipped when nothing changed
+void commitFrame() {
+  if (!frameDirty) {
+    frameSkipCount++;
+    return;
+  }
+  unsigned long start = micros();
+  for (int s = 0; s < stationTable.stripCount; s++) {
+    const StripConfig& strip = stationTable.strips[s];
+    ledOutputs[s]->show(frame + strip.offset, strip.count, ledBrightness);
+  }
+  frameLastShowMicros = micros() - start;
+  frameShowMicros += frameLastShowMicros;
+  frameShowCount++;
+  frameDirty = false;
+}
+
+void printFrameStats() {
+  debugPrint("LED frames (%s): %lu shown, %lu skipped, last show %lu us, total %lu us\n",
+             ledOutputs[0]->name(), frameShowCount, frameSkipCount, frameLastShowMicros, frameShowMicros);
+}
+
+//===================================================== LED Animation =====================================================================//
+// Transitions, blinking and flashing are drawn by the animator at ANIMATION_HZ, the station data only sets
+// what each LED should be showing
+#define FADE_MS 1000
+#define INTRO_TICKS (3 * ANIMATION_HZ)
+#define RENDER_PARK_TICKS 2   // Settled ticks before the renderer stops ticking
+
+LedAnimator<MAX_LEDS> animator;
+
+// Frame timing of the renderer, only written by its task
+struct AnimationStats {
+  uint32_t frames;
+  uint32_t dropped;          // Ticks missed because a frame ran past its slot
+  uint32_t lastFrameMicros;
+  uint32_t maxFrameMicros;
+  uint32_t parks;            // Times the renderer stopped ticking because nothing was moving
+};
+AnimationStats animationStats = {};
+
+// Palette entries are the FlightCategory values, CATEGORY_UNKNOWN stays off
+void updatePalette() {
+  animator.setPalette(CATEGORY_VFR, getSettingValue(SET_COLOR_VFR));
+  animator.setPalette(CATEGORY_MVFR, getSettingValue(SET_COLOR_MVFR));
+  animator.setPalette(CATEGORY_IFR, getSettingValue(SET_COLOR_IFR));
+  animator.setPalette(CATEGORY_LIFR, getSettingValue(SET_COLOR_LIFR));
+}
+
+//======================================================METAR Processing /API Functions ====================================================//
+// Raw METAR text shared by all stations. At ~110 bytes a report the first 80 or so stations keep theirs,
+// stations past that are still drawn but log and serve no raw text.
+#define RAW_ARENA_BYTES 9216
+// Upper bound for one station buffer; the map keeps two of them
+#define STATION_STORE_BUDGET 16384
+
+typedef StationStore<MAX_STATIONS, RAW_ARENA_BYTES> MapStationStore;
+static_assert(sizeof(MapStationStore) <= STATION_STORE_BUDGET, "Station store is over budget, lower RAW_ARENA_BYTES or MAX_STATIONS");
+
+// Latest observation for each station. The parser fills the back store while the renderer draws the front one,
+// so the map never shows a half-applied update.
+MapStationStore stationStores[2];
+volatile uint8_t frontStore = 0;       // Only the parser task changes this, while holding stateMutex
+bool stationUpdated[MAX_STATIONS];     // Stations the payload being parsed reported, changed or not
+bool stationChanged[MAX_STATIONS];     // Stations whose observation differs from the one already shown
+bool stationDirty[MAX_STATIONS];       // Published changes the renderer has not drawn yet, guarded by stateMutex
+SemaphoreHandle_t stateMutex;
+SemaphoreHandle_t updateMutex;         // Held while the back store is filled, by the parser or the LAN follower
+
+// LAN fan-out role and the leader's change versions, kept in step with every published update
+#define LAN_ROLE_OFF 0
+#define LAN_ROLE_LEADER 1
+#define LAN_ROLE_FOLLOWER 2
+#define LAN_LEADER_TIMEOUT_MS (60 * 1000UL)   // Silence after which a follower fetches on its own
+uint8_t lanRole = LAN_ROLE_OFF;
+LanLeader<MAX_STATIONS> lanLeader;     // Guarded by stateMutex
+volatile uint32_t lanLastFrameMs = 0;  // When the follower last heard its leader, 0 while it has none
+
+// Whether this follower has a leader to take its stations from instead of fetching
+bool lanLeaderAlive() {
+  return lanRole == LAN_ROLE_FOLLOWER && lanLastFrameMs != 0 && millis() - lanLastFrameMs < LAN_LEADER_TIMEOUT_MS;
+}
+
+// Last day or two of observations per station, for /api/history and the deteriorating dip. The rings go in
+// PSRAM when the board has it and are smaller in internal RAM otherwise. Guarded by stateMutex.
+#define HISTORY_RETENTION_HOURS 48
+#define HISTORY_RING_BYTES_PSRAM 320   // ~125 bytes per station-day at 30 reports a day, so the full 48 hours
+#define HISTORY_RING_BYTES 160         // About 30 hours
+StationHistory stationHistory;
+bool historyInPsram = false;
+
+void startHistory() {
+  uint16_t ringBytes = HISTORY_RING_BYTES_PSRAM;
+  void* memory = heap_caps_malloc(StationHistory::bytesFor(stationMap.stationCount, ringBytes), MALLOC_CAP_SPIRAM);
+  historyInPsram = memory != nullptr;
+  if (memory == nullptr) {
+    ringBytes = HISTORY_RING_BYTES;
+    memory = heap_caps_malloc(StationHistory::bytesFor(stationMap.stationCount, ringBytes), MALLOC_CAP_8BIT);
+  }
+  if (memory == nullptr) {
+    LOG_WARN("No memory for the observation history, it stays off\n");
+    return;
+  }
+  stationHistory.begin(memory, stationMap.stationCount, ringBytes, HISTORY_RETENTION_HOURS * 3600UL);
+  debugPrint("Observation history: %u bytes in %s\n", (unsigned)StationHistory::bytesFor(stationMap.stationCount, ringBytes),
+             historyInPsram ? "PSRAM" : "internal RAM");
+}
+
+// Add a station's observation to its history, under stateMutex
+void recordHistory(const MapStationStore& store, int station) {
+  if (!store.valid(station) || (store.flags[station] & STATION_STALE) || store.obsTime[station] == 0) {
+    return;
+  }
+  HistorySample sample = {store.obsTime[station], store.ceiling[station], store.windDir[station],
+                          store.altimeter[station], store.category[station], store.visibility[station],
+                          store.windSpeed[station], store.windGust[station]};
+  stationHistory.append(station, sample);
+}
+
+// Render request bits, merged until the renderer picks them up
+#define RENDER_CHANGED 0x1  // Redraw the LEDs of stations marked dirty
+#define RENDER_FULL 0x2     // Redraw every LED, e.g. when the schedule turns the map on or off
+#define RENDER_FORCE 0x4    // Push the frame even if no pixel changed, e.g. after a brightness change
+
+void requestRender(uint32_t bits);
+
+// Stations per request. Large maps are split into several requests so no URL or response gets too big.
+#define METAR_BATCH_SIZE 40
+constexpr int MAX_METAR_BATCHES = (MAX_STATIONS + METAR_BATCH_SIZE - 1) / METAR_BATCH_SIZE;
+
+// Data moved by the fetch path, for the current cycle and since boot
+struct FetchStats {
+  uint32_t cycles;
+  uint32_t notModified;        // Batches answered with 304
+  uint32_t bytesDownloaded;    // Payload bytes of the last cycle
+  uint32_t bytesSkipped;       // Payload bytes the 304s of the last cycle saved
+  uint32_t stationsUpdated;    // Stations whose observation changed in the last cycle
+  uint32_t totalBytesDownloaded;
+  uint32_t totalBytesSkipped;
+  uint32_t totalStationsUpdated;
+  uint32_t batches;            // Requests made in the last cycle
+  uint32_t batchesFailed;
+  uint32_t refreshMs;          // First request to last byte of the last cycle
+  uint32_t batchMs[MAX_METAR_BATCHES];  // Request to last byte for each batch of the last cycle
+};
+
+FetchStats fetchStats;
+
+// What each response format has cost since boot
+IngestStats ingestStats[METAR_FORMAT_COUNT];
+volatile bool fetchInProgress = false;
+unsigned long lastFetchMillis = 0;     // When the last refresh finished, 0 before the first
+
+// Filter handed to ArduinoJson so only the fields of a MetarRecord are ever allocated
+JsonDocument metarFilter;
+
+// Scratch memory of a refresh, one arena per task so neither needs a lock. The fetcher builds request URLs in
+// fetchArena and resets it when the cycle ends; the parser keeps each JSON element in parseArena and rewinds it
+// after every element. Nothing short-lived in the fetch path is left to the heap.
+#define FETCH_ARENA_BYTES 512
+#define PARSE_ARENA_BYTES 4096
+
+uint8_t fetchArenaBuffer[FETCH_ARENA_BYTES] __attribute__((aligned(8)));
+uint8_t parseArenaBuffer[PARSE_ARENA_BYTES] __attribute__((aligned(8)));
+RefreshArena fetchArena(fetchArenaBuffer, sizeof(fetchArenaBuffer));
+RefreshArena parseArena(parseArenaBuffer, sizeof(parseArenaBuffer));
+ArenaJsonAllocator parseJsonAllocator(parseArena);
+
+// Heap fragmentation, sampled after every refresh. The largest free block is what a TLS handshake needs,
+// and its minimum over uptime shows whether the heap is breaking up on a board that has run for weeks.
+struct HeapStats {
+  uint32_t lastFree;
+  uint32_t lastLargestBlock;
+  uint32_t minLargestBlock;
+};
+
+HeapStats heapStats;
+
+void sampleHeap() {
+  heapStats.lastFree = ESP.getFreeHeap();
+  heapStats.lastLargestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  if (heapStats.minLargestBlock == 0 || heapStats.lastLargestBlock < heapStats.minLargestBlock) {
+    heapStats.minLargestBlock = heapStats.lastLargestBlock;
+  }
+}
+
+// Print one station from the store
+void logStation(const MapStationStore& store, int station) {
+  char icao[5];
+  unpackIcao(store.icao[station], icao);
+  debugPrint("\nICAO ID: %s\n", icao);
+  debugPrint("  Flight Conditions: %s\n", flightCategoryName((FlightCategory)store.category[station]));
+  if (store.temperature[station] != TEMPERATURE_UNKNOWN) debugPrint("  Temperature: %d°F\n", store.temperature[station] * 9 / 5 + 32);
+  if (store.altimeter[station] != ALTIMETER_UNKNOWN) debugPrint("  Altimeter: %.2f inHg\n", store.altimeter[station] * 0.002952998);
+  if (store.windDir[station] != WIND_DIR_UNKNOWN) debugPrint("  Wind Direction: %u\n", store.windDir[station]);
+  if (store.windSpeed[station] != WIND_SPEED_UNKNOWN) debugPrint("  Wind Speed: %u knots\n", store.windSpeed[station]);
+  if (store.visibility[station] != VISIBILITY_UNKNOWN) debugPrint("  Visibility: %.2f miles\n", visibilityMiles(store.visibility[station]));
+  if (store.ceiling[station] != CEILING_NONE) debugPrint("  Ceiling: %d ft\n", ceilingFeet(store.ceiling[station]));
+  debugPrint("  Metar Report: %s\n", store.raw(station));
+}
+
+// Quantize a single METAR into the back station store
+void processMetar(const MetarRecord& metar) {
+  int station = stationMap.find(metar.icaoId);
+  if (station < 0) {
+    debugPrint("%s is not on this map\n", metar.icaoId);
+    return;
+  }
+  MapStationStore& back = stationStores[frontStore ^ 1];
+  stationUpdated[station] = true;
+  uint16_t rawDropped = back.rawDropped;
+  if (!back.update(station, metar)) {
+    return;  // Most stations only report hourly, so the same observation usually comes back unchanged
+  }
+  stationChanged[station] = true;
+  if (back.rawDropped != rawDropped) {
+    LOG_WARN("Raw METAR arena full, dropping text for %s\n", metar.icaoId);
+  }
+}
+
+// Start filling the back store from the current map so a partial response only replaces what it contains
+void beginStationUpdate() {
+  stationStores[frontStore ^ 1].copyFrom(stationStores[frontStore]);
+  memset(stationUpdated, 0, sizeof(stationUpdated));
+  memset(stationChanged, 0, sizeof(stationChanged));
+}
+
+// Publish the back store if anything changed. After a complete response, stations of its batch
+// (first to first + count) that it did not include go dark.
+void finishStationUpdate(bool complete, int first, int count) {
+  uint8_t back = frontStore ^ 1;
+  int changed = 0;
+  for (int i = 0; i < stationMap.stationCount; i++) {
+    bool inBatch = i >= first && i < first + count;
+    if (!stationUpdated[i] && complete && inBatch && stationStores[back].valid(i)) {
+      // If the airport's ICAO code wasn't found in the METAR response
+      char icao[5];
+      unpackIcao(stationMap.stationIcao[i], icao);
+      LOG_WARN("Missing METAR data for ICAO: %s\n", icao);
+      stationStores[back].flags[i] &= ~STATION_VALID;
+      stationChanged[i] = true;
+    }
+    if (stationChanged[i]) {
+      changed++;
+    }
+  }
+  fetchStats.stationsUpdated += changed;
+  fetchStats.totalStationsUpdated += changed;
+  debugPrint("%d stations changed\n", changed);
+  if (changed == 0) {
+    return;
+  }
+  MapStationStore& store = stationStores[back];
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  // Classified under the lock so a threshold change cannot land halfway through
+  METRIC_TIMER_START(classifyTimer);
+  classifyStations(store.visibility, store.ceiling, store.category, stationMap.stationCount, categoryThresholds);
+  METRIC_TIMER_STOP(classifyTimer, STAGE_CLASSIFY);
+  frontStore = back;
+  for (int i = 0; i < stationMap.stationCount; i++) {
+    stationDirty[i] |= stationChanged[i];
+    if (stationChanged[i]) {
+      recordHistory(store, i);
+    }
+  }
+  if (lanRole == LAN_ROLE_LEADER) {
+    lanLeader.stationsChanged(stationChanged, stationMap.stationCount);
+  }
+  xSemaphoreGive(stateMutex);
+  requestRender(RENDER_CHANGED);
+  for (int i = 0; i < stationMap.stationCount; i++) {
+    if (stationChanged[i]) {
+      liveFeed.markStation(i);
+    }
+  }
+  for (int i = 0; i < stationMap.stationCount; i++) {
+    if (stationChanged[i] && store.valid(i)) {
+      logStation(store, i);
+    }
+  }
+}
+
+// Switch to new category minima and reclassify what the map is showing
+bool applyCategoryThresholds(const CategoryThresholds& thresholds) {
+  if (!validCategoryThresholds(thresholds)) {
+    return false;
+  }
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  categoryThresholds = thresholds;
+  MapStationStore& front = stationStores[frontStore];
+  classifyStations(front.visibility, front.ceiling, front.category, stationMap.stationCount, categoryThresholds);
+  xSemaphoreGive(stateMutex);
+  requestRender(RENDER_FULL);
+  liveFeed.markAllStations();
+  return true;
+}
+
+void printStationStoreSize() {
+  debugPrint("Station store: %d stations, %u bytes each + %u byte raw arena, %u bytes per buffer (budget %u)\n",
+             stationMap.stationCount, (unsigned)MapStationStore::bytesPerStation, (unsigned)MapStationStore::rawArenaBytes,
+             (unsigned)sizeof(MapStationStore), (unsigned)STATION_STORE_BUDGET);
+}
+
+//====================================================== Warm Boot Snapshot ===============================================================//
+// The drawable part of the station store is kept in NVS so a reboot shows the last known categories, dimmed as
+// stale, as soon as the LEDs are up instead of after WiFi, NTP and a full fetch. It is only written when a
+// category or the set of stations changed, and at most once per SNAPSHOT_MIN_INTERVAL to spare the flash.
+
+#define SNAPSHOT_NAMESPACE "snapshot"
+#define SNAPSHOT_KEY "stations"
+#define SNAPSHOT_MIN_INTERVAL (30 * 60 * 1000UL)
+
+typedef StationSnapshot<MAX_STATIONS> MapSnapshot;
+
+MapSnapshot savedSnapshot;          // What flash holds, to tell whether a new one is worth writing
+bool savedSnapshotValid = false;
+unsigned long lastSnapshotWrite = 0;
+uint32_t snapshotWrites = 0;
+uint32_t snapshotWritesSkipped = 0;  // Changed snapshots held back by the minimum interval
+
+// Boot timing, milliseconds since power-on
+uint32_t bootFirstFrameMs = 0;       // First frame showing any weather, stale or not
+uint32_t bootFreshFrameMs = 0;       // First frame showing fetched weather
+
+// Load the snapshot into the front store. Must run before the pipeline starts.
+int restoreSnapshot() {
+  Preferences store;
+  store.begin(SNAPSHOT_NAMESPACE, true);
+  size_t len = store.getBytes(SNAPSHOT_KEY, &savedSnapshot, sizeof(savedSnapshot));
+  store.end();
+  if (len != sizeof(savedSnapshot) || !savedSnapshot.valid()) {
+    LOG_INFO("No usable station snapshot, starting cold\n");
+    return 0;
+  }
+  savedSnapshotValid = true;
+
+  MapStationStore& front = stationStores[frontStore];
+  int restored = 0;
+  for (int i = 0; i < savedSnapshot.count; i++) {
+    int station = stationMap.findKey(savedSnapshot.icao[i]);
+    if (station < 0) {
+      continue;  // No longer on the map
+    }
+    front.icao[station] = savedSnapshot.icao[i];
+    front.ceiling[station] = savedSnapshot.ceiling[i];
+    front.visibility[station] = savedSnapshot.visibility[i];
+    front.flags[station] = STATION_VALID | STATION_STALE;
+    restored++;
+  }
+  // Reclassified in case the minima changed since the snapshot was taken
+  classifyStations(front.visibility, front.ceiling, front.category, stationMap.stationCount, categoryThresholds);
+  LOG_INFO("Restored %d stations from the snapshot, newest observation %u\n", restored, savedSnapshot.newestObsTime);
+  return restored;
+}
+
+// Write the front store to flash if what it shows changed since the last snapshot
+void saveSnapshotIfChanged() {
+  static MapSnapshot snapshot;  // Only the fetcher task calls this, kept off its stack
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  snapshot.capture(stationStores[frontStore], stationMap.stationCount);
+  xSemaphoreGive(stateMutex);
+  if (snapshot.count == 0 || (savedSnapshotValid && snapshot.sameCategories(savedSnapshot))) {
+    return;
+  }
+  if (lastSnapshotWrite != 0 && millis() - lastSnapshotWrite < SNAPSHOT_MIN_INTERVAL) {
+    snapshotWritesSkipped++;
+    return;
+  }
+  Preferences store;
+  store.begin(SNAPSHOT_NAMESPACE, false);
+  bool ok = store.putBytes(SNAPSHOT_KEY, &snapshot, sizeof(snapshot)) == sizeof(snapshot);
+  store.end();
+  if (!ok) {
+    LOG_WARN("Could not write the station snapshot\n");
+    return;
+  }
+  savedSnapshot = snapshot;
+  savedSnapshotValid = true;
+  lastSnapshotWrite = millis();
+  snapshotWrites++;
+  debugPrint("Station snapshot saved, %u stations\n", snapshot.count);
+}
+
+//====================================================== Fetch/Parse/Render Pipeline =======================================================//
+// Fetching, parsing and rendering each run on their own task so neither loop() nor the web server ever waits on
+// the network. The fetcher streams the HTTP body into a bounded queue of chunks, the parser reads them through
+// ChunkStream into the back station buffer, and the renderer draws the front buffer once the parser swaps it in.
+
+#define FETCH_TASK_CORE 0   // With the WiFi stack
+#define PARSE_TASK_CORE 1
+#define RENDER_TASK_CORE 1
+
+#define PAYLOAD_CHUNK_SIZE 512
+#define PAYLOAD_QUEUE_DEPTH 4
+#define FETCH_IDLE_TIMEOUT 10000  // Give up on a response that stalls this long (ms)
+
+// A slice of the HTTP body for one batch of stations. A chunk with len 0 ends the payload and carries whether
+// it arrived in full.
+struct PayloadChunk {
+  uint16_t len;
+  bool ok;
+  uint16_t batchFirst;    // Stations the request asked for
+  uint16_t batchCount;
+  MetarFormat format;
+  uint8_t data[PAYLOAD_CHUNK_SIZE];
 };
 
-Preference settings[] = {
-{"led_brightness",75},
-{"start_time",7},
-{"end_time",20}
+// What the parser made of one payload, sent back to the fetcher once the payload's stations are published
+struct ParseResult {
+  uint16_t batchFirst;
+  bool complete;
 };
 
-Preferences preferences;
+QueueHandle_t fetchQueue;
+QueueHandle_t chunkQueue;
+QueueHandle_t parseResultQueue;
+uint16_t payloadsPending = 0;   // Payloads of this refresh the parser has not reported on yet, fetcher task only
+TaskHandle_t fetcherTaskHandle;
+TaskHandle_t parserTaskHandle;
+TaskHandle_t rendererTaskHandle;
+
+// Whether the map is inside its schedule window, decided by the fetcher and drawn by the renderer
+volatile bool displayOn = true;
+
+FetchScheduler fetchScheduler({FETCH_MIN_INTERVAL_MS, INTERVAL, FETCH_ALIGN_SECONDS, FETCH_BACKOFF_BASE_MS, INTERVAL},
+                              esp_random());
+
+// Ask for a fetch and wake the fetcher to reconsider its wait. Returns false if the trigger was merged into a
+// fetch already waiting or running.
+bool requestFetch(FetchTrigger trigger = FETCH_TRIGGER_MANUAL) {
+  bool accepted = fetchScheduler.trigger(trigger);
+  uint8_t token = 0;
+  xQueueSend(fetchQueue, &token, 0);
+  return accepted;
+}
+
+// Ask the renderer to redraw, merging with any request it has not picked up yet
+void requestRender(uint32_t bits) {
+  xTaskNotify(rendererTaskHandle, bits, eSetBits);
+}
+
+// Stream over the chunk queue, so streamMetars() can parse a payload while it is still downloading
+class ChunkStream : public PayloadStream {
+public:
+  // Drop any leftover state and wait for the first chunk of the next payload
+  void beginPayload() {
+    pos_ = 0;
+    chunk_.len = 0;
+    ended_ = false;
+    ok_ = false;
+    fill(portMAX_DELAY);
+  }
+
+  // Discard whatever the parser did not consume, up to the end of the payload
+  void drain() {
+    while (!ended_) {
+      pos_ = chunk_.len;
+      fill(pdMS_TO_TICKS(FETCH_IDLE_TIMEOUT));
+    }
+  }
+
+  // True once the payload has ended and arrived in full
+  bool complete() const override { return ended_ && ok_; }
+  int batchFirst() const { return chunk_.batchFirst; }
+  int batchCount() const { return chunk_.batchCount; }
+  MetarFormat format() const { return chunk_.format; }
+
+  int available() override { return ended_ ? 0 : chunk_.len - pos_; }
+  int read() override { return fill(pdMS_TO_TICKS(FETCH_IDLE_TIMEOUT)) ? chunk_.data[pos_++] : -1; }
+  int peek() override { return fill(pdMS_TO_TICKS(FETCH_IDLE_TIMEOUT)) ? chunk_.data[pos_] : -1; }
+  size_t write(uint8_t) override { return 0; }
+
+private:
+  // Make sure there is an unread byte, pulling the next chunk if needed
+  bool fill(TickType_t wait) {
+    while (!ended_ && pos_ >= chunk_.len) {
+      if (xQueueReceive(chunkQueue, &chunk_, wait) != pdTRUE) {
+        ended_ = true;  // The fetcher went quiet
+        return false;
+      }
+      pos_ = 0;
+      if (chunk_.len == 0) {
+        ended_ = true;
+        ok_ = chunk_.ok;
+      }
+    }
+    return !ended_;
+  }
+
+  PayloadChunk chunk_;
+  uint16_t pos_ = 0;
+  bool ended_ = true;
+  bool ok_ = false;
+};
+
+ChunkStream chunkStream;
+
+// Sink that HTTPClient::writeToStream() fills with the decoded body (chunked or not), forwarded to the parser
+// in PAYLOAD_CHUNK_SIZE slices
+class PayloadWriter : public Stream {
+public:
+  size_t write(const uint8_t* data, size_t len) override {
+    size_t left = len;
+    while (left > 0) {
+      size_t n = min(left, (size_t)PAYLOAD_CHUNK_SIZE);
+      chunk_.len = n;
+      chunk_.ok = true;
+      chunk_.batchFirst = batchFirst;
+      chunk_.batchCount = batchCount;
+      chunk_.format = format;
+      memcpy(chunk_.data, data, n);
+      // Blocks while the parser is behind, which bounds the memory held for the payload
+      xQueueSend(chunkQueue, &chunk_, portMAX_DELAY);
+      data += n;
+      left -= n;
+    }
+    bytes += len;
+    return len;
+  }
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+
+  uint32_t bytes = 0;
+  uint16_t batchFirst = 0;
+  uint16_t batchCount = 0;
+  MetarFormat format = METAR_FORMAT_JSON;
+
+private:
+  PayloadChunk chunk_;
+};
+
+PayloadWriter payloadWriter;
+
+void endPayload(bool ok) {
+  PayloadChunk end;
+  end.len = 0;
+  end.ok = ok;
+  end.batchFirst = payloadWriter.batchFirst;
+  end.batchCount = payloadWriter.batchCount;
+  end.format = payloadWriter.format;
+  xQueueSend(chunkQueue, &end, portMAX_DELAY);
+  payloadsPending++;
+}
+
+// Wait until the parser has published every payload of this refresh. Returns false if one of them did not parse
+// in full or the parser did not answer in time.
+bool waitForParser() {
+  bool allParsed = true;
+  ParseResult result;
+  while (payloadsPending > 0) {
+    if (xQueueReceive(parseResultQueue, &result, pdMS_TO_TICKS(FETCH_IDLE_TIMEOUT)) != pdTRUE) {
+      LOG_WARN("Parser did not report on %u payloads\n", payloadsPending);
+      payloadsPending = 0;
+      return false;
+    }
+    payloadsPending--;
+    allParsed &= result.complete;
+  }
+  return allParsed;
+}
+
+//====================================================== METAR HTTPS Client ===============================================================//
+// One TLS connection to aviationweather.gov is kept open across refreshes with HTTP/1.1 keep-alive, so the
+// expensive handshake only happens when the server has dropped the connection. Even then the session of the last
+// connection is offered again, and a server that still knows it resumes without a certificate exchange. The server
+// is verified against a root CA uploaded to the filesystem (METAR_CA_FILE), or the roots built into the firmware
+// (METAR_ROOT_CA) without one. Only tls_verify set to 0 turns verification off.
+
+#define METAR_HOST "aviationweather.gov"
+#define METAR_PORT 443
+#define METAR_CA_FILE "/aviationweather_ca.pem"
+#define METAR_TLS_TIMEOUT_MS 15000
+
+// Validators from the last complete response of each batch. Sending them back lets the server answer an
+// unchanged report set with a bodyless 304, which skips both the download and the parse.
+struct BatchValidators {
+  char etag[72];
+  char lastModified[32];
+  uint32_t payloadBytes;
+};
+
+BatchValidators batchValidators[MAX_METAR_BATCHES];
+// Validators of the response each batch's parser is still reading. They only move into batchValidators once the
+// parser reports the batch complete, so a body it rejects is downloaded again instead of answered with a 304.
+BatchValidators pendingValidators[MAX_METAR_BATCHES];
+
+// WiFiClient carrying a TlsSession, so HTTPClient can use it like WiFiClientSecure. WiFiClientSecure starts every
+// connection from a fresh SSL context and has no way to offer the previous session.
+class ResumingTlsClient : public WiFiClient {
+public:
+  ResumingTlsClient() : tls([]() -> uint32_t { return millis(); }, METAR_TLS_TIMEOUT_MS) {}
+
+  bool begin(const char* caPem) { return tls.begin(caPem); }
+
+  int connect(IPAddress ip, uint16_t port) override { return connectTls(WiFiClient::connect(ip, port), nullptr); }
+  int connect(IPAddress ip, uint16_t port, int32_t timeout) override {
+    return connectTls(WiFiClient::connect(ip, port, timeout), nullptr);
+  }
+  int connect(const char* host, uint16_t port) override { return connectTls(WiFiClient::connect(host, port), host); }
+  int connect(const char* host, uint16_t port, int32_t timeout) override {
+    return connectTls(WiFiClient::connect(host, port, timeout), host);
+  }
+
+  size_t write(uint8_t data) override { return write(&data, 1); }
+  size_t write(const uint8_t* buf, size_t size) override {
+    int sent = tls.write(buf, size);
+    return sent > 0 ? sent : 0;
+  }
+
+  int available() override { return (peeked >= 0 ? 1 : 0) + tls.available(); }
+  int read() override {
+    uint8_t data;
+    return read(&data, 1) == 1 ? data : -1;
+  }
+  int read(uint8_t* buf, size_t size) override {
+    if (size == 0) return 0;
+    size_t count = 0;
+    if (peeked >= 0) {
+      buf[count++] = peeked;
+      peeked = -1;
+    }
+    int ret = tls.read(buf + count, size - count);
+    return ret > 0 ? count + ret : (count > 0 ? (int)count : ret);
+  }
+  int peek() override {
+    if (peeked < 0) {
+      uint8_t data;
+      if (tls.read(&data, 1) == 1) peeked = data;
+    }
+    return peeked;
+  }
+  void flush() override {}
+
+  void stop() override {
+    tls.close();
+    peeked = -1;
+    WiFiClient::stop();
+  }
+  uint8_t connected() override { return peeked >= 0 || tls.available() > 0 || (tls.open() && WiFiClient::connected()); }
+
+  TlsSession tls;
+
+private:
+  int peeked = -1;
+
+  int connectTls(int connected, const char* host) {
+    peeked = -1;
+    if (!connected) return 0;
+    if (tls.connect(host, this, tlsSend, tlsRecv) != 0) {
+      WiFiClient::stop();
+      return 0;
+    }
+    return 1;
+  }
+
+  // Transport for the TLS records, on the plain socket underneath
+  static int tlsSend(void* io, const unsigned char* data, size_t len) {
+    ResumingTlsClient* client = (ResumingTlsClient*)io;
+    size_t sent = client->WiFiClient::write(data, len);
+    return sent > 0 ? (int)sent : (client->WiFiClient::connected() ? MBEDTLS_ERR_SSL_WANT_WRITE : -1);
+  }
+  static int tlsRecv(void* io, unsigned char* data, size_t len) {
+    ResumingTlsClient* client = (ResumingTlsClient*)io;
+    if (client->WiFiClient::available() <= 0) {
+      if (!client->WiFiClient::connected()) return 0;
+      delay(1);   // Let the network stack run while the handshake waits for the server
+      return MBEDTLS_ERR_SSL_WANT_READ;
+    }
+    int got = client->WiFiClient::read(data, len);
+    return got > 0 ? got : MBEDTLS_ERR_SSL_WANT_READ;
+  }
+};
+
+ResumingTlsClient metarClient;
+HTTPClient metarHttp;
+
+// Connection reuse on the METAR client since boot
+struct TlsStats {
+  uint32_t requests;
+  uint32_t handshakes;         // Requests that had to open a new connection
+  uint32_t reused;             // Requests sent on an already open connection
+  uint32_t resumed;            // Handshakes that resumed the previous TLS session
+  uint32_t failures;
+  uint32_t lastHandshakeMs;
+  uint32_t totalHandshakeMs;
+};
+
+TlsStats tlsStats;
+
+void setupMetarClient() {
+  metarHttp.setReuse(true);
+  if (!getSettingValue(SET_TLS_VERIFY)) {
+    LOG_WARN("tls_verify is 0, the METAR connection will not be verified\n");
+    if (!metarClient.begin(nullptr)) {
+      LOG_ERROR("TLS setup failed (-0x%04x), METAR fetches will fail\n", -metarClient.tls.lastError);
+    }
+    return;
+  }
+  File file = SPIFFS.open(METAR_CA_FILE, "r");
+  if (file) {
+    String caCert = file.readString();
+    file.close();
+    if (!metarClient.begin(caCert.c_str())) {
+      LOG_ERROR("Root CA at " METAR_CA_FILE " could not be loaded (-0x%04x), using the built-in roots\n",
+                -metarClient.tls.lastError);
+    }
+  }
+  if (!metarClient.tls.ready() && !metarClient.begin(METAR_ROOT_CA)) {
+    LOG_ERROR("TLS setup failed (-0x%04x), METAR fetches will fail\n", -metarClient.tls.lastError);
+  }
+}
+
+// Make sure the METAR connection is open, timing the handshake when a new one is needed
+bool connectMetarClient() {
+  tlsStats.requests++;
+  if (metarClient.connected()) {
+    tlsStats.reused++;
+    return true;
+  }
+  unsigned long start = millis();
+  METRIC_TIMER_START(tlsTimer);
+  if (!metarClient.connect(METAR_HOST, METAR_PORT)) {
+    tlsStats.failures++;
+    LOG_WARN("TLS connection to " METAR_HOST " failed (-0x%04x)\n", -metarClient.tls.lastError);
+    return false;
+  }
+  METRIC_TIMER_STOP(tlsTimer, STAGE_TLS);
+  tlsStats.handshakes++;
+  if (metarClient.tls.resumed()) {
+    tlsStats.resumed++;
+  }
+  tlsStats.lastHandshakeMs = millis() - start;
+  tlsStats.totalHandshakeMs += tlsStats.lastHandshakeMs;
+  debugPrint("TLS handshake took %u ms%s\n", tlsStats.lastHandshakeMs, metarClient.tls.resumed() ? ", resumed" : "");
+  return true;
+}
+
+// Send the GET, reopening the connection once if the server closed the kept-alive one in the meantime
+int sendMetarRequest(const char* url, const BatchValidators& validators) {
+  const char* validatorHeaders[] = {"ETag", "Last-Modified"};
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool reused = metarClient.connected();
+    if (!connectMetarClient()) {
+      return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+    metarHttp.begin(metarClient, url);
+    metarHttp.collectHeaders(validatorHeaders, 2);
+    if (validators.etag[0] != '\0') {
+      metarHttp.addHeader("If-None-Match", validators.etag);
+    }
+    if (validators.lastModified[0] != '\0') {
+      metarHttp.addHeader("If-Modified-Since", validators.lastModified);
+    }
+    int httpCode = metarHttp.GET();
+    if (httpCode > 0 || !reused) {
+      return httpCode;
+    }
+    debugPrint("Kept-alive connection was closed, reconnecting\n");
+    metarHttp.end();
+    metarClient.stop();
+  }
+  return HTTPC_ERROR_CONNECTION_LOST;
+}
+
+
+//Get METAR Data for one batch of stations and stream it to the parser
+void fetchMetarBatch(int batch, int first, int count, MetarFormat format) {
+  // Construct API URL in the refresh arena, 5 characters per station
+  size_t urlSize = 64 + count * 5;
+  char* url = (char*)fetchArena.allocate(urlSize);
+  if (url == nullptr) {
+    LOG_ERROR("No room for the URL of batch %d\n", batch);
+    endPayload(false);
+    fetchStats.batchesFailed++;
+    return;
+  }
+  size_t len = snprintf(url, urlSize, "https://" METAR_HOST "/api/data/metar?format=%s&ids=", metarFormatName(format));
+  for (int i = first; i < first + count; i++) {
+    if (i > first) url[len++] = ',';
+    unpackIcao(stationMap.stationIcao[i], url + len);
+    len += strlen(url + len);
+  }
+
+  debugPrint("Fetching weather data from: %s\n", url);
+
+  unsigned long start = millis();
+  METRIC_TIMER_START(fetchTimer);
+  BatchValidators& validators = batchValidators[batch];
+  payloadWriter.bytes = 0;
+  payloadWriter.batchFirst = first;
+  payloadWriter.batchCount = count;
+  payloadWriter.format = format;
+
+  int httpCode = sendMetarRequest(url, validators);
+  if (httpCode == HTTP_CODE_NOT_MODIFIED) {
+    debugPrint("METARs not modified since the last fetch\n");
+    fetchStats.notModified++;
+    fetchStats.bytesSkipped += validators.payloadBytes;
+    fetchStats.totalBytesSkipped += validators.payloadBytes;
+    metarHttp.end();
+    fetchStats.batchMs[batch] = millis() - start;
+    METRIC_TIMER_STOP(fetchTimer, STAGE_FETCH);
+    return;
+  }
+  if (httpCode != HTTP_CODE_OK) {
+    LOG_WARN("HTTP request failed with code: %d\n", httpCode);
+    metarHttp.end();
+    endPayload(false);
+    fetchStats.batchesFailed++;
+    fetchStats.batchMs[batch] = millis() - start;
+    METRIC_TIMER_STOP(fetchTimer, STAGE_FETCH);
+    return;
+  }
+  debugPrint("HTTP request successful.\n");
+
+  // writeToStream() undoes chunked transfer encoding and reads exactly the body, leaving the connection reusable
+  int written = metarHttp.writeToStream(&payloadWriter);
+  bool ok = written >= 0;
+  if (!ok) {
+    LOG_WARN("METAR response failed: %s\n", metarHttp.errorToString(written).c_str());
+    fetchStats.batchesFailed++;
+  }
+  fetchStats.bytesDownloaded += payloadWriter.bytes;
+  fetchStats.totalBytesDownloaded += payloadWriter.bytes;
+  ingestStats[format].bytes += payloadWriter.bytes;
+
+  // Held until the parser confirms the batch, see confirmBatchValidators()
+  BatchValidators& pending = pendingValidators[batch];
+  strlcpy(pending.etag, ok ? metarHttp.header("ETag").c_str() : "", sizeof(pending.etag));
+  strlcpy(pending.lastModified, ok ? metarHttp.header("Last-Modified").c_str() : "", sizeof(pending.lastModified));
+  pending.payloadBytes = payloadWriter.bytes;
+  // Keeps the connection open when the server allows keep-alive
+  metarHttp.end();
+  endPayload(ok);
+  fetchStats.batchMs[batch] = millis() - start;
+  METRIC_TIMER_STOP(fetchTimer, STAGE_FETCH);
+}
+
+// Fetch every station, one batch after another on the same connection. Each batch is parsed and published
+// on its own, so a failed batch only leaves its own stations stale. Returns false if any batch failed.
+bool fetchMetarData() {
+  unsigned long start = millis();
+  fetchInProgress = true;
+  liveFeed.markTopic(FEED_STATUS);
+  fetchStats.cycles++;
+  fetchStats.bytesDownloaded = 0;
+  fetchStats.bytesSkipped = 0;
+  fetchStats.stationsUpdated = 0;
+  fetchStats.batches = 0;
+  fetchStats.batchesFailed = 0;
+  // A result that came in after the last refresh gave up waiting must not count for this one
+  xQueueReset(parseResultQueue);
+
+  // Stored validators came with the other format's URLs
+  static MetarFormat lastFormat = METAR_FORMAT_JSON;
+  MetarFormat format = (MetarFormat)getSettingValue(SET_METAR_FORMAT);
+  if (format != lastFormat) {
+    for (BatchValidators& validators : batchValidators) {
+      validators = BatchValidators();
+    }
+    lastFormat = format;
+  }
+
+  for (int batch = 0; batch * METAR_BATCH_SIZE < stationMap.stationCount; batch++) {
+    int first = batch * METAR_BATCH_SIZE;
+    fetchMetarBatch(batch, first, min(METAR_BATCH_SIZE, stationMap.stationCount - first), format);
+    fetchStats.batches++;
+  }
+
+  fetchArena.reset();
+  fetchStats.refreshMs = millis() - start;
+  lastFetchMillis = millis();
+  fetchInProgress = false;
+  liveFeed.markTopic(FEED_STATUS);
+  debugPrint("Refresh took %u ms over %u requests, %u failed\n",
+             fetchStats.refreshMs, fetchStats.batches, fetchStats.batchesFailed);
+  return fetchStats.batchesFailed == 0;
+}
+
+// Called by the parser when a batch's payload has ended. Only a response that arrived in full and parsed may be
+// the base for the next conditional request, anything else clears the batch's validators.
+void confirmBatchValidators(int first, bool complete) {
+  int batch = first / METAR_BATCH_SIZE;
+  batchValidators[batch] = complete ? pendingValidators[batch] : BatchValidators();
+}
+
+//Check Metars disreading 15 min update but still respects the time schedule
+bool checkMetars(){
+  // The map is dark outside the display window, updateDisplaySchedule() asks for a fetch when it opens
+  if (!displayOn) {
+    debugPrint("Outside the display window, not fetching\n");
+    return true;
+  }
+  if (lanLeaderAlive()) {
+    debugPrint("Following the LAN leader, not fetching\n");
+    return true;
+  }
+  return fetchMetarData();
+}
+
+// Sleeps until the scheduler says a fetch is due; requestFetch() wakes it early to look again
+void fetcherTask(void* param) {
+  uint8_t token;
+  for (;;) {
+    uint32_t waitMs;
+    if (!fetchScheduler.due(millis(), unixNow(), waitMs)) {
+      xQueueReceive(fetchQueue, &token, pdMS_TO_TICKS(waitMs));
+      continue;
+    }
+    fetchScheduler.started(millis());
+    bool ok = checkMetars();
+    // Waits for the last batch to be published too. A batch the parser rejected fails the fetch like a download
+    // error would, so it is retried with backoff instead of waiting for the next grid slot.
+    ok &= waitForParser();
+    fetchScheduler.finished(ok, millis(), unixNow());
+    sampleHeap();
+    if (!ok) {
+      LOG_WARN("Fetch failed, retrying in %u s\n", fetchScheduler.status(millis(), unixNow()).backoffMs / 1000);
+    }
+    liveFeed.markTopic(FEED_STATUS);
+    saveSnapshotIfChanged();
+  }
+}
+
+void parserTask(void* param) {
+  for (;;) {
+    chunkStream.beginPayload();
+    xSemaphoreTake(updateMutex, portMAX_DELAY);
+    beginStationUpdate();
+    MetarFormat format = chunkStream.format();
+    int count = format == METAR_FORMAT_RAW
+                    ? streamRawMetars(chunkStream, unixNow(), processMetar, ingestStats[format])
+                    : streamMetars(chunkStream, metarFilter, parseJsonAllocator, processMetar, ingestStats[format]);
+    chunkStream.drain();
+    bool complete = count >= 0 && chunkStream.complete();
+    if (complete) {
+      debugPrint("Parsed %d METARs\n", count);
+    } else {
+      LOG_WARN("METAR stream ended early, keeping the stations already updated\n");
+    }
+    finishStationUpdate(complete, chunkStream.batchFirst(), chunkStream.batchCount());
+    confirmBatchValidators(chunkStream.batchFirst(), complete);
+    xSemaphoreGive(updateMutex);
+    parseArena.reset();
+    ParseResult result = {(uint16_t)chunkStream.batchFirst(), complete};
+    xQueueSend(parseResultQueue, &result, 0);
+  }
+}
+
+// Point the animator at the front station buffer, only the LEDs of changed stations unless full is set
+void renderStations(bool full) {
+  if (full) {
+    updatePalette();
+  }
+  uint8_t windBlink = getSettingValue(SET_WIND_BLINK);
+  uint32_t trendWindow = getSettingValue(SET_TREND_HOURS) * 3600UL;
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  const MapStationStore& front = stationStores[frontStore];
+  bool drewStale = false;
+  bool drewFresh = false;
+  for (int i = 0; i < stationMap.ledCount; i++) {
+    int station = stationMap.ledStation[i];
+    if (!full && (station < 0 || !stationDirty[station])) {
+      continue;
+    }
+    if (displayOn && station >= 0 && front.valid(station)) {
+      bool stale = front.flags[station] & STATION_STALE;
+      uint8_t wind = front.windGust[station] != WIND_SPEED_UNKNOWN ? front.windGust[station] : front.windSpeed[station];
+      uint8_t effects = (stale ? EFFECT_STALE : 0) |
+                        ((front.flags[station] & STATION_THUNDER) ? EFFECT_THUNDER : 0) |
+                        (windBlink > 0 && wind != WIND_SPEED_UNKNOWN && wind >= windBlink ? EFFECT_WIND : 0) |
+                        (!stale && stationHistory.trend(station, trendWindow) == TREND_WORSE ? EFFECT_TREND : 0);
+      animator.setTarget(i, front.category[station], effects);
+      drewStale |= stale;
+      drewFresh |= !stale;
+    } else {
+      animator.setTarget(i, CATEGORY_UNKNOWN, 0);
+    }
+  }
+  memset(stationDirty, 0, sizeof(stationDirty));
+  xSemaphoreGive(stateMutex);
+  if (bootFirstFrameMs == 0 && (drewStale || drewFresh)) {
+    bootFirstFrameMs = millis();
+    LOG_INFO("First weather frame %u ms after boot\n", bootFirstFrameMs);
+  }
+  if (bootFreshFrameMs == 0 && drewFresh) {
+    bootFreshFrameMs = millis();
+    LOG_INFO("First fetched weather frame %u ms after boot\n", bootFreshFrameMs);
+  }
+  printFrameStats();
+}
+
+// Draw one animation frame and push it if any pixel changed
+void renderFrame(uint32_t tick) {
+  METRIC_TIMER_START(renderTimer);
+  uint32_t start = micros();
+  if (animator.render(tick, frame)) {
+    invalidateFrame();
+  }
+  commitFrame();
+  animationStats.lastFrameMicros = micros() - start;
+  if (animationStats.lastFrameMicros > animationStats.maxFrameMicros) {
+    animationStats.maxFrameMicros = animationStats.lastFrameMicros;
+  }
+  animationStats.frames++;
+  METRIC_TIMER_STOP(renderTimer, STAGE_RENDER);
+}
+
+// Whether the renderer has nothing left to draw or push until the next render request
+bool renderSettled() {
+  if (animator.animating() || frameDirty) {
+    return false;
+  }
+  for (int s = 0; s < stationTable.stripCount; s++) {
+    if (ledOutputs[s]->busy()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Runs at ANIMATION_HZ. Render requests are picked up as they come but drawn on the next tick, and a tick
+// that starts late is counted as dropped instead of being made up with a burst of frames. Once the map has
+// settled for a few ticks it parks until the next request, so a still map does not keep the CPU awake.
+void rendererTask(void* param) {
+  const TickType_t period = pdMS_TO_TICKS(1000 / ANIMATION_HZ);
+  uint32_t tick = 0;
+  uint32_t pending = 0;
+  uint32_t settledTicks = 0;
+  TickType_t next = xTaskGetTickCount();
+  for (;;) {
+    if (settledTicks >= RENDER_PARK_TICKS && pending == 0) {
+      uint32_t bits = 0;
+      animationStats.parks++;
+      xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY);
+      pending |= bits;
+      settledTicks = 0;
+      next = xTaskGetTickCount();  // The time parked is not dropped frames
+    }
+    next += period;
+    TickType_t now = xTaskGetTickCount();
+    if ((int32_t)(now - next) >= (int32_t)period) {
+      uint32_t missed = (now - next) / period;
+      animationStats.dropped += missed;
+      tick += missed;
+      next += missed * period;
+    }
+    uint32_t bits;
+    while ((int32_t)(next - now) > 0) {
+      if (xTaskNotifyWait(0, UINT32_MAX, &bits, next - now) == pdTRUE) {
+        pending |= bits;
+      }
+      now = xTaskGetTickCount();
+    }
+    if (pending) {
+      if (pending & RENDER_FORCE) {
+        invalidateFrame();
+      }
+      renderStations(pending & (RENDER_FULL | RENDER_FORCE));
+      pending = 0;
+    }
+    renderFrame(tick++);
+    // A frame the LED output had to hold back goes out as soon as the strip is free
+    for (int s = 0; s < stationTable.stripCount; s++) {
+      ledOutputs[s]->poll();
+    }
+    settledTicks = renderSettled() ? settledTicks + 1 : 0;
+  }
+}
+
+void startPipeline() {
+  fetchQueue = xQueueCreate(1, sizeof(uint8_t));
+  chunkQueue = xQueueCreate(PAYLOAD_QUEUE_DEPTH, sizeof(PayloadChunk));
+  parseResultQueue = xQueueCreate(MAX_METAR_BATCHES, sizeof(ParseResult));
+  stateMutex = xSemaphoreCreateMutex();
+  updateMutex = xSemaphoreCreateMutex();
+  chunkStream.setTimeout(0);  // ChunkStream blocks on the queue itself
+
+  xTaskCreatePinnedToCore(fetcherTask, "fetcher", 10240, nullptr, 1, &fetcherTaskHandle, FETCH_TASK_CORE);
+  xTaskCreatePinnedToCore(parserTask, "parser", 6144, nullptr, 1, &parserTaskHandle, PARSE_TASK_CORE);
+  xTaskCreatePinnedToCore(rendererTask, "renderer", 4096, nullptr, 2, &rendererTaskHandle, RENDER_TASK_CORE);
+}
+
+//=======================================================HTML/WEB Functions=================================================================//
+// index.html is gzipped into flash at build time by scripts/build_webui.py, so the page costs no SPIFFS read
+// or String building per request. Current values are loaded by the page from /api/state.
+struct WebStats {
+  uint32_t pageLoads;
+  uint32_t pageNotModified;
+  uint32_t stateRequests;
+  uint32_t lastPageMicros;
+  uint32_t lastStateMicros;
+  int32_t lastPageHeapDelta;
+  int32_t lastStateHeapDelta;
+};
+WebStats webStats = {};
+
+// Category of a station in the store being shown
+const char* shownCategoryName(int station) {
+  const char* category = "";
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  const MapStationStore& front = stationStores[frontStore];
+  if (front.valid(station)) {
+    category = flightCategoryName((FlightCategory)front.category[station]);
+  }
+  xSemaphoreGive(stateMutex);
+  return category;
+}
+
+// Write the next piece of /api/state into buf
+size_t writeStatePiece(StateCursor& cursor, char* buf, size_t size) {
+  WebState state = {ledBrightness, getSettingValue(SET_START_TIME), getSettingValue(SET_END_TIME),
+                    stationMap.stationCount, stationMap.stationIcao, shownCategoryName};
+  return writeStateJson(state, cursor, buf, size);
+}
+
+// Write the next line of the /api/stations CSV export: the strips, then every LED that shows a station
+size_t writeStationTablePiece(StateCursor& cursor, char* buf, size_t size) {
+  if (cursor.done) {
+    return 0;
+  }
+  if (cursor.next < 0) {
+    cursor.next = 0;
+    return snprintf(buf, size, "# %s station table\n", stationTableFromFlash ? "Uploaded" : "Built-in");
+  }
+  if (cursor.next < stationTable.stripCount) {
+    const StripConfig& strip = stationTable.strips[cursor.next];
+    int len = snprintf(buf, size, "strip,%d,%u,%u", cursor.next++, strip.pin, strip.count);
+    if (strip.order != STRIP_DEFAULT) len += snprintf(buf + len, size - len, ",%s", strip.order == LED_ORDER_GRB ? "grb" : "rgb");
+    if (strip.khz400 != STRIP_DEFAULT) len += snprintf(buf + len, size - len, ",%s", strip.khz400 ? "400" : "800");
+    return len + snprintf(buf + len, size - len, "\n");
+  }
+  int led = cursor.next - stationTable.stripCount;
+  while (led < stationMap.ledCount && stationMap.ledStation[led] < 0) {
+    led++;  // Dark LEDs and spacers are left out
+  }
+  if (led >= stationMap.ledCount) {
+    cursor.done = true;
+    return 0;
+  }
+  cursor.next = stationTable.stripCount + led + 1;
+  int strip = stationTable.stripCount - 1;
+  while (strip > 0 && led < stationTable.strips[strip].offset) {
+    strip--;
+  }
+  char icao[5];
+  unpackIcao(stationMap.stationIcao[stationMap.ledStation[led]], icao);
+  return snprintf(buf, size, "%s,%d,%d\n", icao, led - stationTable.strips[strip].offset, strip);
+}
+
+// Send a StateCursor writer as a chunked response, as many whole pieces per chunk as fit
+AsyncWebServerResponse* beginPieceResponse(AsyncWebServerRequest* request, const char* contentType,
+                                           StatePieceWriter writePiece) {
+  std::shared_ptr<StateCursor> cursor(new StateCursor{-1, false});
+  return request->beginChunkedResponse(contentType, [cursor, writePiece](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+    return fillStateChunk(*cursor, writePiece, buffer, maxLen);
+  });
+}
+
+// Progress through one /api/history response. Each chunk walks the station's history again under the lock and
+// picks up after the last sample sent, so the lock is never held while the client is slow.
+struct HistoryCursor {
+  int station;
+  uint32_t from;        // Next sample to send is at or after this
+  uint16_t sent;
+  bool started;
+  bool done;
+  uint32_t micros;      // Time spent walking the history
+};
 
-unsigned long previousMillis = 0;
-const int NUM_AIRPORTS = sizeof(airports) / sizeof(airports[0]);
+uint32_t lastHistoryQueryMicros = 0;
+
+// One sample as [time,category,ceiling ft,visibility mi,wind dir,wind kt,gust kt,altimeter hPa]
+int formatHistorySample(const HistorySample& sample, char* buf, size_t size) {
+  char ceiling[8] = "null", visibility[8] = "null", windDir[8] = "null", wind[8] = "null", gust[8] = "null", altimeter[8] = "null";
+  if (sample.ceiling != CEILING_NONE) snprintf(ceiling, sizeof(ceiling), "%d", ceilingFeet(sample.ceiling));
+  if (sample.visibility != VISIBILITY_UNKNOWN) snprintf(visibility, sizeof(visibility), "%.2f", visibilityMiles(sample.visibility));
+  if (sample.windDir != WIND_DIR_UNKNOWN) snprintf(windDir, sizeof(windDir), "%u", sample.windDir);
+  if (sample.windSpeed != WIND_SPEED_UNKNOWN) snprintf(wind, sizeof(wind), "%u", sample.windSpeed);
+  if (sample.windGust != WIND_SPEED_UNKNOWN) snprintf(gust, sizeof(gust), "%u", sample.windGust);
+  if (sample.altimeter != ALTIMETER_UNKNOWN) snprintf(altimeter, sizeof(altimeter), "%.1f", sample.altimeter / 10.0f);
+  return snprintf(buf, size, "[%u,\"%s\",%s,%s,%s,%s,%s,%s]", sample.obsTime,
+                  flightCategoryName((FlightCategory)sample.category), ceiling, visibility, windDir, wind, gust, altimeter);
+}
 
-//WS2812B
-#ifndef WS2811_LED
-Adafruit_NeoPixel strip(NUM_AIRPORTS, DATA_PIN, NEO_RGB + NEO_KHZ800);
-#else
-Adafruit_NeoPixel strip(NUM_AIRPORTS, DATA_PIN, NEO_GRB + NEO_KHZ400);
-#endif
+// Write as much of the /api/history response as fits into buf. Returns its length, 0 once everything is sent.
+size_t writeHistoryChunk(HistoryCursor& cursor, char* buf, size_t size) {
+  if (cursor.done) {
+    return 0;
+  }
+  size_t len = 0;
+  if (!cursor.started) {
+    char icao[5];
+    unpackIcao(stationMap.stationIcao[cursor.station], icao);
+    len = snprintf(buf, size, "{\"icao\":\"%s\",\"retentionHours\":%u,\"fields\":[\"time\",\"cat\",\"ceiling\","
+                   "\"visibility\",\"windDir\",\"wind\",\"gust\",\"altimeter\"],\"samples\":[",
+                   icao, HISTORY_RETENTION_HOURS);
+    cursor.started = true;
+  }
+  char piece[STATE_ENTRY_SIZE + 16];
+  piece[0] = ',';
+  bool full = false;
+  uint32_t start = micros();
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  stationHistory.forEach(cursor.station, cursor.from, [&](const HistorySample& sample) {
+    if (full) {
+      return;
+    }
+    // Comma in front of every sample but the first
+    bool first = cursor.sent == 0;
+    size_t pieceLen = formatHistorySample(sample, piece + 1, sizeof(piece) - 1) + (first ? 0 : 1);
+    if (len + pieceLen > size) {
+      full = true;
+      return;
+    }
+    memcpy(buf + len, first ? piece + 1 : piece, pieceLen);
+    len += pieceLen;
+    cursor.from = sample.obsTime + 1;
+    cursor.sent++;
+  });
+  xSemaphoreGive(stateMutex);
+  cursor.micros += micros() - start;
+  if (!full && len + 2 <= size) {
+    memcpy(buf + len, "]}", 2);
+    len += 2;
+    cursor.done = true;
+    lastHistoryQueryMicros = cursor.micros;
+  }
+  return len;
+}
 
-//Need to update to JSON Document 
-DynamicJsonDocument doc(512); // Adjust size as needed
-JsonArray lastMetars;
+// Uploads are collected in request->_tempObject, which the server frees along with the request.
+// It starts with the length so far, UINT32_MAX once the upload went over STATION_TABLE_MAX_UPLOAD.
+void appendUpload(AsyncWebServerRequest* request, const uint8_t* data, size_t len) {
+  uint32_t used = request->_tempObject ? *(uint32_t*)request->_tempObject : 0;
+  if (used == UINT32_MAX) {
+    return;
+  }
+  void* grown = nullptr;
+  if (used + len <= STATION_TABLE_MAX_UPLOAD) {
+    grown = realloc(request->_tempObject, sizeof(uint32_t) + used + len);
+  }
+  if (grown == nullptr) {
+    if (request->_tempObject == nullptr) {
+      request->_tempObject = malloc(sizeof(uint32_t));
+    }
+    if (request->_tempObject != nullptr) {
+      *(uint32_t*)request->_tempObject = UINT32_MAX;
+    }
+    return;
+  }
+  memcpy((uint8_t*)grown + sizeof(uint32_t) + used, data, len);
+  *(uint32_t*)grown = used + len;
+  request->_tempObject = grown;
+}
 
-// Web server setup
-AsyncWebServer server(80);
-//map 1
-//String airports[] = {"KDUG", "KOLS", "KTUS", "KPHX", "KNYL", "KGXF", "KPAN", "KSOW", "KDVT", "KINW", "KPGA", "KFLG", "KIGM", "KGCN", "KPRC", "KCMR", "KSEZ"};
+// Restart once the response that asked for it has gone out, see loop()
+unsigned long restartRequestedAt = 0;
 
-// MAP 2
-//String airports[] = {"KDUG", "KOLS", "KSOW", "KDVT", "KTUS", "KGXF", "KNYL", "KA39", "KSEZ", "KPHX", "KINW", "KFLG", "KGCN", "KPGA"};
+void requestRestart() {
+  restartRequestedAt = millis() | 1;
+}
 
-//===================================================== Helper Functions ===================================================================//
-// Debug print helper
-void debugPrint(const char* format, ...) {
-  if (debug) {
-    va_list args;
-    va_start(args, format);
-    vprintf(format, args);
-    va_end(args);
+//======================================================= Live Feed ========================================================================//
+// Browsers keep a WebSocket on /ws. They get the settings, the fetch status and every station once on connect,
+// then only what changed, and can send settings and fetch requests back over it. See LiveFeed for how slow
+// clients are kept from backing up the send queue.
+#define LIVE_FEED_BATCH 24              // Stations per message
+#define LIVE_FEED_MESSAGE_BYTES 768
+#define LIVE_FEED_MESSAGES_PER_PUMP 4   // Per client each time loop() runs
+#define MAX_SETTINGS_PER_CHANGE 24
+
+AsyncWebSocket liveSocket("/ws");
+
+// Write every setting as "key":value pairs separated by commas, without braces
+size_t writeSettingsJson(char* buf, size_t size) {
+  size_t len = 0;
+  for (size_t i = 0; i < settingsRegistry.count() && len < size; i++) {
+    const Setting& setting = settingsRegistry.at(i);
+    const char* separator = i > 0 ? "," : "";
+    if (setting.type == SETTING_STRING) {
+      char text[SETTING_STRING_MAX];
+      settingsRegistry.getString(i, text, sizeof(text));
+      len += snprintf(buf + len, size - len, "%s\"%s\":\"%s\"", separator, setting.key, text);
+    } else if (setting.type == SETTING_COLOR) {
+      len += snprintf(buf + len, size - len, "%s\"%s\":\"#%06X\"", separator, setting.key, (unsigned)setting.value);
+    } else {
+      len += snprintf(buf + len, size - len, "%s\"%s\":%d", separator, setting.key, setting.value);
+    }
   }
+  return len < size ? len : size - 1;
 }
 
-//Checks if within the Scheduled Time Window
-bool isTimeInRange() {
-    timeClient.update();
-    int currentHour = timeClient.getHours();
-    //Serial.println(currentHour);
-    return (currentHour >= settings[1].value && currentHour < settings[2].value);
+// Apply settings by key, from a form POST or the live feed. Everything is checked before anything changes, and
+// the category minima are checked together so several can move past each other at once. Returns false with
+// error set if any key or value is rejected.
+bool applySettings(const char* const keys[], const char* const values[], int count, const char*& error) {
+  CategoryThresholds thresholds = categoryThresholds;
+  bool thresholdsChanged = false;
+  for (int k = 0; k < count; k++) {
+    int id = settingsRegistry.find(keys[k]);
+    if (id < 0 || id == SET_LED_BACKEND || id == SET_LED_ORDER || id == SET_LED_KHZ400) {
+      error = "Unknown setting, or one that only changes at boot";
+      return false;
+    }
+    if (id >= SET_VIS_MVFR && id <= SET_CEIL_LIFR) {
+      int i = id - SET_VIS_MVFR;
+      if (i < 3) {
+        thresholds.visibility[i] = constrain(atoi(values[k]), 0, 254);
+      } else {
+        thresholds.ceiling[i - 3] = constrain(atoi(values[k]), 0, 0xFFFE);
+      }
+      thresholdsChanged = true;
+    }
+  }
+  if (thresholdsChanged && !validCategoryThresholds(thresholds)) {
+    error = "Minima must get stricter from MVFR to LIFR";
+    return false;
+  }
+
+  uint32_t render = 0;
+  for (int k = 0; k < count; k++) {
+    int id = settingsRegistry.find(keys[k]);
+    const char* value = values[k];
+    const Setting& setting = settingsRegistry.at(id);
+    if (id >= SET_VIS_MVFR && id <= SET_CEIL_LIFR) {
+      continue;  // Applied together below
+    } else if (id == SET_LED_BRIGHTNESS) {
+      ledBrightness = constrain(atoi(value), 0, 255);
+      settingsRegistry.setInt(id, ledBrightness, millis());
+      render |= RENDER_FORCE;
+    } else if (setting.type == SETTING_STRING) {
+      settingsRegistry.setString(id, value, millis());
+    } else if (setting.type == SETTING_COLOR) {
+      settingsRegistry.setInt(id, strtol(value + (value[0] == '#' ? 1 : 0), nullptr, 16), millis());
+      render |= RENDER_FULL;
+    } else {
+      settingsRegistry.setInt(id, atoi(value), millis());
+      render |= id == SET_WIND_BLINK || id == SET_TREND_HOURS ? RENDER_FULL : 0;
+    }
+  }
+  if (thresholdsChanged) {
+    applyCategoryThresholds(thresholds);
+    for (int i = 0; i < 6; i++) {
+      settingsRegistry.setInt(SET_VIS_MVFR + i, i < 3 ? thresholds.visibility[i] : thresholds.ceiling[i - 3], millis());
+    }
+  }
+  if (render) {
+    requestRender(render);
+  }
+  liveFeed.markTopic(FEED_SETTINGS);
+  return true;
 }
 
-//===================================================== Get/Set Preferences ================================================================//
+// Write the next message a client is owed into buf: settings, then fetch status, then changed stations in
+// batches. Returns 0 once it is up to date.
+size_t writeLiveFeedMessage(int slot, char* buf, size_t size) {
+  uint8_t topic = liveFeed.takeTopic(slot);
+  if (topic == FEED_SETTINGS) {
+    size_t len = snprintf(buf, size, "{\"t\":\"settings\",");
+    len += writeSettingsJson(buf + len, size - len - 2);
+    return len + snprintf(buf + len, size - len, "}");
+  }
+  if (topic == FEED_STATUS) {
+    FetchScheduler::Status scheduler = fetchScheduler.status(millis(), unixNow());
+    return snprintf(buf, size, "{\"t\":\"status\",\"fetching\":%s,\"cycles\":%u,\"changed\":%u,\"failed\":%u,"
+                    "\"refreshMs\":%u,\"age\":%ld,\"scheduler\":\"%s\",\"next\":%u,\"failures\":%u,\"displayOn\":%s}",
+                    fetchInProgress ? "true" : "false", fetchStats.cycles, fetchStats.stationsUpdated,
+                    fetchStats.batchesFailed, fetchStats.refreshMs,
+                    lastFetchMillis ? (long)((millis() - lastFetchMillis) / 1000) : -1L,
+                    fetchSchedulerStateName(scheduler.state), scheduler.nextInMs / 1000, scheduler.failures,
+                    displayOn ? "true" : "false");
+  }
 
-// Function to set the value of a setting by name (saves to Preferences)
-void setSettingValue(const char* key, int newValue) {
-  for (int i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
-      if (strcmp(settings[i].name, key) == 0) {
-          settings[i].value = newValue;  // Update the in-memory setting
-          
-          // Save to Preferences
-          preferences.begin("settings", false);  // Open Preferences in write mode
-          preferences.putInt(key, newValue);
-          preferences.end();
-
-          debugPrint("setSettingValue: Saved '%s' with new value %d to Preferences\n", key, newValue);
-          return;
+  uint16_t stations[LIVE_FEED_BATCH];
+  int count = liveFeed.takeStations(slot, stations, LIVE_FEED_BATCH);
+  if (count == 0) {
+    return 0;
+  }
+  size_t len = snprintf(buf, size, "{\"t\":\"stations\",\"s\":{");
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  const MapStationStore& front = stationStores[frontStore];
+  for (int i = 0; i < count; i++) {
+    int station = stations[i];
+    char icao[5];
+    unpackIcao(stationMap.stationIcao[station], icao);
+    const char* category = front.valid(station) ? flightCategoryName((FlightCategory)front.category[station]) : "";
+    len += snprintf(buf + len, size - len, "%s\"%s\":\"%s\"", i > 0 ? "," : "", icao, category);
+  }
+  xSemaphoreGive(stateMutex);
+  return len + snprintf(buf + len, size - len, "}}");
+}
+
+// Messages from a browser: {"set":{"key":value,...}} or {"fetch":true}
+void handleLiveFeedMessage(AsyncWebSocketClient* client, const uint8_t* data, size_t len) {
+  JsonDocument doc;
+  if (deserializeJson(doc, data, len) != DeserializationError::Ok) {
+    client->text("{\"t\":\"error\",\"msg\":\"Bad message\"}");
+    return;
+  }
+  if (doc["fetch"] | false) {
+    requestFetch();
+  }
+  JsonObject set = doc["set"];
+  if (!set.isNull()) {
+    const char* keys[MAX_SETTINGS_PER_CHANGE];
+    const char* values[MAX_SETTINGS_PER_CHANGE];
+    char numbers[MAX_SETTINGS_PER_CHANGE][12];
+    int count = 0;
+    for (JsonPair pair : set) {
+      if (count == MAX_SETTINGS_PER_CHANGE) {
+        break;
       }
+      keys[count] = pair.key().c_str();
+      if (pair.value().is<const char*>()) {
+        values[count] = pair.value().as<const char*>();
+      } else {
+        snprintf(numbers[count], sizeof(numbers[count]), "%ld", pair.value().as<long>());
+        values[count] = numbers[count];
+      }
+      count++;
+    }
+    const char* error = nullptr;
+    if (!applySettings(keys, values, count, error)) {
+      char message[96];
+      snprintf(message, sizeof(message), "{\"t\":\"error\",\"msg\":\"%s\"}", error);
+      client->text(message);
+    }
   }
-  debugPrint("setSettingValue: Setting '%s' not found!\n", key);
 }
 
- // Function to get the value of a setting by name (loads from Preferences)
-int getSettingValue(const char* key) {
-  preferences.begin("settings", true);  // Open Preferences in read-only mode
-  int value = preferences.getInt(key, -1);  // Get value or return -1 if not found
-  preferences.end();
+void onLiveSocketEvent(AsyncWebSocket* socket, AsyncWebSocketClient* client, AwsEventType type, void* arg,
+                       uint8_t* data, size_t len) {
+  if (type == WS_EVT_CONNECT) {
+    if (!liveFeed.add(client->id())) {
+      LOG_WARN("Live feed full, closing client %u\n", client->id());
+      client->close();
+    }
+  } else if (type == WS_EVT_DISCONNECT) {
+    liveFeed.remove(client->id());
+  } else if (type == WS_EVT_DATA) {
+    // Only whole, unfragmented text frames; every message the page sends is small
+    AwsFrameInfo* info = (AwsFrameInfo*)arg;
+    if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
+      handleLiveFeedMessage(client, data, len);
+    }
+  }
+}
 
-  if (value == -1) {  // If not found, use the default from settings array
-      for (int i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
-          if (strcmp(settings[i].name, key) == 0) {
-              value = settings[i].value;
-              break;
-          }
+// Send each client what it is owed, as long as its queue has room. Called from loop().
+void pumpLiveFeed() {
+  for (int slot = 0; slot < LIVE_FEED_CLIENTS; slot++) {
+    uint32_t id;
+    if (!liveFeed.clientAt(slot, id)) {
+      continue;
+    }
+    AsyncWebSocketClient* client = liveSocket.client(id);
+    if (client == nullptr) {
+      liveFeed.remove(id);
+      continue;
+    }
+    // A client still working through earlier messages keeps its bits, they go out merged later
+    for (int sent = 0; sent < LIVE_FEED_MESSAGES_PER_PUMP; sent++) {
+      if (client->status() != WS_CONNECTED || client->queueIsFull()) {
+        break;
       }
-      debugPrint("getSettingValue: '%s' not found in Preferences, using default %d\n", key, value);
-      setSettingValue(key,value);
-  } else {
-      debugPrint("getSettingValue: Loaded '%s' with value %d from Preferences\n", key, value);
+      char message[LIVE_FEED_MESSAGE_BYTES];
+      size_t len = writeLiveFeedMessage(slot, message, sizeof(message));
+      if (len == 0) {
+        break;
+      }
+      client->text(message, len);
+    }
+  }
+  liveSocket.cleanupClients(LIVE_FEED_CLIENTS);
+}
+
+//====================================================== Display Schedule and Power ========================================================//
+// The display window is local time in the tz setting, so it moves with DST. After each pass of loop() the power
+// scheduler picks how to wait for the next thing that needs the board: fully awake while anything animates,
+// fetches or talks to a client, clocked down with the radio in modem sleep between events, and with power_save 2
+// in light sleep outside the display window. Light sleep does not keep the WiFi association up on this core, so
+// WiFi is stopped for it and a lit map is never put to sleep.
+
+#define POWER_POLL_MS 100                     // Loop period while active
+#define POWER_IDLE_MAX_MS 1000                // Longest idle wait, the most a button or setting change waits
+#define POWER_FETCH_LEAD_MS 1000
+#define POWER_REQUEST_HOLD_MS (30 * 1000UL)   // Stay active after a web request, the page polls while open
+#define POWER_MIN_SLEEP_MS 5000
+#define POWER_MAX_SLEEP_MS (10 * 60 * 1000UL)
+#define POWER_SLEEP_LEAD_MS 5000              // Time given to WiFi to reconnect before the event a sleep waits for
+#define POWER_AWAKE_HOLD_MS (30 * 1000UL)     // Reachable after each light sleep before the next
+#define POWER_RECONNECT_TIMEOUT_MS 10000
+#define CPU_ACTIVE_MHZ 240
+#define CPU_IDLE_MHZ 80
+// Typical esp32dev board current with the LEDs off, for the estimate only: 240 MHz with WiFi up, 80 MHz in
+// modem sleep, light sleep
+#define POWER_ACTIVE_MA 80.0f
+#define POWER_IDLE_MA 30.0f
+#define POWER_SLEEP_MA 1.5f
+
+PowerScheduler powerScheduler({POWER_POLL_MS, POWER_IDLE_MAX_MS, POWER_FETCH_LEAD_MS, POWER_REQUEST_HOLD_MS,
+                               POWER_MIN_SLEEP_MS, POWER_MAX_SLEEP_MS, POWER_SLEEP_LEAD_MS, POWER_AWAKE_HOLD_MS,
+                               {POWER_ACTIVE_MA, POWER_IDLE_MA, POWER_SLEEP_MA}});
+PowerPlan powerPlan = {POWER_ACTIVE, WAKE_POLL, POWER_POLL_MS};
+volatile unsigned long lastWebRequestMs = 0;
+
+time_t nextDisplayChange = 0;   // When updateDisplaySchedule() flips displayOn next, 0 for never
+uint32_t displayScheduleKey = 0;   // Settings the current window was worked out from, 0 before the clock was set
+char appliedTz[SETTING_STRING_MAX] = "";
+
+// Sees every web request before the real handlers and passes on all of them, so the board stays awake while
+// someone is using it
+class WebActivityHandler : public AsyncWebHandler {
+public:
+  bool canHandle(AsyncWebServerRequest* request) override {
+    lastWebRequestMs = millis() | 1;
+    return false;
   }
+};
+WebActivityHandler webActivity;
+
+// Set TZ from the tz setting if it changed. Returns whether it did.
+bool applyTimeZone() {
+  char tz[SETTING_STRING_MAX];
+  settingsRegistry.getString(SET_TZ, tz, sizeof(tz));
+  if (strcmp(tz, appliedTz) == 0) {
+    return false;
+  }
+  strlcpy(appliedTz, tz, sizeof(appliedTz));
+  setenv("TZ", tz, 1);
+  tzset();
+  LOG_INFO("Time zone %s\n", tz);
+  return true;
+}
 
-  return value;
+DisplaySchedule displaySchedule() {
+  DisplaySchedule schedule;
+  schedule.startMinute = min(getSettingValue(SET_START_TIME) * 60 + getSettingValue(SET_START_MINUTE), 24 * 60);
+  schedule.endMinute = min(getSettingValue(SET_END_TIME) * 60 + getSettingValue(SET_END_MINUTE), 24 * 60);
+  schedule.days = getSettingValue(SET_DAYS);
+  return schedule;
 }
 
- 
-//======================================================METAR Processing /API Functions ====================================================//
-//NEO PIXEL LIBRARY
-void setColor(int ledIndex, RGBColor color) {
-  if (ledIndex >= 0 && ledIndex < strip.numPixels()) {
-      strip.setPixelColor(ledIndex, strip.Color(color.r, color.g, color.b));
-      strip.show();
+void setDisplayOn(bool on) {
+  if (on == displayOn) {
+    return;
+  }
+  LOG_INFO(on ? "Turn ON\n" : "Turn OFF\n");
+  displayOn = on;
+  requestRender(RENDER_FULL);
+  liveFeed.markTopic(FEED_STATUS);
+  if (on) {
+    // Whatever was fetched before the map went dark is stale by now
+    requestFetch(FETCH_TRIGGER_SCHEDULE);
   }
 }
 
-void fillSolid(RGBColor color) {
-  for (int i = 0; i < strip.numPixels(); i++) {
-      strip.setPixelColor(i, strip.Color(color.r, color.g, color.b));
+// Called from loop(). The window is worked out again when the clock is first set or a schedule setting changes,
+// otherwise displayOn only flips at the boundaries nextScheduleChange() gave.
+void updateDisplaySchedule() {
+  bool tzChanged = applyTimeZone();
+  time_t now = unixNow();
+  if (now == 0) {
+    return;  // Stay lit until SNTP has set the clock
+  }
+  DisplaySchedule schedule = displaySchedule();
+  uint32_t key = ((uint32_t)schedule.startMinute << 20 | (uint32_t)schedule.endMinute << 8 | schedule.days) + 1;
+  if (key != displayScheduleKey || tzChanged) {
+    displayScheduleKey = key;
+    struct tm local;
+    localtime_r(&now, &local);
+    setDisplayOn(displayScheduled(schedule, local));
+  } else if (nextDisplayChange == 0 || now < nextDisplayChange) {
+    return;
+  } else {
+    setDisplayOn(!displayOn);
   }
-  strip.show();
+  nextDisplayChange = nextScheduleChange(schedule, now);
+}
+
+// CPU clock and radio power save for a mode the board stays awake in
+void applyPowerMode(PowerMode mode) {
+  bool idle = mode == POWER_IDLE;
+  setCpuFrequencyMhz(idle ? CPU_IDLE_MHZ : CPU_ACTIVE_MHZ);
+  WiFi.setSleep(idle ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
 }
 
- // Set the LED color based on flight category
- void setLEDColor(String flightCat, int LED){
-  if (flightCat == "VFR") {
-    //leds[LED] = vfr_color;
-    setColor(LED, VFR); // Set LED 1 to VFR (Green)
-  } else if (flightCat == "MVFR") {
-    //leds[LED] = mvfr_color;
-    setColor(LED, MVFR);
-  } else if (flightCat == "IFR") {
-    //leds[LED] = ifr_color;
-    setColor(LED, IFR);
-  } else if (flightCat == "LIFR") {
-    //leds[LED] = lifr_color;
-    setColor(LED, LIFR);
+// Light sleep for ms with WiFi off, then bring WiFi back
+void lightSleep(uint32_t ms) {
+  powerScheduler.enter(POWER_LIGHT_SLEEP, millis());
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+  esp_sleep_enable_timer_wakeup((uint64_t)ms * 1000);
+  int64_t start = esp_timer_get_time();
+  esp_light_sleep_start();
+  uint32_t slept = (esp_timer_get_time() - start) / 1000;
+  powerScheduler.woke(ms, slept, millis());
+  powerScheduler.enter(POWER_ACTIVE, millis());
+  setCpuFrequencyMhz(CPU_ACTIVE_MHZ);
+
+  unsigned long reconnectStart = millis();
+  WiFi.mode(WIFI_STA);
+  WiFi.begin();
+  while (WiFi.status() != WL_CONNECTED && millis() - reconnectStart < POWER_RECONNECT_TIMEOUT_MS) {
+    delay(50);
   }
+  if (WiFi.status() == WL_CONNECTED) {
+    powerScheduler.reconnected(millis() - reconnectStart);
+    WiFi.setSleep(WIFI_PS_MIN_MODEM);
+  } else {
+    LOG_WARN("WiFi not back %u ms after light sleep\n", POWER_RECONNECT_TIMEOUT_MS);
+  }
+  debugPrint("Light sleep %u ms planned, %u ms slept\n", ms, slept);
 }
 
-// Function to determine flight category
- String determineFlightCategory(float visibility, int ceiling,String type) {
-  if (type == "FEW" || type == "CLR" || type == "SCT") {
-    ceiling = 10000;
- }
-  if (visibility > 5.0 && ceiling > 3000) {
-    return "VFR"; // Visual Flight Rules
-  } else if (visibility >= 3.0 && visibility <= 5.0 || (ceiling >= 1000 && ceiling <= 3000)) {
-    return "MVFR"; // Marginal Visual Flight Rules
-  } else if (visibility >= 1.0 && visibility < 3.0 || (ceiling >= 500 && ceiling < 1000)) {
-    return "IFR"; // Instrument Flight Rules
-  } else if (visibility < 1.0 || ceiling < 500) {
-    return "LIFR"; // Low Instrument Flight Rules
+// Replaces the fixed delay at the end of loop(): wait for the next thing that needs the board in the lowest
+// power mode that can
+void powerStep() {
+  unsigned long now = millis();
+  FetchScheduler::Status fetch = fetchScheduler.status(now, unixNow());
+  PowerInputs in;
+  in.nowMs = now;
+  in.level = (PowerLevel)getSettingValue(SET_POWER_SAVE);
+  in.displayOn = displayOn;
+  in.animating = !renderSettled();
+  in.fetchRunning = fetch.state == FETCH_STATE_RUNNING;
+  in.clientsConnected = liveSocket.count() > 0;
+  in.lanActive = lanRole != LAN_ROLE_OFF;
+  in.lastRequestMs = lastWebRequestMs;
+  // A dark map does not fetch, its next fetch is the one the window opening asks for
+  in.fetchWaitMs = displayOn ? fetch.nextInMs : POWER_WAIT_NONE;
+  in.scheduleWaitMs = POWER_WAIT_NONE;
+  if (nextDisplayChange != 0) {
+    // Whole seconds, the change lands on a minute boundary and is picked up by the next pass after it
+    time_t seconds = nextDisplayChange - (time_t)unixNow();
+    in.scheduleWaitMs = seconds > 0 ? (uint32_t)seconds * 1000 : 0;   // At most 9 days out
   }
+  in.housekeepingWaitMs = settingsRegistry.pending() > 0 || restartRequestedAt != 0 ? 0 : POWER_WAIT_NONE;
 
-  return "N/A"; // Catch-all for undetermined cases
+  powerPlan = powerScheduler.plan(in);
+  if (powerPlan.mode == POWER_LIGHT_SLEEP) {
+    lightSleep(powerPlan.waitMs);
+    return;
+  }
+  if (powerPlan.mode != powerScheduler.mode()) {
+    applyPowerMode(powerPlan.mode);
+    powerScheduler.enter(powerPlan.mode, now);
+  }
+  delay(powerPlan.waitMs);
 }
 
-//Get METAR Data and Set LED Colors
-void fetchMetarData() {
-  // Construct API URL
-  String url = "https://aviationweather.gov/api/data/metar?format=json&ids=";
-  for (int i = 0; i < NUM_AIRPORTS; i++) {
-    if (i > 0) url += ",";
-    url += airports[i];
-  }
+//====================================================== LAN Fan-out ======================================================================//
+// With lan_role 1 the map multicasts its station store after every update and in a slow keyframe round, and
+// advertises the group over mDNS. With lan_role 2 it finds a leader that way and takes the stations on its own
+// map from its frames instead of fetching, until the leader has been silent for LAN_LEADER_TIMEOUT_MS. Frames
+// are handled in loop(); the UDP task only queues them.
+
+#define LAN_SERVICE "metarmap"
+#define LAN_GROUP "239.255.77.77"
+#define LAN_PORT 47077
+#define LAN_KEY_INTERVAL_MS 2000            // Between keyframe frames, a round of 256 stations is 4 frames
+#define LAN_RESYNC_MIN_MS 5000              // Between keyframe rounds started early for followers
+#define LAN_DISCOVERY_INTERVAL_MS (30 * 1000UL)
+#define LAN_QUEUE_DEPTH 4
+
+struct LanDatagram {
+  uint16_t len;
+  uint8_t data[LAN_FRAME_MAX_BYTES];
+};
 
-  debugPrint("Fetching weather data from: %s\n", url.c_str());
+AsyncUDP lanUdp;
+QueueHandle_t lanQueue;
+IPAddress lanGroup;
+uint16_t lanPort = LAN_PORT;
+LanFollower<MAX_STATIONS> lanFollower;
+bool lanFollowing = false;            // Taking stations from a leader rather than fetching
+unsigned long lanLastKeyMs = 0;
+unsigned long lanLastResyncMs = 0;
+unsigned long lanLastDiscoveryMs = 0;
+
+struct LanStats {
+  uint32_t framesSent;
+  uint32_t bytesSent;
+  uint32_t framesReceived;
+  uint32_t badFrames;
+  uint32_t queueDrops;          // Datagrams dropped because loop() was behind
+  uint32_t stationsApplied;
+  uint32_t fallbacks;           // Times a follower went back to fetching
+};
 
-  HTTPClient http;
-  http.begin(url);
+LanStats lanStats;
 
-  int httpCode = http.GET();
-  if (httpCode == HTTP_CODE_OK) {
-    debugPrint("HTTP request successful.\n");
+void lanSend(const uint8_t* frame, size_t len) {
+  if (len > 0 && lanUdp.writeTo(frame, len, lanGroup, lanPort) == len) {
+    lanStats.framesSent++;
+    lanStats.bytesSent += len;
+  }
+}
 
-    String payload = http.getString();
-   
-    DeserializationError error = deserializeJson(doc, payload);
-    if (error) {
-      debugPrint("JSON deserialization failed: %s\n", error.c_str());
-      return;
-    }
-     JsonArray metars = doc.as<JsonArray>();
-    for (int i = 0; i < NUM_AIRPORTS; i++) {
-      const char* airportIcao = (const char*)pgm_read_ptr(&(airports[i]));
-
-      // Search through the METAR data for the matching ICAO code
-      bool found = false;
-      for (JsonObject metar : metars) {
-        const String icaoId = metar["icaoId"];
-
-        if (icaoId == airportIcao) {
-          found = true;
-          
-          // Fetch and process METAR data for this airport
-          float temp = metar["temp"];
-          temp = (temp  * 9.0 / 5.0) + 32.0;
-          int wdir = metar["wdir"];
-          int wspd = metar["wspd"];
-          const char* rawOb = metar["rawOb"];
-          const char* name = metar["name"];
-          int ceiling = -1; // Initialize ceiling to invalid value
-          const char* cloudType;
-          float altimeter = metar["altim"];
-          altimeter = altimeter * 0.02952998;
-          
-          float visib;
-            if (metar["visib"].is<const char*>()) {
-              String visibStr = metar["visib"].as<const char*>();
-              if (visibStr == "10+") {
-                visib = 10.0; // Use 10.1 to represent "10+" as a float
-              } else {
-                visib = visibStr.toFloat(); // Convert string to float
-              }
-            } else if (metar["visib"].is<float>()) {
-              visib = metar["visib"].as<float>(); // Directly assign float values
-            } else {
-              visib = -1.0; // Default value for missing or invalid data
-            }
-          
-          // Determine ceiling based on cloud types OVC, BKN, CLR
-          if (metar.containsKey("clouds") && !metar["clouds"].isNull()) {
-            JsonArray clouds = metar["clouds"].as<JsonArray>();
-            for (JsonObject cloud : clouds) {
-              const char* cover = cloud["cover"];
-              int base = cloud["base"] | -1; // Default to -1 if base is missing
-
-              if (base > 0 && (strcmp(cover, "OVC") == 0 || strcmp(cover, "BKN") == 0)) {
-                if (ceiling == -1 || base < ceiling) {
-                  ceiling = base; // Find the lowest cloud base of OVC or BKN
-                  cloudType = cover;
-                }
-              }
-              // If cloud cover is CLR (clear), set visibility to CLR
-              if (strcmp(cover, "FEW") == 0 || strcmp(cover, "SCT") == 0)               {
-                ceiling = base;  // Clear visibility
-                cloudType = cover;
-              }
-              if (strcmp(cover, "CLR") == 0 ){
-                ceiling = 60000;  // Clear visibility
-                cloudType = cover;
-              }
-            }
-          }
-
-          // Determine the flight category based on visibility and ceiling
-          String flightCategory = determineFlightCategory(visib, ceiling,cloudType);
-
-          debugPrint("\nAirport: %s\n", name ? name : "Unknown");
-          debugPrint("  ICAO ID: %s\n", icaoId ? icaoId : "Unknown");
-          debugPrint("  Flight Conditions: %s\n", flightCategory);
-          debugPrint("  Temperature: %.2f°F\n", temp != -999 ? temp : NAN);
-          debugPrint("  Altimeter: %.2f inHg\n",altimeter != -999 ? altimeter : NAN);
-          debugPrint("  Wind Direction: %s\n", wdir != -1 ? String(wdir).c_str() : "Unknown");
-          debugPrint("  Wind Speed: %s knots\n", wspd != -1 ? String(wspd).c_str() : "Unknown");
-          debugPrint("  Visibility: %.2f miles\n", visib != -999 ? visib : NAN);
-          debugPrint("  Clouds: %s at %s\n",cloudType,String(ceiling).c_str());
-          debugPrint("  Metar Report: %s\n", rawOb ? rawOb : "Unknown");
-          
-
-          setLEDColor(flightCategory,i);
-          
-
-          break; // Found the airport, no need to continue searching for this airport
-        }
-      }
+// Build a frame of the given stations from the front store. Call with stateMutex held.
+size_t buildLanFrame(LanFrameType type, const uint16_t* stations, int count, uint32_t baseVersion, uint8_t* out) {
+  static LanStation entries[LAN_FRAME_STATIONS];  // Only loop() builds frames, kept off its stack
+  const MapStationStore& front = stationStores[frontStore];
+  for (int i = 0; i < count; i++) {
+    int station = stations[i];
+    LanStation& entry = entries[i];
+    entry.icao = stationMap.stationIcao[station];
+    entry.version = lanLeader.changedIn[station];
+    entry.obsTime = front.obsTime[station];
+    entry.ceiling = front.ceiling[station];
+    entry.windDir = front.windDir[station];
+    entry.altimeter = front.altimeter[station];
+    entry.visibility = front.visibility[station];
+    entry.category = front.category[station];
+    entry.flags = front.flags[station];
+    entry.windSpeed = front.windSpeed[station];
+    entry.windGust = front.windGust[station];
+    entry.temperature = front.temperature[station];
+  }
+  LanFrameHeader header = {type, (uint16_t)count, lanLeader.leaderId, lanLeader.version, baseVersion};
+  return encodeLanFrame(header, entries, out, LAN_FRAME_MAX_BYTES);
+}
 
-      // If the airport's ICAO code wasn't found in the METAR response
-      if (!found) {
-        debugPrint("Missing METAR data for ICAO: %s\n", airportIcao);
-       // leds[i] = CRGB::Black;  // Set a default color if METAR is missing
-        setColor(i, BLACK);
+// Leader: send what changed since the last delta, then the next keyframe frame when it is due
+void publishLan() {
+  static uint8_t frame[LAN_FRAME_MAX_BYTES];
+  uint16_t stations[LAN_FRAME_STATIONS];
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  bool pending = lanLeader.deltaPending();
+  uint32_t base = lanLeader.sentVersion;
+  uint32_t target = lanLeader.version;
+  xSemaphoreGive(stateMutex);
+  if (pending) {
+    int cursor = 0;
+    for (;;) {
+      xSemaphoreTake(stateMutex, portMAX_DELAY);
+      int count = lanLeader.collectDelta(cursor, stationMap.stationCount, stations, LAN_FRAME_STATIONS);
+      size_t len = count > 0 ? buildLanFrame(LAN_FRAME_DELTA, stations, count, base, frame) : 0;
+      xSemaphoreGive(stateMutex);
+      if (count == 0) {
+        break;
       }
+      lanSend(frame, len);
     }
-    lastMetars = metars;
-  } else {
-    debugPrint("HTTP request failed with code: %d\n", httpCode);
+    // Stations changed while this went out have a newer version and go in the next delta
+    xSemaphoreTake(stateMutex, portMAX_DELAY);
+    lanLeader.deltaSent(target);
+    xSemaphoreGive(stateMutex);
+  }
+
+  if (millis() - lanLastKeyMs >= LAN_KEY_INTERVAL_MS) {
+    lanLastKeyMs = millis();
+    xSemaphoreTake(stateMutex, portMAX_DELAY);
+    int count = lanLeader.collectKey(stationMap.stationCount, stations, LAN_FRAME_STATIONS);
+    size_t len = count > 0 ? buildLanFrame(LAN_FRAME_KEY, stations, count, 0, frame) : 0;
+    xSemaphoreGive(stateMutex);
+    lanSend(frame, len);
   }
-  
- // FastLED.show();
- strip.show(); // Initialize all pixels to 'off'
-  http.end();
 }
 
-//Check Metars disreading 15 min update but still respects the time schedule
-void checkMetars(){
+// Follower: copy the kept entries of a frame into the station store as if they had been parsed. Their report
+// text is not sent, so followers show none. Call with updateMutex held.
+void applyLanStations(const LanStation* entries, const uint16_t* stations, int count) {
+  beginStationUpdate();
+  MapStationStore& back = stationStores[frontStore ^ 1];
+  for (int k = 0; k < count; k++) {
+    const LanStation& entry = entries[k];
+    int station = stations[k];
+    back.icao[station] = entry.icao;
+    back.obsTime[station] = entry.obsTime;
+    back.rawHash[station] = 0;
+    back.rawOffset[station] = RAW_NONE;
+    back.ceiling[station] = entry.ceiling;
+    back.windDir[station] = entry.windDir;
+    back.altimeter[station] = entry.altimeter;
+    back.visibility[station] = entry.visibility;
+    back.windSpeed[station] = entry.windSpeed;
+    back.windGust[station] = entry.windGust;
+    back.temperature[station] = entry.temperature;
+    back.flags[station] = entry.flags;   // Category is reclassified with this map's own minima
+    stationUpdated[station] = true;
+    stationChanged[station] = true;
+  }
+  finishStationUpdate(false, 0, 0);
+  lanStats.stationsApplied += count;
+}
 
-  if (isTimeInRange()) {
-    Serial.println("Turn ON");
-    // Add code to turn on your device
+// Handle one datagram. Returns false if it has to wait because the parser is filling the back store.
+bool handleLanDatagram(const LanDatagram& datagram) {
+  static LanStation entries[LAN_FRAME_STATIONS];
+  LanFrameHeader header;
+  int count = decodeLanFrame(datagram.data, datagram.len, header, entries, LAN_FRAME_STATIONS);
+  if (count < 0) {
+    lanStats.badFrames++;
+    return true;
+  }
+  if (lanRole == LAN_ROLE_LEADER) {
+    if (header.type == LAN_FRAME_RESYNC && header.leaderId == lanLeader.leaderId &&
+        millis() - lanLastResyncMs >= LAN_RESYNC_MIN_MS) {
+      lanLastResyncMs = millis();
+      lanLastKeyMs = millis() - LAN_KEY_INTERVAL_MS;  // Next pump sends the first frame of the new round
+      xSemaphoreTake(stateMutex, portMAX_DELAY);
+      lanLeader.restartKeyRound();
+      xSemaphoreGive(stateMutex);
+    }
+    return true;
+  }
+  if (header.type == LAN_FRAME_RESYNC) {
+    return true;  // Another follower asking
+  }
+  if (xSemaphoreTake(updateMutex, 0) != pdTRUE) {
+    return false;
+  }
+  lanStats.framesReceived++;
+  uint16_t stations[LAN_FRAME_STATIONS];
+  int kept = lanFollower.accept(header, entries, count, [](uint32_t icao) { return stationMap.findKey(icao); }, stations);
+  if (kept > 0) {
+    applyLanStations(entries, stations, kept);
+  }
+  xSemaphoreGive(updateMutex);
+  lanLastFrameMs = millis();
+  if (!lanFollowing) {
+    LOG_INFO("Following LAN leader %08x\n", header.leaderId);
+    lanFollowing = true;
+  }
+  return true;
+}
 
-  fetchMetarData();
+// Follower: look for a leader over mDNS and join the group it advertises. Blocks for the query, so only runs
+// while the follower has no leader.
+bool discoverLanLeader() {
+  lanLastDiscoveryMs = millis();
+  int found = MDNS.queryService(LAN_SERVICE, "udp");
+  if (found <= 0) {
+    debugPrint("No LAN leader found\n");
+    return false;
+  }
+  IPAddress group;
+  if (!group.fromString(MDNS.txt(0, "group"))) {
+    return false;
+  }
+  if (group != lanGroup || MDNS.port(0) != lanPort || !lanUdp.connected()) {
+    lanGroup = group;
+    lanPort = MDNS.port(0);
+    lanUdp.close();
+    lanUdp.listenMulticast(lanGroup, lanPort);
+  }
+  LOG_INFO("LAN leader %s found, group %s:%u\n", MDNS.hostname(0).c_str(), lanGroup.toString().c_str(), lanPort);
+  return true;
+}
 
-} else {
-  Serial.println("Turn OFF");
-  //fill_solid(leds, NUM_AIRPORTS, CRGB::Black);
-  fillSolid(BLACK);
- // FastLED.show();
-  
+void onLanPacket(AsyncUDPPacket& packet) {
+  if (packet.length() > LAN_FRAME_MAX_BYTES) {
+    lanStats.badFrames++;
+    return;
+  }
+  static LanDatagram datagram;  // Only the UDP task gets here
+  datagram.len = packet.length();
+  memcpy(datagram.data, packet.data(), packet.length());
+  if (xQueueSend(lanQueue, &datagram, 0) != pdTRUE) {
+    lanStats.queueDrops++;
+  }
 }
 
+// Start the role chosen by lan_role. Needs WiFi and mDNS up.
+void startLan() {
+  lanRole = getSettingValue(SET_LAN_ROLE);
+  if (lanRole == LAN_ROLE_OFF) {
+    return;
+  }
+  lanQueue = xQueueCreate(LAN_QUEUE_DEPTH, sizeof(LanDatagram));
+  lanGroup.fromString(LAN_GROUP);
+  lanUdp.onPacket(onLanPacket);
+  if (!lanUdp.listenMulticast(lanGroup, lanPort)) {
+    LOG_WARN("Could not join the LAN multicast group\n");
+  }
+  if (lanRole == LAN_ROLE_LEADER) {
+    lanLeader.leaderId = esp_random();
+    MDNS.addService(LAN_SERVICE, "udp", lanPort);
+    MDNS.addServiceTxt(LAN_SERVICE, "udp", "group", LAN_GROUP);
+    LOG_INFO("LAN leader %08x on %s:%u\n", lanLeader.leaderId, LAN_GROUP, lanPort);
+  } else if (discoverLanLeader()) {
+    // Count the leader as heard so the boot fetch waits for its frames instead of racing them
+    lanLastFrameMs = millis();
+    lanFollowing = true;
+  }
 }
 
-void printMetars(){
-  for (JsonObject metar : lastMetars) {
-        const String icaoId = metar["icaoId"];
-        // Fetch and process METAR data for this airport
-        float temp = metar["temp"];
-        int wdir = metar["wdir"];
-        int wspd = metar["wspd"];
-        const char* rawOb = metar["rawOb"];
-        const char* name = metar["name"];
-        int ceiling = -1; // Initialize ceiling to invalid value
-         float visib;
-          if (metar["visib"].is<const char*>()) {
-            String visibStr = metar["visib"].as<const char*>();
-            if (visibStr == "10+") {
-              visib = 10.0; // Use 10.1 to represent "10+" as a float
-            } else {
-              visib = visibStr.toFloat(); // Convert string to float
-            }
-          } else if (metar["visib"].is<float>()) {
-            visib = metar["visib"].as<float>(); // Directly assign float values
-          } else {
-            visib = -1.0; // Default value for missing or invalid data
-          }
-      // debugPrint("\nAirport: %s\n", name ? name : "Unknown");
-      // debugPrint("  ICAO ID: %s\n", icaoId ? icaoId : "Unknown");
-      // debugPrint("  Temperature: %.1f°C\n", temp != -999 ? temp : NAN);
-      // debugPrint("  Wind Direction: %s\n", wdir != -1 ? String(wdir).c_str() : "Unknown");
-      // debugPrint("  Wind Speed: %s knots\n", wspd != -1 ? String(wspd).c_str() : "Unknown");
-      // debugPrint("  Visibility: %.1f miles\n", visib != -999 ? visib : NAN);
-      // debugPrint("  Metar Report: %s\n", rawOb ? rawOb : "Unknown");
-    delay(30000);
+// Called from loop()
+void pumpLan() {
+  if (lanRole == LAN_ROLE_OFF) {
+    return;
+  }
+  static LanDatagram datagram;
+  static bool held = false;  // Dequeued but not handled yet
+  for (;;) {
+    if (!held && xQueueReceive(lanQueue, &datagram, 0) != pdTRUE) {
+      break;
+    }
+    held = !handleLanDatagram(datagram);
+    if (held) {
+      break;
+    }
+  }
+
+  if (lanRole == LAN_ROLE_LEADER) {
+    publishLan();
+    return;
+  }
+  if (lanFollowing && !lanLeaderAlive()) {
+    LOG_WARN("LAN leader went silent, fetching directly\n");
+    lanFollowing = false;
+    lanStats.fallbacks++;
+    requestFetch(FETCH_TRIGGER_FALLBACK);
+  }
+  if (!lanFollowing && millis() - lanLastDiscoveryMs >= LAN_DISCOVERY_INTERVAL_MS) {
+    discoverLanLeader();
+  }
+  // A delta skipped ahead, ask for a keyframe round rather than wait for the next one
+  if (lanFollower.resyncWanted && lanFollowing && millis() - lanLastResyncMs >= LAN_RESYNC_MIN_MS) {
+    lanLastResyncMs = millis();
+    lanFollower.resyncWanted = false;
+    static uint8_t frame[LAN_HEADER_BYTES + 4];
+    LanFrameHeader header = {LAN_FRAME_RESYNC, 0, lanFollower.leaderId, lanFollower.version, 0};
+    lanSend(frame, encodeLanFrame(header, nullptr, frame, sizeof(frame)));
   }
 }
 
-//=======================================================HTML/WEB Functions=================================================================//
- // Function to load HTML from SPIFFS
-String loadHTML(const char* filename) {
-  File file = SPIFFS.open(filename, "r");
-  if (!file) {
-    Serial.println("Failed to open file for reading");
-    return "";
+#if METRICS_ENABLED
+// Stage latency histograms, heap and task stacks in the Prometheus text format
+void writeMetrics(Print& out) {
+  out.print("# HELP metar_stage_latency_microseconds Time spent in each pipeline stage\n"
+            "# TYPE metar_stage_latency_microseconds histogram\n");
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    const char* name = metricStageName((MetricStage)stage);
+    const LatencyHistogram& histogram = stageLatency[stage];
+    uint32_t cumulative = 0;
+    for (int i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+      cumulative += histogram.buckets[i];
+      out.printf("metar_stage_latency_microseconds_bucket{stage=\"%s\",le=\"%u\"} %u\n", name, LATENCY_BUCKETS_US[i], cumulative);
+    }
+    out.printf("metar_stage_latency_microseconds_bucket{stage=\"%s\",le=\"+Inf\"} %u\n", name, histogram.count);
+    out.printf("metar_stage_latency_microseconds_sum{stage=\"%s\"} %llu\n", name, histogram.sumMicros);
+    out.printf("metar_stage_latency_microseconds_count{stage=\"%s\"} %u\n", name, histogram.count);
   }
-  
-  String content = "";
-  while (file.available()) {
-    content += (char)file.read();
+  out.print("# TYPE metar_stage_latency_max_microseconds gauge\n");
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    out.printf("metar_stage_latency_max_microseconds{stage=\"%s\"} %u\n",
+               metricStageName((MetricStage)stage), stageLatency[stage].maxMicros);
   }
-  file.close();
-  
-  return content;
+
+  out.print("# TYPE metar_heap_free_bytes gauge\n");
+  out.printf("metar_heap_free_bytes %u\n", ESP.getFreeHeap());
+  out.print("# TYPE metar_heap_min_free_bytes gauge\n");
+  out.printf("metar_heap_min_free_bytes %u\n", ESP.getMinFreeHeap());
+  out.print("# TYPE metar_heap_largest_free_block_bytes gauge\n");
+  out.printf("metar_heap_largest_free_block_bytes %u\n", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+  out.print("# TYPE metar_heap_largest_free_block_min_bytes gauge\n");  // Smallest seen after a refresh
+  out.printf("metar_heap_largest_free_block_min_bytes %u\n", heapStats.minLargestBlock);
+  out.print("# TYPE metar_arena_high_water_bytes gauge\n");
+  out.printf("metar_arena_high_water_bytes{arena=\"fetch\"} %u\n", fetchArena.highWater);
+  out.printf("metar_arena_high_water_bytes{arena=\"parse\"} %u\n", parseArena.highWater);
+  out.print("# TYPE metar_arena_heap_fallbacks_total counter\n");
+  out.printf("metar_arena_heap_fallbacks_total %u\n", parseJsonAllocator.heapFallbacks);
+
+  // High-water marks are the least stack each task has had left since it started
+  out.print("# TYPE metar_task_stack_free_min_bytes gauge\n");
+  TaskHandle_t tasks[] = {fetcherTaskHandle, parserTaskHandle, rendererTaskHandle};
+  for (TaskHandle_t task : tasks) {
+    if (task != nullptr) {
+      out.printf("metar_task_stack_free_min_bytes{task=\"%s\"} %u\n", pcTaskGetTaskName(task),
+                 uxTaskGetStackHighWaterMark(task));
+    }
+  }
+
+  out.print("# TYPE metar_fetch_cycles_total counter\n");
+  out.printf("metar_fetch_cycles_total %u\n", fetchStats.cycles);
+  out.print("# TYPE metar_fetch_batches_failed gauge\n");  // Last cycle only
+  out.printf("metar_fetch_batches_failed %u\n", fetchStats.batchesFailed);
+  out.print("# TYPE metar_tls_handshakes_total counter\n");
+  out.printf("metar_tls_handshakes_total %u\n", tlsStats.handshakes);
+  out.print("# TYPE metar_tls_resumed_handshakes_total counter\n");
+  out.printf("metar_tls_resumed_handshakes_total %u\n", tlsStats.resumed);
+  out.print("# TYPE metar_boot_first_frame_milliseconds gauge\n");
+  out.printf("metar_boot_first_frame_milliseconds{fresh=\"false\"} %u\n", bootFirstFrameMs);
+  out.printf("metar_boot_first_frame_milliseconds{fresh=\"true\"} %u\n", bootFreshFrameMs);
+  out.print("# TYPE metar_snapshot_writes_total counter\n");
+  out.printf("metar_snapshot_writes_total %u\n", snapshotWrites);
+  out.print("# TYPE metar_frames_shown_total counter\n");
+  out.printf("metar_frames_shown_total %lu\n", frameShowCount);
+  out.print("# TYPE metar_animation_frames_total counter\n");
+  out.printf("metar_animation_frames_total %u\n", animationStats.frames);
+  out.print("# TYPE metar_animation_frames_dropped_total counter\n");
+  out.printf("metar_animation_frames_dropped_total %u\n", animationStats.dropped);
+  out.print("# TYPE metar_animation_parks_total counter\n");
+  out.printf("metar_animation_parks_total %u\n", animationStats.parks);
+  out.print("# TYPE metar_animation_frame_max_microseconds gauge\n");
+  out.printf("metar_animation_frame_max_microseconds %u\n", animationStats.maxFrameMicros);
+  out.print("# TYPE metar_ingest_bytes_total counter\n");
+  for (int i = 0; i < METAR_FORMAT_COUNT; i++) {
+    out.printf("metar_ingest_bytes_total{format=\"%s\"} %u\n", metarFormatName((MetarFormat)i), ingestStats[i].bytes);
+  }
+  out.print("# TYPE metar_ingest_reports_total counter\n");
+  for (int i = 0; i < METAR_FORMAT_COUNT; i++) {
+    out.printf("metar_ingest_reports_total{format=\"%s\"} %u\n", metarFormatName((MetarFormat)i), ingestStats[i].metars);
+  }
+  out.print("# TYPE metar_ingest_parse_microseconds_total counter\n");
+  for (int i = 0; i < METAR_FORMAT_COUNT; i++) {
+    out.printf("metar_ingest_parse_microseconds_total{format=\"%s\"} %llu\n", metarFormatName((MetarFormat)i),
+               ingestStats[i].parseMicros);
+  }
+  out.print("# TYPE metar_power_residency_seconds_total counter\n");
+  for (int i = 0; i < POWER_MODE_COUNT; i++) {
+    out.printf("metar_power_residency_seconds_total{mode=\"%s\"} %llu\n", powerModeName((PowerMode)i),
+               powerScheduler.residencyMs((PowerMode)i, millis()) / 1000);
+  }
+  out.print("# TYPE metar_power_estimated_milliamps gauge\n");
+  out.printf("metar_power_estimated_milliamps %.1f\n", powerScheduler.estimatedMilliamps(millis()));
+  out.print("# TYPE metar_power_light_sleeps_total counter\n");
+  out.printf("metar_power_light_sleeps_total %u\n", powerScheduler.sleeps);
+  out.print("# TYPE metar_power_wake_late_max_milliseconds gauge\n");
+  out.printf("metar_power_wake_late_max_milliseconds %u\n", powerScheduler.wakeLateMsMax);
+  out.print("# TYPE metar_power_reconnect_max_milliseconds gauge\n");
+  out.printf("metar_power_reconnect_max_milliseconds %u\n", powerScheduler.reconnectMsMax);
+  out.print("# TYPE metar_live_feed_coalesced_total counter\n");
+  out.printf("metar_live_feed_coalesced_total %u\n", liveFeed.coalesced);
+
+  out.print("# TYPE metar_lan_frames_sent_total counter\n");
+  out.printf("metar_lan_frames_sent_total %u\n", lanStats.framesSent);
+  out.print("# TYPE metar_lan_frames_received_total counter\n");
+  out.printf("metar_lan_frames_received_total %u\n", lanStats.framesReceived);
+  out.print("# TYPE metar_lan_gaps_total counter\n");
+  out.printf("metar_lan_gaps_total %u\n", lanFollower.gaps);
+  out.print("# TYPE metar_lan_fallbacks_total counter\n");
+  out.printf("metar_lan_fallbacks_total %u\n", lanStats.fallbacks);
+
+  FetchScheduler::Status scheduler = fetchScheduler.status(millis(), unixNow());
+  out.print("# TYPE metar_fetch_triggers_total counter\n");
+  for (int i = 0; i < FETCH_TRIGGER_COUNT; i++) {
+    out.printf("metar_fetch_triggers_total{trigger=\"%s\"} %u\n", fetchTriggerName((FetchTrigger)i), scheduler.triggers[i]);
+  }
+  out.print("# TYPE metar_fetch_triggers_coalesced_total counter\n");
+  out.printf("metar_fetch_triggers_coalesced_total %u\n", scheduler.coalesced);
+  out.print("# TYPE metar_fetch_consecutive_failures gauge\n");
+  out.printf("metar_fetch_consecutive_failures %u\n", scheduler.failures);
+  out.print("# TYPE metar_fetch_next_seconds gauge\n");
+  out.printf("metar_fetch_next_seconds %u\n", scheduler.nextInMs / 1000);
 }
+#endif
 
  // Serve the HTML webpage
 void serveWebPage() {
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-      String html = loadHTML("/index.html");
-
-       // Add each airport as a list item
-    String airportListHtml = "";
-    for (size_t i = 0; i < sizeof(airports) / sizeof(airports[0]); i++) {
-      // Correctly read the string pointer from PROGMEM using pgm_read_ptr
-      const char* airportIcao = (const char*)pgm_read_ptr(&(airports[i]));
-      
-      // Concatenate the airport to the HTML string
-      airportListHtml += "<div>" + String(airportIcao) + "</div>";
-    }
-
-    // Apply CSS class based on the number of airports
-    size_t numAirports = sizeof(airports) / sizeof(airports[0]);
-    if (numAirports > 30) {
-        html += "<style>.airport-list { grid-template-columns: repeat(4, 1fr); }</style>";  // Four columns
-    } else if (numAirports >= 20) {
-        html += "<style>.airport-list { grid-template-columns: repeat(3, 1fr); }</style>";  // Three columns
-    } else if (numAirports >= 10) {
-        html += "<style>.airport-list { grid-template-columns: repeat(2, 1fr); }</style>";  // Two columns
-    }
-
-    // Replace the placeholder with the dynamic airport list
-    html.replace("<!-- AIRPORT_LIST_PLACEHOLDER -->", airportListHtml);
-    html.replace("{{LED_BRIGHTNESS}}",String(ledBrightness));
-    html.replace("{{START_TIME}}",String(settings[1].value));
-    html.replace("{{END_TIME}}",String(settings[2].value));
-
-    request->send(200, "text/html", html);
+    METRIC_TIMER_START(webTimer);
+    uint32_t started = micros();
+    int32_t heapBefore = ESP.getFreeHeap();
+    AsyncWebServerResponse* response;
+    if (request->hasHeader("If-None-Match") && request->header("If-None-Match") == INDEX_HTML_GZ_ETAG) {
+      response = request->beginResponse(304);
+      webStats.pageNotModified++;
+    } else {
+      response = request->beginResponse_P(200, "text/html", INDEX_HTML_GZ, INDEX_HTML_GZ_LEN);
+      response->addHeader("Content-Encoding", "gzip");
+    }
+    // no-cache still lets the browser keep the page, it just has to revalidate with the ETag
+    response->addHeader("ETag", INDEX_HTML_GZ_ETAG);
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+    webStats.pageLoads++;
+    webStats.lastPageMicros = micros() - started;
+    webStats.lastPageHeapDelta = heapBefore - (int32_t)ESP.getFreeHeap();
+    debugPrint("Page served in %uus, heap used %d\n", webStats.lastPageMicros, webStats.lastPageHeapDelta);
+    METRIC_TIMER_STOP(webTimer, STAGE_WEB);
+});
+
+server.on("/api/state", HTTP_GET, [](AsyncWebServerRequest *request) {
+    METRIC_TIMER_START(webTimer);
+    uint32_t started = micros();
+    int32_t heapBefore = ESP.getFreeHeap();
+    // Streamed one station at a time so the response size does not depend on how many are on the map
+    AsyncWebServerResponse* response = beginPieceResponse(request, "application/json", writeStatePiece);
+    response->addHeader("Cache-Control", "no-store");
+    request->send(response);
+    webStats.stateRequests++;
+    webStats.lastStateMicros = micros() - started;
+    webStats.lastStateHeapDelta = heapBefore - (int32_t)ESP.getFreeHeap();
+    METRIC_TIMER_STOP(webTimer, STAGE_WEB);
 });
 
 server.on("/updatebrightness", HTTP_POST, [](AsyncWebServerRequest *request) {
     if (request->hasParam("brightness", true)) {
-        ledBrightness = request->getParam("brightness", true)->value().toInt();
-        //FastLED.setBrightness(ledBrightness);
-        //FastLED.show();
-        strip.setBrightness(ledBrightness);
-        strip.show();
-        setSettingValue("led_brightness", ledBrightness);
+        // Same path as /api/settings: clamped to 0-255 and stored before the redraw is requested
+        const char* keys[] = {settings[SET_LED_BRIGHTNESS].key};
+        const char* values[] = {request->getParam("brightness", true)->value().c_str()};
+        const char* error = nullptr;
+        applySettings(keys, values, 1, error);
         debugPrint("New Led Brightness: %d\n", ledBrightness);
     }
     request->redirect("/");
@@ -458,7 +2451,7 @@ server.on("/updatebrightness", HTTP_POST, [](AsyncWebServerRequest *request) {
 server.on("/updatestarttime", HTTP_POST, [](AsyncWebServerRequest *request) {
     if (request->hasParam("starttime", true)) {
         int startTime = request->getParam("starttime", true)->value().toInt();
-        setSettingValue("start_time", startTime);
+        setSettingValue(SET_START_TIME, startTime);
         debugPrint("New Start Time: %d\n", startTime);
     }
     request->redirect("/");
@@ -467,15 +2460,334 @@ server.on("/updatestarttime", HTTP_POST, [](AsyncWebServerRequest *request) {
 server.on("/updateendtime", HTTP_POST, [](AsyncWebServerRequest *request) {
     if (request->hasParam("endtime", true)) {
         int endTime = request->getParam("endtime", true)->value().toInt();
-        setSettingValue("end_time", endTime);
+        setSettingValue(SET_END_TIME, endTime);
         debugPrint("New End Time: %d\n", endTime);
     }
     request->redirect("/");
 });
 
+server.on("/api/stats", HTTP_GET, [](AsyncWebServerRequest *request) {
+    char json[1408 + MAX_METAR_BATCHES * 11];
+    int len = snprintf(json, sizeof(json),
+             "{\"cycles\":%u,\"notModified\":%u,\"bytesDownloaded\":%u,\"bytesSkipped\":%u,\"stationsUpdated\":%u,"
+             "\"totalBytesDownloaded\":%u,\"totalBytesSkipped\":%u,\"totalStationsUpdated\":%u,"
+             "\"batches\":%u,\"batchesFailed\":%u,\"refreshMs\":%u,\"batchMs\":[",
+             fetchStats.cycles, fetchStats.notModified, fetchStats.bytesDownloaded, fetchStats.bytesSkipped,
+             fetchStats.stationsUpdated, fetchStats.totalBytesDownloaded, fetchStats.totalBytesSkipped,
+             fetchStats.totalStationsUpdated, fetchStats.batches, fetchStats.batchesFailed, fetchStats.refreshMs);
+    for (uint32_t i = 0; i < fetchStats.batches; i++) {
+      len += snprintf(json + len, sizeof(json) - len, i > 0 ? ",%u" : "%u", fetchStats.batchMs[i]);
+    }
+    len += snprintf(json + len, sizeof(json) - len, "],\"format\":\"%s\",\"ingest\":{",
+                    metarFormatName((MetarFormat)getSettingValue(SET_METAR_FORMAT)));
+    for (int i = 0; i < METAR_FORMAT_COUNT; i++) {
+      const IngestStats& ingest = ingestStats[i];
+      len += snprintf(json + len, sizeof(json) - len,
+                      "%s\"%s\":{\"bytes\":%u,\"metars\":%u,\"parseMicros\":%llu,\"bytesPerMetar\":%u,\"microsPerMetar\":%u}",
+                      i > 0 ? "," : "", metarFormatName((MetarFormat)i), ingest.bytes, ingest.metars, ingest.parseMicros,
+                      ingest.metars ? ingest.bytes / ingest.metars : 0,
+                      ingest.metars ? (uint32_t)(ingest.parseMicros / ingest.metars) : 0);
+    }
+    snprintf(json + len, sizeof(json) - len,
+             "},\"pageLoads\":%u,\"pageNotModified\":%u,\"lastPageMicros\":%u,\"lastPageHeapDelta\":%d,"
+             "\"stateRequests\":%u,\"lastStateMicros\":%u,\"lastStateHeapDelta\":%d,"
+             "\"bootFirstFrameMs\":%u,\"bootFreshFrameMs\":%u,\"snapshotWrites\":%u,\"snapshotWritesSkipped\":%u,"
+             "\"animationFrames\":%u,\"animationDropped\":%u,\"lastFrameMicros\":%u,\"maxFrameMicros\":%u,"
+             "\"heap\":{\"free\":%u,\"largestBlock\":%u,\"minLargestBlock\":%u},"
+             "\"arenas\":{\"fetch\":{\"size\":%u,\"highWater\":%u,\"overflows\":%u},"
+             "\"parse\":{\"size\":%u,\"highWater\":%u,\"overflows\":%u,\"heapFallbacks\":%u}}}",
+             webStats.pageLoads, webStats.pageNotModified, webStats.lastPageMicros, webStats.lastPageHeapDelta,
+             webStats.stateRequests, webStats.lastStateMicros, webStats.lastStateHeapDelta,
+             bootFirstFrameMs, bootFreshFrameMs, snapshotWrites, snapshotWritesSkipped,
+             animationStats.frames, animationStats.dropped, animationStats.lastFrameMicros, animationStats.maxFrameMicros,
+             heapStats.lastFree, heapStats.lastLargestBlock, heapStats.minLargestBlock,
+             fetchArena.size(), fetchArena.highWater, fetchArena.overflows,
+             parseArena.size(), parseArena.highWater, parseArena.overflows, parseJsonAllocator.heapFallbacks);
+    request->send(200, "application/json", json);
+});
+
+server.on("/api/power", HTTP_GET, [](AsyncWebServerRequest *request) {
+    uint32_t now = millis();
+    time_t unixTime = unixNow();
+    char localTime[24] = "";
+    if (unixTime != 0) {
+      struct tm local;
+      localtime_r(&unixTime, &local);
+      strftime(localTime, sizeof(localTime), "%Y-%m-%dT%H:%M:%S", &local);
+    }
+    char json[640];
+    int len = snprintf(json, sizeof(json),
+             "{\"level\":%d,\"mode\":\"%s\",\"wake\":\"%s\",\"waitMs\":%u,\"displayOn\":%s,"
+             "\"nextDisplayChange\":%ld,\"tz\":\"%s\",\"localTime\":\"%s\",\"residencyMs\":{",
+             getSettingValue(SET_POWER_SAVE), powerModeName(powerScheduler.mode()), powerWakeName(powerPlan.wake),
+             powerPlan.waitMs, displayOn ? "true" : "false", (long)nextDisplayChange, appliedTz, localTime);
+    for (int i = 0; i < POWER_MODE_COUNT; i++) {
+      len += snprintf(json + len, sizeof(json) - len, "%s\"%s\":%llu", i > 0 ? "," : "",
+                      powerModeName((PowerMode)i), powerScheduler.residencyMs((PowerMode)i, now));
+    }
+    snprintf(json + len, sizeof(json) - len,
+             "},\"estimatedMa\":%.1f,\"sleeps\":%u,\"wakeLateMs\":{\"avg\":%u,\"max\":%u},"
+             "\"reconnectMs\":{\"avg\":%u,\"max\":%u},\"rendererParks\":%u}",
+             powerScheduler.estimatedMilliamps(now), powerScheduler.sleeps,
+             powerScheduler.sleeps ? (uint32_t)(powerScheduler.wakeLateMsTotal / powerScheduler.sleeps) : 0,
+             powerScheduler.wakeLateMsMax,
+             powerScheduler.reconnects ? (uint32_t)(powerScheduler.reconnectMsTotal / powerScheduler.reconnects) : 0,
+             powerScheduler.reconnectMsMax, animationStats.parks);
+    request->send(200, "application/json", json);
+});
+
+server.on("/api/history", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (!request->hasParam("icao")) {
+      // Without a station: what the history holds and how long a pass over all of it takes
+      uint32_t samples = 0, recordBytes = 0, spanSeconds = 0, scanned = 0;
+      xSemaphoreTake(stateMutex, portMAX_DELAY);
+      uint32_t start = micros();
+      for (int i = 0; i < stationHistory.stations(); i++) {
+        scanned += stationHistory.forEach(i, 0, [](const HistorySample&) {});
+      }
+      uint32_t scanMicros = micros() - start;
+      for (int i = 0; i < stationHistory.stations(); i++) {
+        samples += stationHistory.count(i);
+        recordBytes += stationHistory.used(i);
+        spanSeconds += stationHistory.newestTime(i) - stationHistory.oldestTime(i);
+      }
+      xSemaphoreGive(stateMutex);
+      char json[448];
+      snprintf(json, sizeof(json),
+               "{\"stations\":%d,\"inPsram\":%s,\"ringBytes\":%u,\"bytes\":%u,\"retentionHours\":%u,"
+               "\"samples\":%u,\"recordBytes\":%u,\"bytesPerStationDay\":%u,\"appended\":%u,\"evictedFull\":%u,"
+               "\"evictedAged\":%u,\"scanMicros\":%u,\"scanned\":%u,\"lastQueryMicros\":%u}",
+               stationHistory.stations(), historyInPsram ? "true" : "false", stationHistory.ringBytes(),
+               (unsigned)StationHistory::bytesFor(stationHistory.stations(), stationHistory.ringBytes()),
+               HISTORY_RETENTION_HOURS, samples, recordBytes,
+               spanSeconds ? (uint32_t)((uint64_t)recordBytes * 86400 / spanSeconds) : 0,
+               stationHistory.appended, stationHistory.evictedFull, stationHistory.evictedAged, scanMicros, scanned,
+               lastHistoryQueryMicros);
+      request->send(200, "application/json", json);
+      return;
+    }
+    String icao = request->getParam("icao")->value();
+    icao.toUpperCase();
+    int station = stationMap.find(icao.c_str());
+    if (station < 0) {
+      request->send(404, "text/plain", "Station is not on this map");
+      return;
+    }
+    // hours limits the samples to the most recent ones
+    uint32_t hours = request->hasParam("hours") ? request->getParam("hours")->value().toInt() : 0;
+    uint32_t now = unixNow();
+    std::shared_ptr<HistoryCursor> cursor(new HistoryCursor{station, hours > 0 && now > hours * 3600 ? now - hours * 3600 : 0});
+    request->send(request->beginChunkedResponse("application/json", [cursor](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+      return writeHistoryChunk(*cursor, (char*)buffer, maxLen);
+    }));
+});
+
+server.on("/api/lan", HTTP_GET, [](AsyncWebServerRequest *request) {
+    static const char* const roles[] = {"off", "leader", "follower"};
+    bool leader = lanRole == LAN_ROLE_LEADER;
+    char json[448];
+    snprintf(json, sizeof(json),
+             "{\"role\":\"%s\",\"following\":%s,\"leaderId\":\"%08x\",\"version\":%u,\"lastFrameAge\":%ld,"
+             "\"framesSent\":%u,\"bytesSent\":%u,\"framesReceived\":%u,\"badFrames\":%u,\"queueDrops\":%u,"
+             "\"stationsApplied\":%u,\"gaps\":%u,\"staleEntries\":%u,\"leaderChanges\":%u,\"fallbacks\":%u}",
+             roles[lanRole], lanLeaderAlive() ? "true" : "false",
+             leader ? lanLeader.leaderId : lanFollower.leaderId, leader ? lanLeader.version : lanFollower.version,
+             lanLastFrameMs ? (long)((millis() - lanLastFrameMs) / 1000) : -1L,
+             lanStats.framesSent, lanStats.bytesSent, lanStats.framesReceived, lanStats.badFrames, lanStats.queueDrops,
+             lanStats.stationsApplied, lanFollower.gaps, lanFollower.staleEntries, lanFollower.leaderChanges,
+             lanStats.fallbacks);
+    request->send(200, "application/json", json);
+});
+
+server.on("/api/tls", HTTP_GET, [](AsyncWebServerRequest *request) {
+    char json[320];
+    snprintf(json, sizeof(json),
+             "{\"ready\":%s,\"verified\":%s,\"lastError\":%d,\"requests\":%u,\"handshakes\":%u,\"resumed\":%u,"
+             "\"reused\":%u,\"failures\":%u,\"reuseRate\":%.2f,\"lastHandshakeMs\":%u,\"avgHandshakeMs\":%u}",
+             metarClient.tls.ready() ? "true" : "false", metarClient.tls.verified() ? "true" : "false",
+             metarClient.tls.lastError, tlsStats.requests, tlsStats.handshakes, tlsStats.resumed, tlsStats.reused,
+             tlsStats.failures, tlsStats.requests ? (float)tlsStats.reused / tlsStats.requests : 0.0f,
+             tlsStats.lastHandshakeMs, tlsStats.handshakes ? tlsStats.totalHandshakeMs / tlsStats.handshakes : 0);
+    request->send(200, "application/json", json);
+});
+
+#if METRICS_ENABLED
+server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+    AsyncResponseStream* response = request->beginResponseStream("text/plain; version=0.0.4");
+    writeMetrics(*response);
+    request->send(response);
+});
+#endif
+
+server.on("/api/settings", HTTP_GET, [](AsyncWebServerRequest *request) {
+    char json[LIVE_FEED_MESSAGE_BYTES + 96];
+    size_t len = snprintf(json, sizeof(json), "{");
+    len += writeSettingsJson(json + len, LIVE_FEED_MESSAGE_BYTES);
+    snprintf(json + len, sizeof(json) - len, ",\"_pending\":%u,\"_requests\":%u,\"_writes\":%u,\"_writesAvoided\":%u}",
+             settingsRegistry.pending(), settingsRegistry.requests, settingsRegistry.writes,
+             settingsRegistry.writesAvoided());
+    request->send(200, "application/json", json);
+});
+
+server.on("/api/settings", HTTP_POST, [](AsyncWebServerRequest *request) {
+    // Any settings but the LED setup, the same as over the live feed
+    const char* keys[MAX_SETTINGS_PER_CHANGE];
+    const char* values[MAX_SETTINGS_PER_CHANGE];
+    int count = 0;
+    for (int i = 0; i < (int)request->params() && count < MAX_SETTINGS_PER_CHANGE; i++) {
+      AsyncWebParameter* param = request->getParam(i);
+      if (param->isPost()) {
+        keys[count] = param->name().c_str();
+        values[count] = param->value().c_str();
+        count++;
+      }
+    }
+    const char* error = nullptr;
+    if (!applySettings(keys, values, count, error)) {
+      request->send(400, "text/plain", error);
+      return;
+    }
+    request->send(200, "text/plain", "Settings updated.");
+});
+
+server.on("/api/thresholds", HTTP_GET, [](AsyncWebServerRequest *request) {
+    char json[160];
+    snprintf(json, sizeof(json),
+             "{\"vis_mvfr\":%u,\"vis_ifr\":%u,\"vis_lifr\":%u,\"ceil_mvfr\":%u,\"ceil_ifr\":%u,\"ceil_lifr\":%u}",
+             categoryThresholds.visibility[0], categoryThresholds.visibility[1], categoryThresholds.visibility[2],
+             categoryThresholds.ceiling[0], categoryThresholds.ceiling[1], categoryThresholds.ceiling[2]);
+    request->send(200, "application/json", json);
+});
+
+server.on("/api/thresholds", HTTP_POST, [](AsyncWebServerRequest *request) {
+    // Any of the six settings, in quarter miles and hundreds of feet; the others keep their value
+    static const char* const names[] = {"vis_mvfr", "vis_ifr", "vis_lifr", "ceil_mvfr", "ceil_ifr", "ceil_lifr"};
+    CategoryThresholds thresholds = categoryThresholds;
+    for (int i = 0; i < 6; i++) {
+      if (!request->hasParam(names[i], true)) {
+        continue;
+      }
+      int value = request->getParam(names[i], true)->value().toInt();
+      if (i < 3) {
+        thresholds.visibility[i] = constrain(value, 0, 254);
+      } else {
+        thresholds.ceiling[i - 3] = constrain(value, 0, 0xFFFE);
+      }
+    }
+    if (!applyCategoryThresholds(thresholds)) {
+      request->send(400, "text/plain", "Minima must get stricter from MVFR to LIFR");
+      return;
+    }
+    for (int i = 0; i < 6; i++) {
+      setSettingValue((SettingId)(SET_VIS_MVFR + i), i < 3 ? thresholds.visibility[i] : thresholds.ceiling[i - 3]);
+    }
+    request->send(200, "text/plain", "Category minima updated.");
+});
+
+server.on("/logs", HTTP_GET, [](AsyncWebServerRequest *request) {
+    // ?level=error|warn|info|debug changes what gets logged from now on
+    if (request->hasParam("level")) {
+      String level = request->getParam("level")->value();
+      for (uint8_t l = LOG_LEVEL_ERROR; l <= LOG_LEVEL; l++) {
+        if (level.equalsIgnoreCase(logLevelName(l))) {
+          logRing.level = l;
+        }
+      }
+    }
+    AsyncResponseStream* response = request->beginResponseStream("text/plain");
+    response->printf("# level %s, %u records, %u dropped\n", logLevelName(logRing.level), logRing.written, logRing.dropped);
+    xSemaphoreTake(logTextMutex, portMAX_DELAY);
+    if (logTextWrapped) {
+      response->write((const uint8_t*)logText + logTextHead, LOG_TEXT_BYTES - logTextHead);
+    }
+    response->write((const uint8_t*)logText, logTextHead);
+    xSemaphoreGive(logTextMutex);
+    request->send(response);
+});
+
+server.on("/api/stations", HTTP_GET, [](AsyncWebServerRequest *request) {
+    AsyncWebServerResponse* response = beginPieceResponse(request, "text/csv", writeStationTablePiece);
+    response->addHeader("Content-Disposition", "attachment; filename=stations.csv");
+    request->send(response);
+});
+
+// A station table as CSV or binary, either as the raw body or as a file field of a form. It is checked and
+// converted to binary here, saved to SPIFFS and takes effect after the restart that follows.
+server.on("/api/stations", HTTP_POST, [](AsyncWebServerRequest *request) {
+    uint32_t len = request->_tempObject ? *(uint32_t*)request->_tempObject : 0;
+    if (len == 0) {
+      request->send(400, "text/plain", "No station table in the request");
+      return;
+    }
+    if (len == UINT32_MAX) {
+      request->send(413, "text/plain", "Station table is too large");
+      return;
+    }
+    const uint8_t* data = (const uint8_t*)request->_tempObject + sizeof(uint32_t);
+    uint32_t magic = 0;
+    memcpy(&magic, data, min(len, (uint32_t)sizeof(magic)));
+    StationTable table;
+    bool parsed = magic == STATION_TABLE_MAGIC ? table.parseBinary(data, len) : table.parseCsv((const char*)data, len);
+    if (!parsed || !table.validate(MAX_LEDS, MAX_STATIONS)) {
+      request->send(400, "text/plain", table.error);
+      return;
+    }
+    std::vector<uint8_t> binary;
+    table.serialize(binary);
+    File file = SPIFFS.open(STATION_TABLE_FILE, "w");
+    if (!file || file.write(binary.data(), binary.size()) != binary.size()) {
+      LOG_ERROR("Could not write %s\n", STATION_TABLE_FILE);
+      request->send(500, "text/plain", "Could not save the station table");
+      return;
+    }
+    file.close();
+    char message[96];
+    snprintf(message, sizeof(message), "Station table saved: %u strips, %u LEDs, %u entries. Restarting...",
+             table.stripCount, table.ledCount(), (unsigned)table.entries.size());
+    LOG_INFO("%s\n", message);
+    request->send(200, "text/plain", message);
+    requestRestart();
+}, [](AsyncWebServerRequest *request, const String& filename, size_t index, uint8_t *data, size_t len, bool final) {
+    appendUpload(request, data, len);
+}, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    appendUpload(request, data, len);
+});
+
+server.on("/api/stations", HTTP_DELETE, [](AsyncWebServerRequest *request) {
+    // Back to the built-in airports[]
+    SPIFFS.remove(STATION_TABLE_FILE);
+    request->send(200, "text/plain", "Station table removed. Restarting...");
+    requestRestart();
+});
+
 server.on("/fetch", HTTP_GET, [](AsyncWebServerRequest *request) {
-    checkMetars();
-    request->send(200, "text/plain", "Metar fetch triggered.");
+    // The fetcher task does the work; a press while a fetch is already waiting is merged into it
+    bool accepted = requestFetch();
+    request->send(200, "text/plain", accepted ? "Metar fetch triggered." : "Metar fetch already queued.");
+});
+
+server.on("/api/fetch", HTTP_GET, [](AsyncWebServerRequest *request) {
+    FetchScheduler::Status status = fetchScheduler.status(millis(), unixNow());
+    char json[320];
+    int len = snprintf(json, sizeof(json),
+             "{\"state\":\"%s\",\"nextInMs\":%u,\"failures\":%u,\"backoffMs\":%u,\"coalesced\":%u,"
+             "\"fetches\":%u,\"pending\":[",
+             fetchSchedulerStateName(status.state), status.nextInMs, status.failures, status.backoffMs,
+             status.coalesced, status.fetches);
+    bool first = true;
+    for (int i = 0; i < FETCH_TRIGGER_COUNT; i++) {
+      if (status.pending & (1 << i)) {
+        len += snprintf(json + len, sizeof(json) - len, "%s\"%s\"", first ? "" : ",", fetchTriggerName((FetchTrigger)i));
+        first = false;
+      }
+    }
+    len += snprintf(json + len, sizeof(json) - len, "],\"triggers\":{");
+    for (int i = 0; i < FETCH_TRIGGER_COUNT; i++) {
+      len += snprintf(json + len, sizeof(json) - len, "%s\"%s\":%u", i > 0 ? "," : "",
+                      fetchTriggerName((FetchTrigger)i), status.triggers[i]);
+    }
+    snprintf(json + len, sizeof(json) - len, "}}");
+    request->send(200, "application/json", json);
 });
 
 // Corrected file upload route with separated POST handler
@@ -522,11 +2834,12 @@ void handleFileUpload(AsyncWebServerRequest *request, const String& filename, si
 
  // Wi-Fi setup
 void setupWiFi() {
-  String hostname = "esp_metar_map";
+  char hostname[SETTING_STRING_MAX];
+  settingsRegistry.getString(SET_HOSTNAME, hostname, sizeof(hostname));
   
   WiFiManager wm;
   if (!wm.autoConnect("ESP-MetarMap")) {
-    debugPrint("Failed to connect to Wi-Fi.\n");
+    LOG_WARN("Failed to connect to Wi-Fi.\n");
     delay(5000);
     ESP.restart();
   }
@@ -540,98 +2853,102 @@ void setupWiFi() {
 
 }
 
- //Start-up LED Sequence
-void testStartupSequence() {
-  Serial.println("Starting Up...");
-
-  for (int i = 1; i <= NUM_AIRPORTS; i++) { // Start with 1 LED, end with NUM_AIRPORTS LEDs
-      uint8_t thisHue = (i * 255) / NUM_AIRPORTS; // Generate a changing hue based on the index
-      for (int j = 0; j < i; j++) {
-          // Set each LED to the calculated hue
-          strip.setPixelColor(j, strip.Color(thisHue, 255 - thisHue, 0)); // Example: Hue to RGB
-      }
-      strip.show();
-      delay(200);
-  }
-
-  // Keep the animation running with all LEDs on
-  for (int j = 0; j < 30; j++) { // Run animation for a set duration
-      uint8_t thisHue = (j * 255) / NUM_AIRPORTS;
-      for (int i = 0; i < NUM_AIRPORTS; i++) {
-          strip.setPixelColor(i, strip.Color(thisHue, 255 - thisHue, 0)); // Example: Gradient effect
-      }
-      strip.show();
-      delay(100);
+// Start the output for one strip; order and speed not set in the table come from the led_* settings
+LedOutput* startLedOutput(const StripConfig& strip, uint8_t channel) {
+  LedConfig ledConfig;
+  ledConfig.pin = strip.pin;
+  ledConfig.count = strip.count;
+  ledConfig.order = (LedColorOrder)(strip.order != STRIP_DEFAULT ? strip.order : getSettingValue(SET_LED_ORDER));
+  ledConfig.khz400 = strip.khz400 != STRIP_DEFAULT ? strip.khz400 != 0 : getSettingValue(SET_LED_KHZ400) != 0;
+  ledConfig.channel = channel;
+  LedOutput* output = createLedOutput((LedBackendType)getSettingValue(SET_LED_BACKEND));
+  if (output == nullptr || !output->begin(ledConfig)) {
+    LOG_WARN("LED backend failed to start on pin %u, falling back to NeoPixel\n", strip.pin);
+    delete output;
+    output = createLedOutput(LED_BACKEND_NEOPIXEL);
+    output->begin(ledConfig);
   }
-
-  // Turn off all LEDs after the sequence
-  for (int i = 0; i < NUM_AIRPORTS; i++) {
-      strip.setPixelColor(i, strip.Color(0, 0, 0)); // Turn off LED
-  }
-  strip.show();
+  return output;
 }
+
 //========================================================Setup Function====================================================================//
 
 void setup() {
   Serial.begin(115200);
-  delay(1000);
+  startLogger();
+  setupMetarFilter(metarFilter);
 
-  Serial.println("Setting up Wi-Fi...\n");
-  setupWiFi();
-  delay(1000);
-  //loadBrightness();
-  ledBrightness = getSettingValue("led_brightness");
-  settings[1].value = getSettingValue("start_time");
-  settings[2].value = getSettingValue("end_time");
+  //SPIFFS, mounted first since it holds the station table
+  if (!SPIFFS.begin()) {
+    LOG_ERROR("SPIFFS Mount Failed\n");
+  }
+  loadStationTable();
+
+  settingsRegistry.load();
+  ledBrightness = getSettingValue(SET_LED_BRIGHTNESS);
+  CategoryThresholds thresholds = {
+    {(uint8_t)getSettingValue(SET_VIS_MVFR), (uint8_t)getSettingValue(SET_VIS_IFR), (uint8_t)getSettingValue(SET_VIS_LIFR)},
+    {(uint16_t)getSettingValue(SET_CEIL_MVFR), (uint16_t)getSettingValue(SET_CEIL_IFR), (uint16_t)getSettingValue(SET_CEIL_LIFR)}
+  };
+  if (validCategoryThresholds(thresholds)) {
+    categoryThresholds = thresholds;
+  } else {
+    LOG_WARN("Stored category minima are not in order, using the FAA ones\n");
+  }
   
   //Load Depending which led type
-  #ifdef WS2811_LED
-  //FastLED.addLeds<WS2811, DATA_PIN,RGB>(leds,NUM_AIRPORTS);
-  //FastLED.addLeds<WS2811, DATA_PIN, GRB>(leds, 15);
-  #else
-  //FastLED.addLeds<WS2812B, DATA_PIN, RGB>(leds, NUM_AIRPORTS);
-  #endif
-
-  // FastLED.setBrightness(ledBrightness);
-  // FastLED.clear();
-  // FastLED.show();
-  strip.setBrightness(ledBrightness);
-  strip.clear();
-  strip.show();
-  //SPIFFS
-  if (!SPIFFS.begin()) {
-    Serial.println("SPIFFS Mount Failed");
-    return;
+  for (int s = 0; s < stationTable.stripCount; s++) {
+    ledOutputs[s] = startLedOutput(stationTable.strips[s], s);
+  }
+  invalidateFrame();
+  commitFrame();
+
+  for (int i = 0; i < 2; i++) {
+    stationStores[i].clear();
+  }
+  printStationStoreSize();
+  startHistory();
+  // With a snapshot the last known map goes up right away, a cold boot plays the startup sequence.
+  // Either way it is animated by the renderer while WiFi connects.
+  bool warmBoot = restoreSnapshot() > 0;
+  animator.begin(stationMap.ledCount, FADE_MS);
+  if (!warmBoot) {
+    Serial.println("Starting Up...");
+    animator.startIntro(0, INTRO_TICKS);
   }
+  // The renderer owns the LEDs from here on
+  startPipeline();
+  requestRender(RENDER_FULL);
+
+  Serial.println("Setting up Wi-Fi...\n");
+  setupWiFi();
+  delay(1000);
+  applyTimeZone();
+  configTzTime(appliedTz, NTP_SERVER);
 
+  setupMetarClient();
+  // A follower that finds its leader skips the boot fetch and waits for frames
+  startLan();
+  requestFetch(FETCH_TRIGGER_BOOT);
+
+  // Ahead of every other handler so it sees each request
+  server.addHandler(&webActivity);
+  // The page is in flash, so the web UI no longer depends on SPIFFS mounting
   serveWebPage();
+  liveSocket.onEvent(onLiveSocketEvent);
+  server.addHandler(&liveSocket);
   server.begin();
-  timeClient.begin();
-  testStartupSequence();
- if (isTimeInRange()) {
-        Serial.println("Turn ON");
-        // Add code to turn on your device
-          fetchMetarData();
-   }
 }
 
 void loop() {
-    
- unsigned long currentMillis = millis();
-      if (currentMillis - previousMillis >= INTERVAL) {
-          previousMillis = currentMillis;
-        if (isTimeInRange()) {
-          Serial.println("Turn ON");
-          // Add code to turn on your device
-      
-        fetchMetarData();
-      
-    } else {
-        Serial.println("Turn OFF");
-        // fill_solid(leds, NUM_AIRPORTS, CRGB::Black);
-        // FastLED.show();
-        fillSolid(BLACK);
-        
-      }
-    }
-}
\ No newline at end of file
+  // Fetching, parsing and rendering run on the pipeline tasks, the fetcher keeps its own schedule
+  flushSettings();
+  updateDisplaySchedule();
+  pumpLiveFeed();
+  pumpLan();
+  if (restartRequestedAt != 0 && millis() - restartRequestedAt >= 1000) {
+    settingsRegistry.flush(millis(), true);
+    ESP.restart();
+  }
+  powerStep();
+}
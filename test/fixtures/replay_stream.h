@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "metar_stream.h"
+
+//===================================================== Replay Stream =====================================================================//
+// PayloadStream over a body that arrives in chunks, the host stand-in for the firmware's ChunkStream. Each
+// write() is one chunk, as PayloadWriter forwards each slice of HTTPClient::writeToStream(), and end() closes
+// the payload the way endPayload() does. Reads cross chunk boundaries without waiting, like ChunkStream pulling
+// the next chunk off its queue.
+
+class ReplayStream : public PayloadStream {
+public:
+  ReplayStream() { setTimeout(0); }
+
+  void clear() {
+    chunks_.clear();
+    chunk_ = 0;
+    pos_ = 0;
+    ended_ = false;
+    ok_ = false;
+    bytes = 0;
+  }
+
+  // Queue a whole body split into chunks of chunkSize, or of sizes from 1 to chunkSize when seed is non-zero
+  void load(const std::string& body, size_t chunkSize, unsigned seed = 0) {
+    clear();
+    for (size_t at = 0; at < body.size();) {
+      size_t n = chunkSize;
+      if (seed != 0) {
+        seed = seed * 1103515245u + 12345u;
+        n = 1 + (seed >> 16) % chunkSize;
+      }
+      n = n < body.size() - at ? n : body.size() - at;
+      write((const uint8_t*)body.data() + at, n);
+      at += n;
+    }
+  }
+
+  void end(bool ok) {
+    ended_ = true;
+    ok_ = ok;
+  }
+
+  bool complete() const override { return ended_ && ok_ && chunk_ >= chunks_.size(); }
+  size_t chunkCount() const { return chunks_.size(); }
+
+  int available() override { return fill() ? chunks_[chunk_].size() - pos_ : 0; }
+  int read() override { return fill() ? (uint8_t)chunks_[chunk_][pos_++] : -1; }
+  int peek() override { return fill() ? (uint8_t)chunks_[chunk_][pos_] : -1; }
+
+  size_t write(const uint8_t* data, size_t len) override {
+    chunks_.push_back(std::string((const char*)data, len));
+    bytes += len;
+    return len;
+  }
+  size_t write(uint8_t b) override { return write(&b, 1); }
+
+  uint32_t bytes = 0;   // Body bytes written
+
+private:
+  bool fill() {
+    while (chunk_ < chunks_.size() && pos_ >= chunks_[chunk_].size()) {
+      chunk_++;
+      pos_ = 0;
+    }
+    return chunk_ < chunks_.size();
+  }
+
+  std::vector<std::string> chunks_;
+  size_t chunk_ = 0;
+  size_t pos_ = 0;
+  bool ended_ = false;
+  bool ok_ = false;
+};
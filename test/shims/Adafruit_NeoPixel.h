@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+//===================================================== Adafruit_NeoPixel Shim ============================================================//
+// Keeps the strip as the wire-order bytes Adafruit_NeoPixel would send, brightness applied the way it does,
+// so a frame can be compared byte for byte with what another backend puts on the wire.
+
+typedef uint16_t neoPixelType;
+
+#define NEO_RGB ((0 << 6) | (0 << 4) | (1 << 2) | (2))
+#define NEO_GRB ((1 << 6) | (1 << 4) | (0 << 2) | (2))
+#define NEO_KHZ800 0x0000
+#define NEO_KHZ400 0x0100
+
+class Adafruit_NeoPixel {
+public:
+  Adafruit_NeoPixel(uint16_t count, int16_t pin, neoPixelType type)
+    : pin_(pin), type_(type), pixels_((size_t)count * 3, 0) {}
+
+  void begin() {}
+  uint16_t numPixels() const { return pixels_.size() / 3; }
+  int16_t getPin() const { return pin_; }
+  neoPixelType getType() const { return type_; }
+
+  void setBrightness(uint8_t brightness) { brightness_ = brightness + 1; }
+
+  void setPixelColor(uint16_t n, uint32_t color) {
+    if (n >= numPixels()) return;
+    uint8_t r = color >> 16, g = color >> 8, b = color;
+    if (brightness_) {
+      r = (r * brightness_) >> 8;
+      g = (g * brightness_) >> 8;
+      b = (b * brightness_) >> 8;
+    }
+    uint8_t* p = &pixels_[(size_t)n * 3];
+    p[(type_ >> 4) & 3] = r;
+    p[(type_ >> 2) & 3] = g;
+    p[type_ & 3] = b;
+  }
+
+  void show() {
+    shown = pixels_;
+    shows++;
+    lastShown() = this;
+  }
+
+  // Strip that show() was last called on, so a test can read what a backend sent
+  static Adafruit_NeoPixel*& lastShown() {
+    static Adafruit_NeoPixel* strip = nullptr;
+    return strip;
+  }
+
+  const uint8_t* getPixels() const { return pixels_.data(); }
+
+  std::vector<uint8_t> shown;   // Bytes of the last show(), in wire order
+  uint32_t shows = 0;
+
+private:
+  int16_t pin_;
+  neoPixelType type_;
+  uint8_t brightness_ = 0;   // 0 is full brightness, otherwise brightness + 1 like the library
+  std::vector<uint8_t> pixels_;
+};
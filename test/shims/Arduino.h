@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+//===================================================== Arduino Shim ======================================================================//
+// Just enough of the Arduino core for MetarCore and the tests to build on the host in the native env: time,
+// Print and Stream with the core's timeout behaviour, and a String over std::string.
+
+inline unsigned long micros() {
+  static const auto start = std::chrono::steady_clock::now();
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+inline unsigned long millis() { return micros() / 1000; }
+inline void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void yield() { std::this_thread::yield(); }
+
+template <typename T, typename U> inline typename std::common_type<T, U>::type min(T a, U b) { return a < b ? a : b; }
+template <typename T, typename U> inline typename std::common_type<T, U>::type max(T a, U b) { return a > b ? a : b; }
+template <typename T> inline T constrain(T x, T low, T high) { return x < low ? low : (x > high ? high : x); }
+
+// The ESP32 core sets the time zone and starts SNTP in one call. Only the zone is applied here.
+inline void configTzTime(const char* tz, const char* server1, const char* server2 = nullptr,
+                         const char* server3 = nullptr) {
+  (void)server1; (void)server2; (void)server3;
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+class String {
+public:
+  String(const char* text = "") : text_(text ? text : "") {}
+  String(const std::string& text) : text_(text) {}
+  String(int value) : text_(std::to_string(value)) {}
+  const char* c_str() const { return text_.c_str(); }
+  unsigned int length() const { return text_.size(); }
+  bool isEmpty() const { return text_.empty(); }
+  int toInt() const { return atoi(text_.c_str()); }
+  String& operator+=(const String& other) { text_ += other.text_; return *this; }
+  bool operator==(const char* other) const { return text_ == other; }
+  bool operator==(const String& other) const { return text_ == other.text_; }
+  bool operator!=(const char* other) const { return text_ != other; }
+
+private:
+  std::string text_;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* data, size_t len) {
+    size_t n = 0;
+    while (len-- > 0 && write(*data++)) n++;
+    return n;
+  }
+  size_t write(const char* text) { return write((const uint8_t*)text, strlen(text)); }
+  size_t print(const char* text) { return write(text); }
+  size_t print(const String& text) { return write(text.c_str()); }
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (len < 0) return 0;
+    return write((const uint8_t*)buffer, min((size_t)len, sizeof(buffer) - 1));
+  }
+};
+
+// Like the core's Stream: read() and peek() return -1 when nothing is buffered, the timed helpers wait up to
+// the timeout for more
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { timeout_ = timeout; }
+  unsigned long getTimeout() const { return timeout_; }
+
+  bool find(const char* target) { return findUntil(target, nullptr); }
+
+  bool findUntil(const char* target, const char* terminator) {
+    size_t targetLen = strlen(target);
+    size_t termLen = terminator ? strlen(terminator) : 0;
+    size_t targetPos = 0;
+    size_t termPos = 0;
+    int c;
+    while ((c = timedRead()) >= 0) {
+      targetPos = c == target[targetPos] ? targetPos + 1 : (c == target[0] ? 1 : 0);
+      if (targetPos == targetLen) return true;
+      if (termLen > 0) {
+        termPos = c == terminator[termPos] ? termPos + 1 : (c == terminator[0] ? 1 : 0);
+        if (termPos == termLen) return false;
+      }
+    }
+    return false;
+  }
+
+  size_t readBytes(char* buffer, size_t length) {
+    size_t n = 0;
+    while (n < length) {
+      int c = timedRead();
+      if (c < 0) break;
+      buffer[n++] = (char)c;
+    }
+    return n;
+  }
+  size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+
+protected:
+  int timedRead() {
+    unsigned long start = millis();
+    do {
+      int c = read();
+      if (c >= 0) return c;
+      yield();
+    } while (millis() - start < timeout_);
+    return -1;
+  }
+
+  unsigned long timeout_ = 1000;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <Arduino.h>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+//===================================================== HTTPClient Shim ===================================================================//
+// Replays canned responses in the order they were queued, through the same calls the fetcher makes. The body
+// goes to writeToStream() in slices of sliceSize, the way the real client forwards each TCP read.
+
+#define HTTP_CODE_OK 200
+#define HTTP_CODE_NOT_MODIFIED 304
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_STREAM (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM (-8)
+#define HTTPC_ERROR_ENCODING (-9)
+#define HTTPC_ERROR_STREAM_WRITE (-10)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+class HTTPClient {
+public:
+  typedef std::vector<std::pair<std::string, std::string>> Headers;
+
+  struct Response {
+    int code;
+    std::string body;
+    Headers headers;
+    size_t cutAt;   // Body bytes sent before the connection drops, body.size() for a complete one
+  };
+
+  struct Request {
+    std::string url;
+    Headers headers;
+  };
+
+  //---- Test side ----//
+  void queueResponse(int code, const std::string& body, const Headers& headers = Headers()) {
+    responses_.push_back({code, body, headers, body.size()});
+  }
+  // A response whose connection drops after cutAt body bytes
+  void queueTruncated(const std::string& body, size_t cutAt) {
+    responses_.push_back({HTTP_CODE_OK, body, Headers(), cutAt});
+  }
+  const std::vector<Request>& requests() const { return requests_; }
+  size_t pending() const { return responses_.size(); }
+  size_t sliceSize = 1436;
+
+  //---- Arduino side ----//
+  bool begin(const String& url) {
+    current_ = {};
+    current_.url = url.c_str();
+    return true;
+  }
+  template <typename Client> bool begin(Client& client, const String& url) {
+    (void)client;
+    return begin(url);
+  }
+  void setReuse(bool reuse) { reuse_ = reuse; }
+  void collectHeaders(const char* keys[], size_t count) { collected_.assign(keys, keys + count); }
+  void addHeader(const String& name, const String& value) { current_.headers.push_back({name.c_str(), value.c_str()}); }
+
+  int GET() {
+    requests_.push_back(current_);
+    if (responses_.empty()) {
+      return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+    response_ = responses_.front();
+    responses_.pop_front();
+    return response_.code;
+  }
+
+  int getSize() { return response_.cutAt == response_.body.size() ? (int)response_.body.size() : -1; }
+
+  int writeToStream(Stream* stream) {
+    size_t sent = 0;
+    while (sent < response_.cutAt) {
+      size_t n = min(sliceSize, response_.cutAt - sent);
+      if (stream->write((const uint8_t*)response_.body.data() + sent, n) != n) {
+        return HTTPC_ERROR_STREAM_WRITE;
+      }
+      sent += n;
+    }
+    return sent == response_.body.size() ? (int)sent : HTTPC_ERROR_CONNECTION_LOST;
+  }
+
+  String header(const char* name) {
+    for (const char* key : collected_) {
+      if (strcasecmp(key, name) != 0) continue;
+      for (const auto& header : response_.headers) {
+        if (strcasecmp(header.first.c_str(), name) == 0) return String(header.second);
+      }
+    }
+    return String();
+  }
+
+  static String errorToString(int error) {
+    switch (error) {
+      case HTTPC_ERROR_CONNECTION_REFUSED: return "connection refused";
+      case HTTPC_ERROR_CONNECTION_LOST: return "connection lost";
+      case HTTPC_ERROR_STREAM_WRITE: return "Stream write error";
+      case HTTPC_ERROR_READ_TIMEOUT: return "read Timeout";
+      default: return String();
+    }
+  }
+
+  void end() { response_ = {}; }
+
+private:
+  std::deque<Response> responses_;
+  std::vector<Request> requests_;
+  std::vector<const char*> collected_;
+  Request current_;
+  Response response_ = {};
+  bool reuse_ = false;
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+//===================================================== Preferences Shim ==================================================================//
+// NVS namespaces in memory. What is written survives end() and a new Preferences object, like flash does across
+// a reboot, until reset() wipes it. Every successful put counts as one flash write.
+
+class Preferences {
+public:
+  // Like NVS, a namespace that was never written cannot be opened read-only
+  bool begin(const char* name, bool readOnly = false) {
+    if (readOnly && storage().count(name) == 0) return false;
+    space_ = &storage()[name];
+    readOnly_ = readOnly;
+    return true;
+  }
+  void end() { space_ = nullptr; }
+
+  bool isKey(const char* key) const { return space_ && space_->count(key) > 0; }
+
+  bool remove(const char* key) { return writable() && space_->erase(key) > 0; }
+  bool clear() {
+    if (!writable()) return false;
+    space_->clear();
+    return true;
+  }
+
+  size_t putInt(const char* key, int32_t value) { return put(key, &value, sizeof(value)); }
+  int32_t getInt(const char* key, int32_t defaultValue = 0) const {
+    int32_t value = defaultValue;
+    return get(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+  }
+
+  // Strings are kept with their terminator, so getString() returns the length including it like NVS does
+  size_t putString(const char* key, const char* text) {
+    return put(key, text, strlen(text) + 1) ? strlen(text) : 0;
+  }
+  size_t getString(const char* key, char* text, size_t maxLen) const {
+    const std::vector<uint8_t>* value = find(key);
+    if (value == nullptr || value->size() > maxLen) return 0;
+    memcpy(text, value->data(), value->size());
+    return value->size();
+  }
+
+  size_t putBytes(const char* key, const void* data, size_t len) { return put(key, data, len); }
+  size_t getBytesLength(const char* key) const {
+    const std::vector<uint8_t>* value = find(key);
+    return value ? value->size() : 0;
+  }
+  size_t getBytes(const char* key, void* data, size_t maxLen) const { return get(key, data, maxLen); }
+
+  // Flash writes since the last reset()
+  static uint32_t& writes() {
+    static uint32_t count = 0;
+    return count;
+  }
+  static void reset() {
+    storage().clear();
+    writes() = 0;
+  }
+
+private:
+  typedef std::map<std::string, std::vector<uint8_t>> Namespace;
+
+  static std::map<std::string, Namespace>& storage() {
+    static std::map<std::string, Namespace> spaces;
+    return spaces;
+  }
+
+  bool writable() const { return space_ != nullptr && !readOnly_; }
+
+  const std::vector<uint8_t>* find(const char* key) const {
+    if (space_ == nullptr) return nullptr;
+    Namespace::const_iterator it = space_->find(key);
+    return it == space_->end() ? nullptr : &it->second;
+  }
+
+  size_t put(const char* key, const void* data, size_t len) {
+    if (!writable()) return 0;
+    const uint8_t* bytes = (const uint8_t*)data;
+    (*space_)[key].assign(bytes, bytes + len);
+    writes()++;
+    return len;
+  }
+
+  size_t get(const char* key, void* data, size_t maxLen) const {
+    const std::vector<uint8_t>* value = find(key);
+    if (value == nullptr || value->size() > maxLen) return 0;
+    memcpy(data, value->data(), value->size());
+    return value->size();
+  }
+
+  Namespace* space_ = nullptr;
+  bool readOnly_ = false;
+};
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string.h>
+
+//===================================================== pgmspace Shim =====================================================================//
+// A host has one address space, so flash data is ordinary memory.
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const unsigned char*)(addr))
+#define pgm_read_ptr(addr) (*(void* const*)(addr))
+#define memcpy_P memcpy
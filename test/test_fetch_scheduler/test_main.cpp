@@ -0,0 +1,222 @@
+#include <unity.h>
+
+#include <stdio.h>
+
+#include "fetch_scheduler.h"
+
+//===================================================== Fetch Scheduler Tests =============================================================//
+// The scheduler on a simulated clock: a millisecond counter and Unix time that advance together, with the Unix
+// time 0 until "NTP" sets it, the way fetcherTask drives it on the map.
+
+#define MINUTE_MS 60000u
+#define HOUR_S 3600u
+#define ALIGN_SECONDS (56 * 60)
+#define BOOT_UNIX 1792238400u      // 2026-10-17 12:00:00 UTC, on the hour
+
+static uint32_t nowMs = 0;
+static uint32_t unixTime = 0;
+
+static FetchSchedulerConfig config(uint32_t refreshMinutes) {
+  FetchSchedulerConfig config = {MINUTE_MS, refreshMinutes * MINUTE_MS, ALIGN_SECONDS, 30000, refreshMinutes * MINUTE_MS};
+  return config;
+}
+
+static void advance(uint32_t ms) {
+  nowMs += ms;
+  if (unixTime != 0) {
+    unixTime += ms / 1000;
+  }
+}
+
+// Wait as fetcherTask does until the scheduler lets a fetch start, then run one that takes fetchMs
+static void runFetch(FetchScheduler& scheduler, bool ok, uint32_t fetchMs = 2000) {
+  uint32_t waitMs;
+  while (!scheduler.due(nowMs, unixTime, waitMs)) {
+    advance(waitMs);
+  }
+  scheduler.started(nowMs);
+  advance(fetchMs);
+  scheduler.finished(ok, nowMs, unixTime);
+}
+
+static uint32_t secondsPastHour(uint32_t time) {
+  return time % HOUR_S;
+}
+
+void setUp() {
+  nowMs = 0;
+  unixTime = 0;
+}
+
+void tearDown() {}
+
+// Triggers while one fetch waits or runs all collapse into it
+void test_triggers_coalesce() {
+  FetchScheduler scheduler(config(15), 1234);
+  uint32_t waitMs;
+  TEST_ASSERT_FALSE(scheduler.due(nowMs, unixTime, waitMs));
+  TEST_ASSERT_TRUE(scheduler.trigger(FETCH_TRIGGER_BOOT));
+  TEST_ASSERT_FALSE(scheduler.trigger(FETCH_TRIGGER_MANUAL));
+  TEST_ASSERT_FALSE(scheduler.trigger(FETCH_TRIGGER_MANUAL));
+  TEST_ASSERT_TRUE(scheduler.due(nowMs, unixTime, waitMs));
+  scheduler.started(nowMs);
+  TEST_ASSERT_FALSE(scheduler.trigger(FETCH_TRIGGER_MANUAL));
+  TEST_ASSERT_FALSE(scheduler.due(nowMs, unixTime, waitMs));
+  advance(3000);
+  scheduler.finished(true, nowMs, unixTime);
+
+  FetchScheduler::Status status = scheduler.status(nowMs, unixTime);
+  TEST_ASSERT_EQUAL_UINT32(1, status.fetches);
+  TEST_ASSERT_EQUAL_UINT32(3, status.coalesced);
+  TEST_ASSERT_EQUAL_UINT32(3, status.triggers[FETCH_TRIGGER_MANUAL]);
+  TEST_ASSERT_EQUAL(FETCH_STATE_IDLE, status.state);
+}
+
+// A manual fetch right after another waits out the minimum interval, however often it is asked for
+void test_minimum_interval() {
+  FetchScheduler scheduler(config(15), 1234);
+  scheduler.trigger(FETCH_TRIGGER_BOOT);
+  runFetch(scheduler, true, 3000);
+  TEST_ASSERT_TRUE(scheduler.trigger(FETCH_TRIGGER_MANUAL));
+  uint32_t waitMs;
+  TEST_ASSERT_FALSE(scheduler.due(nowMs, unixTime, waitMs));
+  TEST_ASSERT_EQUAL_UINT32(MINUTE_MS - 3000, waitMs);
+  for (int i = 0; i < 10; i++) {
+    TEST_ASSERT_FALSE(scheduler.trigger(FETCH_TRIGGER_MANUAL));
+  }
+  advance(waitMs);
+  TEST_ASSERT_TRUE(scheduler.due(nowMs, unixTime, waitMs));
+}
+
+// Without a wall clock refreshes follow the interval, once it is set they move onto the grid
+void test_clock_set_later() {
+  FetchScheduler scheduler(config(15), 1234);
+  scheduler.trigger(FETCH_TRIGGER_BOOT);
+  runFetch(scheduler, true, 1000);
+  uint32_t waitMs;
+  TEST_ASSERT_FALSE(scheduler.due(nowMs, unixTime, waitMs));
+  TEST_ASSERT_EQUAL_UINT32(15 * MINUTE_MS, waitMs);
+
+  unixTime = BOOT_UNIX + 3 * 60 + 20;
+  TEST_ASSERT_FALSE(scheduler.due(nowMs, unixTime, waitMs));
+  TEST_ASSERT_EQUAL_UINT32(11 * 60, secondsPastHour(unixTime + waitMs / 1000));
+  runFetch(scheduler, true);
+  TEST_ASSERT_FALSE(scheduler.due(nowMs, unixTime, waitMs));
+  TEST_ASSERT_EQUAL_UINT32(26 * 60, secondsPastHour(unixTime + waitMs / 1000));
+}
+
+// A simulated day of scheduled refreshes for an interval: every start is on the grid, and the grid is back on :56
+// every hour whether or not the interval divides the hour
+static void checkDay(uint32_t refreshMinutes) {
+  FetchScheduler scheduler(config(refreshMinutes), 99);
+  unixTime = BOOT_UNIX + 17 * 60 + 5;
+  scheduler.trigger(FETCH_TRIGGER_BOOT);
+  runFetch(scheduler, true);
+
+  uint32_t period = refreshMinutes * 60;
+  uint32_t cycle = period < HOUR_S ? HOUR_S : 24 * HOUR_S;
+  uint32_t end = unixTime + 24 * HOUR_S;
+  uint32_t fetches = 0;
+  uint32_t anchored = 0;
+  uint32_t lastStart = 0;
+  uint32_t waitMs;
+  while (unixTime < end) {
+    while (!scheduler.due(nowMs, unixTime, waitMs)) {
+      advance(waitMs);
+    }
+    uint32_t sinceAnchor = (unixTime + cycle - ALIGN_SECONDS) % cycle;
+    char message[64];
+    snprintf(message, sizeof(message), "%u minutes, start at %u s past the anchor", refreshMinutes, sinceAnchor);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, sinceAnchor % period, message);
+    TEST_ASSERT_TRUE(lastStart == 0 || unixTime - lastStart <= period);
+    TEST_ASSERT_TRUE(lastStart == 0 || unixTime - lastStart >= MINUTE_MS / 1000);
+    anchored += sinceAnchor == 0;
+    lastStart = unixTime;
+    scheduler.started(nowMs);
+    advance(2000);
+    scheduler.finished(true, nowMs, unixTime);
+    fetches++;
+  }
+  char line[96];
+  snprintf(line, sizeof(line), "%3u minutes: %u refreshes in a day, %u on the anchor", refreshMinutes, fetches, anchored);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL_UINT32(24 * HOUR_S / cycle, anchored);
+}
+
+void test_grid_divides_hour() {
+  checkDay(15);
+  checkDay(20);
+  checkDay(5);
+}
+
+void test_grid_does_not_divide_hour() {
+  checkDay(25);
+  checkDay(45);
+  checkDay(7);
+}
+
+void test_grid_longer_than_hour() {
+  checkDay(90);
+  checkDay(120);
+}
+
+// Failures back off with jitter up to the cap, triggers merge into the pending retry, and a success clears it
+void test_backoff() {
+  FetchScheduler scheduler(config(15), 1234);
+  unixTime = BOOT_UNIX;
+  scheduler.trigger(FETCH_TRIGGER_BOOT);
+  runFetch(scheduler, true);
+  uint32_t waitMs;
+  for (uint32_t failures = 1; failures <= 8; failures++) {
+    runFetch(scheduler, false, 1000);
+    FetchScheduler::Status status = scheduler.status(nowMs, unixTime);
+    TEST_ASSERT_EQUAL(FETCH_STATE_BACKOFF, status.state);
+    TEST_ASSERT_EQUAL_UINT32(failures, status.failures);
+    uint32_t ceiling = 30000u << (failures - 1);
+    if (ceiling > 15 * MINUTE_MS) ceiling = 15 * MINUTE_MS;
+    TEST_ASSERT_TRUE(status.backoffMs >= ceiling / 2 && status.backoffMs <= ceiling);
+    TEST_ASSERT_FALSE(scheduler.trigger(FETCH_TRIGGER_MANUAL));
+    TEST_ASSERT_FALSE(scheduler.due(nowMs, unixTime, waitMs));
+    TEST_ASSERT_TRUE(waitMs >= MINUTE_MS - 1000 || waitMs == status.backoffMs);
+  }
+  runFetch(scheduler, true);
+  FetchScheduler::Status status = scheduler.status(nowMs, unixTime);
+  TEST_ASSERT_EQUAL(FETCH_STATE_IDLE, status.state);
+  TEST_ASSERT_EQUAL_UINT32(0, status.failures);
+  TEST_ASSERT_EQUAL_UINT32(8, status.triggers[FETCH_TRIGGER_RETRY]);
+}
+
+// Maps that failed together do not retry in step
+void test_backoff_jitter_spreads() {
+  uint32_t shortest = UINT32_MAX;
+  uint32_t longest = 0;
+  for (uint32_t seed = 1; seed < 200; seed++) {
+    FetchScheduler scheduler(config(15), seed * 7919);
+    scheduler.trigger(FETCH_TRIGGER_BOOT);
+    uint32_t waitMs;
+    scheduler.due(0, 0, waitMs);
+    scheduler.started(0);
+    scheduler.finished(false, 0, 0);
+    uint32_t backoff = scheduler.status(0, 0).backoffMs;
+    if (backoff < shortest) shortest = backoff;
+    if (backoff > longest) longest = backoff;
+  }
+  TEST_ASSERT_TRUE(shortest >= 15000);
+  TEST_ASSERT_TRUE(longest <= 30000);
+  TEST_ASSERT_TRUE(longest - shortest > 10000);
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_triggers_coalesce);
+  RUN_TEST(test_minimum_interval);
+  RUN_TEST(test_clock_set_later);
+  RUN_TEST(test_grid_divides_hour);
+  RUN_TEST(test_grid_does_not_divide_hour);
+  RUN_TEST(test_grid_longer_than_hour);
+  RUN_TEST(test_backoff);
+  RUN_TEST(test_backoff_jitter_spreads);
+  return UNITY_END();
+}
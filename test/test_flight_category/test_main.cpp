@@ -0,0 +1,216 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <Arduino.h>
+
+#include "flight_category.h"
+#include "station_store.h"
+
+//===================================================== Flight Category Tests =============================================================//
+// classifyStations() and classifyFlightCategory() against a plain reference of the rules, for every quantized
+// visibility and ceiling pair, and how long a whole store takes to classify next to the per-station float and
+// strcmp classifier it replaced.
+
+// Thresholds, host figures with room for a slow CI machine
+#define MAX_NANOS_PER_STATION 10
+#define BENCH_STATIONS 500
+#define BENCH_ROUNDS 20000
+
+// Category by the rules, on the dequantized values. A value is MVFR at or below the MVFR minimum and IFR or LIFR
+// below theirs, which is what the table's "below thresholds[0]" means in quantized steps.
+static FlightCategory reference(uint8_t visibility, uint16_t ceiling, const CategoryThresholds& thresholds) {
+  if (visibility == VISIBILITY_UNKNOWN && ceiling == CEILING_NONE) return CATEGORY_UNKNOWN;
+  bool visKnown = visibility != VISIBILITY_UNKNOWN;
+  bool ceilKnown = ceiling != CEILING_NONE;
+  float vis = visibilityMiles(visibility);
+  int ceil = ceilingFeet(ceiling);
+  for (int level = 2; level >= 0; level--) {
+    if ((visKnown && vis < visibilityMiles(thresholds.visibility[level])) ||
+        (ceilKnown && ceil < ceilingFeet(thresholds.ceiling[level]))) {
+      return (FlightCategory)(CATEGORY_MVFR + level);
+    }
+  }
+  return CATEGORY_VFR;
+}
+
+// The FAA rules as they are written, in miles and feet
+static FlightCategory faaReference(uint8_t visibility, uint16_t ceiling) {
+  if (visibility == VISIBILITY_UNKNOWN && ceiling == CEILING_NONE) return CATEGORY_UNKNOWN;
+  float vis = visibility == VISIBILITY_UNKNOWN ? 1e9f : visibilityMiles(visibility);
+  long ceil = ceiling == CEILING_NONE ? 1000000000L : ceilingFeet(ceiling);
+  if (vis < 1 || ceil < 500) return CATEGORY_LIFR;
+  if (vis < 3 || ceil < 1000) return CATEGORY_IFR;
+  if (vis <= 5 || ceil <= 3000) return CATEGORY_MVFR;
+  return CATEGORY_VFR;
+}
+
+// The classifier before the threshold table, for the benchmark
+static FlightCategory determineFlightCategory(float visibility, int ceiling, const char* type) {
+  if (strcmp(type, "FEW") == 0 || strcmp(type, "CLR") == 0 || strcmp(type, "SCT") == 0) {
+    ceiling = 10000;
+  }
+  if (visibility > 5.0 && ceiling > 3000) {
+    return CATEGORY_VFR;
+  } else if ((visibility >= 3.0 && visibility <= 5.0) || (ceiling >= 1000 && ceiling <= 3000)) {
+    return CATEGORY_MVFR;
+  } else if ((visibility >= 1.0 && visibility < 3.0) || (ceiling >= 500 && ceiling < 1000)) {
+    return CATEGORY_IFR;
+  } else if (visibility < 1.0 || ceiling < 500) {
+    return CATEGORY_LIFR;
+  }
+  return CATEGORY_UNKNOWN;
+}
+
+// Every ceiling for each visibility, through both entry points. Returns the number of mismatches.
+static long checkAllPairs(const CategoryThresholds& thresholds, bool faa) {
+  static uint8_t visibility[65536];
+  static uint16_t ceiling[65536];
+  static uint8_t category[65536];
+  long mismatches = 0;
+  for (int v = 0; v < 256; v++) {
+    for (int c = 0; c < 65536; c++) {
+      visibility[c] = v;
+      ceiling[c] = c;
+    }
+    classifyStations(visibility, ceiling, category, 65536, thresholds);
+    for (int c = 0; c < 65536; c++) {
+      FlightCategory expected = faa ? faaReference(v, c) : reference(v, c, thresholds);
+      if (category[c] != expected || classifyFlightCategory(v, c, thresholds) != expected) {
+        if (mismatches++ < 5) {
+          char line[96];
+          snprintf(line, sizeof(line), "visibility %d ceiling %d: got %d, expected %d", v, c, category[c], expected);
+          TEST_MESSAGE(line);
+        }
+      }
+    }
+  }
+  return mismatches;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_faa_every_pair() {
+  TEST_ASSERT_EQUAL_INT32(0, checkAllPairs(FAA_CATEGORY_THRESHOLDS, true));
+}
+
+// The generic reference agrees with the FAA one on the FAA table, and with the classifier on other tables
+void test_custom_thresholds_every_pair() {
+  TEST_ASSERT_EQUAL_INT32(0, checkAllPairs(FAA_CATEGORY_THRESHOLDS, false));
+  const CategoryThresholds strict = {{32, 20, 8}, {50, 15, 8}};
+  TEST_ASSERT_EQUAL_INT32(0, checkAllPairs(strict, false));
+  const CategoryThresholds flat = {{12, 12, 12}, {10, 10, 10}};
+  TEST_ASSERT_EQUAL_INT32(0, checkAllPairs(flat, false));
+}
+
+void test_edges() {
+  const CategoryThresholds& faa = FAA_CATEGORY_THRESHOLDS;
+  TEST_ASSERT_EQUAL(CATEGORY_UNKNOWN, classifyFlightCategory(VISIBILITY_UNKNOWN, CEILING_NONE, faa));
+  TEST_ASSERT_EQUAL(CATEGORY_VFR, classifyFlightCategory(quantizeVisibility(10), CEILING_NONE, faa));
+  TEST_ASSERT_EQUAL(CATEGORY_VFR, classifyFlightCategory(VISIBILITY_UNKNOWN, quantizeCeiling(3100), faa));
+  TEST_ASSERT_EQUAL(CATEGORY_MVFR, classifyFlightCategory(quantizeVisibility(5), CEILING_NONE, faa));
+  TEST_ASSERT_EQUAL(CATEGORY_MVFR, classifyFlightCategory(VISIBILITY_UNKNOWN, quantizeCeiling(3000), faa));
+  TEST_ASSERT_EQUAL(CATEGORY_MVFR, classifyFlightCategory(quantizeVisibility(3), quantizeCeiling(1000), faa));
+  TEST_ASSERT_EQUAL(CATEGORY_IFR, classifyFlightCategory(quantizeVisibility(2.75f), CEILING_NONE, faa));
+  TEST_ASSERT_EQUAL(CATEGORY_IFR, classifyFlightCategory(quantizeVisibility(10), quantizeCeiling(900), faa));
+  TEST_ASSERT_EQUAL(CATEGORY_IFR, classifyFlightCategory(quantizeVisibility(1), quantizeCeiling(500), faa));
+  TEST_ASSERT_EQUAL(CATEGORY_LIFR, classifyFlightCategory(quantizeVisibility(0.75f), quantizeCeiling(5000), faa));
+  TEST_ASSERT_EQUAL(CATEGORY_LIFR, classifyFlightCategory(quantizeVisibility(10), quantizeCeiling(400), faa));
+  TEST_ASSERT_EQUAL(CATEGORY_LIFR, classifyFlightCategory(0, 0, faa));
+}
+
+void test_thresholds_must_tighten() {
+  TEST_ASSERT_TRUE(validCategoryThresholds(FAA_CATEGORY_THRESHOLDS));
+  const CategoryThresholds flat = {{12, 12, 12}, {10, 10, 10}};
+  TEST_ASSERT_TRUE(validCategoryThresholds(flat));
+  const CategoryThresholds visibilityInverted = {{4, 12, 21}, {31, 10, 5}};
+  TEST_ASSERT_FALSE(validCategoryThresholds(visibilityInverted));
+  const CategoryThresholds ceilingInverted = {{21, 12, 4}, {31, 5, 10}};
+  TEST_ASSERT_FALSE(validCategoryThresholds(ceilingInverted));
+}
+
+void test_cloud_covers() {
+  static const struct {
+    const char* code;
+    CloudCover cover;
+  } covers[] = {
+    {"CLR", COVER_CLR}, {"SKC", COVER_CLR}, {"CAVOK", COVER_CLR}, {"NCD", COVER_CLR}, {"NSC", COVER_CLR},
+    {"FEW", COVER_FEW}, {"SCT", COVER_SCT}, {"BKN", COVER_BKN}, {"OVC", COVER_OVC}, {"OVX", COVER_VV},
+    {"VV", COVER_VV}, {"", COVER_NONE}, {"BKNX", COVER_NONE}, {"ovc", COVER_NONE}, {nullptr, COVER_NONE}
+  };
+  for (const auto& entry : covers) {
+    TEST_ASSERT_EQUAL(entry.cover, parseCloudCover(entry.code));
+  }
+  TEST_ASSERT_FALSE(isCeilingCover(COVER_SCT));
+  TEST_ASSERT_TRUE(isCeilingCover(COVER_BKN));
+  TEST_ASSERT_TRUE(isCeilingCover(COVER_VV));
+}
+
+void test_names() {
+  TEST_ASSERT_EQUAL_STRING("N/A", flightCategoryName(CATEGORY_UNKNOWN));
+  TEST_ASSERT_EQUAL_STRING("MVFR", flightCategoryName(CATEGORY_MVFR));
+  TEST_ASSERT_EQUAL_STRING("LIFR", flightCategoryName(CATEGORY_LIFR));
+  TEST_ASSERT_EQUAL_STRING("N/A", flightCategoryName((FlightCategory)9));
+}
+
+// A whole store in one pass, against the old classifier called per station on floats and cover strings
+void test_classify_speed() {
+  static uint8_t visibility[BENCH_STATIONS];
+  static uint16_t ceiling[BENCH_STATIONS];
+  static uint8_t category[BENCH_STATIONS];
+  static float visib[BENCH_STATIONS];
+  static int ceilingFt[BENCH_STATIONS];
+  static const char* covers[BENCH_STATIONS];
+  static const char* const coverCodes[] = {"CLR", "FEW", "SCT", "BKN", "OVC"};
+  uint32_t seed = 12345;
+  for (int i = 0; i < BENCH_STATIONS; i++) {
+    seed = seed * 1103515245u + 12345u;
+    visib[i] = (seed >> 8) % 44 / 4.0f;
+    ceilingFt[i] = (seed >> 16) % 60 * 100;
+    covers[i] = coverCodes[(seed >> 24) % 5];
+    visibility[i] = quantizeVisibility(visib[i]);
+    ceiling[i] = isCeilingCover(parseCloudCover(covers[i])) ? quantizeCeiling(ceilingFt[i]) : CEILING_NONE;
+  }
+
+  // Read back so the compiler cannot drop the work
+  static volatile uint32_t checksum = 0;
+  unsigned long started = micros();
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    classifyStations(visibility, ceiling, category, BENCH_STATIONS, FAA_CATEGORY_THRESHOLDS);
+    checksum += category[round % BENCH_STATIONS];
+  }
+  double tableNanos = (micros() - started) * 1000.0 / BENCH_ROUNDS / BENCH_STATIONS;
+
+  started = micros();
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    for (int i = 0; i < BENCH_STATIONS; i++) {
+      category[i] = determineFlightCategory(visib[i], ceilingFt[i], covers[i]);
+    }
+    checksum += category[round % BENCH_STATIONS];
+  }
+  double oldNanos = (micros() - started) * 1000.0 / BENCH_ROUNDS / BENCH_STATIONS;
+
+  char line[128];
+  snprintf(line, sizeof(line), "%d stations: %.2f ns per station in one pass, %.2f ns with the old classifier",
+           BENCH_STATIONS, tableNanos, oldNanos);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_NANOS_PER_STATION, tableNanos, "ns per station");
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(oldNanos, tableNanos, "one pass against the old classifier");
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_faa_every_pair);
+  RUN_TEST(test_custom_thresholds_every_pair);
+  RUN_TEST(test_edges);
+  RUN_TEST(test_thresholds_must_tighten);
+  RUN_TEST(test_cloud_covers);
+  RUN_TEST(test_names);
+  RUN_TEST(test_classify_speed);
+  return UNITY_END();
+}
@@ -0,0 +1,332 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <vector>
+
+#include "lan_sync.h"
+
+//===================================================== LAN Sync Tests ====================================================================//
+// A leader and a follower joined by a loopback wire that drops, duplicates and reorders datagrams. Every frame
+// goes through encodeLanFrame() and decodeLanFrame(), the way the firmware sends and receives them. Whatever the
+// wire did, the follower must never go back to an older entry, and one keyframe round over a clean wire must
+// leave it with exactly the leader's stations.
+
+#define STATIONS 200
+#define ROUNDS 300
+#define KEY_ROUND_EVERY 10
+#define LEADER_ID 0xC0FFEE
+#define NOW 1792260000u
+
+struct Wire {
+  uint32_t dropPerMille;
+  uint32_t duplicatePerMille;
+  uint32_t holdPerMille;        // Held back and delivered after later frames
+};
+
+static const Wire CLEAN_WIRE = {0, 0, 0};
+
+static LanLeader<STATIONS> leader;
+static LanFollower<STATIONS / 2> follower;
+static LanStation leaderState[STATIONS];
+static LanStation followerState[STATIONS / 2];
+static bool followerHas[STATIONS / 2];
+
+static Wire wire;
+static std::vector<std::vector<uint8_t>> inFlight;
+static std::vector<std::vector<uint8_t>> heldBack;
+static uint32_t sent, dropped, duplicated, reordered;
+static uint32_t seed = 1;
+
+static uint32_t wireRandom(uint32_t range) {
+  seed = seed * 1103515245u + 12345u;
+  return (seed >> 8) % range;
+}
+
+static uint32_t stationIcao(int station) {
+  return 0x4B000000u | station;
+}
+
+// The follower's map has every other station of the leader's, at half its index
+static int findStation(uint32_t icao) {
+  uint32_t station = icao & 0xFFFFFF;
+  if ((icao & 0xFF000000u) != 0x4B000000u || station >= STATIONS || station % 2 != 0) {
+    return -1;
+  }
+  return station / 2;
+}
+
+static void transmit(const uint8_t* frame, size_t len) {
+  sent++;
+  std::vector<uint8_t> datagram(frame, frame + len);
+  if (wireRandom(1000) < wire.dropPerMille) {
+    dropped++;
+    return;
+  }
+  if (wireRandom(1000) < wire.holdPerMille) {
+    heldBack.push_back(datagram);
+    reordered++;
+    return;
+  }
+  inFlight.push_back(datagram);
+  if (wireRandom(1000) < wire.duplicatePerMille) {
+    inFlight.push_back(datagram);
+    duplicated++;
+  }
+  if (!heldBack.empty() && wireRandom(3) == 0) {
+    inFlight.push_back(heldBack.front());
+    heldBack.erase(heldBack.begin());
+  }
+}
+
+// Receive everything on the wire, as lanTask does between sends
+static void receive() {
+  LanFrameHeader header;
+  LanStation entries[LAN_FRAME_STATIONS];
+  uint16_t stations[LAN_FRAME_STATIONS];
+  for (const std::vector<uint8_t>& datagram : inFlight) {
+    int count = decodeLanFrame(datagram.data(), datagram.size(), header, entries, LAN_FRAME_STATIONS);
+    TEST_ASSERT_GREATER_OR_EQUAL(0, count);
+    uint32_t before[STATIONS / 2];
+    memcpy(before, follower.stationVersion, sizeof(before));
+    int kept = follower.accept(header, entries, count, findStation, stations);
+    for (int i = 0; i < kept; i++) {
+      TEST_ASSERT_TRUE(entries[i].version > before[stations[i]]);
+      followerState[stations[i]] = entries[i];
+      followerHas[stations[i]] = true;
+    }
+  }
+  inFlight.clear();
+}
+
+static void sendFrame(LanFrameType type, const uint16_t* stations, int count, uint32_t baseVersion) {
+  LanStation entries[LAN_FRAME_STATIONS];
+  for (int i = 0; i < count; i++) {
+    entries[i] = leaderState[stations[i]];
+    entries[i].version = leader.changedIn[stations[i]];
+  }
+  LanFrameHeader header = {type, (uint16_t)count, LEADER_ID, leader.version, baseVersion};
+  uint8_t frame[LAN_FRAME_MAX_BYTES];
+  size_t len = encodeLanFrame(header, entries, frame, sizeof(frame));
+  TEST_ASSERT_TRUE(len > 0 && len <= LAN_FRAME_MAX_BYTES);
+  transmit(frame, len);
+}
+
+static void sendDelta() {
+  uint16_t stations[LAN_FRAME_STATIONS];
+  uint32_t base = leader.sentVersion;
+  int cursor = 0;
+  int count;
+  while ((count = leader.collectDelta(cursor, STATIONS, stations, LAN_FRAME_STATIONS)) > 0) {
+    sendFrame(LAN_FRAME_DELTA, stations, count, base);
+  }
+  leader.deltaSent(leader.version);
+}
+
+static void sendKeyRound() {
+  uint16_t stations[LAN_FRAME_STATIONS];
+  int count;
+  while ((count = leader.collectKey(STATIONS, stations, LAN_FRAME_STATIONS)) > 0) {
+    sendFrame(LAN_FRAME_KEY, stations, count, 0);
+  }
+}
+
+static bool sameStation(const LanStation& a, const LanStation& b) {
+  return a.icao == b.icao && a.obsTime == b.obsTime && a.ceiling == b.ceiling && a.windDir == b.windDir &&
+         a.altimeter == b.altimeter && a.visibility == b.visibility && a.category == b.category &&
+         a.flags == b.flags && a.windSpeed == b.windSpeed && a.windGust == b.windGust &&
+         a.temperature == b.temperature;
+}
+
+static int stationsBehind() {
+  int behind = 0;
+  for (int i = 0; i < STATIONS / 2; i++) {
+    behind += !followerHas[i] || !sameStation(leaderState[i * 2], followerState[i]);
+  }
+  return behind;
+}
+
+// A map whose weather changes every round: deltas as the leader publishes, and a keyframe round now and then or
+// when the follower asks. Then the wire goes quiet and clean, and one keyframe round has to bring it level.
+static void runWire(const Wire& conditions, const char* name) {
+  wire = conditions;
+  for (int round = 0; round < ROUNDS; round++) {
+    bool changed[STATIONS] = {};
+    for (uint32_t n = 1 + wireRandom(30); n > 0; n--) {
+      int i = wireRandom(STATIONS);
+      LanStation& station = leaderState[i];
+      changed[i] = true;
+      station.category = 1 + wireRandom(4);
+      station.visibility = wireRandom(60);
+      station.ceiling = wireRandom(100);
+      station.windSpeed = wireRandom(40);
+      station.windGust = wireRandom(2) ? station.windSpeed + wireRandom(20) : 0;
+      station.temperature = (int)wireRandom(60) - 20;
+      station.obsTime = NOW + round * 60;
+      station.flags = 1 | (wireRandom(2) ? 4 : 0);
+    }
+    leader.stationsChanged(changed, STATIONS);
+    sendDelta();
+    if (round % KEY_ROUND_EVERY == 0 || follower.resyncWanted) {
+      if (follower.resyncWanted) {
+        follower.resyncWanted = false;
+        leader.restartKeyRound();
+      }
+      sendKeyRound();
+    }
+    receive();
+  }
+  int behindBefore = stationsBehind();
+
+  heldBack.clear();
+  wire = CLEAN_WIRE;
+  leader.restartKeyRound();
+  sendKeyRound();
+  receive();
+
+  char line[160];
+  snprintf(line, sizeof(line), "%-9s: %u sent, %u dropped, %u duplicated, %u reordered, %u gaps, %u stale, %d behind before the round",
+           name, sent, dropped, duplicated, reordered, follower.gaps, follower.staleEntries, behindBefore);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL_INT(0, stationsBehind());
+  TEST_ASSERT_EQUAL_UINT32(leader.version, follower.version);
+}
+
+void setUp() {
+  leader = LanLeader<STATIONS>();
+  follower = LanFollower<STATIONS / 2>();
+  for (int i = 0; i < STATIONS; i++) {
+    leaderState[i] = {stationIcao(i), 0, NOW - 3600, (uint16_t)(i % 50), 270, 10132, 40, 1, 1, 5, 0, 20};
+  }
+  memset(followerHas, 0, sizeof(followerHas));
+  inFlight.clear();
+  heldBack.clear();
+  sent = dropped = duplicated = reordered = 0;
+  seed = 7;
+}
+
+void tearDown() {}
+
+void test_frame_round_trip() {
+  LanStation entries[3] = {leaderState[0], leaderState[1], leaderState[2]};
+  entries[0].version = 5;
+  entries[1].obsTime = 0;
+  entries[2].temperature = -40;
+  LanFrameHeader header = {LAN_FRAME_DELTA, 3, LEADER_ID, 9, 4};
+  uint8_t frame[LAN_FRAME_MAX_BYTES];
+  size_t len = encodeLanFrame(header, entries, frame, sizeof(frame));
+  TEST_ASSERT_EQUAL(LAN_HEADER_BYTES + 3 * LAN_STATION_BYTES + 4, len);
+
+  LanFrameHeader decodedHeader;
+  LanStation decoded[3];
+  TEST_ASSERT_EQUAL_INT(3, decodeLanFrame(frame, len, decodedHeader, decoded, 3));
+  TEST_ASSERT_EQUAL(LAN_FRAME_DELTA, decodedHeader.type);
+  TEST_ASSERT_EQUAL_UINT32(LEADER_ID, decodedHeader.leaderId);
+  TEST_ASSERT_EQUAL_UINT32(9, decodedHeader.version);
+  TEST_ASSERT_EQUAL_UINT32(4, decodedHeader.baseVersion);
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_TRUE(sameStation(entries[i], decoded[i]));
+    TEST_ASSERT_EQUAL_UINT32(entries[i].version, decoded[i].version);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, decoded[1].obsTime);
+}
+
+// A flipped bit, a short frame or too many stations for the buffer are not frames
+void test_rejects_damaged_frames() {
+  LanFrameHeader header = {LAN_FRAME_KEY, 3, LEADER_ID, 5, 0};
+  uint8_t frame[LAN_FRAME_MAX_BYTES];
+  size_t len = encodeLanFrame(header, leaderState, frame, sizeof(frame));
+  LanStation decoded[3];
+  TEST_ASSERT_EQUAL_INT(3, decodeLanFrame(frame, len, header, decoded, 3));
+  TEST_ASSERT_EQUAL_INT(-1, decodeLanFrame(frame, len - 1, header, decoded, 3));
+  TEST_ASSERT_EQUAL_INT(-1, decodeLanFrame(frame, len, header, decoded, 2));
+  for (size_t bit = 0; bit < len * 8; bit += 7) {
+    frame[bit / 8] ^= 1 << bit % 8;
+    TEST_ASSERT_EQUAL_INT(-1, decodeLanFrame(frame, len, header, decoded, 3));
+    frame[bit / 8] ^= 1 << bit % 8;
+  }
+  TEST_ASSERT_EQUAL(0, encodeLanFrame(header, leaderState, frame, len - 1));
+}
+
+void test_full_frame_fits_a_datagram() {
+  LanFrameHeader header = {LAN_FRAME_KEY, LAN_FRAME_STATIONS, LEADER_ID, 1, 0};
+  uint8_t frame[LAN_FRAME_MAX_BYTES];
+  TEST_ASSERT_LESS_OR_EQUAL(LAN_FRAME_MAX_BYTES, encodeLanFrame(header, leaderState, frame, sizeof(frame)));
+}
+
+void test_clean_wire() {
+  runWire(CLEAN_WIRE, "clean");
+  // Only the first delta, which finds the follower without any version yet
+  TEST_ASSERT_EQUAL_UINT32(1, follower.gaps);
+  TEST_ASSERT_EQUAL_UINT32(0, follower.staleEntries);
+}
+
+void test_dropped_frames() {
+  Wire lossy = {200, 0, 0};
+  runWire(lossy, "dropped");
+  TEST_ASSERT_TRUE(follower.gaps > 0);
+}
+
+// Duplicates are stale the second time and change nothing
+void test_duplicated_frames() {
+  Wire doubling = {0, 300, 0};
+  runWire(doubling, "duplicate");
+  TEST_ASSERT_TRUE(duplicated > 0);
+  TEST_ASSERT_EQUAL_UINT32(1, follower.gaps);
+}
+
+void test_reordered_frames() {
+  Wire shuffling = {0, 0, 200};
+  runWire(shuffling, "reordered");
+  TEST_ASSERT_TRUE(reordered > 0);
+}
+
+void test_everything_at_once() {
+  Wire bad = {200, 50, 200};
+  runWire(bad, "all");
+}
+
+// A missed delta makes the follower ask for a keyframe round
+void test_gap_asks_for_resync() {
+  bool changed[STATIONS] = {};
+  changed[0] = true;
+  leader.stationsChanged(changed, STATIONS);
+  wire = {1000, 0, 0};
+  sendDelta();
+  wire = CLEAN_WIRE;
+  leader.stationsChanged(changed, STATIONS);
+  sendDelta();
+  receive();
+  TEST_ASSERT_EQUAL_UINT32(1, follower.gaps);
+  TEST_ASSERT_TRUE(follower.resyncWanted);
+}
+
+// A restarted leader numbers its versions from the start again, and the follower starts over with it
+void test_leader_restart() {
+  LanStation entry = leaderState[0];
+  uint16_t stations[1];
+  entry.version = 100;
+  LanFrameHeader before = {LAN_FRAME_KEY, 1, 1, 100, 0};
+  TEST_ASSERT_EQUAL_INT(1, follower.accept(before, &entry, 1, findStation, stations));
+  entry.version = 2;
+  TEST_ASSERT_EQUAL_INT(0, follower.accept(before, &entry, 1, findStation, stations));
+  LanFrameHeader after = {LAN_FRAME_KEY, 1, 2, 2, 0};
+  TEST_ASSERT_EQUAL_INT(1, follower.accept(after, &entry, 1, findStation, stations));
+  TEST_ASSERT_EQUAL_UINT32(2, follower.leaderChanges);
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_frame_round_trip);
+  RUN_TEST(test_rejects_damaged_frames);
+  RUN_TEST(test_full_frame_fits_a_datagram);
+  RUN_TEST(test_clean_wire);
+  RUN_TEST(test_dropped_frames);
+  RUN_TEST(test_duplicated_frames);
+  RUN_TEST(test_reordered_frames);
+  RUN_TEST(test_everything_at_once);
+  RUN_TEST(test_gap_asks_for_resync);
+  RUN_TEST(test_leader_restart);
+  return UNITY_END();
+}
@@ -0,0 +1,141 @@
+#include <unity.h>
+
+#include <Adafruit_NeoPixel.h>
+
+#include "led_output.h"
+
+//===================================================== LED Output Tests ==================================================================//
+// RecordingLedOutput keeps what was shown and the bytes a strip would receive for it. Those bytes must match
+// Adafruit_NeoPixel's brightness scaling and color order exactly, which is what the RMT backend relies on too.
+
+static uint32_t fakeMicros = 0;
+
+static uint32_t fakeClock() {
+  return fakeMicros;
+}
+
+static LedConfig stripConfig(uint16_t count, LedColorOrder order) {
+  LedConfig config = {};
+  config.pin = 25;
+  config.count = count;
+  config.order = order;
+  return config;
+}
+
+void setUp() {
+  fakeMicros = 0;
+}
+
+void tearDown() {}
+
+void test_records_frames() {
+  RecordingLedOutput output(3, fakeClock);
+  TEST_ASSERT_TRUE(output.begin(stripConfig(2, LED_ORDER_RGB)));
+  for (uint32_t i = 0; i < 5; i++) {
+    uint32_t pixels[2] = {i, 0xFF0000 + i};
+    fakeMicros = 20000 * i;
+    TEST_ASSERT_TRUE(output.show(pixels, 2, 255));
+  }
+  TEST_ASSERT_EQUAL_UINT32(5, output.frameCount());
+  TEST_ASSERT_EQUAL(3, output.frames().size());
+  for (uint32_t i = 0; i < 3; i++) {
+    const RecordingLedOutput::Frame& frame = output.frames()[i];
+    TEST_ASSERT_EQUAL_UINT32(20000 * i, frame.timestampMicros);
+    TEST_ASSERT_EQUAL(2, frame.pixels.size());
+    TEST_ASSERT_EQUAL_HEX32(i, frame.pixels[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xFF0000 + i, frame.pixels[1]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(80000, output.lastFrame().timestampMicros);
+  TEST_ASSERT_EQUAL_HEX32(0xFF0004, output.lastFrame().pixels[1]);
+
+  output.clear();
+  TEST_ASSERT_EQUAL_UINT32(0, output.frameCount());
+  TEST_ASSERT_EQUAL(0, output.frames().size());
+}
+
+// Without a frame limit only the count and the latest frame are kept
+void test_counts_without_keeping_frames() {
+  RecordingLedOutput output;
+  output.begin(stripConfig(1, LED_ORDER_GRB));
+  uint32_t pixel = 0x123456;
+  for (int i = 0; i < 100; i++) {
+    output.show(&pixel, 1, 10);
+  }
+  TEST_ASSERT_EQUAL_UINT32(100, output.frameCount());
+  TEST_ASSERT_EQUAL(0, output.frames().size());
+  TEST_ASSERT_EQUAL_UINT8(10, output.lastFrame().brightness);
+}
+
+void test_color_order() {
+  uint32_t pixel = 0x112233;
+  RecordingLedOutput rgb;
+  rgb.begin(stripConfig(1, LED_ORDER_RGB));
+  rgb.show(&pixel, 1, 255);
+  const uint8_t rgbWire[] = {0x11, 0x22, 0x33};
+  TEST_ASSERT_EQUAL_MEMORY(rgbWire, rgb.lastFrame().wire.data(), 3);
+
+  RecordingLedOutput grb;
+  grb.begin(stripConfig(1, LED_ORDER_GRB));
+  grb.show(&pixel, 1, 255);
+  const uint8_t grbWire[] = {0x22, 0x11, 0x33};
+  TEST_ASSERT_EQUAL_MEMORY(grbWire, grb.lastFrame().wire.data(), 3);
+}
+
+// Every channel value at every brightness scales the way Adafruit_NeoPixel does, 255 leaving it unchanged
+void test_brightness_scaling() {
+  for (int brightness = 0; brightness <= 255; brightness++) {
+    for (int value = 0; value <= 255; value++) {
+      TEST_ASSERT_EQUAL_UINT8((value * (brightness + 1)) >> 8, scaleChannel(value, brightness));
+    }
+  }
+  for (int value = 0; value <= 255; value++) {
+    TEST_ASSERT_EQUAL_UINT8(value, scaleChannel(value, 255));
+    TEST_ASSERT_EQUAL_UINT8(0, scaleChannel(value, 0));
+  }
+}
+
+// The recorded wire bytes are byte for byte what the NeoPixel backend sends, in both orders
+void test_matches_neopixel_backend() {
+  const uint16_t count = 64;
+  uint32_t pixels[count];
+  for (uint16_t i = 0; i < count; i++) {
+    pixels[i] = packColor(i * 4, 255 - i * 3, i * 37);
+  }
+  for (int o = LED_ORDER_RGB; o <= LED_ORDER_GRB; o++) {
+    LedConfig config = stripConfig(count, (LedColorOrder)o);
+    LedOutput* neopixel = createLedOutput(LED_BACKEND_NEOPIXEL);
+    TEST_ASSERT_NOT_NULL(neopixel);
+    TEST_ASSERT_TRUE(neopixel->begin(config));
+    RecordingLedOutput recording;
+    recording.begin(config);
+    static const uint8_t levels[] = {0, 1, 20, 127, 128, 254, 255};
+    for (uint8_t brightness : levels) {
+      neopixel->show(pixels, count, brightness);
+      recording.show(pixels, count, brightness);
+      const Adafruit_NeoPixel* strip = Adafruit_NeoPixel::lastShown();
+      TEST_ASSERT_EQUAL(count * 3, strip->shown.size());
+      TEST_ASSERT_EQUAL_MEMORY(strip->shown.data(), recording.lastFrame().wire.data(), count * 3);
+    }
+    delete neopixel;
+  }
+}
+
+void test_backends_by_type() {
+  LedOutput* recording = createLedOutput(LED_BACKEND_RECORDING);
+  TEST_ASSERT_EQUAL_STRING("recording", recording->name());
+  delete recording;
+  TEST_ASSERT_NULL(createLedOutput(LED_BACKEND_RMT));
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_records_frames);
+  RUN_TEST(test_counts_without_keeping_frames);
+  RUN_TEST(test_color_order);
+  RUN_TEST(test_brightness_scaling);
+  RUN_TEST(test_matches_neopixel_backend);
+  RUN_TEST(test_backends_by_type);
+  return UNITY_END();
+}
@@ -0,0 +1,167 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include <Arduino.h>
+
+#include "log_ring.h"
+
+//===================================================== Log Ring Tests ====================================================================//
+// What a log call costs the caller, next to formatting the same message the way debugPrint used to, and that
+// what comes out of the ring is what was logged.
+
+// Thresholds, host nanoseconds per call with room for a slow CI machine
+#define MAX_NANOS_PER_CALL 400          // Two arguments, copied into the ring
+#define MAX_NANOS_PER_FILTERED_CALL 20  // Above the runtime level, nothing is copied
+
+#define CALLS 200000
+#define POP_EVERY 32                    // Calls between log task runs, so the ring never fills
+
+static uint32_t fakeMillis = 0;
+
+static uint32_t fakeClock() {
+  return fakeMillis;
+}
+
+static void drain() {
+  LogRecord record;
+  while (logRing.pop(record)) {
+  }
+}
+
+static std::string popFormatted() {
+  LogRecord record;
+  char out[LOG_MAX_ARG_BYTES + 64];
+  if (!logRing.pop(record)) return "";
+  LogRing::format(record, out, sizeof(out));
+  return out;
+}
+
+// The sink keeps the formatted text alive, like the UART did for debugPrint
+static char sink[256];
+
+static double nanosPerCall(unsigned long micros) {
+  return micros * 1000.0 / CALLS;
+}
+
+void setUp() {
+  fakeMillis = 0;
+  logRing.begin(fakeClock);
+  logRing.level = LOG_LEVEL_DEBUG;
+  drain();
+  logRing.dropped = 0;
+  logRing.written = 0;
+}
+
+void tearDown() {}
+
+void test_cost_per_call() {
+  std::string station = "KPHX";
+  unsigned long started = micros();
+  for (int i = 0; i < CALLS; i++) {
+    LOG_DEBUG("Station %s updated in %d ms\n", station.c_str(), i);
+    if (i % POP_EVERY == 0) drain();
+  }
+  double ringNanos = nanosPerCall(micros() - started);
+  drain();
+  TEST_ASSERT_EQUAL_UINT32(0, logRing.dropped);
+
+  // What each debugPrint call did before it reached the UART
+  started = micros();
+  for (int i = 0; i < CALLS; i++) {
+    snprintf(sink, sizeof(sink), "Station %s updated in %d ms\n", station.c_str(), i);
+  }
+  double formatNanos = nanosPerCall(micros() - started);
+
+  logRing.level = LOG_LEVEL_WARN;
+  uint32_t written = logRing.written;
+  started = micros();
+  for (int i = 0; i < CALLS; i++) {
+    LOG_DEBUG("Station %s updated in %d ms\n", station.c_str(), i);
+  }
+  double filteredNanos = nanosPerCall(micros() - started);
+  TEST_ASSERT_EQUAL_UINT32(written, logRing.written);
+
+  char line[160];
+  snprintf(line, sizeof(line), "log call %.1f ns, filtered %.1f ns, snprintf of the same message %.1f ns",
+           ringNanos, filteredNanos, formatNanos);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_NANOS_PER_CALL, ringNanos, "ns per log call");
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_NANOS_PER_FILTERED_CALL, filteredNanos, "ns per filtered log call");
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(formatNanos, ringNanos, "log call against formatting the message");
+}
+
+void test_formats_every_type() {
+  std::string station = "KSFO";
+  LOG_ERROR("%d %u %lu %.2f %s %5s%% %x\n", -3, 7u, 9ul, 1.234, station.c_str(), "ab", 255);
+  TEST_ASSERT_EQUAL_STRING("-3 7 9 1.23 KSFO    ab% ff\n", popFormatted().c_str());
+  LOG_INFO("%llu %lld\n", 1ull << 40, -(1ll << 40));
+  TEST_ASSERT_EQUAL_STRING("1099511627776 -1099511627776\n", popFormatted().c_str());
+  LOG_INFO("no arguments\n");
+  TEST_ASSERT_EQUAL_STRING("no arguments\n", popFormatted().c_str());
+}
+
+// A float passed to %d, an int to %f or too few arguments print something sane instead of reading garbage
+void test_mismatched_arguments() {
+  LOG_WARN("%d %.1f\n", 2.7, 3);
+  std::string out = popFormatted();
+  TEST_ASSERT_EQUAL_STRING("2 3.0\n", out.c_str());
+  LOG_WARN("%d %d\n", 1);
+  out = popFormatted();
+  TEST_ASSERT_EQUAL_INT(0, out.find("1 "));
+}
+
+// String arguments are copied when logged, so the caller's buffer can change before the log task runs
+void test_strings_are_copied() {
+  char name[8];
+  strcpy(name, "KPHX");
+  LOG_INFO("%s\n", name);
+  strcpy(name, "XXXX");
+  TEST_ASSERT_EQUAL_STRING("KPHX\n", popFormatted().c_str());
+}
+
+void test_timestamps_and_levels() {
+  fakeMillis = 1234;
+  LOG_WARN("late\n");
+  LogRecord record;
+  TEST_ASSERT_TRUE(logRing.pop(record));
+  TEST_ASSERT_EQUAL_UINT32(1234, record.timestampMs);
+  TEST_ASSERT_EQUAL_UINT8(LOG_LEVEL_WARN, record.level);
+  TEST_ASSERT_EQUAL_STRING("WARN", logLevelName(record.level));
+}
+
+// A full ring drops new records and counts them, and keeps working across the wrap once drained
+void test_full_ring_drops() {
+  uint32_t calls = 0;
+  while (logRing.dropped == 0) {
+    LOG_INFO("record %u %s\n", calls++, "padding the record out");
+  }
+  TEST_ASSERT_EQUAL_UINT32(calls - 1, logRing.written);
+  for (uint32_t i = 0; i < logRing.written; i++) {
+    char expected[64];
+    snprintf(expected, sizeof(expected), "record %u padding the record out\n", i);
+    TEST_ASSERT_EQUAL_STRING(expected, popFormatted().c_str());
+  }
+  TEST_ASSERT_EQUAL_STRING("", popFormatted().c_str());
+  for (uint32_t i = 0; i < 3 * LOG_RING_BYTES / 32; i++) {
+    LOG_INFO("wrap %u\n", i);
+    char expected[32];
+    snprintf(expected, sizeof(expected), "wrap %u\n", i);
+    TEST_ASSERT_EQUAL_STRING(expected, popFormatted().c_str());
+  }
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_cost_per_call);
+  RUN_TEST(test_formats_every_type);
+  RUN_TEST(test_mismatched_arguments);
+  RUN_TEST(test_strings_are_copied);
+  RUN_TEST(test_timestamps_and_levels);
+  RUN_TEST(test_full_ring_drops);
+  return UNITY_END();
+}
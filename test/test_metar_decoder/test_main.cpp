@@ -0,0 +1,245 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include <Arduino.h>
+
+#include "metar_decoder.h"
+#include "metar_fixtures.h"
+#include "metar_stream.h"
+#include "refresh_arena.h"
+#include "replay_stream.h"
+
+//===================================================== METAR Decoder Tests ===============================================================//
+// decodeMetar() against the captured corpus, then fed corpus reports that are cut short, overwritten and spliced
+// together, and plain noise. Run with -fsanitize=address,undefined to catch reads past the end of a report.
+// Last, the same stations through both formats: response bytes and parse time per report, raw against JSON. Only
+// the bytes and the raw parse time are checked, the JSON time is reported to compare by hand.
+
+#define FUZZ_ITERATIONS 500000
+#define BENCH_STATIONS 500
+// Thresholds. The raw format must stay well under the JSON one in size
+#define MAX_RAW_TO_JSON_BYTES 0.25
+#define MAX_RAW_MICROS_PER_METAR 10
+
+#define HOST_PARSE_ARENA_BYTES 16384
+
+static uint8_t parseArenaBuffer[HOST_PARSE_ARENA_BYTES] __attribute__((aligned(8)));
+static RefreshArena parseArena(parseArenaBuffer, sizeof(parseArenaBuffer));
+static ArenaJsonAllocator parseJsonAllocator(parseArena);
+static JsonDocument metarFilter;
+
+static uint32_t fuzzSeed = 1;
+
+static uint32_t fuzzRandom(uint32_t range) {
+  fuzzSeed = fuzzSeed * 1103515245u + 12345u;
+  return (fuzzSeed >> 8) % range;
+}
+
+struct ExpectedMetar {
+  const char* icao;
+  float visib;
+  int ceiling;
+  CloudCover cover;
+  float temp;
+  int wdir;
+  int wspd;
+  int wgst;
+  float altim;
+  uint32_t obsTime;
+  bool thunderstorm;
+};
+
+// Checked by hand against the reports. Metres and MPS are converted, CAVOK and 9999 read as 6.21 miles
+static const ExpectedMetar EXPECTED[] = {
+  {"KPHX", 10, -1, COVER_NONE, 30.6f, 270, 8, -1, 1013.2f, 1792259460, false},
+  {"KSFO", 10, 1200, COVER_BKN, 15.0f, 290, 15, 23, 1016.3f, 1792259760, false},
+  {"KJFK", 1.5f, 500, COVER_OVC, 11.7f, 40, 12, -1, 1011.5f, 1792259460, false},
+  {"KDEN", 10, -1, COVER_NONE, -1.7f, -1, 3, -1, 1024.0f, 1792259580, false},
+  {"KORD", 3, 1600, COVER_BKN, 18.3f, 210, 18, 29, 1005.1f, 1792259460, true},
+  {"KMIA", 6, 4000, COVER_BKN, 28.9f, 90, 10, -1, 1016.6f, 1792259580, true},
+  {"KSEA", 0.25f, 200, COVER_VV, 8.9f, 0, 0, -1, 1019.3f, 1792259580, false},
+  {"KBOS", 0.25f, 100, COVER_VV, -0.6f, 330, 8, -1, 1022.0f, 1792259640, false},
+  {"EGLL", 6.21f, -1, COVER_NONE, 14.0f, 240, 12, -1, 1015.0f, 1792259400, false},
+  {"LFPG", 2.49f, 1200, COVER_BKN, 11.0f, 220, 16, -1, 1009.0f, 1792260000, false},
+  {"EDDF", 6.21f, -1, COVER_NONE, 17.0f, -1, 2, -1, 1021.0f, 1792259400, false},
+  {"UUEE", 0.5f, 200, COVER_VV, -5.0f, 180, 6, -1, 1030.0f, 1792260000, false},
+  {"KLAX", 10, -1, COVER_NONE, 22.0f, 250, 10, -1, 1014.2f, 1792259580, false},
+  {"KXYZ", -1, -1, COVER_NONE, -999, -1, -1, -1, -999, 1792259700, false},
+  {"KTPA", 6, 25000, COVER_BKN, 28.0f, 90, 5, -1, 1017.3f, 1792259580, false},
+  {"PANC", 10, 2000, COVER_OVC, -7.8f, 10, 5, -1, 1008.5f, 1792259580, false},
+  {"KABC", 0.5f, 400, COVER_OVC, 20.0f, 180, 25, 40, 1002.4f, 1792260300, true},
+  {"KGYR", 10, -1, COVER_NONE, 34.0f, 180, 7, -1, 1011.9f, 1792259220, false},
+  {nullptr, -1, -1, COVER_NONE, -999, -1, -1, -1, -999, 0, false},  // KCHD NIL
+  {"CYYZ", 10, 25000, COVER_BKN, 10.0f, 270, 15, 25, 1015.2f, 1792260000, false},
+  {"RJTT", 6.21f, -1, COVER_NONE, 18.0f, 340, 8, -1, 1018.0f, 1792260000, false},
+  {"KDVT", 7, 800, COVER_BKN, 14.0f, 150, 4, -1, 1012.5f, 1792259400, false},
+};
+
+// Whatever the input, a record is either rejected or holds terminated strings and values in range
+static void assertSaneRecord(const char* input, const MetarRecord& record) {
+  TEST_ASSERT_TRUE_MESSAGE(memchr(record.icaoId, 0, sizeof(record.icaoId)) != nullptr, input);
+  TEST_ASSERT_TRUE_MESSAGE(memchr(record.rawOb, 0, sizeof(record.rawOb)) != nullptr, input);
+  TEST_ASSERT_TRUE_MESSAGE(record.icaoId[0] != '\0', input);
+  TEST_ASSERT_TRUE_MESSAGE(record.visib == -1 || record.visib >= 0, input);
+  TEST_ASSERT_TRUE_MESSAGE(record.ceiling >= -1, input);
+  TEST_ASSERT_TRUE_MESSAGE((record.ceiling < 0) == (record.ceilingCover == COVER_NONE), input);
+  TEST_ASSERT_TRUE_MESSAGE(record.wdir >= -1 && record.wdir <= 360, input);
+  TEST_ASSERT_TRUE_MESSAGE(record.wspd >= -1 && record.wgst >= -1, input);
+  TEST_ASSERT_TRUE_MESSAGE(record.obsTime == 0 || record.obsTime <= FIXTURE_NOW + 86400, input);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_corpus() {
+  TEST_ASSERT_EQUAL_INT(METAR_CORPUS_COUNT, sizeof(EXPECTED) / sizeof(EXPECTED[0]));
+  for (int i = 0; i < METAR_CORPUS_COUNT; i++) {
+    const ExpectedMetar& expected = EXPECTED[i];
+    MetarRecord record;
+    bool decoded = decodeMetar(METAR_CORPUS[i], FIXTURE_NOW, record);
+    TEST_ASSERT_EQUAL_MESSAGE(expected.icao != nullptr, decoded, METAR_CORPUS[i]);
+    if (!decoded) continue;
+    TEST_ASSERT_EQUAL_STRING(expected.icao, record.icaoId);
+    TEST_ASSERT_FLOAT_WITHIN_MESSAGE(0.01f, expected.visib, record.visib, METAR_CORPUS[i]);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(expected.ceiling, record.ceiling, METAR_CORPUS[i]);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(expected.cover, record.ceilingCover, METAR_CORPUS[i]);
+    TEST_ASSERT_FLOAT_WITHIN_MESSAGE(0.05f, expected.temp, record.temp, METAR_CORPUS[i]);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(expected.wdir, record.wdir, METAR_CORPUS[i]);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(expected.wspd, record.wspd, METAR_CORPUS[i]);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(expected.wgst, record.wgst, METAR_CORPUS[i]);
+    TEST_ASSERT_FLOAT_WITHIN_MESSAGE(0.05f, expected.altim, record.altim, METAR_CORPUS[i]);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected.obsTime, record.obsTime, METAR_CORPUS[i]);
+    TEST_ASSERT_EQUAL_MESSAGE(expected.thunderstorm, record.thunderstorm, METAR_CORPUS[i]);
+  }
+}
+
+// A report from the last days of the previous month, seen on the 1st
+void test_obs_time_month_rollover() {
+  const uint32_t october1 = 1790812800;
+  TEST_ASSERT_EQUAL_UINT32(1790805600, metarObsTime(30, 22, 0, october1));   // 2026-09-30 22:00Z
+  TEST_ASSERT_EQUAL_UINT32(october1 + 3600, metarObsTime(1, 1, 0, october1));
+  TEST_ASSERT_EQUAL_UINT32(0, metarObsTime(31, 12, 0, 0));
+  TEST_ASSERT_EQUAL_UINT32(0, metarObsTime(32, 12, 0, october1));
+  TEST_ASSERT_EQUAL_UINT32(0, metarObsTime(12, 24, 0, october1));
+}
+
+void test_rejects_without_station_and_time() {
+  MetarRecord record;
+  TEST_ASSERT_FALSE(decodeMetar("", FIXTURE_NOW, record));
+  TEST_ASSERT_FALSE(decodeMetar("   ", FIXTURE_NOW, record));
+  TEST_ASSERT_FALSE(decodeMetar("KPHX", FIXTURE_NOW, record));
+  TEST_ASSERT_FALSE(decodeMetar("METAR", FIXTURE_NOW, record));
+  TEST_ASSERT_FALSE(decodeMetar("KCHD 171747Z NIL", FIXTURE_NOW, record));
+}
+
+// Corpus reports truncated, with characters overwritten from the METAR alphabet, spliced into one another, and
+// random bytes. Any of them may decode or not, none may crash or leave a broken record.
+void test_fuzz() {
+  static const char alphabet[] = " /0123456789ABCGKMNOPRSTVZ+-=";
+  MetarRecord record;
+  uint32_t decoded = 0;
+  for (uint32_t i = 0; i < FUZZ_ITERATIONS; i++) {
+    std::string input = METAR_CORPUS[fuzzRandom(METAR_CORPUS_COUNT)];
+    switch (fuzzRandom(4)) {
+      case 0:
+        input.resize(fuzzRandom(input.size() + 1));
+        break;
+      case 1:
+        for (uint32_t n = 1 + fuzzRandom(4); n > 0; n--) {
+          input[fuzzRandom(input.size())] = alphabet[fuzzRandom(sizeof(alphabet) - 1)];
+        }
+        break;
+      case 2: {
+        input.clear();
+        for (uint32_t n = fuzzRandom(200); n > 0; n--) {
+          input += (char)(1 + fuzzRandom(255));
+        }
+        break;
+      }
+      default: {
+        std::string other = METAR_CORPUS[fuzzRandom(METAR_CORPUS_COUNT)];
+        input = input.substr(0, fuzzRandom(input.size() + 1)) + other.substr(fuzzRandom(other.size() + 1));
+        break;
+      }
+    }
+    if (decodeMetar(input.c_str(), fuzzRandom(2) ? FIXTURE_NOW : 0, record)) {
+      assertSaneRecord(input.c_str(), record);
+      decoded++;
+    }
+  }
+  char line[64];
+  snprintf(line, sizeof(line), "%u of %u inputs decoded", decoded, FUZZ_ITERATIONS);
+  TEST_MESSAGE(line);
+}
+
+// Reports longer than rawOb are cut at its end, never past it
+void test_long_report() {
+  std::string input = std::string(METAR_CORPUS[0]) + std::string(400, ' ') + " RMK" + std::string(400, 'X');
+  MetarRecord record;
+  TEST_ASSERT_TRUE(decodeMetar(input.c_str(), FIXTURE_NOW, record));
+  TEST_ASSERT_EQUAL(sizeof(record.rawOb) - 1, strlen(record.rawOb));
+  assertSaneRecord(input.c_str(), record);
+}
+
+//---- Raw against JSON for the same stations ----//
+struct FormatCost {
+  uint32_t bytes;
+  uint32_t metars;
+  double micros;
+};
+
+static void discard(const MetarRecord&) {}
+
+static FormatCost parseCost(MetarFormat format) {
+  std::string body = format == METAR_FORMAT_RAW ? fixtureRawPayload(0, BENCH_STATIONS)
+                                                : fixtureJsonPayload(0, BENCH_STATIONS);
+  FormatCost cost = {(uint32_t)body.size(), 0, 0};
+  const int rounds = 20;
+  ReplayStream stream;
+  for (int round = 0; round < rounds; round++) {
+    stream.load(body, 1436);
+    stream.end(true);
+    IngestStats stats = {};
+    unsigned long started = micros();
+    int count = format == METAR_FORMAT_RAW ? streamRawMetars(stream, FIXTURE_NOW, discard, stats)
+                                           : streamMetars(stream, metarFilter, parseJsonAllocator, discard, stats);
+    cost.micros += micros() - started;
+    parseArena.reset();
+    TEST_ASSERT_EQUAL_INT(BENCH_STATIONS, count);
+    cost.metars += count;
+  }
+  char line[128];
+  snprintf(line, sizeof(line), "%-4s: %6u bytes for %d stations, %.1f bytes and %.2f us per METAR",
+           metarFormatName(format), cost.bytes, BENCH_STATIONS, (double)cost.bytes / BENCH_STATIONS,
+           cost.micros / cost.metars);
+  TEST_MESSAGE(line);
+  return cost;
+}
+
+void test_raw_against_json() {
+  FormatCost json = parseCost(METAR_FORMAT_JSON);
+  FormatCost raw = parseCost(METAR_FORMAT_RAW);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_RAW_TO_JSON_BYTES, (double)raw.bytes / json.bytes, "raw to JSON bytes");
+  char line[64];
+  snprintf(line, sizeof(line), "raw takes %.2f of the JSON parse time", raw.micros / json.micros);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_RAW_MICROS_PER_METAR, raw.micros / raw.metars, "raw parse time per METAR");
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  setupMetarFilter(metarFilter);
+  UNITY_BEGIN();
+  RUN_TEST(test_corpus);
+  RUN_TEST(test_obs_time_month_rollover);
+  RUN_TEST(test_rejects_without_station_and_time);
+  RUN_TEST(test_fuzz);
+  RUN_TEST(test_long_report);
+  RUN_TEST(test_raw_against_json);
+  return UNITY_END();
+}
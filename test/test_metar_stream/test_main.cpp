@@ -0,0 +1,167 @@
+#include <unity.h>
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "metar_fixtures.h"
+#include "metar_stream.h"
+#include "refresh_arena.h"
+#include "replay_stream.h"
+
+//===================================================== METAR Stream Tests ================================================================//
+// Replays captured payloads through streamMetars() and streamRawMetars() cut into chunks of every size the
+// fetcher can hand over, from single bytes to whole TCP segments. Where the chunk boundaries fall must never
+// change what comes out, and a payload cut short must never produce a partial report.
+
+#define HOST_PARSE_ARENA_BYTES 16384
+#define STATIONS 40
+
+static uint8_t parseArenaBuffer[HOST_PARSE_ARENA_BYTES] __attribute__((aligned(8)));
+static RefreshArena parseArena(parseArenaBuffer, sizeof(parseArenaBuffer));
+static ArenaJsonAllocator parseJsonAllocator(parseArena);
+static JsonDocument metarFilter;
+
+static std::vector<MetarRecord> received;
+
+static void collect(const MetarRecord& record) {
+  received.push_back(record);
+}
+
+static int replay(const std::string& body, MetarFormat format, size_t chunkSize, unsigned seed = 0,
+                  bool ok = true) {
+  ReplayStream stream;
+  stream.load(body, chunkSize, seed);
+  stream.end(ok);
+  IngestStats stats = {};
+  received.clear();
+  int count = format == METAR_FORMAT_RAW ? streamRawMetars(stream, FIXTURE_NOW, collect, stats)
+                                         : streamMetars(stream, metarFilter, parseJsonAllocator, collect, stats);
+  parseArena.reset();
+  TEST_ASSERT_EQUAL_UINT32(received.size(), stats.metars);
+  return count;
+}
+
+static void assertSameRecord(const MetarRecord& expected, const MetarRecord& actual) {
+  TEST_ASSERT_EQUAL_STRING(expected.icaoId, actual.icaoId);
+  TEST_ASSERT_EQUAL_STRING(expected.rawOb, actual.rawOb);
+  TEST_ASSERT_EQUAL_UINT32(expected.obsTime, actual.obsTime);
+  TEST_ASSERT_EQUAL_FLOAT(expected.visib, actual.visib);
+  TEST_ASSERT_EQUAL_INT(expected.ceiling, actual.ceiling);
+  TEST_ASSERT_EQUAL_INT(expected.ceilingCover, actual.ceilingCover);
+  TEST_ASSERT_EQUAL_FLOAT(expected.temp, actual.temp);
+  TEST_ASSERT_EQUAL_INT(expected.wdir, actual.wdir);
+  TEST_ASSERT_EQUAL_INT(expected.wspd, actual.wspd);
+  TEST_ASSERT_EQUAL_INT(expected.wgst, actual.wgst);
+  TEST_ASSERT_EQUAL_FLOAT(expected.altim, actual.altim);
+  TEST_ASSERT_EQUAL(expected.thunderstorm, actual.thunderstorm);
+}
+
+// The reports every chunking must reproduce, decoded straight from the fixture text
+static std::vector<MetarRecord> expectedRecords(int count) {
+  std::vector<MetarRecord> expected(count);
+  for (int i = 0; i < count; i++) {
+    TEST_ASSERT_TRUE(decodeMetar(fixtureRawMetar(i).c_str(), FIXTURE_NOW, expected[i]));
+  }
+  return expected;
+}
+
+static void checkChunkings(const std::string& body, MetarFormat format) {
+  static const size_t sizes[] = {1, 2, 3, 7, 64, 511, 1436, 65536};
+  std::vector<MetarRecord> expected = expectedRecords(STATIONS);
+  for (size_t size : sizes) {
+    TEST_ASSERT_EQUAL_INT(STATIONS, replay(body, format, size));
+    TEST_ASSERT_EQUAL(STATIONS, received.size());
+    for (int i = 0; i < STATIONS; i++) {
+      assertSameRecord(expected[i], received[i]);
+    }
+  }
+  // Random chunk sizes, as a congested connection delivers them
+  for (unsigned seed = 1; seed <= 50; seed++) {
+    TEST_ASSERT_EQUAL_INT(STATIONS, replay(body, format, 1 + seed * 37 % 700, seed));
+    for (int i = 0; i < STATIONS; i++) {
+      assertSameRecord(expected[i], received[i]);
+    }
+  }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_json_any_chunking() {
+  checkChunkings(fixtureJsonPayload(0, STATIONS), METAR_FORMAT_JSON);
+}
+
+void test_raw_any_chunking() {
+  checkChunkings(fixtureRawPayload(0, STATIONS), METAR_FORMAT_RAW);
+}
+
+void test_raw_crlf_and_blank_lines() {
+  std::string body = "\r\n" + fixtureRawMetar(0) + "\r\n\r\n" + fixtureRawMetar(1) + " \r\n";
+  TEST_ASSERT_EQUAL_INT(2, replay(body, METAR_FORMAT_RAW, 5));
+  TEST_ASSERT_EQUAL_STRING(fixtureRawMetar(1).c_str(), received[1].rawOb);
+}
+
+void test_json_empty_and_malformed() {
+  TEST_ASSERT_EQUAL_INT(0, replay("[]", METAR_FORMAT_JSON, 1));
+  TEST_ASSERT_EQUAL_INT(0, replay(" \r\n[ \n\t]\n", METAR_FORMAT_JSON, 1));
+  TEST_ASSERT_EQUAL_INT(-1, replay("{\"error\":\"bad request\"}", METAR_FORMAT_JSON, 3));
+  TEST_ASSERT_EQUAL_INT(-1, replay("", METAR_FORMAT_JSON, 1));
+  TEST_ASSERT_EQUAL_INT(-1, replay("[{\"icaoId\":\"KPHX\",}]", METAR_FORMAT_JSON, 4));
+}
+
+// Cut at every point of the payload, only reports that arrived whole come out, and all of them correctly. A
+// JSON payload cut after its last element still parses, the stream's complete() is what rejects it.
+void test_truncated_payloads() {
+  std::vector<MetarRecord> expected = expectedRecords(3);
+  for (int f = 0; f < METAR_FORMAT_COUNT; f++) {
+    MetarFormat format = (MetarFormat)f;
+    std::string body = format == METAR_FORMAT_RAW ? fixtureRawPayload(0, 3) : fixtureJsonPayload(0, 3);
+    for (size_t cut = 0; cut < body.size(); cut++) {
+      int count = replay(body.substr(0, cut), format, 1 + cut % 13, 0, false);
+      TEST_ASSERT_LESS_OR_EQUAL(3, received.size());
+      if (format == METAR_FORMAT_RAW) {
+        TEST_ASSERT_EQUAL_INT(received.size(), count);
+        TEST_ASSERT_LESS_THAN(3, count);
+      }
+      for (size_t i = 0; i < received.size(); i++) {
+        assertSameRecord(expected[i], received[i]);
+      }
+    }
+  }
+}
+
+// A raw payload whose last line has no newline is decoded only when it arrived in full
+void test_raw_last_line_needs_complete_payload() {
+  std::string body = fixtureRawMetar(0) + "\n" + fixtureRawMetar(1);
+  TEST_ASSERT_EQUAL_INT(2, replay(body, METAR_FORMAT_RAW, 16, 0, true));
+  TEST_ASSERT_EQUAL_INT(1, replay(body, METAR_FORMAT_RAW, 16, 0, false));
+}
+
+// Each element is parsed in the arena and released before the next, so its use does not grow with the payload
+void test_json_arena_does_not_grow() {
+  parseArena.highWater = 0;
+  replay(fixtureJsonPayload(0, STATIONS), METAR_FORMAT_JSON, 64);
+  size_t oneBatch = parseArena.highWater;
+  parseArena.highWater = 0;
+  replay(fixtureJsonPayload(0, STATIONS * 10), METAR_FORMAT_JSON, 64);
+  TEST_ASSERT_EQUAL(STATIONS * 10, received.size());
+  TEST_ASSERT_EQUAL(oneBatch, parseArena.highWater);
+  TEST_ASSERT_EQUAL_UINT32(0, parseJsonAllocator.heapFallbacks);
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  setupMetarFilter(metarFilter);
+  UNITY_BEGIN();
+  RUN_TEST(test_json_any_chunking);
+  RUN_TEST(test_raw_any_chunking);
+  RUN_TEST(test_raw_crlf_and_blank_lines);
+  RUN_TEST(test_json_empty_and_malformed);
+  RUN_TEST(test_truncated_payloads);
+  RUN_TEST(test_raw_last_line_needs_complete_payload);
+  RUN_TEST(test_json_arena_does_not_grow);
+  return UNITY_END();
+}
@@ -0,0 +1,307 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <time.h>
+
+#include <Arduino.h>
+
+#include "power_scheduler.h"
+
+//===================================================== Power Scheduler Tests =============================================================//
+// nextScheduleChange() against a brute force walk over every minute, in zones with and without DST and across
+// both shifts, including windows that start in the skipped hour or end in the repeated one. Then whole days on
+// a simulated clock at each power_save level: the fetches and the display window as fetcherTask and loop() see
+// them, and the mode and estimated current each level ends up with.
+
+// The firmware's settings
+#define POWER_CONFIG {100, 1000, 1000, 30000, 5000, 10 * 60 * 1000UL, 5000, 30000, {80.0f, 30.0f, 1.5f}}
+
+#define US_MOUNTAIN "MST7MDT,M3.2.0,M11.1.0"
+#define CENTRAL_EUROPE "CET-1CEST,M3.5.0,M10.5.0/3"
+#define US_SPRING_FORWARD 1772960400      // 2026-03-08 09:00Z, 03:00 MDT
+#define EU_FALL_BACK 1792890000           // 2026-10-25 01:00Z, 02:00 CET for the second time
+#define LEVEL_DAY 1776063600              // 2026-04-13 07:00Z, midnight MST
+
+// Thresholds for the estimated average current over a day lit from 07:00 to 22:00
+#define MAX_IDLE_MILLIAMPS 40
+#define MAX_SLEEP_MILLIAMPS 30
+
+static const PowerConfig config = POWER_CONFIG;
+
+// The first minute after now whose start or end changes the window, found minute by minute
+static time_t bruteNextChange(const DisplaySchedule& schedule, time_t now) {
+  struct tm local;
+  localtime_r(&now, &local);
+  bool current = displayScheduled(schedule, local);
+  time_t t = now - now % 60 + 60;
+  for (int i = 0; i < 60 * 24 * 9; i++, t += 60) {
+    localtime_r(&t, &local);
+    int minute = local.tm_hour * 60 + local.tm_min;
+    if (displayScheduled(schedule, local) != current &&
+        (minute == schedule.startMinute || minute == schedule.endMinute % 1440)) {
+      return t;
+    }
+  }
+  return 0;
+}
+
+static void compareWithBruteForce(const char* tz, const DisplaySchedule& schedule, time_t from, int hours) {
+  configTzTime(tz, "pool.ntp.org");
+  int checked = 0;
+  for (time_t now = from; now < from + hours * 3600; now += 997) {
+    time_t expected = bruteNextChange(schedule, now);
+    time_t actual = nextScheduleChange(schedule, now);
+    if (expected != actual) {
+      char message[160];
+      struct tm local;
+      char want[32], got[32];
+      localtime_r(&expected, &local);
+      strftime(want, sizeof(want), "%a %F %R %Z", &local);
+      localtime_r(&actual, &local);
+      strftime(got, sizeof(got), "%a %F %R %Z", &local);
+      snprintf(message, sizeof(message), "%s %02d:%02d-%02d:%02d: want %s, got %s", tz, schedule.startMinute / 60,
+               schedule.startMinute % 60, schedule.endMinute / 60, schedule.endMinute % 60, want, got);
+      TEST_FAIL_MESSAGE(message);
+    }
+    checked++;
+  }
+  TEST_ASSERT_TRUE(checked > 0);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_schedule_without_dst() {
+  DisplaySchedule daily = {7 * 60, 20 * 60, 0x7F};
+  compareWithBruteForce("MST7", daily, US_SPRING_FORWARD - 3 * 86400, 24 * 10);
+  DisplaySchedule never = {600, 600, 0x7F};
+  compareWithBruteForce("UTC0", never, EU_FALL_BACK, 24);
+  configTzTime("UTC0", "pool.ntp.org");
+  TEST_ASSERT_EQUAL(0, nextScheduleChange(never, EU_FALL_BACK));
+}
+
+void test_schedule_across_spring_forward() {
+  DisplaySchedule weekdays = {7 * 60 + 30, 22 * 60 + 15, 0x3E};
+  compareWithBruteForce(US_MOUNTAIN, weekdays, US_SPRING_FORWARD - 3 * 86400, 24 * 10);
+  DisplaySchedule overnight = {22 * 60, 6 * 60 + 45, 0x41};
+  compareWithBruteForce(US_MOUNTAIN, overnight, US_SPRING_FORWARD - 3 * 86400, 24 * 10);
+  // Starts in the hour that is skipped
+  DisplaySchedule skipped = {2 * 60 + 30, 3 * 60, 0x7F};
+  compareWithBruteForce(US_MOUNTAIN, skipped, US_SPRING_FORWARD - 3 * 86400, 24 * 10);
+}
+
+void test_schedule_across_fall_back() {
+  // Ends in the hour that repeats
+  DisplaySchedule repeated = {6 * 60, 2 * 60 + 30, 0x7F};
+  compareWithBruteForce(CENTRAL_EUROPE, repeated, EU_FALL_BACK - 3 * 86400, 24 * 10);
+  DisplaySchedule always = {0, 1440, 0x7F};
+  compareWithBruteForce(CENTRAL_EUROPE, always, EU_FALL_BACK - 3 * 86400, 24 * 3);
+}
+
+// A 02:30 close in the repeated hour happens at the first 02:30, and the window stays shut through the second
+void test_repeated_hour_closes_once() {
+  configTzTime(CENTRAL_EUROPE, "pool.ntp.org");
+  DisplaySchedule repeated = {6 * 60, 2 * 60 + 30, 0x7F};
+  time_t close = nextScheduleChange(repeated, EU_FALL_BACK - 3 * 3600);
+  TEST_ASSERT_EQUAL(EU_FALL_BACK - 3600 + 30 * 60, close);           // 00:30Z, 02:30 CEST
+  time_t open = nextScheduleChange(repeated, close);
+  struct tm local;
+  localtime_r(&open, &local);
+  TEST_ASSERT_EQUAL_INT(6, local.tm_hour);
+  TEST_ASSERT_EQUAL_INT(0, local.tm_min);
+}
+
+// The window follows the local clock: 07:00 MST is 14:00Z, 07:00 MDT is 13:00Z
+void test_dst_moves_the_window() {
+  configTzTime(US_MOUNTAIN, "pool.ntp.org");
+  DisplaySchedule daily = {7 * 60, 20 * 60, 0x7F};
+  struct tm utc;
+  time_t before = nextScheduleChange(daily, US_SPRING_FORWARD - 2 * 86400);
+  gmtime_r(&before, &utc);
+  TEST_ASSERT_EQUAL_INT(14, utc.tm_hour);
+  time_t after = nextScheduleChange(daily, US_SPRING_FORWARD + 86400);
+  gmtime_r(&after, &utc);
+  TEST_ASSERT_EQUAL_INT(13, utc.tm_hour);
+}
+
+static PowerInputs quietInputs(PowerLevel level, bool displayOn) {
+  PowerInputs in = {};
+  in.nowMs = 100000;
+  in.level = level;
+  in.displayOn = displayOn;
+  in.fetchWaitMs = POWER_WAIT_NONE;
+  in.scheduleWaitMs = POWER_WAIT_NONE;
+  in.housekeepingWaitMs = POWER_WAIT_NONE;
+  return in;
+}
+
+void test_plan() {
+  PowerScheduler scheduler(config);
+  PowerInputs in = quietInputs(POWER_LEVEL_OFF, true);
+  TEST_ASSERT_EQUAL(POWER_ACTIVE, scheduler.plan(in).mode);
+
+  // Anything moving or waiting on the board keeps it active
+  in = quietInputs(POWER_LEVEL_SLEEP, false);
+  in.animating = true;
+  TEST_ASSERT_EQUAL(POWER_ACTIVE, scheduler.plan(in).mode);
+  in = quietInputs(POWER_LEVEL_SLEEP, false);
+  in.lastRequestMs = in.nowMs - 1000;
+  TEST_ASSERT_EQUAL(POWER_ACTIVE, scheduler.plan(in).mode);
+
+  // Idle up to the fetch less its lead, in slices short enough to notice new work
+  in = quietInputs(POWER_LEVEL_IDLE, true);
+  in.fetchWaitMs = 1500;
+  PowerPlan plan = scheduler.plan(in);
+  TEST_ASSERT_EQUAL(POWER_IDLE, plan.mode);
+  TEST_ASSERT_EQUAL(WAKE_FETCH, plan.wake);
+  TEST_ASSERT_EQUAL_UINT32(500, plan.waitMs);
+  in.fetchWaitMs = 60000;
+  TEST_ASSERT_EQUAL_UINT32(config.idleMaxMs, scheduler.plan(in).waitMs);
+
+  // Light sleep only outside the window, waking early for WiFi, and never longer than a slice
+  in = quietInputs(POWER_LEVEL_SLEEP, true);
+  in.scheduleWaitMs = 3600000;
+  TEST_ASSERT_EQUAL(POWER_IDLE, scheduler.plan(in).mode);
+  in.displayOn = false;
+  plan = scheduler.plan(in);
+  TEST_ASSERT_EQUAL(POWER_LIGHT_SLEEP, plan.mode);
+  TEST_ASSERT_EQUAL(WAKE_CHECK, plan.wake);
+  TEST_ASSERT_EQUAL_UINT32(config.maxSleepMs, plan.waitMs);
+  in.scheduleWaitMs = 60000;
+  plan = scheduler.plan(in);
+  TEST_ASSERT_EQUAL(WAKE_SCHEDULE, plan.wake);
+  TEST_ASSERT_EQUAL_UINT32(60000 - config.sleepLeadMs, plan.waitMs);
+  in.scheduleWaitMs = config.minSleepMs;
+  TEST_ASSERT_EQUAL(POWER_IDLE, scheduler.plan(in).mode);
+
+  // Reachable for a while after each wake
+  scheduler.woke(1000, 1000, in.nowMs);
+  in.scheduleWaitMs = 60000;
+  TEST_ASSERT_EQUAL(POWER_IDLE, scheduler.plan(in).mode);
+  in.nowMs += config.awakeHoldMs;
+  TEST_ASSERT_EQUAL(POWER_LIGHT_SLEEP, scheduler.plan(in).mode);
+}
+
+struct DayResult {
+  float milliamps;
+  uint32_t sleeps;
+  uint32_t lateFetches;
+  uint32_t fetchesNotActive;
+  uint32_t sleepsWhileLit;
+};
+
+// A day lit 07:00 to 22:00 with a 6 s fetch every 15 minutes while lit and wind blinking in one hour of five.
+// Light sleeps overrun by 3 ms and WiFi takes 1.8 s to come back.
+static DayResult simulateDay(PowerLevel level) {
+  configTzTime("MST7", "pool.ntp.org");
+  PowerScheduler scheduler(config);
+  DisplaySchedule schedule = {7 * 60, 22 * 60, 0x7F};
+  DayResult result = {};
+  uint64_t ms = 0;
+  uint32_t fetchAt = 0;
+  uint32_t fetchEnd = 0;
+  uint32_t fadeEnd = 0;
+  bool displayOn = false;
+  time_t nextChange = 0;
+  while (ms < 86400000ULL) {
+    uint32_t now = ms;
+    time_t unixTime = LEVEL_DAY + ms / 1000;
+    struct tm local;
+    localtime_r(&unixTime, &local);
+    bool on = displayScheduled(schedule, local);
+    if (on != displayOn) {
+      displayOn = on;
+      fadeEnd = now + 1000;
+    }
+    if (nextChange == 0 || unixTime >= nextChange) {
+      nextChange = nextScheduleChange(schedule, unixTime);
+    }
+    if (displayOn && fetchAt == 0) {
+      fetchAt = now;
+    }
+    if (displayOn && fetchAt != 0 && now >= fetchAt && fetchEnd < fetchAt) {
+      result.lateFetches += now > fetchAt + config.fetchLeadMs;
+      fetchEnd = now + 6000;
+      fetchAt = now + 15 * 60000;
+    }
+    bool windy = displayOn && local.tm_hour % 5 == 0;
+
+    PowerInputs in = {};
+    in.nowMs = now;
+    in.level = level;
+    in.displayOn = displayOn;
+    in.animating = windy || now < fadeEnd;
+    in.fetchRunning = now < fetchEnd;
+    in.fetchWaitMs = displayOn && fetchAt != 0 ? (fetchAt > now ? fetchAt - now : 0) : POWER_WAIT_NONE;
+    in.scheduleWaitMs = nextChange ? (uint32_t)((nextChange - unixTime) * 1000 - ms % 1000) : POWER_WAIT_NONE;
+    in.housekeepingWaitMs = POWER_WAIT_NONE;
+    PowerPlan plan = scheduler.plan(in);
+    if (plan.mode != scheduler.mode()) {
+      scheduler.enter(plan.mode, now);
+    }
+    result.fetchesNotActive += in.fetchRunning && scheduler.mode() != POWER_ACTIVE;
+    uint32_t waitMs = plan.waitMs ? plan.waitMs : 1;
+    if (plan.mode == POWER_LIGHT_SLEEP) {
+      result.sleepsWhileLit += displayOn;
+      ms += waitMs + 3;
+      scheduler.woke(waitMs, waitMs + 3, ms);
+      scheduler.enter(POWER_ACTIVE, ms);
+      ms += 1800;
+      scheduler.reconnected(1800);
+    } else {
+      ms += waitMs;
+    }
+  }
+  uint32_t end = ms;
+  result.milliamps = scheduler.estimatedMilliamps(end);
+  result.sleeps = scheduler.sleeps;
+  char line[160];
+  snprintf(line, sizeof(line), "power_save %d: active %.1f h, idle %.1f h, light sleep %.1f h, %u sleeps, %.1f mA",
+           level, scheduler.residencyMs(POWER_ACTIVE, end) / 3.6e6, scheduler.residencyMs(POWER_IDLE, end) / 3.6e6,
+           scheduler.residencyMs(POWER_LIGHT_SLEEP, end) / 3.6e6, result.sleeps, result.milliamps);
+  TEST_MESSAGE(line);
+  return result;
+}
+
+static void checkDay(const DayResult& day) {
+  TEST_ASSERT_EQUAL_UINT32(0, day.lateFetches);
+  TEST_ASSERT_EQUAL_UINT32(0, day.fetchesNotActive);
+  TEST_ASSERT_EQUAL_UINT32(0, day.sleepsWhileLit);
+}
+
+void test_day_always_active() {
+  DayResult day = simulateDay(POWER_LEVEL_OFF);
+  checkDay(day);
+  TEST_ASSERT_EQUAL_FLOAT(config.modeMilliamps[POWER_ACTIVE], day.milliamps);
+}
+
+void test_day_idle() {
+  DayResult day = simulateDay(POWER_LEVEL_IDLE);
+  checkDay(day);
+  TEST_ASSERT_EQUAL_UINT32(0, day.sleeps);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_IDLE_MILLIAMPS, day.milliamps, "estimated current at power_save 1");
+}
+
+void test_day_light_sleep() {
+  DayResult day = simulateDay(POWER_LEVEL_SLEEP);
+  checkDay(day);
+  TEST_ASSERT_TRUE(day.sleeps > 0);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_SLEEP_MILLIAMPS, day.milliamps, "estimated current at power_save 2");
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_schedule_without_dst);
+  RUN_TEST(test_schedule_across_spring_forward);
+  RUN_TEST(test_schedule_across_fall_back);
+  RUN_TEST(test_repeated_hour_closes_once);
+  RUN_TEST(test_dst_moves_the_window);
+  RUN_TEST(test_plan);
+  RUN_TEST(test_day_always_active);
+  RUN_TEST(test_day_idle);
+  RUN_TEST(test_day_light_sleep);
+  return UNITY_END();
+}
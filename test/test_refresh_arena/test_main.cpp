@@ -0,0 +1,214 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "refresh_arena.h"
+
+//===================================================== Refresh Arena Soak ================================================================//
+// 10,000 refresh cycles with the allocation pattern of the firmware's: the request URL in the fetch arena, then
+// per element a JSON variant pool, strings grown by reallocate() while they are read and shrunk once done, the
+// pool shrunk to fit, the element released with a rewind and the batch with a reset. Every block is filled and
+// checked before it is freed, so two blocks handed out over each other fail the test. The same cycles on a
+// heap allocator are the baseline for the allocations the arenas save.
+
+#define SOAK_CYCLES 10000
+#define WARMUP_CYCLES 100
+#define BATCHES_PER_CYCLE 3
+#define ELEMENTS_PER_BATCH 40     // METAR_BATCH_SIZE
+#define STRINGS_PER_ELEMENT 12
+#define FETCH_ARENA_BYTES 512     // As in the firmware
+#define PARSE_ARENA_BYTES 4096
+
+static uint8_t fetchArenaBuffer[FETCH_ARENA_BYTES] __attribute__((aligned(8)));
+static uint8_t parseArenaBuffer[PARSE_ARENA_BYTES] __attribute__((aligned(8)));
+static RefreshArena fetchArena(fetchArenaBuffer, sizeof(fetchArenaBuffer));
+static RefreshArena parseArena(parseArenaBuffer, sizeof(parseArenaBuffer));
+static ArenaJsonAllocator parseJsonAllocator(parseArena);
+
+// The heap, counting what goes through it
+class HeapJsonAllocator : public ArduinoJson::Allocator {
+public:
+  void* allocate(size_t size) override {
+    calls++;
+    return malloc(size);
+  }
+  void deallocate(void* ptr) override { free(ptr); }
+  void* reallocate(void* ptr, size_t size) override {
+    calls++;
+    return realloc(ptr, size);
+  }
+  uint32_t calls = 0;
+};
+
+static HeapJsonAllocator heapJsonAllocator;
+static uint32_t seed = 3;
+
+static uint32_t soakRandom(uint32_t range) {
+  seed = seed * 1103515245u + 12345u;
+  return (seed >> 8) % range;
+}
+
+static void fill(void* block, size_t size, uint8_t tag) {
+  memset(block, tag, size);
+}
+
+static void check(const void* block, size_t size, uint8_t tag) {
+  // Every byte equal to the first, and the first the tag
+  const uint8_t* p = (const uint8_t*)block;
+  if (p[0] != tag || memcmp(p, p + 1, size - 1) != 0) {
+    TEST_FAIL_MESSAGE("a block was overwritten by another");
+  }
+}
+
+// One element the way ArduinoJson builds and drops it
+static void parseElement(ArduinoJson::Allocator& allocator) {
+  size_t poolSize = 1024;
+  void* pool = allocator.allocate(poolSize);
+  TEST_ASSERT_NOT_NULL(pool);
+  fill(pool, poolSize, 0xA5);
+  void* strings[STRINGS_PER_ELEMENT];
+  size_t sizes[STRINGS_PER_ELEMENT];
+  for (int i = 0; i < STRINGS_PER_ELEMENT; i++) {
+    size_t size = 8;
+    void* s = allocator.allocate(size);
+    fill(s, size, i);
+    // rawOb is the long one
+    size_t length = 8 + soakRandom(i == STRINGS_PER_ELEMENT - 1 ? 160 : 24);
+    while (size < length) {
+      size *= 2;
+      s = allocator.reallocate(s, size);
+      TEST_ASSERT_NOT_NULL(s);
+      check(s, size / 2, i);
+      fill(s, size, i);
+    }
+    strings[i] = allocator.reallocate(s, length);
+    sizes[i] = length;
+    check(strings[i], length, i);
+  }
+  poolSize = 200 + soakRandom(300);
+  pool = allocator.reallocate(pool, poolSize);
+  check(pool, poolSize, 0xA5);
+  for (int i = 0; i < STRINGS_PER_ELEMENT; i++) {
+    check(strings[i], sizes[i], i);
+    allocator.deallocate(strings[i]);
+  }
+  allocator.deallocate(pool);
+}
+
+// One refresh; on the heap the URL is a String grown as it is built
+static void refreshCycle(bool arenas) {
+  char* url;
+  if (arenas) {
+    url = (char*)fetchArena.allocate(300);
+  } else {
+    url = (char*)malloc(64);
+    for (size_t n = 128; n <= 512; n *= 2) {
+      url = (char*)realloc(url, n);
+      heapJsonAllocator.calls++;
+    }
+    heapJsonAllocator.calls++;
+  }
+  TEST_ASSERT_NOT_NULL(url);
+  snprintf(url, 300, "https://aviationweather.gov/api/data/metar?format=json&ids=KPHX");
+
+  for (int batch = 0; batch < BATCHES_PER_CYCLE; batch++) {
+    size_t mark = parseArena.mark();
+    for (int element = 0; element < ELEMENTS_PER_BATCH; element++) {
+      if (arenas) {
+        parseElement(parseJsonAllocator);
+        parseArena.rewind(mark);
+      } else {
+        parseElement(heapJsonAllocator);
+      }
+    }
+    parseArena.reset();
+  }
+  TEST_ASSERT_EQUAL_STRING("https://aviationweather.gov/api/data/metar?format=json&ids=KPHX", url);
+  if (arenas) {
+    fetchArena.reset();
+  } else {
+    free(url);
+  }
+}
+
+void setUp() {
+  seed = 3;
+}
+
+void tearDown() {}
+
+// The arenas hold every cycle, never grow past what the first cycles needed and never send a block to the heap
+void test_soak() {
+  size_t fetchHighWater = 0;
+  size_t parseHighWater = 0;
+  for (int cycle = 0; cycle < SOAK_CYCLES; cycle++) {
+    refreshCycle(true);
+    TEST_ASSERT_EQUAL(0, fetchArena.used());
+    TEST_ASSERT_EQUAL(0, parseArena.used());
+    if (cycle == WARMUP_CYCLES) {
+      fetchHighWater = fetchArena.highWater;
+      parseHighWater = parseArena.highWater;
+    }
+  }
+  char line[160];
+  snprintf(line, sizeof(line), "parse arena high water %u of %u, fetch arena %u of %u, %u overflows, %u heap fallbacks",
+           (unsigned)parseArena.highWater, PARSE_ARENA_BYTES, (unsigned)fetchArena.highWater, FETCH_ARENA_BYTES,
+           parseArena.overflows + fetchArena.overflows, parseJsonAllocator.heapFallbacks);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL_UINT32(0, parseArena.overflows);
+  TEST_ASSERT_EQUAL_UINT32(0, fetchArena.overflows);
+  TEST_ASSERT_EQUAL_UINT32(0, parseJsonAllocator.heapFallbacks);
+  // Past the warm-up only a string longer than any before could raise it, and by a few bytes
+  TEST_ASSERT_LESS_OR_EQUAL(parseHighWater + 256, parseArena.highWater);
+  TEST_ASSERT_EQUAL(fetchHighWater, fetchArena.highWater);
+}
+
+// What the arenas save: every one of these would have been a heap call
+void test_heap_baseline() {
+  heapJsonAllocator.calls = 0;
+  for (int cycle = 0; cycle < SOAK_CYCLES; cycle++) {
+    refreshCycle(false);
+  }
+  char line[96];
+  snprintf(line, sizeof(line), "the heap path makes %.0f allocator calls per refresh, the arenas none",
+           (double)heapJsonAllocator.calls / SOAK_CYCLES);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_TRUE(heapJsonAllocator.calls > 0);
+}
+
+// A document larger than planned still parses from the heap, and its blocks are freed normally
+void test_overflow_falls_back_to_heap() {
+  uint8_t buffer[64] __attribute__((aligned(8)));
+  RefreshArena tiny(buffer, sizeof(buffer));
+  ArenaJsonAllocator allocator(tiny);
+  void* big = allocator.allocate(200);
+  TEST_ASSERT_FALSE(tiny.owns(big));
+  fill(big, 200, 1);
+  big = allocator.reallocate(big, 400);
+  check(big, 200, 1);
+  allocator.deallocate(big);
+  TEST_ASSERT_EQUAL_UINT32(1, allocator.heapFallbacks);
+
+  // The newest block grows in place, an older one moves and keeps its contents
+  void* first = allocator.allocate(16);
+  fill(first, 16, 2);
+  TEST_ASSERT_EQUAL_PTR(first, allocator.reallocate(first, 24));
+  void* second = allocator.allocate(8);
+  TEST_ASSERT_TRUE(tiny.owns(second));
+  void* moved = allocator.reallocate(first, 48);
+  TEST_ASSERT_TRUE(moved != first);
+  check(moved, 16, 2);
+  allocator.deallocate(moved);
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_soak);
+  RUN_TEST(test_heap_baseline);
+  RUN_TEST(test_overflow_falls_back_to_heap);
+  return UNITY_END();
+}
@@ -0,0 +1,259 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+
+#include "flight_category.h"
+#include "metar_fixtures.h"
+#include "metar_stream.h"
+#include "refresh_arena.h"
+#include "replay_stream.h"
+#include "station_index.h"
+#include "station_store.h"
+
+//===================================================== Refresh Replay Benchmark ==========================================================//
+// Replays whole refreshes of 15, 100 and 500 stations through the firmware's path: canned responses from the
+// HTTPClient shim written in TCP-sized slices into a PayloadStream, streamed into MetarRecords, quantized into
+// the station store and classified. Reports parse time, heap allocations, peak heap and end-to-end latency for
+// each format, and fails when one of them is worse than its threshold below.
+
+// Thresholds. Times are host figures with room for a slow CI machine; heap use must not grow with the station
+// count at all, each element lives in the parse arena.
+#define MAX_PARSE_MICROS_PER_METAR 40
+#define MAX_REFRESH_MILLIS_500 100
+#define MAX_ALLOCATIONS_PER_REFRESH 0
+#define MAX_PEAK_HEAP_BYTES 0
+
+#define REPLAY_BATCH_SIZE 40      // METAR_BATCH_SIZE of the firmware
+#define REPLAY_MAX_STATIONS 512
+#define REPLAY_RAW_ARENA_BYTES 49152
+// ArduinoJson's pools hold more and larger slots with 64-bit pointers, so this is more than PARSE_ARENA_BYTES
+#define HOST_PARSE_ARENA_BYTES 16384
+
+//---- Heap accounting, only while a refresh is being measured ----//
+static bool countingHeap = false;
+static uint32_t allocations = 0;
+static long liveBytes = 0;
+static long peakBytes = 0;
+
+void* operator new(size_t size) {
+  size_t* block = (size_t*)malloc(sizeof(size_t) * 2 + size);
+  if (block == nullptr) throw std::bad_alloc();
+  block[0] = size;
+  block[1] = countingHeap;
+  if (countingHeap) {
+    allocations++;
+    liveBytes += size;
+    if (liveBytes > peakBytes) peakBytes = liveBytes;
+  }
+  return block + 2;
+}
+
+void operator delete(void* ptr) noexcept {
+  if (ptr == nullptr) return;
+  size_t* block = (size_t*)ptr - 2;
+  if (block[1]) liveBytes -= block[0];
+  free(block);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* ptr) noexcept { operator delete(ptr); }
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { operator delete(ptr); }
+
+//---- The map being refreshed ----//
+typedef StationStore<REPLAY_MAX_STATIONS, REPLAY_RAW_ARENA_BYTES> ReplayStore;
+
+static StationIndex<REPLAY_MAX_STATIONS, REPLAY_MAX_STATIONS> stationIndex;
+static ReplayStore stores[METAR_FORMAT_COUNT];
+static ReplayStore* store = nullptr;
+static uint32_t unknownStations = 0;
+
+static uint8_t parseArenaBuffer[HOST_PARSE_ARENA_BYTES] __attribute__((aligned(8)));
+static RefreshArena parseArena(parseArenaBuffer, sizeof(parseArenaBuffer));
+static ArenaJsonAllocator parseJsonAllocator(parseArena);
+static JsonDocument metarFilter;
+
+static HTTPClient http;
+static ReplayStream payload;
+
+static void storeMetar(const MetarRecord& metar) {
+  int station = stationIndex.find(metar.icaoId);
+  if (station < 0) {
+    unknownStations++;
+    return;
+  }
+  store->update(station, metar);
+}
+
+struct RefreshResult {
+  int metars;
+  uint32_t bytes;
+  uint64_t parseMicros;
+  uint32_t refreshMicros;
+  uint32_t allocations;
+  long peakHeap;
+  bool complete;
+};
+
+static void buildMap(int stations) {
+  stationIndex.clear(stations);
+  for (int i = 0; i < stations; i++) {
+    stationIndex.add(packIcao(fixtureIcao(i).c_str()), i);
+  }
+}
+
+// One refresh of every batch, the way fetcherTask and parserTask split it, with the responses already queued
+static RefreshResult refresh(int stations, MetarFormat format) {
+  RefreshResult result = {};
+  IngestStats stats = {};
+  store = &stores[format];
+  result.complete = true;
+
+  unsigned long started = micros();
+  for (int first = 0; first < stations; first += REPLAY_BATCH_SIZE) {
+    http.begin(String("https://aviationweather.gov/api/data/metar"));
+    if (http.GET() != HTTP_CODE_OK) {
+      result.complete = false;
+      continue;
+    }
+    payload.clear();
+    payload.end(http.writeToStream(&payload) > 0);
+    http.end();
+    stats.bytes += payload.bytes;
+
+    countingHeap = true;
+    int count = format == METAR_FORMAT_RAW
+                    ? streamRawMetars(payload, FIXTURE_NOW, storeMetar, stats)
+                    : streamMetars(payload, metarFilter, parseJsonAllocator, storeMetar, stats);
+    countingHeap = false;
+    parseArena.reset();
+    result.complete &= count >= 0 && payload.complete();
+  }
+  countingHeap = true;
+  classifyStations(store->visibility, store->ceiling, store->category, stations, FAA_CATEGORY_THRESHOLDS);
+  countingHeap = false;
+  result.refreshMicros = micros() - started;
+
+  result.metars = stats.metars;
+  result.bytes = stats.bytes;
+  result.parseMicros = stats.parseMicros;
+  result.allocations = allocations + parseJsonAllocator.heapFallbacks;
+  result.peakHeap = peakBytes;
+  return result;
+}
+
+static void queueResponses(int stations, MetarFormat format) {
+  for (int first = 0; first < stations; first += REPLAY_BATCH_SIZE) {
+    int count = min(REPLAY_BATCH_SIZE, stations - first);
+    http.queueResponse(HTTP_CODE_OK, format == METAR_FORMAT_RAW ? fixtureRawPayload(first, count)
+                                                                : fixtureJsonPayload(first, count));
+  }
+}
+
+static RefreshResult replay(int stations, MetarFormat format) {
+  buildMap(stations);
+  stores[format].clear();
+  // A first refresh fills the store, the measured one is the steady state where most reports come back unchanged
+  queueResponses(stations, format);
+  refresh(stations, format);
+  queueResponses(stations, format);
+
+  allocations = 0;
+  liveBytes = 0;
+  peakBytes = 0;
+  parseJsonAllocator.heapFallbacks = 0;
+  RefreshResult result = refresh(stations, format);
+
+  char line[160];
+  snprintf(line, sizeof(line), "%3d stations %-4s: %6u bytes, %.2f us/METAR, %u allocations, peak heap %ld, refresh %.2f ms",
+           stations, metarFormatName(format), result.bytes, result.metars ? (double)result.parseMicros / result.metars : 0.0,
+           result.allocations, result.peakHeap, result.refreshMicros / 1000.0);
+  TEST_MESSAGE(line);
+  return result;
+}
+
+static void checkThresholds(int stations, MetarFormat format) {
+  RefreshResult result = replay(stations, format);
+  TEST_ASSERT_TRUE(result.complete);
+  TEST_ASSERT_EQUAL_INT(stations, result.metars);
+  TEST_ASSERT_EQUAL_UINT32(0, unknownStations);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_PARSE_MICROS_PER_METAR, (double)result.parseMicros / result.metars,
+                                    "parse time per METAR");
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_ALLOCATIONS_PER_REFRESH, result.allocations, "heap allocations per refresh");
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_PEAK_HEAP_BYTES, result.peakHeap, "peak heap of the parse path");
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_REFRESH_MILLIS_500 * 1000.0 * stations / 500, result.refreshMicros,
+                                    "end-to-end refresh latency");
+}
+
+void setUp() {
+  unknownStations = 0;
+}
+
+void tearDown() {}
+
+void test_json_15() { checkThresholds(15, METAR_FORMAT_JSON); }
+void test_json_100() { checkThresholds(100, METAR_FORMAT_JSON); }
+void test_json_500() { checkThresholds(500, METAR_FORMAT_JSON); }
+void test_raw_15() { checkThresholds(15, METAR_FORMAT_RAW); }
+void test_raw_100() { checkThresholds(100, METAR_FORMAT_RAW); }
+void test_raw_500() { checkThresholds(500, METAR_FORMAT_RAW); }
+
+// Both formats of the same reports must leave the same weather in the store
+void test_formats_fill_the_same_store() {
+  const int stations = 500;
+  replay(stations, METAR_FORMAT_JSON);
+  replay(stations, METAR_FORMAT_RAW);
+  const ReplayStore& json = stores[METAR_FORMAT_JSON];
+  const ReplayStore& raw = stores[METAR_FORMAT_RAW];
+  for (int i = 0; i < stations; i++) {
+    TEST_ASSERT_EQUAL_HEX32(raw.icao[i], json.icao[i]);
+    TEST_ASSERT_EQUAL_UINT32(raw.obsTime[i], json.obsTime[i]);
+    TEST_ASSERT_EQUAL_UINT8(raw.category[i], json.category[i]);
+    TEST_ASSERT_EQUAL_UINT8(raw.visibility[i], json.visibility[i]);
+    TEST_ASSERT_EQUAL_UINT16(raw.ceiling[i], json.ceiling[i]);
+    TEST_ASSERT_EQUAL_UINT8(raw.windSpeed[i], json.windSpeed[i]);
+    TEST_ASSERT_EQUAL_UINT8(raw.windGust[i], json.windGust[i]);
+    TEST_ASSERT_EQUAL_INT8(raw.temperature[i], json.temperature[i]);
+    TEST_ASSERT_EQUAL_UINT16(raw.altimeter[i], json.altimeter[i]);
+    TEST_ASSERT_EQUAL_UINT8(raw.flags[i], json.flags[i]);
+    TEST_ASSERT_EQUAL_STRING(raw.raw(i), json.raw(i));
+  }
+}
+
+// A batch cut off mid-response is reported incomplete, never as a shorter complete one
+void test_truncated_batch_is_incomplete() {
+  for (int f = 0; f < METAR_FORMAT_COUNT; f++) {
+    MetarFormat format = (MetarFormat)f;
+    buildMap(REPLAY_BATCH_SIZE);
+    stores[format].clear();
+    std::string body = format == METAR_FORMAT_RAW ? fixtureRawPayload(0, REPLAY_BATCH_SIZE)
+                                                  : fixtureJsonPayload(0, REPLAY_BATCH_SIZE);
+    http.queueTruncated(body, body.size() / 2);
+    RefreshResult result = refresh(REPLAY_BATCH_SIZE, format);
+    TEST_ASSERT_FALSE(result.complete);
+    TEST_ASSERT_LESS_THAN(REPLAY_BATCH_SIZE, result.metars);
+  }
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  setupMetarFilter(metarFilter);
+  http.setReuse(true);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_json_15);
+  RUN_TEST(test_json_100);
+  RUN_TEST(test_json_500);
+  RUN_TEST(test_raw_15);
+  RUN_TEST(test_raw_100);
+  RUN_TEST(test_raw_500);
+  RUN_TEST(test_formats_fill_the_same_store);
+  RUN_TEST(test_truncated_batch_is_incomplete);
+  return UNITY_END();
+}
@@ -0,0 +1,112 @@
+#include <unity.h>
+
+#include <Preferences.h>
+
+#include "settings_registry.h"
+
+//===================================================== Settings Registry Tests ===========================================================//
+// The registry over PreferencesSettingsStorage and the Preferences shim, which keeps NVS in memory across
+// "reboots" and counts flash writes.
+
+#define DEBOUNCE_MS 2000
+
+enum { SET_BRIGHTNESS, SET_FORMAT, SET_NAME, SET_COUNT };
+
+static Setting settings[SET_COUNT];
+
+static void resetSettings() {
+  settings[SET_BRIGHTNESS] = {"brightness", SETTING_INT, 20, 0, 255, nullptr, 0, "", false};
+  settings[SET_FORMAT] = {"metar_format", SETTING_INT, 0, 0, 1, nullptr, 0, "", false};
+  settings[SET_NAME] = {"name", SETTING_STRING, 0, 0, 0, "IFR_MAP", 0, "", false};
+}
+
+void setUp() {
+  Preferences::reset();
+  resetSettings();
+}
+
+void tearDown() {}
+
+void test_defaults_without_storage() {
+  PreferencesSettingsStorage storage("settings");
+  SettingsRegistry registry(settings, SET_COUNT, storage, DEBOUNCE_MS);
+  registry.load();
+  TEST_ASSERT_EQUAL_INT32(20, registry.getInt(SET_BRIGHTNESS));
+  char name[SETTING_STRING_MAX];
+  registry.getString(SET_NAME, name, sizeof(name));
+  TEST_ASSERT_EQUAL_STRING("IFR_MAP", name);
+  TEST_ASSERT_EQUAL_UINT32(0, Preferences::writes());
+}
+
+// A slider dragged through many values costs one flash write once it settles
+void test_changes_are_coalesced() {
+  PreferencesSettingsStorage storage("settings");
+  SettingsRegistry registry(settings, SET_COUNT, storage, DEBOUNCE_MS);
+  registry.load();
+  for (int v = 0; v <= 200; v += 5) {
+    registry.setInt(SET_BRIGHTNESS, v, 1000 + v);
+    TEST_ASSERT_EQUAL(0, registry.flush(1000 + v));
+  }
+  TEST_ASSERT_EQUAL(0, registry.flush(1200 + DEBOUNCE_MS - 1));
+  TEST_ASSERT_EQUAL(1, registry.flush(1200 + DEBOUNCE_MS));
+  TEST_ASSERT_EQUAL_UINT32(1, Preferences::writes());
+  TEST_ASSERT_EQUAL_UINT32(40, registry.writesAvoided());
+}
+
+void test_values_are_clamped() {
+  PreferencesSettingsStorage storage("settings");
+  SettingsRegistry registry(settings, SET_COUNT, storage, DEBOUNCE_MS);
+  registry.load();
+  registry.setInt(SET_BRIGHTNESS, 1000, 0);
+  TEST_ASSERT_EQUAL_INT32(255, registry.getInt(SET_BRIGHTNESS));
+  registry.setInt(SET_BRIGHTNESS, -3, 0);
+  TEST_ASSERT_EQUAL_INT32(0, registry.getInt(SET_BRIGHTNESS));
+  registry.setInt(SET_FORMAT, 7, 0);
+  TEST_ASSERT_EQUAL_INT32(1, registry.getInt(SET_FORMAT));
+}
+
+// What was flushed is what the next boot loads
+void test_settings_survive_a_reboot() {
+  {
+    PreferencesSettingsStorage storage("settings");
+    SettingsRegistry registry(settings, SET_COUNT, storage, DEBOUNCE_MS);
+    registry.load();
+    registry.setInt(SET_BRIGHTNESS, 128, 0);
+    registry.setString(SET_NAME, "HANGAR_MAP", 0);
+    TEST_ASSERT_EQUAL(2, registry.flush(0, true));
+  }
+  resetSettings();
+  PreferencesSettingsStorage storage("settings");
+  SettingsRegistry registry(settings, SET_COUNT, storage, DEBOUNCE_MS);
+  registry.load();
+  TEST_ASSERT_EQUAL_INT32(128, registry.getInt(SET_BRIGHTNESS));
+  char name[SETTING_STRING_MAX];
+  registry.getString(SET_NAME, name, sizeof(name));
+  TEST_ASSERT_EQUAL_STRING("HANGAR_MAP", name);
+  TEST_ASSERT_EQUAL_INT32(0, registry.getInt(SET_FORMAT));
+}
+
+// Another namespace, like the boot snapshot, does not see the settings
+void test_namespaces_are_separate() {
+  PreferencesSettingsStorage storage("settings");
+  SettingsRegistry registry(settings, SET_COUNT, storage, DEBOUNCE_MS);
+  registry.load();
+  registry.setInt(SET_BRIGHTNESS, 99, 0);
+  registry.flush(0, true);
+  Preferences other;
+  other.begin("snapshot", true);
+  TEST_ASSERT_FALSE(other.isKey("brightness"));
+  other.end();
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_defaults_without_storage);
+  RUN_TEST(test_changes_are_coalesced);
+  RUN_TEST(test_values_are_clamped);
+  RUN_TEST(test_settings_survive_a_reboot);
+  RUN_TEST(test_namespaces_are_separate);
+  return UNITY_END();
+}
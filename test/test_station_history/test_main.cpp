@@ -0,0 +1,242 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <deque>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "station_history.h"
+#include "station_store.h"
+
+//===================================================== Station History Tests =============================================================//
+// Six days of a 500 station map fed into the history at the firmware's ring sizes: hourly reports plus a special
+// now and then, with the altimeter drifting, the wind changing often and the sky now and then. A plain list of
+// every sample appended is the reference. What the history hands back must be exactly its newest samples within
+// the retention, however often the rings wrapped and evicted. Reports the bytes a station-day takes and how long
+// a pass over every station takes, and fails when either is worse than its threshold below.
+
+#define STATIONS 500
+#define DAYS 6
+#define RETENTION_SECONDS (48 * 3600UL)
+#define RING_BYTES_PSRAM 320      // HISTORY_RING_BYTES_PSRAM, the whole retention
+#define RING_BYTES 160            // HISTORY_RING_BYTES, evicts by size first
+#define START_TIME 1792195200u    // 2026-10-17 00:00Z
+
+// Thresholds. The README promises about 125 bytes per station-day, and the query is a host figure with room
+// for a slow CI machine
+#define MAX_BYTES_PER_STATION_DAY 140
+#define MAX_QUERY_MICROS_500 5000
+#define MAX_TREND_MICROS_500 5000
+
+static uint32_t seed = 12345;
+
+static uint32_t historyRandom(uint32_t range) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed % range;
+}
+
+static bool sameSample(const HistorySample& a, const HistorySample& b) {
+  return a.obsTime == b.obsTime && a.ceiling == b.ceiling && a.windDir == b.windDir && a.altimeter == b.altimeter &&
+         a.category == b.category && a.visibility == b.visibility && a.windSpeed == b.windSpeed &&
+         a.windGust == b.windGust;
+}
+
+struct Feed {
+  std::vector<uint8_t> memory;
+  StationHistory history;
+  std::vector<std::deque<HistorySample>> appended;
+};
+
+// Fill a history with DAYS of reports in 15 minute steps, keeping the reference alongside
+static void feed(Feed& f, uint16_t ringBytes) {
+  seed = 12345;
+  f.memory.assign(StationHistory::bytesFor(STATIONS, ringBytes), 0);
+  f.history.begin(f.memory.data(), STATIONS, ringBytes, RETENTION_SECONDS);
+  f.appended.assign(STATIONS, std::deque<HistorySample>());
+  std::vector<HistorySample> current(STATIONS);
+  for (int s = 0; s < STATIONS; s++) {
+    current[s] = {START_TIME, (uint16_t)historyRandom(60), (uint16_t)(historyRandom(36) * 10),
+                  (uint16_t)(10130 + historyRandom(40)), (uint8_t)(1 + historyRandom(4)), 40,
+                  (uint8_t)historyRandom(20), WIND_SPEED_UNKNOWN};
+  }
+  for (uint32_t step = 0; step < DAYS * 24 * 4; step++) {
+    uint32_t now = START_TIME + step * 900;
+    for (int s = 0; s < STATIONS; s++) {
+      bool hourly = step % 4 == 3;
+      bool special = historyRandom(40) == 0;
+      if (!hourly && !special) {
+        continue;
+      }
+      HistorySample sample = current[s];
+      sample.obsTime = now + (s % 7) * 60;
+      sample.altimeter += (int)historyRandom(5) - 2;
+      if (historyRandom(3) == 0) sample.windSpeed = historyRandom(30);
+      sample.windGust = sample.windSpeed > 15 && historyRandom(2) ? sample.windSpeed + 5 + historyRandom(10)
+                                                                  : WIND_SPEED_UNKNOWN;
+      if (historyRandom(4) == 0) {
+        sample.windDir = historyRandom(6) == 0 ? WIND_DIR_UNKNOWN : historyRandom(36) * 10;
+      }
+      if (historyRandom(8) == 0) {
+        sample.ceiling = historyRandom(5) == 0 ? CEILING_NONE : historyRandom(120);
+        sample.visibility = historyRandom(10) == 0 ? historyRandom(40) : 40;
+        sample.category = 1 + historyRandom(4);
+      }
+      TEST_ASSERT_TRUE(f.history.append(s, sample));
+      current[s] = sample;
+      f.appended[s].push_back(sample);
+    }
+  }
+}
+
+// Every station reads back as the newest samples appended, none older than the retention
+static void checkReadBack(const Feed& f) {
+  for (int s = 0; s < STATIONS; s++) {
+    std::vector<HistorySample> kept;
+    f.history.forEach(s, 0, [&](const HistorySample& sample) { kept.push_back(sample); });
+    const std::deque<HistorySample>& appended = f.appended[s];
+    TEST_ASSERT_TRUE(kept.size() > 1 && kept.size() <= appended.size());
+    TEST_ASSERT_EQUAL(kept.size(), f.history.count(s));
+    size_t skipped = appended.size() - kept.size();
+    for (size_t i = 0; i < kept.size(); i++) {
+      TEST_ASSERT_TRUE(sameSample(appended[skipped + i], kept[i]));
+    }
+    TEST_ASSERT_TRUE(kept.front().obsTime + RETENTION_SECONDS >= kept.back().obsTime);
+    TEST_ASSERT_EQUAL_UINT32(kept.front().obsTime, f.history.oldestTime(s));
+    TEST_ASSERT_EQUAL_UINT32(kept.back().obsTime, f.history.newestTime(s));
+  }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+// With room for the whole retention only age evicts, and everything within it is kept
+void test_round_trip_evicted_by_age() {
+  static Feed f;
+  feed(f, RING_BYTES_PSRAM);
+  checkReadBack(f);
+  TEST_ASSERT_EQUAL_UINT32(0, f.history.evictedFull);
+  TEST_ASSERT_TRUE(f.history.evictedAged > 0);
+  for (int s = 0; s < STATIONS; s++) {
+    const std::deque<HistorySample>& appended = f.appended[s];
+    uint32_t newest = appended.back().obsTime;
+    size_t inRetention = 0;
+    for (const HistorySample& sample : appended) {
+      inRetention += sample.obsTime + RETENTION_SECONDS >= newest;
+    }
+    TEST_ASSERT_EQUAL(inRetention, f.history.count(s));
+  }
+}
+
+// A smaller ring wraps and evicts by size long before the retention
+void test_round_trip_evicted_by_size() {
+  static Feed f;
+  feed(f, RING_BYTES);
+  checkReadBack(f);
+  TEST_ASSERT_TRUE(f.history.evictedFull > 0);
+  for (int s = 0; s < STATIONS; s++) {
+    TEST_ASSERT_LESS_OR_EQUAL(RING_BYTES, f.history.used(s));
+  }
+}
+
+// Every field changing at once, and gaps of up to two months, through the smallest ring allowed
+void test_every_field_changes() {
+  std::vector<uint8_t> memory(StationHistory::bytesFor(1, HISTORY_MIN_RING_BYTES));
+  StationHistory history;
+  history.begin(memory.data(), 1, HISTORY_MIN_RING_BYTES, RETENTION_SECONDS);
+  HistorySample previous = {START_TIME, 0, 0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < 400; i++) {
+    HistorySample sample = {previous.obsTime + 60 * (1 + historyRandom(100000)), (uint16_t)historyRandom(0x10000),
+                            (uint16_t)historyRandom(0x10000), (uint16_t)historyRandom(0x10000),
+                            (uint8_t)historyRandom(256), (uint8_t)historyRandom(256), (uint8_t)historyRandom(256),
+                            (uint8_t)historyRandom(256)};
+    TEST_ASSERT_TRUE(history.append(0, sample));
+    HistorySample newest = {};
+    history.forEach(0, 0, [&](const HistorySample& kept) { newest = kept; });
+    TEST_ASSERT_TRUE(sameSample(sample, newest));
+    previous = sample;
+  }
+  TEST_ASSERT_FALSE(history.append(0, previous));
+}
+
+void test_trend() {
+  std::vector<uint8_t> memory(StationHistory::bytesFor(1, HISTORY_MIN_RING_BYTES));
+  StationHistory history;
+  history.begin(memory.data(), 1, HISTORY_MIN_RING_BYTES, RETENTION_SECONDS);
+  HistorySample sample = {START_TIME, 50, 0, 10130, CATEGORY_VFR, 40, 5, WIND_SPEED_UNKNOWN};
+  history.append(0, sample);
+  sample.obsTime += 3600;
+  history.append(0, sample);
+  sample.obsTime += 3600;
+  sample.category = CATEGORY_IFR;
+  history.append(0, sample);
+  TEST_ASSERT_EQUAL(TREND_WORSE, history.trend(0, 3 * 3600));
+  sample.obsTime += 4 * 3600;
+  history.append(0, sample);
+  TEST_ASSERT_EQUAL(TREND_STEADY, history.trend(0, 3 * 3600));
+  sample.obsTime += 3600;
+  sample.category = CATEGORY_VFR;
+  history.append(0, sample);
+  TEST_ASSERT_EQUAL(TREND_BETTER, history.trend(0, 3 * 3600));
+}
+
+// Memory per station-day and the cost of a pass over a full 500 station map
+void test_benchmark() {
+  static Feed f;
+  feed(f, RING_BYTES_PSRAM);
+  uint64_t recordBytes = 0;
+  uint64_t spanSeconds = 0;
+  uint32_t samples = 0;
+  for (int s = 0; s < STATIONS; s++) {
+    recordBytes += f.history.used(s);
+    spanSeconds += f.history.newestTime(s) - f.history.oldestTime(s);
+    samples += f.history.count(s);
+  }
+  size_t headerBytes = StationHistory::bytesFor(1, 0);
+  double bytesPerDay = (double)recordBytes / (spanSeconds / 86400.0) + headerBytes * 86400.0 / RETENTION_SECONDS;
+
+  const int rounds = 100;
+  uint32_t visited = 0;
+  unsigned long started = micros();
+  for (int r = 0; r < rounds; r++) {
+    for (int s = 0; s < STATIONS; s++) {
+      visited += f.history.forEach(s, 0, [](const HistorySample&) {});
+    }
+  }
+  double queryMicros = (double)(micros() - started) / rounds;
+  uint32_t worse = 0;
+  started = micros();
+  for (int r = 0; r < rounds; r++) {
+    for (int s = 0; s < STATIONS; s++) {
+      worse += f.history.trend(s, 3 * 3600) == TREND_WORSE;
+    }
+  }
+  double trendMicros = (double)(micros() - started) / rounds;
+
+  char line[160];
+  snprintf(line, sizeof(line), "%u samples, %.2f record bytes each, %.1f bytes per station-day with the %u byte header",
+           samples, (double)recordBytes / (samples - STATIONS), bytesPerDay, (unsigned)headerBytes);
+  TEST_MESSAGE(line);
+  snprintf(line, sizeof(line), "every sample of %d stations in %.0f us, the trend of each in %.0f us",
+           STATIONS, queryMicros, trendMicros);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL_UINT32(samples * rounds, visited);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_BYTES_PER_STATION_DAY, bytesPerDay, "bytes per station-day");
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_QUERY_MICROS_500, queryMicros, "pass over 500 stations");
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_TREND_MICROS_500, trendMicros, "trend of 500 stations");
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip_evicted_by_age);
+  RUN_TEST(test_round_trip_evicted_by_size);
+  RUN_TEST(test_every_field_changes);
+  RUN_TEST(test_trend);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,441 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl_cache.h>
+#include <mbedtls/ssl_ticket.h>
+#include <mbedtls/pk.h>
+
+#include "tls_fixtures.h"
+#include "tls_session.h"
+
+//===================================================== TLS Resume Tests ==================================================================//
+// TlsSession against an mbedTLS server on localhost that counts its handshakes: full ones, and resumed ones by
+// session ID from its cache or by session ticket. Every reconnect after the first must be resumed, and a keep-alive
+// connection must carry any number of requests on one handshake. Written against mbedTLS 2.28, the version the
+// ESP32 core ships.
+
+#define TLS_TIMEOUT_MS 5000
+#define RESPONSE_BODY "KPHX 171751Z 27008KT 10SM FEW250 31/M03 A2992"
+
+static uint32_t hostMillis() {
+  using namespace std::chrono;
+  return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+//---- Server ----//
+struct ServerOptions {
+  bool cache;                   // Resume by session ID
+  bool tickets;                 // Resume by session ticket
+  int requestsPerConnection;    // Close the connection after this many responses, 0 keeps it open
+};
+
+class TestServer {
+public:
+  std::atomic<uint32_t> handshakes{0};       // Completed handshakes, full or resumed
+  std::atomic<uint32_t> idResumptions{0};
+  std::atomic<uint32_t> ticketResumptions{0};
+  std::atomic<uint32_t> failedHandshakes{0};
+  std::atomic<uint32_t> responses{0};
+  int port = 0;
+
+  bool start(ServerOptions options) {
+    options_ = options;
+    mbedtls_net_init(&listen_);
+    mbedtls_ssl_config_init(&conf_);
+    mbedtls_x509_crt_init(&cert_);
+    mbedtls_pk_init(&key_);
+    mbedtls_entropy_init(&entropy_);
+    mbedtls_ctr_drbg_init(&drbg_);
+    mbedtls_ssl_cache_init(&cache_);
+    mbedtls_ssl_ticket_init(&ticket_);
+
+    if (mbedtls_ctr_drbg_seed(&drbg_, mbedtls_entropy_func, &entropy_, nullptr, 0) != 0 ||
+        mbedtls_x509_crt_parse(&cert_, (const unsigned char*)TEST_SERVER_CERT_PEM, sizeof(TEST_SERVER_CERT_PEM)) != 0 ||
+        mbedtls_pk_parse_key(&key_, (const unsigned char*)TEST_SERVER_KEY_PEM, sizeof(TEST_SERVER_KEY_PEM), nullptr, 0) != 0 ||
+        mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0 ||
+        mbedtls_ssl_conf_own_cert(&conf_, &cert_, &key_) != 0) {
+      return false;
+    }
+    mbedtls_ssl_conf_rng(&conf_, mbedtls_ctr_drbg_random, &drbg_);
+    if (options.cache) {
+      mbedtls_ssl_conf_session_cache(&conf_, this, countingCacheGet, countingCacheSet);
+    }
+    if (options.tickets) {
+      if (mbedtls_ssl_ticket_setup(&ticket_, mbedtls_ctr_drbg_random, &drbg_, MBEDTLS_CIPHER_AES_256_GCM, 86400) != 0) {
+        return false;
+      }
+      mbedtls_ssl_conf_session_tickets_cb(&conf_, mbedtls_ssl_ticket_write, countingTicketParse, this);
+    }
+
+    // Port 0 lets the system pick a free one
+    if (mbedtls_net_bind(&listen_, "127.0.0.1", "0", MBEDTLS_NET_PROTO_TCP) != 0) {
+      return false;
+    }
+    sockaddr_in address;
+    socklen_t length = sizeof(address);
+    getsockname(listen_.fd, (sockaddr*)&address, &length);
+    port = ntohs(address.sin_port);
+    running_ = true;
+    thread_ = std::thread(&TestServer::run, this);
+    return true;
+  }
+
+  void stop() {
+    if (running_) {
+      running_ = false;
+      // Wake the accept() up with a connection of its own
+      mbedtls_net_context wake;
+      mbedtls_net_init(&wake);
+      mbedtls_net_connect(&wake, "127.0.0.1", portString().c_str(), MBEDTLS_NET_PROTO_TCP);
+      thread_.join();
+      mbedtls_net_free(&wake);
+    }
+    mbedtls_net_free(&listen_);
+    mbedtls_ssl_ticket_free(&ticket_);
+    mbedtls_ssl_cache_free(&cache_);
+    mbedtls_ssl_config_free(&conf_);
+    mbedtls_pk_free(&key_);
+    mbedtls_x509_crt_free(&cert_);
+    mbedtls_ctr_drbg_free(&drbg_);
+    mbedtls_entropy_free(&entropy_);
+  }
+
+  // Lose every session, the way a server restart or a key rotation does. Only called between connections.
+  void forgetSessions() {
+    mbedtls_ssl_cache_free(&cache_);
+    mbedtls_ssl_cache_init(&cache_);
+    if (options_.tickets) {
+      mbedtls_ssl_ticket_free(&ticket_);
+      mbedtls_ssl_ticket_init(&ticket_);
+      mbedtls_ssl_ticket_setup(&ticket_, mbedtls_ctr_drbg_random, &drbg_, MBEDTLS_CIPHER_AES_256_GCM, 86400);
+    }
+  }
+
+  uint32_t fullHandshakes() const { return handshakes - idResumptions - ticketResumptions; }
+
+  std::string portString() const { return std::to_string(port); }
+
+private:
+  ServerOptions options_;
+  mbedtls_net_context listen_;
+  mbedtls_ssl_config conf_;
+  mbedtls_x509_crt cert_;
+  mbedtls_pk_context key_;
+  mbedtls_entropy_context entropy_;
+  mbedtls_ctr_drbg_context drbg_;
+  mbedtls_ssl_cache_context cache_;
+  mbedtls_ssl_ticket_context ticket_;
+  std::atomic<bool> running_{false};
+  std::thread thread_;
+
+  static int countingCacheGet(void* data, mbedtls_ssl_session* session) {
+    TestServer* server = (TestServer*)data;
+    int ret = mbedtls_ssl_cache_get(&server->cache_, session);
+    if (ret == 0) server->idResumptions++;
+    return ret;
+  }
+  static int countingCacheSet(void* data, const mbedtls_ssl_session* session) {
+    return mbedtls_ssl_cache_set(&((TestServer*)data)->cache_, session);
+  }
+  static int countingTicketParse(void* data, mbedtls_ssl_session* session, unsigned char* buf, size_t len) {
+    TestServer* server = (TestServer*)data;
+    int ret = mbedtls_ssl_ticket_parse(&server->ticket_, session, buf, len);
+    if (ret == 0) server->ticketResumptions++;
+    return ret;
+  }
+
+  void run() {
+    while (running_) {
+      mbedtls_net_context client;
+      mbedtls_net_init(&client);
+      if (mbedtls_net_accept(&listen_, &client, nullptr, 0, nullptr) == 0 && running_) {
+        serve(client);
+      }
+      mbedtls_net_free(&client);
+    }
+  }
+
+  void serve(mbedtls_net_context& client) {
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_init(&ssl);
+    mbedtls_ssl_setup(&ssl, &conf_);
+    mbedtls_ssl_set_bio(&ssl, &client, mbedtls_net_send, mbedtls_net_recv, nullptr);
+    int ret;
+    while ((ret = mbedtls_ssl_handshake(&ssl)) == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    }
+    if (ret != 0) {
+      failedHandshakes++;
+    } else {
+      handshakes++;
+      // One response per request header, until the client goes away or the connection has served its quota
+      std::string request;
+      int served = 0;
+      unsigned char buf[512];
+      while ((ret = mbedtls_ssl_read(&ssl, buf, sizeof(buf))) > 0) {
+        request.append((const char*)buf, ret);
+        size_t end;
+        while ((end = request.find("\r\n\r\n")) != std::string::npos) {
+          request.erase(0, end + 4);
+          static const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: " "45" "\r\n\r\n" RESPONSE_BODY;
+          mbedtls_ssl_write(&ssl, (const unsigned char*)response, sizeof(response) - 1);
+          responses++;
+          served++;
+        }
+        if (options_.requestsPerConnection > 0 && served >= options_.requestsPerConnection) {
+          break;
+        }
+      }
+      mbedtls_ssl_close_notify(&ssl);
+    }
+    mbedtls_ssl_free(&ssl);
+  }
+};
+
+//---- Client ----//
+static TestServer server;
+static mbedtls_net_context socket_;
+
+static int connectTo(TlsSession& tls) {
+  mbedtls_net_free(&socket_);
+  mbedtls_net_init(&socket_);
+  int ret = mbedtls_net_connect(&socket_, "127.0.0.1", server.portString().c_str(), MBEDTLS_NET_PROTO_TCP);
+  if (ret != 0) return ret;
+  return tls.connect("localhost", &socket_, mbedtls_net_send, mbedtls_net_recv);
+}
+
+static void disconnect(TlsSession& tls) {
+  tls.close();
+  mbedtls_net_free(&socket_);
+  mbedtls_net_init(&socket_);
+}
+
+// One GET on the open connection. False when the server had closed it.
+static bool get(TlsSession& tls) {
+  static const char request[] = "GET /api/data/metar HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  if (tls.write((const uint8_t*)request, sizeof(request) - 1) < 0) {
+    return false;
+  }
+  std::string response;
+  uint8_t buf[256];
+  while (response.find(RESPONSE_BODY) == std::string::npos) {
+    int got = tls.read(buf, sizeof(buf));
+    if (got < 0) return false;
+    response.append((const char*)buf, got);
+  }
+  return true;
+}
+
+// A request the way sendMetarRequest() makes it: on the kept-alive connection, reconnecting once if it was closed
+static bool fetch(TlsSession& tls) {
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (!tls.open()) {
+      disconnect(tls);
+      if (connectTo(tls) != 0) return false;
+    }
+    if (get(tls)) return true;
+    disconnect(tls);
+  }
+  return false;
+}
+
+static void report(const char* name, const TlsSession& tls) {
+  char line[160];
+  snprintf(line, sizeof(line), "%s: server %u handshakes (%u full, %u by ID, %u by ticket), client %u resumed",
+           name, (unsigned)server.handshakes, (unsigned)server.fullHandshakes(), (unsigned)server.idResumptions,
+           (unsigned)server.ticketResumptions, tls.resumptions);
+  TEST_MESSAGE(line);
+}
+
+static void startServer(bool cache, bool tickets, int requestsPerConnection) {
+  ServerOptions options = {cache, tickets, requestsPerConnection};
+  TEST_ASSERT_TRUE(server.start(options));
+}
+
+void setUp() {
+  mbedtls_net_init(&socket_);
+}
+
+void tearDown() {
+  mbedtls_net_free(&socket_);
+  server.stop();
+  server.handshakes = 0;
+  server.idResumptions = 0;
+  server.ticketResumptions = 0;
+  server.failedHandshakes = 0;
+  server.responses = 0;
+}
+
+// Reconnecting to a server that only keeps a session cache resumes by session ID
+void test_resumes_by_session_id() {
+  startServer(true, false, 0);
+  TlsSession tls(hostMillis, TLS_TIMEOUT_MS);
+  TEST_ASSERT_TRUE(tls.begin(TEST_CA_PEM));
+  for (int i = 0; i < 4; i++) {
+    TEST_ASSERT_EQUAL_INT(0, connectTo(tls));
+    TEST_ASSERT_TRUE(get(tls));
+    TEST_ASSERT_EQUAL(i > 0, tls.resumed());
+    disconnect(tls);
+  }
+  report("session ID", tls);
+  TEST_ASSERT_EQUAL_UINT32(4, server.handshakes);
+  TEST_ASSERT_EQUAL_UINT32(1, server.fullHandshakes());
+  TEST_ASSERT_EQUAL_UINT32(3, server.idResumptions);
+  TEST_ASSERT_EQUAL_UINT32(3, tls.resumptions);
+}
+
+// A server without a cache resumes from the ticket it handed out, renewing it each time
+void test_resumes_by_ticket() {
+  startServer(false, true, 0);
+  TlsSession tls(hostMillis, TLS_TIMEOUT_MS);
+  TEST_ASSERT_TRUE(tls.begin(TEST_CA_PEM));
+  for (int i = 0; i < 4; i++) {
+    TEST_ASSERT_EQUAL_INT(0, connectTo(tls));
+    TEST_ASSERT_TRUE(get(tls));
+    TEST_ASSERT_EQUAL(i > 0, tls.resumed());
+    disconnect(tls);
+  }
+  report("ticket", tls);
+  TEST_ASSERT_EQUAL_UINT32(1, server.fullHandshakes());
+  TEST_ASSERT_EQUAL_UINT32(3, server.ticketResumptions);
+  TEST_ASSERT_EQUAL_UINT32(3, tls.resumptions);
+}
+
+// Requests on a kept-alive connection cost no handshake at all
+void test_keep_alive_needs_one_handshake() {
+  startServer(true, true, 0);
+  TlsSession tls(hostMillis, TLS_TIMEOUT_MS);
+  TEST_ASSERT_TRUE(tls.begin(TEST_CA_PEM));
+  for (int i = 0; i < 10; i++) {
+    TEST_ASSERT_TRUE(fetch(tls));
+  }
+  report("keep-alive", tls);
+  TEST_ASSERT_EQUAL_UINT32(10, server.responses);
+  TEST_ASSERT_EQUAL_UINT32(1, server.handshakes);
+  TEST_ASSERT_EQUAL_UINT32(1, tls.handshakes);
+}
+
+// A server that drops the connection after every response, as aviationweather.gov does between refreshes: each
+// refresh reconnects, and all but the first reconnect resume
+void test_dropped_connections_resume() {
+  startServer(true, true, 1);
+  TlsSession tls(hostMillis, TLS_TIMEOUT_MS);
+  TEST_ASSERT_TRUE(tls.begin(TEST_CA_PEM));
+  const int refreshes = 8;
+  for (int i = 0; i < refreshes; i++) {
+    TEST_ASSERT_TRUE(fetch(tls));
+  }
+  disconnect(tls);
+  report("dropped connections", tls);
+  TEST_ASSERT_EQUAL_UINT32(refreshes, server.responses);
+  TEST_ASSERT_EQUAL_UINT32(refreshes, server.handshakes);
+  TEST_ASSERT_EQUAL_UINT32(1, server.fullHandshakes());
+  TEST_ASSERT_EQUAL_UINT32(refreshes - 1, tls.resumptions);
+}
+
+// When the server no longer knows the session the handshake falls back to a full one, and the new session resumes
+void test_forgotten_session_falls_back() {
+  startServer(true, true, 0);
+  TlsSession tls(hostMillis, TLS_TIMEOUT_MS);
+  TEST_ASSERT_TRUE(tls.begin(TEST_CA_PEM));
+  TEST_ASSERT_EQUAL_INT(0, connectTo(tls));
+  // The response means the server is done with the handshake and its cache
+  TEST_ASSERT_TRUE(get(tls));
+  disconnect(tls);
+  server.forgetSessions();
+  TEST_ASSERT_EQUAL_INT(0, connectTo(tls));
+  TEST_ASSERT_FALSE(tls.resumed());
+  TEST_ASSERT_TRUE(get(tls));
+  disconnect(tls);
+  TEST_ASSERT_EQUAL_INT(0, connectTo(tls));
+  TEST_ASSERT_TRUE(tls.resumed());
+  disconnect(tls);
+  report("forgotten session", tls);
+  TEST_ASSERT_EQUAL_UINT32(2, server.fullHandshakes());
+  TEST_ASSERT_EQUAL_UINT32(1, tls.resumptions);
+}
+
+// A certificate the CA did not sign fails the handshake and leaves nothing to resume
+void test_wrong_ca_fails() {
+  startServer(true, true, 0);
+  TlsSession tls(hostMillis, TLS_TIMEOUT_MS);
+  TEST_ASSERT_TRUE(tls.begin(OTHER_CA_PEM));
+  TEST_ASSERT_NOT_EQUAL(0, connectTo(tls));
+  TEST_ASSERT_FALSE(tls.open());
+  TEST_ASSERT_FALSE(tls.hasSession());
+  TEST_ASSERT_EQUAL_UINT32(0, tls.handshakes);
+  disconnect(tls);
+}
+
+// A CA that does not parse is reported by begin() and leaves the session free to begin again with a good one
+void test_bad_ca_can_be_replaced() {
+  startServer(true, true, 0);
+  TlsSession tls(hostMillis, TLS_TIMEOUT_MS);
+  TEST_ASSERT_FALSE(tls.begin("-----BEGIN CERTIFICATE-----\nnot a certificate\n-----END CERTIFICATE-----\n"));
+  TEST_ASSERT_NOT_EQUAL(0, tls.lastError);
+  TEST_ASSERT_FALSE(tls.ready());
+  TEST_ASSERT_TRUE(tls.begin(TEST_CA_PEM));
+  TEST_ASSERT_TRUE(tls.ready());
+  TEST_ASSERT_TRUE(tls.verified());
+  TEST_ASSERT_EQUAL_INT(0, connectTo(tls));
+  TEST_ASSERT_TRUE(tls.open());
+  disconnect(tls);
+}
+
+// Without a CA nothing is verified, resumption works and is detected all the same
+void test_unverified_connection_resumes() {
+  startServer(true, true, 0);
+  TlsSession tls(hostMillis, TLS_TIMEOUT_MS);
+  TEST_ASSERT_TRUE(tls.begin(nullptr));
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL_INT(0, connectTo(tls));
+    TEST_ASSERT_EQUAL(i > 0, tls.resumed());
+    disconnect(tls);
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, server.fullHandshakes());
+  TEST_ASSERT_EQUAL_UINT32(2, tls.resumptions);
+}
+
+// A client told to forget its session does a full handshake
+void test_forget_session() {
+  startServer(true, true, 0);
+  TlsSession tls(hostMillis, TLS_TIMEOUT_MS);
+  TEST_ASSERT_TRUE(tls.begin(TEST_CA_PEM));
+  TEST_ASSERT_EQUAL_INT(0, connectTo(tls));
+  disconnect(tls);
+  tls.forgetSession();
+  TEST_ASSERT_EQUAL_INT(0, connectTo(tls));
+  TEST_ASSERT_FALSE(tls.resumed());
+  disconnect(tls);
+  TEST_ASSERT_EQUAL_UINT32(2, server.fullHandshakes());
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  // A write to a connection the server just closed must fail, not end the process
+  signal(SIGPIPE, SIG_IGN);
+  UNITY_BEGIN();
+  RUN_TEST(test_resumes_by_session_id);
+  RUN_TEST(test_resumes_by_ticket);
+  RUN_TEST(test_keep_alive_needs_one_handshake);
+  RUN_TEST(test_dropped_connections_resume);
+  RUN_TEST(test_forgotten_session_falls_back);
+  RUN_TEST(test_wrong_ca_fails);
+  RUN_TEST(test_bad_ca_can_be_replaced);
+  RUN_TEST(test_unverified_connection_resumes);
+  RUN_TEST(test_forget_session);
+  return UNITY_END();
+}
@@ -0,0 +1,339 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <new>
+
+#include <Arduino.h>
+#include <pgmspace.h>
+
+#include "metar_fixtures.h"
+#include "station_index.h"
+#include "web_state.h"
+#include "webui_fixtures.h"
+#include "webui_index_html.h"
+
+//===================================================== Web UI Benchmark ==================================================================//
+// Time and heap per page load, before and after the web UI moved into flash. Before: index.html read from SPIFFS
+// a character at a time into a String, the airport list built by String concatenation and four String.replace
+// calls, then the whole page copied into the response. After: the gzipped page sent straight from flash, and the
+// live values streamed from /api/state one station at a time through fillStateChunk().
+//
+// The web server's own request and response objects cost the same on both paths and are left out. A host has no
+// flash to read, so the before figures leave out the SPIFFS read time and are if anything too kind to it.
+
+// Thresholds for the flash-backed path, per page load including /api/state
+#define MAX_ALLOCATIONS_PER_LOAD 2      // The StateCursor of the chunked response and its shared_ptr
+#define MAX_PEAK_HEAP_BYTES 64
+#define MIN_SPEEDUP 2                   // At least this much faster than the String path
+
+#define LOADS 200
+#define TCP_CHUNK 1436
+
+//---- Heap accounting ----//
+static bool countingHeap = false;
+static uint32_t allocations = 0;
+static long liveBytes = 0;
+static long peakBytes = 0;
+
+static void countAllocation(long delta) {
+  if (!countingHeap) return;
+  allocations++;
+  liveBytes += delta;
+  if (liveBytes > peakBytes) peakBytes = liveBytes;
+}
+
+void* operator new(size_t size) {
+  size_t* block = (size_t*)malloc(sizeof(size_t) * 2 + size);
+  if (block == nullptr) throw std::bad_alloc();
+  block[0] = size;
+  block[1] = countingHeap;
+  countAllocation(size);
+  return block + 2;
+}
+
+void operator delete(void* ptr) noexcept {
+  if (ptr == nullptr) return;
+  size_t* block = (size_t*)ptr - 2;
+  if (block[1]) liveBytes -= block[0];
+  free(block);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* ptr) noexcept { operator delete(ptr); }
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { operator delete(ptr); }
+
+//---- Arduino String, as the old page used it ----//
+// WString grows its buffer to exactly the length it needs, so every append reallocates. The shim String is built
+// on std::string, which grows geometrically, and would flatter the old path.
+class LegacyString {
+public:
+  LegacyString() {}
+  LegacyString(const char* text) { concat(text, strlen(text)); }
+  LegacyString(const LegacyString& other) { concat(other.buf_, other.len_); }
+  ~LegacyString() { release(); }
+
+  LegacyString& operator+=(char c) { return concat(&c, 1); }
+  LegacyString& operator+=(const char* text) { return concat(text, strlen(text)); }
+  LegacyString& operator+=(const LegacyString& other) { return concat(other.buf_, other.len_); }
+  // The StringSumHelper a + b builds is a copy of a that b is appended to
+  friend LegacyString operator+(const LegacyString& a, const char* b) { return LegacyString(a) += b; }
+  friend LegacyString operator+(const LegacyString& a, const LegacyString& b) { return LegacyString(a) += b; }
+  friend LegacyString operator+(const char* a, const LegacyString& b) { return LegacyString(a) += b; }
+
+  // Same as WString::replace: one exact reallocation when the result is longer, in place otherwise
+  void replace(const char* find, const char* with) {
+    size_t findLen = strlen(find);
+    size_t withLen = strlen(with);
+    if (len_ == 0 || findLen == 0) return;
+    size_t count = 0;
+    for (const char* p = strstr(buf_, find); p != nullptr; p = strstr(p + findLen, find)) count++;
+    if (count == 0) return;
+    size_t newLen = len_ + count * withLen - count * findLen;
+    char* out = buf_;
+    if (newLen > len_) {
+      reserve(newLen);
+      // Walk from the back so nothing is overwritten before it has moved
+      char* src = buf_ + len_;
+      char* dst = buf_ + newLen;
+      *dst = '\0';
+      while (src > buf_) {
+        if ((size_t)(src - buf_) >= findLen && memcmp(src - findLen, find, findLen) == 0) {
+          src -= findLen;
+          dst -= withLen;
+          memcpy(dst, with, withLen);
+        } else {
+          *--dst = *--src;
+        }
+      }
+    } else {
+      const char* src = buf_;
+      while (*src) {
+        if (strncmp(src, find, findLen) == 0) {
+          memcpy(out, with, withLen);
+          out += withLen;
+          src += findLen;
+        } else {
+          *out++ = *src++;
+        }
+      }
+      *out = '\0';
+    }
+    len_ = newLen;
+  }
+
+  size_t length() const { return len_; }
+  const char* c_str() const { return buf_ ? buf_ : ""; }
+
+private:
+  char* buf_ = nullptr;
+  size_t len_ = 0;
+  size_t capacity_ = 0;
+
+  void reserve(size_t size) {
+    if (buf_ != nullptr && size <= capacity_) return;
+    countAllocation((long)size + 1 - (buf_ ? (long)capacity_ + 1 : 0));
+    buf_ = (char*)realloc(buf_, size + 1);
+    capacity_ = size;
+  }
+  LegacyString& concat(const char* text, size_t len) {
+    reserve(len_ + len);
+    memcpy(buf_ + len_, text, len);
+    len_ += len;
+    buf_[len_] = '\0';
+    return *this;
+  }
+  void release() {
+    if (buf_ == nullptr) return;
+    if (countingHeap) liveBytes -= capacity_ + 1;
+    free(buf_);
+  }
+};
+
+//---- The map ----//
+static StationIndex<512, 512> stationMap;
+static uint8_t categories[512];
+static const char* const categoryNames[] = {"VFR", "MVFR", "IFR", "LIFR"};
+static int brightness = 20;
+static int startTime = 6;
+static int endTime = 22;
+
+static const char* stationCategory(int station) {
+  return categoryNames[categories[station] % 4];
+}
+
+static void buildMap(int stations) {
+  stationMap.clear(stations);
+  for (int i = 0; i < stations; i++) {
+    stationMap.add(packIcao(fixtureIcao(i).c_str()), i);
+    categories[i] = i * 7 % 5;
+  }
+}
+
+// What the client receives, so the compiler cannot drop the work
+static uint8_t wire[TCP_CHUNK];
+static uint32_t wireBytes = 0;
+
+static void sendChunks(const uint8_t* data, size_t len) {
+  for (size_t sent = 0; sent < len; sent += TCP_CHUNK) {
+    size_t n = len - sent < TCP_CHUNK ? len - sent : TCP_CHUNK;
+    memcpy_P(wire, data + sent, n);
+    wireBytes += n;
+  }
+}
+
+//---- Before: loadHTML() and the String handler of "/" ----//
+// The SPIFFS file, read a byte at a time like the old loop did
+struct PageFile {
+  const char* data;
+  size_t pos;
+  size_t size;
+  int available() const { return size - pos; }
+  int read() { return pos < size ? data[pos++] : -1; }
+};
+
+static LegacyString loadHTML() {
+  PageFile file = {LEGACY_INDEX_HTML, 0, sizeof(LEGACY_INDEX_HTML) - 1};
+  LegacyString content = "";
+  while (file.available()) {
+    content += (char)file.read();
+  }
+  return content;
+}
+
+static void servePageBefore() {
+  LegacyString html = loadHTML();
+  LegacyString airportListHtml = "";
+  for (int i = 0; i < stationMap.stationCount; i++) {
+    char icao[5];
+    unpackIcao(stationMap.stationIcao[i], icao);
+    airportListHtml += "<div>" + LegacyString(icao) + " " + stationCategory(i) + "</div>";
+  }
+  if (stationMap.stationCount > 30) {
+    html += "<style>.airport-list { grid-template-columns: repeat(4, 1fr); }</style>";
+  } else if (stationMap.stationCount >= 20) {
+    html += "<style>.airport-list { grid-template-columns: repeat(3, 1fr); }</style>";
+  } else if (stationMap.stationCount >= 10) {
+    html += "<style>.airport-list { grid-template-columns: repeat(2, 1fr); }</style>";
+  }
+  char number[12];
+  html.replace("<!-- AIRPORT_LIST_PLACEHOLDER -->", airportListHtml.c_str());
+  snprintf(number, sizeof(number), "%d", brightness);
+  html.replace("{{LED_BRIGHTNESS}}", number);
+  snprintf(number, sizeof(number), "%d", startTime);
+  html.replace("{{START_TIME}}", number);
+  snprintf(number, sizeof(number), "%d", endTime);
+  html.replace("{{END_TIME}}", number);
+  // request->send() copied the page into the response
+  LegacyString response(html);
+  sendChunks((const uint8_t*)response.c_str(), response.length());
+}
+
+//---- After: the gzipped page from flash, then /api/state ----//
+static size_t writeStatePiece(StateCursor& cursor, char* buf, size_t size) {
+  WebState state = {brightness, startTime, endTime, stationMap.stationCount, stationMap.stationIcao, stationCategory};
+  return writeStateJson(state, cursor, buf, size);
+}
+
+static void servePageAfter() {
+  sendChunks(INDEX_HTML_GZ, INDEX_HTML_GZ_LEN);
+  std::shared_ptr<StateCursor> cursor(new StateCursor{-1, false});
+  uint8_t chunk[TCP_CHUNK];
+  size_t len;
+  while ((len = fillStateChunk(*cursor, writeStatePiece, chunk, sizeof(chunk))) > 0) {
+    sendChunks(chunk, len);
+  }
+}
+
+//---- Measurement ----//
+struct LoadResult {
+  double micros;          // Per load
+  double allocations;     // Per load
+  long peakHeap;
+  uint32_t bytes;         // Sent per load
+};
+
+static LoadResult measure(void (*serve)()) {
+  serve();  // Warm up the caches
+  allocations = 0;
+  liveBytes = 0;
+  peakBytes = 0;
+  wireBytes = 0;
+  countingHeap = true;
+  unsigned long started = micros();
+  for (int i = 0; i < LOADS; i++) {
+    serve();
+  }
+  unsigned long elapsed = micros() - started;
+  countingHeap = false;
+  LoadResult result = {(double)elapsed / LOADS, (double)allocations / LOADS, peakBytes, wireBytes / LOADS};
+  return result;
+}
+
+static void compare(int stations) {
+  buildMap(stations);
+  LoadResult before = measure(servePageBefore);
+  LoadResult after = measure(servePageAfter);
+  char line[200];
+  snprintf(line, sizeof(line), "%3d stations before: %8.1f us, %6.1f allocations, peak heap %6ld, %5u bytes sent",
+           stations, before.micros, before.allocations, before.peakHeap, before.bytes);
+  TEST_MESSAGE(line);
+  snprintf(line, sizeof(line), "%3d stations after:  %8.1f us, %6.1f allocations, peak heap %6ld, %5u bytes sent",
+           stations, after.micros, after.allocations, after.peakHeap, after.bytes);
+  TEST_MESSAGE(line);
+
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_ALLOCATIONS_PER_LOAD, after.allocations, "heap allocations per page load");
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_PEAK_HEAP_BYTES, after.peakHeap, "peak heap per page load");
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(before.micros / MIN_SPEEDUP, after.micros, "time per page load");
+  // The old page held at least the whole page twice at its peak
+  TEST_ASSERT_GREATER_OR_EQUAL(2 * (long)(sizeof(LEGACY_INDEX_HTML) - 1), before.peakHeap);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_15_stations() { compare(15); }
+void test_100_stations() { compare(100); }
+void test_500_stations() { compare(500); }
+
+// Whatever chunk size the server asks for, /api/state comes out whole and the same
+void test_state_chunks_are_whole() {
+  buildMap(100);
+  std::string expected;
+  {
+    StateCursor cursor = {-1, false};
+    char piece[STATE_ENTRY_SIZE];
+    size_t len;
+    while ((len = writeStatePiece(cursor, piece, sizeof(piece))) > 0) expected.append(piece, len);
+  }
+  TEST_ASSERT_EQUAL_STRING("{\"brightness\":20,\"startTime\":6,\"endTime\":22,\"stations\":[{\"icao\":\"KAAA\",\"cat\":\"VFR\"}",
+                           expected.substr(0, 83).c_str());
+  TEST_ASSERT_EQUAL_STRING("]}", expected.substr(expected.size() - 2).c_str());
+  static const size_t sizes[] = {STATE_ENTRY_SIZE, 64, 100, 511, TCP_CHUNK};
+  for (size_t size : sizes) {
+    StateCursor cursor = {-1, false};
+    std::string body;
+    uint8_t chunk[TCP_CHUNK];
+    size_t len;
+    while ((len = fillStateChunk(cursor, writeStatePiece, chunk, size)) > 0) {
+      TEST_ASSERT_LESS_OR_EQUAL(size, len);
+      body.append((const char*)chunk, len);
+    }
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), body.c_str());
+  }
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_state_chunks_are_whole);
+  RUN_TEST(test_15_stations);
+  RUN_TEST(test_100_stations);
+  RUN_TEST(test_500_stations);
+  return UNITY_END();
+}